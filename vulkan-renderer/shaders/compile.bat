@@ -1,3 +1,15 @@
 C:/VulkanSDK/1.3.268.0/Bin/glslc.exe test.vert -o test_vert.spv
 C:/VulkanSDK/1.3.268.0/Bin/glslc.exe test.frag -o test_frag.spv
+C:/VulkanSDK/1.3.268.0/Bin/glslc.exe --target-env=vulkan1.2 -DBINDLESS test.frag -o test_bindless_frag.spv
+C:/VulkanSDK/1.3.268.0/Bin/glslc.exe cull.comp -o cull_comp.spv
+C:/VulkanSDK/1.3.268.0/Bin/glslc.exe hiz.comp -o hiz_comp.spv
+C:/VulkanSDK/1.3.268.0/Bin/glslc.exe -DMULTISAMPLED hiz.comp -o hiz_ms_comp.spv
+C:/VulkanSDK/1.3.268.0/Bin/glslc.exe fullscreen.vert -o fullscreen_vert.spv
+C:/VulkanSDK/1.3.268.0/Bin/glslc.exe upscale.frag -o upscale_frag.spv
+C:/VulkanSDK/1.3.268.0/Bin/glslc.exe taa.frag -o taa_frag.spv
+C:/VulkanSDK/1.3.268.0/Bin/glslc.exe visibility.vert -o visibility_vert.spv
+C:/VulkanSDK/1.3.268.0/Bin/glslc.exe visibility.frag -o visibility_frag.spv
+C:/VulkanSDK/1.3.268.0/Bin/glslc.exe visibility_resolve.frag -o visibility_resolve_frag.spv
+C:/VulkanSDK/1.3.268.0/Bin/glslc.exe shadow.vert -o shadow_vert.spv
+C:/VulkanSDK/1.3.268.0/Bin/glslc.exe depth_prepass.vert -o depth_prepass_vert.spv
 pause
\ No newline at end of file
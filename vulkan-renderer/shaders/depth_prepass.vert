@@ -0,0 +1,34 @@
+#version 450
+
+// see test.vert
+layout(set = 0, binding = 0) uniform UniformBufferObject {
+    mat4 viewProj;
+    mat4 view;
+    mat4 proj;
+    uvec4 clusterGrid;
+    vec4 clusterParams;
+    mat4 shadowViewProj[4];
+    vec4 shadowSplits;
+    vec4 sunDirection;
+} ubo;
+
+layout(std430, set = 0, binding = 2) readonly buffer InstanceBuffer {
+    mat4 models[];
+} instances;
+
+layout(push_constant) uniform PushConstants {
+    mat4 model;
+    uint materialIndex;
+} draw;
+
+// the packed position stream, see createPositionBuffer
+layout(location = 0) in vec3 inPosition;
+
+// the main pass tests for EQUAL depth, both shaders have to compute the position the same way, bit for bit
+invariant gl_Position;
+
+void main() {
+    mat4 model = draw.model * instances.models[gl_InstanceIndex];
+    vec4 worldPosition = model * vec4(inPosition, 1.0);
+    gl_Position = ubo.viewProj * worldPosition;
+}
\ No newline at end of file
@@ -0,0 +1,10 @@
+#version 450
+
+// One triangle covering the whole target, no vertex buffer: vertices 0, 1, 2 land on (-1,-1), (3,-1), (-1,3).
+// uv is 0 at the top left corner and 1 at the bottom right one.
+layout(location = 0) out vec2 fragUv;
+
+void main() {
+    fragUv = vec2((gl_VertexIndex << 1) & 2, gl_VertexIndex & 2);
+    gl_Position = vec4(fragUv * 2.0 - 1.0, 0.0, 1.0);
+}
\ No newline at end of file
@@ -0,0 +1,86 @@
+// Clustered point lights and the shadowed sun, shared by test.frag and visibility_resolve.frag. Expects ubo (set 0, binding 0)
+// to be declared first.
+
+// must match LightClusters
+const uint CLUSTER_COUNT = 16 * 9 * 24;
+// must match ShadowCascades
+const uint SHADOW_CASCADES = 4;
+const vec3 AMBIENT = vec3(0.15);
+
+// see PointLight
+struct PointLight {
+	vec3 position;
+	float radius;
+	vec3 color;
+	float intensity;
+};
+
+layout(std430, set = 0, binding = 3) readonly buffer LightBuffer {
+	PointLight lights[];
+} lightBuffer;
+
+// see ClusterLightLists, every cluster's (offset, count) into lightIndices
+layout(std430, set = 0, binding = 4) readonly buffer ClusterBuffer {
+	uvec2 ranges[CLUSTER_COUNT];
+	uint lightIndices[];
+} clusters;
+
+// one layer per cascade, compared against the fragment's depth in the sampler
+layout(set = 0, binding = 7) uniform sampler2DArrayShadow shadowMap;
+
+// 1 lit, 0 in shadow, in between along edges where the sampler filters the comparison
+float sunShadow(vec3 worldPosition, float viewDepth)
+{
+	uint cascade = 0;
+	while (cascade < SHADOW_CASCADES - 1 && viewDepth > ubo.shadowSplits[cascade])
+		cascade++;
+
+	vec4 lightPosition = ubo.shadowViewProj[cascade] * vec4(worldPosition, 1.0);
+	vec3 shadowCoord = vec3(lightPosition.xy * 0.5 + 0.5, lightPosition.z);
+	if (any(lessThan(shadowCoord, vec3(0.0))) || any(greaterThan(shadowCoord, vec3(1.0))))
+		return 1.0;
+
+	return texture(shadowMap, vec4(shadowCoord.xy, float(cascade), shadowCoord.z));
+}
+
+// Clustered forward shading: the froxel this fragment falls into lists the few lights that can reach it,
+// instead of every fragment looping over every light. The sun comes first, shadowed by its cascades
+vec3 lighting(vec3 worldPosition, vec3 normal, float viewDepth)
+{
+	normal = normalize(normal);
+	vec3 light = AMBIENT;
+
+	if (ubo.sunDirection.w > 0.0)
+	{
+		float diffuse = max(dot(normal, ubo.sunDirection.xyz), 0.0);
+		if (diffuse > 0.0)
+			light += vec3(ubo.sunDirection.w * diffuse * sunShadow(worldPosition, viewDepth));
+	}
+
+	if (ubo.clusterGrid.w == 0)
+		return light;
+
+	uvec3 cluster;
+	cluster.xy = uvec2(gl_FragCoord.xy * ubo.clusterParams.zw * vec2(ubo.clusterGrid.xy));
+	cluster.z = uint(max(log(viewDepth) * ubo.clusterParams.x + ubo.clusterParams.y, 0.0));
+	cluster = min(cluster, ubo.clusterGrid.xyz - 1);
+
+	uvec2 range = clusters.ranges[(cluster.z * ubo.clusterGrid.y + cluster.y) * ubo.clusterGrid.x + cluster.x];
+	for (uint i = 0; i < range.y; i++)
+	{
+		PointLight pointLight = lightBuffer.lights[clusters.lightIndices[range.x + i]];
+		vec3 toLight = pointLight.position - worldPosition;
+		float distanceSquared = dot(toLight, toLight);
+		float radiusSquared = pointLight.radius * pointLight.radius;
+		if (distanceSquared >= radiusSquared)
+			continue;
+
+		// inverse square, windowed so it reaches 0 at the radius the clusters were built with
+		float window = 1.0 - (distanceSquared * distanceSquared) / (radiusSquared * radiusSquared);
+		float attenuation = window * window / (distanceSquared + 1.0);
+		float diffuse = max(dot(normal, toLight * inversesqrt(distanceSquared)), 0.0);
+		light += pointLight.color * (pointLight.intensity * attenuation * diffuse);
+	}
+
+	return light;
+}
\ No newline at end of file
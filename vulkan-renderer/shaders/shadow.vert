@@ -0,0 +1,18 @@
+#version 450
+
+// see test.vert
+layout(std430, set = 0, binding = 2) readonly buffer InstanceBuffer {
+    mat4 models[];
+} instances;
+
+// see ShadowPushConstants, the light's view projection of the cascade being rendered
+layout(push_constant) uniform PushConstants {
+    mat4 viewProj;
+} cascade;
+
+// depth only, see createShadowResources
+layout(location = 0) in vec3 inPosition;
+
+void main() {
+    gl_Position = cascade.viewProj * (instances.models[gl_InstanceIndex] * vec4(inPosition, 1.0));
+}
\ No newline at end of file
@@ -0,0 +1,55 @@
+#version 450
+
+// Temporal antialiasing. Every frame is rendered with a different subpixel jitter and blended into the history of
+// the previous ones, found through the camera motion: the depth gives this texel's position, the reprojection matrix
+// its place in the previous frame. Object motion isn't known, so history colors outside the range of this texel's
+// neighbourhood are clamped into it, which trades a little of the accumulated detail for no ghosting.
+layout(set = 0, binding = 0) uniform sampler2D sceneColor;
+layout(set = 0, binding = 1) uniform sampler2D sceneDepth;
+layout(set = 0, binding = 2) uniform sampler2D history;
+
+// see TaaPushConstants
+layout(push_constant) uniform TaaParameters {
+    mat4 reprojection;
+    vec2 uvScale;
+    vec2 historyUvScale;
+    vec2 historyUvClamp;
+    vec2 texelSize;
+    float currentWeight;
+} params;
+
+layout(location = 0) in vec2 fragUv;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+    // the viewport covers the render extent, texels match the scene targets one to one
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    ivec2 lastTexel = ivec2(params.uvScale / params.texelSize + 0.5) - 1;
+
+    vec3 current = texelFetch(sceneColor, texel, 0).rgb;
+    vec3 minColor = current;
+    vec3 maxColor = current;
+    for (int y = -1; y <= 1; y++) {
+        for (int x = -1; x <= 1; x++) {
+            vec3 neighbour = texelFetch(sceneColor, clamp(texel + ivec2(x, y), ivec2(0), lastTexel), 0).rgb;
+            minColor = min(minColor, neighbour);
+            maxColor = max(maxColor, neighbour);
+        }
+    }
+
+    // back to clip space of this frame, on to the previous one
+    float depth = texelFetch(sceneDepth, texel, 0).r;
+    vec4 previous = params.reprojection * vec4(fragUv * 2.0 - 1.0, depth, 1.0);
+    vec2 previousUv = previous.xy / previous.w * 0.5 + 0.5;
+
+    // off screen last frame, nothing to blend with
+    float currentWeight = params.currentWeight;
+    if (any(lessThan(previousUv, vec2(0.0))) || any(greaterThan(previousUv, vec2(1.0))))
+        currentWeight = 1.0;
+
+    vec3 previousColor = texture(history, min(previousUv * params.historyUvScale, params.historyUvClamp)).rgb;
+    previousColor = clamp(previousColor, minColor, maxColor);
+
+    outColor = vec4(mix(previousColor, current, currentWeight), 1.0);
+}
\ No newline at end of file
@@ -1,13 +1,74 @@
 #version 450
+#extension GL_GOOGLE_include_directive : require
+#ifdef BINDLESS
+#extension GL_EXT_nonuniform_qualifier : require
+#endif
 
+// pipeline permutations, see PipelineKey, disabled paths are compiled out
+layout(constant_id = 0) const bool USE_TEXTURE = true;
+layout(constant_id = 1) const bool USE_VERTEX_COLOR = true;
+
+layout(set = 0, binding = 0) uniform UniformBufferObject {
+	mat4 viewProj;
+	mat4 view;
+	mat4 proj;
+	uvec4 clusterGrid; // xyz grid size, w light count
+	vec4 clusterParams; // slice scale, slice bias, 1 / render extent
+	mat4 shadowViewProj[4]; // per cascade, see lighting.glsl
+	vec4 shadowSplits; // view depth where each cascade ends
+	vec4 sunDirection; // xyz towards the sun, w intensity, 0 without shadows
+	uvec4 bindless; // x material table slot
+} ubo;
+
+#ifdef BINDLESS
+// bound once per frame, every material's texture is in there, see Application::createBindlessSetLayout
+layout(set = 1, binding = 0) uniform sampler2D textures[];
+
+// material index -> texture slot
+layout(std430, set = 1, binding = 1) readonly buffer MaterialTable {
+	uint textureSlots[];
+} materialTables[];
+
+layout(push_constant) uniform PushConstants {
+	mat4 model;
+	uint materialIndex;
+} draw;
+#else
 layout(set = 0, binding = 1) uniform sampler2D texSampler;
+#endif
+
+#include "lighting.glsl"
 
 layout(location = 0) in vec3 fragColor;
 layout(location = 1) in vec2 fragTexCoord;
+layout(location = 2) in vec3 fragWorldPosition;
+layout(location = 3) in vec3 fragNormal;
+layout(location = 4) in float fragViewDepth;
 
 layout(location = 0) out vec4 outColor;
 
 void main()
 {
-	outColor = vec4(fragColor * texture(texSampler, fragTexCoord).rgb, 1.0);
+	vec3 color = vec3(1.0);
+
+	if (USE_VERTEX_COLOR)
+		color *= fragColor;
+
+	if (USE_TEXTURE)
+	{
+#ifdef BINDLESS
+		// both indices are the same for the whole draw, no nonuniformEXT needed
+		uint table = ubo.bindless.x;
+		uint material = min(draw.materialIndex, materialTables[table].textureSlots.length() - 1);
+		color *= texture(textures[materialTables[table].textureSlots[material]], fragTexCoord).rgb;
+#else
+		color *= texture(texSampler, fragTexCoord).rgb;
+#endif
+	}
+
+	// no lights and no sun, unlit
+	if (ubo.clusterGrid.w > 0 || ubo.sunDirection.w > 0.0)
+		color *= lighting(fragWorldPosition, fragNormal, fragViewDepth);
+
+	outColor = vec4(color, 1.0);
 }
\ No newline at end of file
@@ -1,20 +1,52 @@
 #version 450
 
 layout(set = 0, binding = 0) uniform UniformBufferObject {
-    mat4 model;
+    mat4 viewProj;
     mat4 view;
     mat4 proj;
+    uvec4 clusterGrid;
+    vec4 clusterParams;
+    mat4 shadowViewProj[4];
+    vec4 shadowSplits;
+    vec4 sunDirection;
 } ubo;
 
+// per frame, transforms of every instance, batches index it through firstInstance
+layout(std430, set = 0, binding = 2) readonly buffer InstanceBuffer {
+    mat4 models[];
+} instances;
+
+// per draw, see DrawPushConstants
+layout(push_constant) uniform PushConstants {
+    mat4 model;
+    uint materialIndex;
+} draw;
+
 layout(location = 0) in vec3 inPosition;
 layout(location = 1) in vec3 inColor;
 layout(location = 2) in vec2 inTexCoord;
+layout(location = 3) in vec3 inNormal;
 
 layout(location = 0) out vec3 fragColor;
 layout(location = 1) out vec2 fragTexCoord;
+layout(location = 2) out vec3 fragWorldPosition;
+layout(location = 3) out vec3 fragNormal;
+layout(location = 4) out float fragViewDepth;
+
+// the depth pre-pass computes the same position, see depth_prepass.vert
+invariant gl_Position;
 
 void main() {
-    gl_Position = ubo.proj * ubo.view * ubo.model * vec4(inPosition, 1.0);
+    mat4 model = draw.model * instances.models[gl_InstanceIndex];
+    vec4 worldPosition = model * vec4(inPosition, 1.0);
+    gl_Position = ubo.viewProj * worldPosition;
     fragColor = inColor;
     fragTexCoord = inTexCoord;
+    fragWorldPosition = worldPosition.xyz;
+    fragViewDepth = -(ubo.view * worldPosition).z;
+
+    // transforms are rotations and scales, their columns are orthogonal and dividing by the squared column lengths
+    // gives the inverse transpose without inverting a matrix per vertex
+    mat3 linear = mat3(model);
+    fragNormal = linear * (inNormal / vec3(dot(linear[0], linear[0]), dot(linear[1], linear[1]), dot(linear[2], linear[2])));
 }
\ No newline at end of file
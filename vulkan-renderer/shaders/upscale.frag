@@ -0,0 +1,143 @@
+#version 450
+
+// Dynamic resolution target to swap chain. Bilinear, or bilinear followed by contrast adaptive sharpening:
+// a negative lobe on the four neighbours that backs off where the neighbourhood already has strong contrast,
+// so soft upscaled edges get crisper without ringing around the hard ones.
+// FXAA replaces the center sample with one moved across the edge it lies on, by how far along the edge it is,
+// walking in texels of the source so it antialiases the rendered image rather than the upscaled one.
+layout(constant_id = 0) const bool EDGE_ADAPTIVE = false;
+layout(constant_id = 1) const bool FXAA = false;
+
+layout(set = 0, binding = 0) uniform sampler2D sceneColor;
+
+// see UpscalePushConstants
+layout(push_constant) uniform UpscaleParameters {
+    vec2 uvScale;
+    vec2 uvClamp;
+    vec2 texelSize;
+    float sharpness;
+} params;
+
+layout(location = 0) in vec2 fragUv;
+
+layout(location = 0) out vec4 outColor;
+
+vec3 fetch(vec2 uv) {
+    // texels right of and below the rendered part hold whatever a larger scale left there
+    return texture(sceneColor, min(uv, params.uvClamp)).rgb;
+}
+
+float luma(vec3 color) {
+    // the target is sRGB, the square root brings the linear luma close to what the eye sees as an edge
+    return sqrt(dot(color, vec3(0.299, 0.587, 0.114)));
+}
+
+// FXAA 3.11 quality, with a fixed search schedule
+const float EDGE_THRESHOLD = 0.125; // of the brightest neighbour
+const float EDGE_THRESHOLD_MIN = 0.0312; // dark areas
+const float SUBPIXEL_QUALITY = 0.75;
+const int SEARCH_STEPS = 10;
+const float SEARCH_STEP_SIZE[SEARCH_STEPS] = float[](1.0, 1.0, 1.0, 1.0, 1.5, 2.0, 2.0, 2.0, 4.0, 8.0);
+
+vec3 fxaa(vec2 uv, vec3 center) {
+    vec2 texel = params.texelSize;
+    float lumaM = luma(center);
+    float lumaN = luma(fetch(uv - vec2(0.0, texel.y)));
+    float lumaS = luma(fetch(uv + vec2(0.0, texel.y)));
+    float lumaW = luma(fetch(uv - vec2(texel.x, 0.0)));
+    float lumaE = luma(fetch(uv + vec2(texel.x, 0.0)));
+
+    float lumaMin = min(lumaM, min(min(lumaN, lumaS), min(lumaW, lumaE)));
+    float lumaMax = max(lumaM, max(max(lumaN, lumaS), max(lumaW, lumaE)));
+    float range = lumaMax - lumaMin;
+    if (range < max(EDGE_THRESHOLD_MIN, lumaMax * EDGE_THRESHOLD))
+        return center;
+
+    float lumaNW = luma(fetch(uv - texel));
+    float lumaSE = luma(fetch(uv + texel));
+    float lumaNE = luma(fetch(uv + vec2(texel.x, -texel.y)));
+    float lumaSW = luma(fetch(uv + vec2(-texel.x, texel.y)));
+
+    // a horizontal edge changes a lot from row to row
+    float edgeHorizontal = abs(lumaNW + lumaNE - 2.0 * lumaN) + 2.0 * abs(lumaW + lumaE - 2.0 * lumaM) + abs(lumaSW + lumaSE - 2.0 * lumaS);
+    float edgeVertical = abs(lumaNW + lumaSW - 2.0 * lumaW) + 2.0 * abs(lumaN + lumaS - 2.0 * lumaM) + abs(lumaNE + lumaSE - 2.0 * lumaE);
+    bool horizontal = edgeHorizontal >= edgeVertical;
+
+    // the edge lies between this texel and the neighbour across it with the steeper gradient
+    float luma1 = horizontal ? lumaN : lumaW;
+    float luma2 = horizontal ? lumaS : lumaE;
+    float gradient1 = luma1 - lumaM;
+    float gradient2 = luma2 - lumaM;
+    bool steeper1 = abs(gradient1) >= abs(gradient2);
+    float gradientScaled = 0.25 * max(abs(gradient1), abs(gradient2));
+    float stepLength = horizontal ? texel.y : texel.x;
+    float lumaLocalAverage = 0.5 * ((steeper1 ? luma1 : luma2) + lumaM);
+    if (steeper1)
+        stepLength = -stepLength;
+
+    vec2 edgeUv = uv + (horizontal ? vec2(0.0, 0.5 * stepLength) : vec2(0.5 * stepLength, 0.0));
+    vec2 offset = horizontal ? vec2(texel.x, 0.0) : vec2(0.0, texel.y);
+
+    // walk both ways along the edge until the average across it no longer matches
+    vec2 uv1 = edgeUv - offset;
+    vec2 uv2 = edgeUv + offset;
+    float lumaEnd1 = 0.0, lumaEnd2 = 0.0;
+    bool reached1 = false, reached2 = false;
+    for (int i = 0; i < SEARCH_STEPS && !(reached1 && reached2); i++) {
+        if (!reached1) {
+            lumaEnd1 = luma(fetch(uv1)) - lumaLocalAverage;
+            reached1 = abs(lumaEnd1) >= gradientScaled;
+            if (!reached1)
+                uv1 -= offset * SEARCH_STEP_SIZE[i];
+        }
+        if (!reached2) {
+            lumaEnd2 = luma(fetch(uv2)) - lumaLocalAverage;
+            reached2 = abs(lumaEnd2) >= gradientScaled;
+            if (!reached2)
+                uv2 += offset * SEARCH_STEP_SIZE[i];
+        }
+    }
+
+    float distance1 = horizontal ? uv.x - uv1.x : uv.y - uv1.y;
+    float distance2 = horizontal ? uv2.x - uv.x : uv2.y - uv.y;
+    bool closer1 = distance1 < distance2;
+    float edgeLength = distance1 + distance2;
+    float pixelOffset = 0.5 - min(distance1, distance2) / edgeLength;
+
+    // only move towards the end whose luma says the edge turns away from this texel
+    bool centerDarker = lumaM < lumaLocalAverage;
+    bool correctVariation = ((closer1 ? lumaEnd1 : lumaEnd2) < 0.0) != centerDarker;
+    float finalOffset = correctVariation ? pixelOffset : 0.0;
+
+    // single texel features have no edge to walk, blend them with the neighbourhood instead
+    float lumaAverage = (2.0 * (lumaN + lumaS + lumaW + lumaE) + lumaNW + lumaNE + lumaSW + lumaSE) / 12.0;
+    float subpixel = clamp(abs(lumaAverage - lumaM) / range, 0.0, 1.0);
+    subpixel = (-2.0 * subpixel + 3.0) * subpixel * subpixel;
+    finalOffset = max(finalOffset, subpixel * subpixel * SUBPIXEL_QUALITY);
+
+    return fetch(uv + (horizontal ? vec2(0.0, finalOffset * stepLength) : vec2(finalOffset * stepLength, 0.0)));
+}
+
+void main() {
+    vec2 uv = fragUv * params.uvScale;
+    vec3 center = fetch(uv);
+    if (FXAA)
+        center = fxaa(uv, center);
+
+    if (EDGE_ADAPTIVE) {
+        vec3 north = fetch(uv - vec2(0.0, params.texelSize.y));
+        vec3 south = fetch(uv + vec2(0.0, params.texelSize.y));
+        vec3 west = fetch(uv - vec2(params.texelSize.x, 0.0));
+        vec3 east = fetch(uv + vec2(params.texelSize.x, 0.0));
+
+        vec3 minColor = min(center, min(min(north, south), min(west, east)));
+        vec3 maxColor = max(center, max(max(north, south), max(west, east)));
+
+        // headroom before the result would clip either way, flat areas and soft edges get the full lobe
+        vec3 amplitude = sqrt(clamp(min(minColor, 1.0 - maxColor) / max(maxColor, vec3(1e-4)), 0.0, 1.0));
+        vec3 weight = -amplitude * mix(0.125, 0.2, params.sharpness);
+        center = clamp((center + (north + south + west + east) * weight) / (1.0 + 4.0 * weight), 0.0, 1.0);
+    }
+
+    outColor = vec4(center, 1.0);
+}
\ No newline at end of file
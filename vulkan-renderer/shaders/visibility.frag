@@ -0,0 +1,19 @@
+#version 450
+
+// see DrawPushConstants
+layout(push_constant) uniform PushConstants {
+	mat4 model;
+	uint materialIndex;
+	uint firstTriangle;
+} draw;
+
+layout(location = 0) flat in uint fragInstance;
+
+// instance + 1, 0 is left for pixels nothing covers, and the triangle's index in the shared index buffer
+layout(location = 0) out uvec2 outTriangleId;
+
+void main()
+{
+	// gl_PrimitiveID restarts at 0 for every draw and instance
+	outTriangleId = uvec2(fragInstance + 1, draw.firstTriangle + uint(gl_PrimitiveID));
+}
\ No newline at end of file
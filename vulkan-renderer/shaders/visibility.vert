@@ -0,0 +1,34 @@
+#version 450
+
+layout(set = 0, binding = 0) uniform UniformBufferObject {
+    mat4 viewProj;
+    mat4 view;
+    mat4 proj;
+    uvec4 clusterGrid;
+    vec4 clusterParams;
+    mat4 shadowViewProj[4];
+    vec4 shadowSplits;
+    vec4 sunDirection;
+} ubo;
+
+// see test.vert
+layout(std430, set = 0, binding = 2) readonly buffer InstanceBuffer {
+    mat4 models[];
+} instances;
+
+// see DrawPushConstants
+layout(push_constant) uniform PushConstants {
+    mat4 model;
+    uint materialIndex;
+    uint firstTriangle;
+} draw;
+
+// position only, everything else is fetched by the resolve for the one triangle that ends up visible
+layout(location = 0) in vec3 inPosition;
+
+layout(location = 0) flat out uint fragInstance;
+
+void main() {
+    gl_Position = ubo.viewProj * (draw.model * instances.models[gl_InstanceIndex] * vec4(inPosition, 1.0));
+    fragInstance = uint(gl_InstanceIndex);
+}
\ No newline at end of file
@@ -0,0 +1,139 @@
+#version 450
+#extension GL_GOOGLE_include_directive : require
+
+layout(set = 0, binding = 0) uniform UniformBufferObject {
+	mat4 viewProj;
+	mat4 view;
+	mat4 proj;
+	uvec4 clusterGrid; // xyz grid size, w light count
+	vec4 clusterParams; // slice scale, slice bias, 1 / render extent
+	mat4 shadowViewProj[4]; // per cascade, see lighting.glsl
+	vec4 shadowSplits; // view depth where each cascade ends
+	vec4 sunDirection; // xyz towards the sun, w intensity, 0 without shadows
+} ubo;
+
+layout(set = 0, binding = 1) uniform sampler2D texSampler;
+
+layout(std430, set = 0, binding = 2) readonly buffer InstanceBuffer {
+	mat4 models[];
+} instances;
+
+// see Vertex, read as plain floats since std430 would pad its vec3 members to 16 bytes
+const uint VERTEX_FLOATS = 11;
+const uint COLOR_OFFSET = 3;
+const uint TEX_COORD_OFFSET = 6;
+const uint NORMAL_OFFSET = 8;
+
+layout(std430, set = 0, binding = 5) readonly buffer VertexBuffer {
+	float vertices[];
+} vertexBuffer;
+
+layout(std430, set = 0, binding = 6) readonly buffer IndexBuffer {
+	uint indices[];
+} indexBuffer;
+
+#include "lighting.glsl"
+
+// written by visibility.frag, instance + 1 and triangle
+layout(input_attachment_index = 0, set = 1, binding = 0) uniform usubpassInput triangleIds;
+
+layout(location = 0) out vec4 outColor;
+
+vec3 readVec3(uint offset)
+{
+	return vec3(vertexBuffer.vertices[offset], vertexBuffer.vertices[offset + 1], vertexBuffer.vertices[offset + 2]);
+}
+
+struct Barycentrics {
+	vec3 lambda; // perspective correct weights of the three corners at the pixel center
+	vec3 ddx, ddy; // their change one pixel to the right and one pixel down
+};
+
+// What the rasterizer would have interpolated, from the clip space corners of the triangle. The derivatives stand in for
+// the ones a fullscreen pass doesn't have, textureGrad picks the mip level with them
+Barycentrics barycentrics(vec4 clip0, vec4 clip1, vec4 clip2, vec2 ndc, vec2 pixelSize)
+{
+	vec3 invW = 1.0 / vec3(clip0.w, clip1.w, clip2.w);
+	vec2 ndc0 = clip0.xy * invW.x;
+	vec2 ndc1 = clip1.xy * invW.y;
+	vec2 ndc2 = clip2.xy * invW.z;
+
+	// screen space weights are linear in NDC, divided by w they interpolate 1 / w and the weights over w
+	float invDet = 1.0 / determinant(mat2(ndc2 - ndc1, ndc0 - ndc1));
+	vec3 ddx = vec3(ndc1.y - ndc2.y, ndc2.y - ndc0.y, ndc0.y - ndc1.y) * invDet * invW;
+	vec3 ddy = vec3(ndc2.x - ndc1.x, ndc0.x - ndc2.x, ndc1.x - ndc0.x) * invDet * invW;
+	float ddxSum = ddx.x + ddx.y + ddx.z;
+	float ddySum = ddy.x + ddy.y + ddy.z;
+
+	vec2 delta = ndc - ndc0;
+	float interpolatedInvW = invW.x + delta.x * ddxSum + delta.y * ddySum;
+
+	Barycentrics result;
+	result.lambda = (vec3(invW.x, 0.0, 0.0) + delta.x * ddx + delta.y * ddy) / interpolatedInvW;
+
+	ddx *= pixelSize.x;
+	ddy *= pixelSize.y;
+	ddxSum *= pixelSize.x;
+	ddySum *= pixelSize.y;
+	result.ddx = (result.lambda * interpolatedInvW + ddx) / (interpolatedInvW + ddxSum) - result.lambda;
+	result.ddy = (result.lambda * interpolatedInvW + ddy) / (interpolatedInvW + ddySum) - result.lambda;
+	return result;
+}
+
+void main()
+{
+	uvec2 id = subpassLoad(triangleIds).xy;
+
+	// nothing drawn here, the color the forward path clears to
+	if (id.x == 0)
+	{
+		outColor = vec4(0.2, 0.2, 0.2, 1.0);
+		return;
+	}
+
+	// batched draws push an identity model matrix, the instance transform is the whole transform
+	mat4 model = instances.models[id.x - 1];
+
+	uint offsets[3];
+	vec3 worldPositions[3];
+	vec4 clipPositions[3];
+	for (uint i = 0; i < 3; i++)
+	{
+		offsets[i] = indexBuffer.indices[id.y * 3 + i] * VERTEX_FLOATS;
+		worldPositions[i] = (model * vec4(readVec3(offsets[i]), 1.0)).xyz;
+		clipPositions[i] = ubo.viewProj * vec4(worldPositions[i], 1.0);
+	}
+
+	// the viewport covers the render extent, like in the ID pass
+	vec2 pixelSize = 2.0 * ubo.clusterParams.zw;
+	vec2 ndc = gl_FragCoord.xy * pixelSize - 1.0;
+	Barycentrics weights = barycentrics(clipPositions[0], clipPositions[1], clipPositions[2], ndc, pixelSize);
+
+	vec3 color = vec3(0.0);
+	vec3 normal = vec3(0.0);
+	vec2 texCoord = vec2(0.0), texCoordDx = vec2(0.0), texCoordDy = vec2(0.0);
+	vec3 worldPosition = vec3(0.0);
+	for (uint i = 0; i < 3; i++)
+	{
+		vec2 cornerTexCoord = vec2(vertexBuffer.vertices[offsets[i] + TEX_COORD_OFFSET], vertexBuffer.vertices[offsets[i] + TEX_COORD_OFFSET + 1]);
+		color += weights.lambda[i] * readVec3(offsets[i] + COLOR_OFFSET);
+		normal += weights.lambda[i] * readVec3(offsets[i] + NORMAL_OFFSET);
+		texCoord += weights.lambda[i] * cornerTexCoord;
+		texCoordDx += weights.ddx[i] * cornerTexCoord;
+		texCoordDy += weights.ddy[i] * cornerTexCoord;
+		worldPosition += weights.lambda[i] * worldPositions[i];
+	}
+
+	color *= textureGrad(texSampler, texCoord, texCoordDx, texCoordDy).rgb;
+
+	if (ubo.clusterGrid.w > 0 || ubo.sunDirection.w > 0.0)
+	{
+		// see test.vert, the columns of the instance transforms are orthogonal
+		mat3 linear = mat3(model);
+		normal = linear * (normal / vec3(dot(linear[0], linear[0]), dot(linear[1], linear[1]), dot(linear[2], linear[2])));
+		float viewDepth = -(ubo.view * vec4(worldPosition, 1.0)).z;
+		color *= lighting(worldPosition, normal, viewDepth);
+	}
+
+	outColor = vec4(color, 1.0);
+}
\ No newline at end of file
@@ -9,8 +9,64 @@
 
 #include "Application.h"
 
+#include <filesystem>
+#include <bit>
+#include <cstddef>
+#include <cstdio>
+
+static void setQualityTier(PipelineKey& key, const QualityTier& tier)
+{
+	key.samples = tier.samples;
+	key.sampleShadingEnable = tier.sampleShading > 0.0f ? VK_TRUE : VK_FALSE;
+	key.minSampleShading = tier.sampleShading > 0.0f ? tier.sampleShading : 1.0f;
+}
+
+// the depth pre-pass permutation of a main pass key: same rasterization and sample count, depth only with the usual test
+static PipelineKey depthPrepassKey(PipelineKey key)
+{
+	key.depthPrepass = VK_TRUE;
+	key.depthWriteEnable = VK_TRUE;
+	key.depthCompareOp = VK_COMPARE_OP_LESS;
+	key.sampleShadingEnable = VK_FALSE; // nothing to shade per sample without a fragment shader
+	key.minSampleShading = 1.0f;
+	return key;
+}
+
+static std::string describeQualityTier(const QualityTier& tier)
+{
+	std::string description = tier.samples == VK_SAMPLE_COUNT_1_BIT ? "no MSAA" : std::to_string(tier.samples) + "x MSAA";
+	if (tier.sampleShading > 0.0f)
+		description += ", sample shading " + std::to_string(tier.sampleShading).substr(0, 4);
+	if (tier.antiAliasing == PostAntiAliasing::Fxaa)
+		description += ", FXAA";
+	else if (tier.antiAliasing == PostAntiAliasing::Taa)
+		description += ", TAA";
+	return description;
+}
+
+// element index of the base b van der Corput sequence, (2, 3) pairs give well spread subpixel offsets for any prefix
+static float halton(uint32_t index, uint32_t base)
+{
+	float result = 0.0f, fraction = 1.0f;
+	for (; index > 0; index /= base)
+	{
+		fraction /= base;
+		result += fraction * (index % base);
+	}
+	return result;
+}
+
 // public
 
+Application::Application(const ApplicationConfig& config)
+	: m_config(config), m_width(config.width), m_height(config.height), m_resolutionController(config.resolution), m_upscaleFilter(config.upscaleFilter)
+{
+	if (m_config.headless)
+	{
+		deviceExtensions.clear(); // nothing to present to
+	}
+}
+
 void Application::run()
 {
 	initWindow();
@@ -23,6 +79,9 @@ void Application::run()
 
 void Application::initWindow()
 {
+	if (m_config.headless)
+		return;
+
 	glfwInit();
 
 	glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
@@ -31,50 +90,572 @@ void Application::initWindow()
 	m_window = glfwCreateWindow(m_width, m_height, "Vulkan Renderer", nullptr, nullptr);
 	glfwSetWindowUserPointer(m_window, this);
 	glfwSetFramebufferSizeCallback(m_window, framebufferResizeCallback);
+	glfwSetKeyCallback(m_window, keyCallback);
 }
 
 void Application::initVulkan()
 {
-	createVulkanInstance();
-	setupDebugMessenger();
-	createSurface();
-	pickPhysicalDevice();
-	createLogicalDevice();
-	createSwapChain();
-	createImageViews();
-	createRenderPass();
-	createDescriptorSetLayout();
-	createGraphicsPipeline();
-	createCommandPools();
-	createColorResources();
-	createDepthResources();
-	createFramebuffers();
+	// parsing and decoding don't touch Vulkan, overlap them with device and pipeline creation
+	JobCounter assetsLoaded;
+	m_jobSystem.run([this]() { loadModel(); }, &assetsLoaded);
+	m_jobSystem.run([this]() { decodeTextureImage(); }, &assetsLoaded);
+
+	try
+	{
+		createVulkanInstance();
+		setupDebugMessenger();
+		createSurface();
+		pickPhysicalDevice();
+		createLogicalDevice();
+		if (m_config.headless)
+			createOffscreenTargets();
+		else
+			createSwapChain();
+		createImageViews();
+		createRenderPass();
+		createDescriptorSetLayout();
+		if (m_supportsBindless)
+			createBindlessSetLayout();
+		createPipelineCache();
+		createGraphicsPipeline();
+		if (rendersOffscreen())
+			createPostProcessing();
+		if (m_config.visibilityBuffer)
+			createVisibilityBuffer();
+		createCommandPools();
+		createColorResources();
+		createDepthResources();
+		createFramebuffers();
+		createPostDescriptorSet();
+		createVisibilityDescriptorSet();
+	}
+	catch (...)
+	{
+		// the loader jobs still write into this object, don't unwind past them
+		try { m_jobSystem.wait(assetsLoaded); } catch (...) {}
+		throw;
+	}
+
+	m_jobSystem.wait(assetsLoaded);
+
 	createTextureImage();
 	createTextureImageView();
 	createTextureSampler();
-	loadModel();
 	createVertexBuffer();
+	if (m_config.depthPrepass)
+		createPositionBuffer();
 	createIndexBuffer();
 	createUniformBuffers();
+	createInstanceBuffers();
+	createLightBuffers();
+	createShadowResources();
 	createDescriptorPool();
 	createDescriptorSets();
+	if (m_supportsBindless)
+		createBindlessResources();
+	if (m_config.gpuDriven)
+		createGpuDrivenResources();
 	createCommandBuffers();
 	createSyncObjects();
+	m_frameGraph.init(m_device, [this](uint32_t typeFilter, VkMemoryPropertyFlags properties) { return findMemoryType(typeFilter, properties); },
+		[this](std::function<void()>&& deleter) { deferDeletion(std::move(deleter)); });
+	createTimestampQueries();
+	createPipelineStatisticsQueries();
+	createReadbackBuffers();
 }
 
 void Application::mainLoop()
 {
-	while (!glfwWindowShouldClose(m_window)) {
-		glfwPollEvents();
-		drawFrame();
+	startSimulation();
+
+	try
+	{
+		auto frameStart = std::chrono::high_resolution_clock::now();
+		double lastFrameTimeMs = 0.0;
+
+		while (!shouldClose()) {
+			if (!m_config.headless)
+			{
+				CpuTimer eventsTimer;
+				glfwPollEvents();
+				m_jobSystem.pumpMainThread();
+				m_frameStats.addStageTime(FrameStage::Events, eventsTimer.elapsedMs());
+			}
+			else
+			{
+				m_jobSystem.pumpMainThread();
+			}
+
+			// without worker threads background jobs (pipeline compiles) only move forward when someone helps
+			if (m_jobSystem.workerCount() == 0)
+				m_jobSystem.runPendingJob();
+
+			if (isWindowMinimized())
+			{
+				// nothing to present to, sleep until an event arrives instead of spinning
+				glfwWaitEventsTimeout(0.1);
+				frameStart = std::chrono::high_resolution_clock::now();
+				continue;
+			}
+
+			if (m_config.pipelineStress != PipelineStressMode::None)
+				updatePipelineStress(lastFrameTimeMs);
+
+			if (m_config.qualitySweep)
+				updateQualitySweep();
+			if (!(m_requestedTier == m_qualityTier))
+				applyQualityTier();
+
+			if (m_config.headless)
+				drawOffscreenFrame();
+			else
+				drawFrame();
+
+			auto frameEnd = std::chrono::high_resolution_clock::now();
+			double frameTimeMs = std::chrono::duration<double, std::chrono::milliseconds::period>(frameEnd - frameStart).count();
+			bool resizing = std::chrono::steady_clock::now() - m_lastResizeEvent < RESIZE_STATS_WINDOW;
+			m_frameStats.addFrame(frameTimeMs, resizing);
+			lastFrameTimeMs = frameTimeMs;
+			m_frameStats.report();
+			frameStart = frameEnd;
+		}
+	}
+	catch (...)
+	{
+		stopSimulation();
+		throw;
 	}
 
+	stopSimulation();
 	vkDeviceWaitIdle(m_device);
+
+	for (uint32_t i = 0; i < m_pendingFrameDumps.size(); i++)
+	{
+		writePendingFrameDump(i);
+	}
+}
+
+bool Application::shouldClose()
+{
+	if (m_config.frameCount > 0 && m_frameNumber >= m_config.frameCount)
+		return true;
+
+	if (m_config.qualitySweep && m_qualitySweep.finished)
+		return true;
+
+	return !m_config.headless && glfwWindowShouldClose(m_window);
+}
+
+void Application::startSimulation()
+{
+	m_simulationRunning = true;
+	m_simulationThread = std::thread(&Application::simulationLoop, this);
+}
+
+void Application::stopSimulation()
+{
+	if (!m_simulationThread.joinable())
+		return;
+
+	m_simulationRunning = false;
+	// wake the simulation thread up if it is waiting for the renderer
+	m_consumedPacket.store(std::numeric_limits<uint64_t>::max());
+	m_consumedPacket.notify_all();
+	m_simulationThread.join();
+}
+
+void Application::simulationLoop()
+{
+	auto startTime = std::chrono::high_resolution_clock::now();
+	uint64_t simulationFrame = 1;
+
+	while (m_simulationRunning.load(std::memory_order_acquire))
+	{
+		// stay at most one packet ahead of the renderer, so we overlap with frame N without simulating frames nobody draws
+		uint64_t consumed = m_consumedPacket.load(std::memory_order_acquire);
+		if (consumed < simulationFrame - 1)
+		{
+			m_consumedPacket.wait(consumed, std::memory_order_acquire);
+			continue;
+		}
+
+		CpuTimer timer;
+		float time = std::chrono::duration<float, std::chrono::seconds::period>(std::chrono::high_resolution_clock::now() - startTime).count();
+
+		FramePacket& packet = m_framePackets.writeBuffer();
+		packet.simulationFrame = simulationFrame++;
+		simulateFrame(packet, time);
+		packet.simulationTimeMs = timer.elapsedMs();
+
+		m_framePackets.publish();
+	}
+}
+
+void Application::simulateFrame(FramePacket& packet, float time)
+{
+	// packets are recycled by the triple buffer, clearing keeps the vector capacity around
+	packet.transforms.clear();
+	packet.drawList.clear();
+	packet.occluders.clear();
+	packet.lights.clear();
+
+	if (m_config.citySize > 0)
+		simulateCityScene(packet, time);
+	else if (m_config.instanceCount > 0)
+		simulateInstanceScene(packet, time);
+	else
+	{
+		float scale_factor = 1.0f; // Adjust the scaling factor as needed
+		glm::mat4 rotation_matrix = glm::rotate(glm::mat4(1.0f), time * glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+		glm::mat4 scaling_matrix = glm::scale(glm::mat4(1.0f), glm::vec3(scale_factor, scale_factor, scale_factor));
+		packet.transforms.push_back(scaling_matrix * rotation_matrix);
+
+		packet.drawList.push_back({ 0, 0, static_cast<uint32_t>(m_indices.size()) });
+
+		packet.view = glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+		packet.fovY = glm::radians(45.0f);
+		packet.nearPlane = 0.1f;
+		packet.farPlane = 10.0f;
+
+		simulateLights(packet, time, { glm::vec3(-1.5f, -1.5f, -0.5f), glm::vec3(1.5f, 1.5f, 1.5f) });
+	}
+
+	// the GPU driven path culls in its compute pass, the cascades pick their casters from the whole draw list before
+	// culling drops what the camera doesn't see
+	if (!m_config.gpuDriven || m_config.shadows)
+		updateCullBounds(packet);
+	if (m_config.shadows)
+		updateShadowCascades(packet);
+	if (!m_config.gpuDriven)
+	{
+		cullDrawList(packet);
+		sortDrawList(packet);
+	}
+	assignLights(packet);
+}
+
+void Application::updateCullBounds(FramePacket& packet)
+{
+	uint32_t itemCount = static_cast<uint32_t>(packet.drawList.size());
+	m_cullBounds.resize(itemCount);
+
+	// a single mesh for now, every item shares its bounds
+	m_jobSystem.parallelFor(itemCount, CULL_GRAIN_SIZE, [&](uint32_t begin, uint32_t end)
+	{
+		for (uint32_t i = begin; i < end; i++)
+		{
+			m_cullBounds.set(i, m_meshBounds, packet.transforms[packet.drawList[i].transformIndex]);
+		}
+	});
+}
+
+void Application::cullDrawList(FramePacket& packet)
+{
+	CpuTimer cullTimer;
+
+	// same projection the render thread builds, apart from a frame of lag while resizing
+	glm::mat4 proj = projectionFor(packet, m_viewAspect.load(std::memory_order_relaxed));
+	Frustum frustum = Frustum::fromViewProj(proj * packet.view);
+
+	// bounds of every item are in m_cullBounds already, see updateCullBounds
+	uint32_t itemCount = static_cast<uint32_t>(packet.drawList.size());
+	m_cullVisibility.resize(itemCount);
+
+	uint32_t visibleCount = cullObjectsParallel(m_jobSystem, frustum, m_cullBounds, m_cullVisibility.data(), CULL_GRAIN_SIZE);
+
+	packet.occludedObjects = 0;
+	packet.frustumCulledTriangles = 0;
+	packet.occludedTriangles = 0;
+	if (!packet.occluders.empty())
+	{
+		// tally before the occlusion test clears more entries, the stats keep both apart
+		for (uint32_t i = 0; i < itemCount; i++)
+		{
+			if (!m_cullVisibility[i])
+				packet.frustumCulledTriangles += packet.drawList[i].indexCount / 3;
+		}
+
+		glm::mat4 viewProj = proj * packet.view;
+		m_occlusionBuffer.rasterize(m_jobSystem, viewProj, packet.occluders);
+		packet.occludedObjects = m_occlusionBuffer.cullObjects(m_jobSystem, m_cullBounds, m_cullVisibility.data());
+		visibleCount -= packet.occludedObjects;
+	}
+
+	// compact in place, keeps the order so batching still sees neighbours next to each other
+	uint32_t kept = 0;
+	uint64_t culledTriangles = 0;
+	for (uint32_t i = 0; i < itemCount; i++)
+	{
+		if (m_cullVisibility[i])
+			packet.drawList[kept++] = packet.drawList[i];
+		else
+			culledTriangles += packet.drawList[i].indexCount / 3;
+	}
+	packet.drawList.resize(kept);
+
+	packet.culledObjects = itemCount - visibleCount;
+	if (!packet.occluders.empty())
+		packet.occludedTriangles = culledTriangles - packet.frustumCulledTriangles;
+	packet.cullTimeMs = cullTimer.elapsedMs();
+}
+
+void Application::sortDrawList(FramePacket& packet)
+{
+	packet.sortTimeMs = 0.0;
+	if (!m_config.sortDraws)
+		return;
+
+	CpuTimer sortTimer;
+
+	// one pass and one frame pipeline for now, material and mesh decide the order, depth breaks ties front to back
+	float depthRange = packet.farPlane - packet.nearPlane;
+	uint32_t itemCount = static_cast<uint32_t>(packet.drawList.size());
+	m_renderQueue.clear();
+	m_renderQueue.reserve(itemCount);
+	for (uint32_t i = 0; i < itemCount; i++)
+	{
+		const DrawItem& item = packet.drawList[i];
+
+		DrawKeyFields fields;
+		fields.material = item.materialIndex;
+		fields.mesh = item.firstIndex / 3;
+		fields.depth = (-(packet.view * packet.transforms[item.transformIndex][3]).z - packet.nearPlane) / depthRange;
+		m_renderQueue.push(packDrawKey(fields), i);
+	}
+
+	m_renderQueue.sort(&m_jobSystem);
+
+	m_sortedDrawList.resize(itemCount);
+	const std::vector<RenderQueue::Entry>& entries = m_renderQueue.entries();
+	for (uint32_t i = 0; i < itemCount; i++)
+		m_sortedDrawList[i] = packet.drawList[entries[i].payload];
+	packet.drawList.swap(m_sortedDrawList);
+
+	packet.sortTimeMs = sortTimer.elapsedMs();
+}
+
+void Application::simulateLights(FramePacket& packet, float time, const Aabb& area)
+{
+	uint32_t count = m_config.lightCount;
+	if (count == 0)
+		return;
+
+	// spread over the area, the radius grows with the spacing so every point is reached by about the same number of lights
+	glm::vec3 size = area.max - area.min;
+	float spacing = std::sqrt(size.x * size.y / count);
+	float radius = 2.0f * spacing;
+
+	packet.lights.resize(count);
+	for (uint32_t i = 0; i < count; i++)
+	{
+		// stable pseudo random placement and color per light, each circling around its spot
+		uint32_t hash = i * 0x9e3779b9u + 0x7f4a7c15u;
+		auto next = [&hash]()
+		{
+			hash = (hash ^ (hash >> 15)) * 0x2c1b3c6du;
+			hash ^= hash >> 12;
+			return static_cast<float>(hash & 0xffffff) / 0xffffff;
+		};
+
+		glm::vec3 position = area.min + size * glm::vec3(next(), next(), next());
+		float phase = next() * glm::two_pi<float>();
+		position.x += 0.5f * spacing * std::cos(time + phase);
+		position.y += 0.5f * spacing * std::sin(time + phase);
+
+		PointLight& light = packet.lights[i];
+		light.position = position;
+		light.radius = radius;
+		light.color = glm::vec3(0.3f) + 0.7f * glm::vec3(next(), next(), next());
+		light.intensity = radius * radius / 16.0f; // about 0.2 at half the radius, with a dozen lights reaching every point
+	}
+}
+
+void Application::assignLights(FramePacket& packet)
+{
+	packet.lightTimeMs = 0.0;
+	if (packet.lights.empty())
+		return;
+
+	CpuTimer lightTimer;
+
+	// same projection the render thread builds, without the TAA jitter, which moves clusters by less than a texel
+	glm::mat4 proj = projectionFor(packet, m_viewAspect.load(std::memory_order_relaxed));
+	m_lightClusters.build(m_jobSystem, packet.lights, packet.view, proj, packet.nearPlane, packet.farPlane, packet.lightClusters);
+
+	packet.lightTimeMs = lightTimer.elapsedMs();
+}
+
+void Application::updateShadowCascades(FramePacket& packet)
+{
+	CpuTimer shadowTimer;
+
+	// same projection the render thread builds, the cascades compare every item's transform against the last frame's
+	uint32_t itemCount = static_cast<uint32_t>(packet.drawList.size());
+	m_shadowTransforms.resize(itemCount);
+	for (uint32_t i = 0; i < itemCount; i++)
+		m_shadowTransforms[i] = packet.transforms[packet.drawList[i].transformIndex];
+
+	m_shadowCascades.update(m_jobSystem, packet.view, packet.fovY, m_viewAspect.load(std::memory_order_relaxed), packet.nearPlane, packet.farPlane,
+		SUN_DIRECTION, m_cullBounds, m_shadowTransforms.data());
+
+	for (uint32_t c = 0; c < ShadowCascades::CASCADE_COUNT; c++)
+	{
+		const ShadowCascade& cascade = m_shadowCascades.cascades()[c];
+		ShadowCascadePacket& cascadePacket = packet.shadowCascades[c];
+		cascadePacket.viewProj = cascade.viewProj;
+		cascadePacket.splitDepth = cascade.splitDepth;
+		cascadePacket.generation = cascade.generation;
+
+		cascadePacket.casters.clear();
+		for (uint32_t item : cascade.casters)
+			cascadePacket.casters.push_back(packet.drawList[item]);
+	}
+
+	packet.shadowMovedObjects = m_shadowCascades.movedObjects();
+	packet.shadowTimeMs = shadowTimer.elapsedMs();
+}
+
+void Application::simulateInstanceScene(FramePacket& packet, float time)
+{
+	// 1, 2, 4, ... copies, each step held for INSTANCE_RAMP_FRAMES so the per second stats settle
+	uint64_t step = std::min<uint64_t>(packet.simulationFrame / INSTANCE_RAMP_FRAMES, 31);
+	uint32_t count = std::min(m_config.instanceCount, 1u << step);
+
+	// square grid around the origin, every copy spinning with its own phase, or standing still for the shadow cache
+	const float spacing = 2.5f;
+	uint32_t side = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<float>(count))));
+	float halfExtent = 0.5f * spacing * (side - 1);
+
+	bool rebuilt = count != m_instanceSceneCount;
+	if (rebuilt)
+	{
+		m_instanceSceneCount = count;
+		std::cout << "Instance scene: " << count << " instances" << std::endl;
+
+		// a grid node at the origin, one child per copy
+		m_sceneGraph.clear();
+		m_instanceNodes.resize(count);
+		uint32_t grid = m_sceneGraph.createNode();
+		for (uint32_t i = 0; i < count; i++)
+		{
+			m_instanceNodes[i] = m_sceneGraph.createNode(grid);
+		}
+	}
+
+	// standing still, the transforms only need setting when the grid was rebuilt
+	if (rebuilt || !m_config.staticInstances)
+	{
+		float spin = m_config.staticInstances ? 0.0f : time * glm::radians(-90.0f);
+		for (uint32_t i = 0; i < count; i++)
+		{
+			glm::vec3 position((i % side) * spacing - halfExtent, (i / side) * spacing - halfExtent, 0.0f);
+			glm::mat4 transform = glm::translate(glm::mat4(1.0f), position);
+			m_sceneGraph.setLocalTransform(m_instanceNodes[i], glm::rotate(transform, spin + i * 0.37f, glm::vec3(0.0f, 0.0f, 1.0f)));
+		}
+	}
+	m_sceneGraph.update(m_jobSystem);
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		packet.transforms.push_back(m_sceneGraph.worldTransform(m_instanceNodes[i]));
+		packet.drawList.push_back({ i, 0, static_cast<uint32_t>(m_indices.size()) });
+	}
+
+	float distance = std::max(2.0f, halfExtent * 1.5f);
+	packet.view = glm::lookAt(glm::vec3(distance, distance, distance), glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+	packet.fovY = glm::radians(45.0f);
+	packet.nearPlane = 0.1f;
+	packet.farPlane = distance * 4.0f;
+
+	simulateLights(packet, time, { glm::vec3(-halfExtent - spacing, -halfExtent - spacing, -0.5f), glm::vec3(halfExtent + spacing, halfExtent + spacing, 1.5f) });
+}
+
+void Application::simulateCityScene(FramePacket& packet, float time)
+{
+	uint32_t side = m_config.citySize;
+	uint32_t count = std::min(side * side, m_instanceBufferCapacity);
+
+	// blocks on a regular grid with streets in between, the model is stretched to each building's footprint and height
+	const float blockSpacing = 6.0f, footprint = 4.0f;
+	float halfExtent = 0.5f * blockSpacing * (side - 1);
+
+	if (count != m_instanceSceneCount)
+	{
+		m_instanceSceneCount = count;
+		std::cout << "City scene: " << count << " buildings" << std::endl;
+
+		glm::vec3 meshSize = glm::max(m_meshBounds.aabb.max - m_meshBounds.aabb.min, glm::vec3(1e-4f));
+		glm::vec3 meshBase(0.5f * (m_meshBounds.aabb.min.x + m_meshBounds.aabb.max.x), 0.5f * (m_meshBounds.aabb.min.y + m_meshBounds.aabb.max.y), m_meshBounds.aabb.min.z);
+
+		for (Entity building : m_buildingEntities)
+			m_renderables.destroy(building);
+		m_buildingEntities.resize(count);
+
+		for (uint32_t i = 0; i < count; i++)
+		{
+			uint32_t x = i % side, y = i / side;
+
+			// stable pseudo random height per block, 3 to 18 units
+			uint32_t hash = (x * 73856093u) ^ (y * 19349663u);
+			hash = (hash ^ (hash >> 13)) * 0x5bd1e995u;
+			float height = 3.0f + 15.0f * static_cast<float>((hash >> 8) & 0xffff) / 65535.0f;
+
+			RenderableDesc desc;
+			desc.components = componentBit(RenderableComponent::Transform) | componentBit(RenderableComponent::Mesh)
+				| componentBit(RenderableComponent::Material) | componentBit(RenderableComponent::Flags);
+			desc.transform = glm::translate(glm::mat4(1.0f), glm::vec3(x * blockSpacing - halfExtent, y * blockSpacing - halfExtent, 0.0f));
+			desc.transform = glm::scale(desc.transform, glm::vec3(footprint / meshSize.x, footprint / meshSize.y, height / meshSize.z));
+			desc.transform = glm::translate(desc.transform, -meshBase);
+			desc.mesh = { 0, static_cast<uint32_t>(m_indices.size()) };
+			desc.flags = height > 6.0f ? RENDERABLE_OCCLUDER : 0; // low blocks hide little
+			m_buildingEntities[i] = m_renderables.create(desc);
+		}
+	}
+
+	// structural changes land here, at the frame boundary, before anything walks the store
+	m_renderables.flush();
+
+	// walk down the middle street at eye height, looking around a little, so the nearest blocks hide most of the city
+	float streetY = (side / 2 - 0.5f) * blockSpacing - halfExtent;
+	float walked = std::fmod(time * 4.0f, std::max(1.0f, 2.0f * halfExtent));
+	glm::vec3 eye(walked - halfExtent, streetY, 1.7f);
+
+	// the CPU path rasterizes the tall blocks around the eye as occluders, far ones cover too few pixels to be worth it
+	const float occluderRange = 60.0f;
+	bool collectOccluders = !m_config.gpuDriven;
+
+	const ComponentMask drawable = componentBit(RenderableComponent::Transform) | componentBit(RenderableComponent::Mesh);
+	m_renderables.forEachChunk(drawable, [&](const RenderableChunk& chunk)
+	{
+		for (uint32_t i = 0; i < chunk.count; i++)
+		{
+			uint32_t transformIndex = static_cast<uint32_t>(packet.transforms.size());
+			packet.transforms.push_back(chunk.transforms[i]);
+			packet.drawList.push_back({ transformIndex, chunk.meshes[i].firstIndex, chunk.meshes[i].indexCount, chunk.materials ? chunk.materials[i] : 0 });
+
+			glm::vec3 position(chunk.transforms[i][3]);
+			if (collectOccluders && chunk.flags && (chunk.flags[i] & RENDERABLE_OCCLUDER)
+				&& std::abs(position.x - eye.x) < occluderRange && std::abs(position.y - eye.y) < occluderRange)
+				packet.occluders.push_back({ &m_buildingOccluder, chunk.transforms[i] });
+		}
+	});
+
+	float yaw = 0.6f * std::sin(time * 0.3f);
+	packet.view = glm::lookAt(eye, eye + glm::vec3(std::cos(yaw), std::sin(yaw), 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+	packet.fovY = glm::radians(60.0f);
+	packet.nearPlane = 0.1f;
+	packet.farPlane = std::max(10.0f, 3.0f * halfExtent);
+
+	// street lamps to rooftops
+	float cityExtent = halfExtent + 0.5f * blockSpacing;
+	simulateLights(packet, time, { glm::vec3(-cityExtent, -cityExtent, 0.5f), glm::vec3(cityExtent, cityExtent, 12.0f) });
 }
 
 void Application::cleanup()
 {
 	//Vulkan
+	flushDeletionQueue(true);
+	m_frameGraph.destroy();
 	cleanupSwapChain();
 
 	vkDestroyBuffer(m_device, m_vertexBuffer, nullptr);
@@ -83,10 +664,36 @@ void Application::cleanup()
 	vkDestroyBuffer(m_device, m_indexBuffer, nullptr);
 	vkFreeMemory(m_device, m_indexBufferMemory, nullptr);
 
-	vkDestroyPipeline(m_device, m_graphicsPipeline, nullptr);
+	vkDestroyBuffer(m_device, m_positionBuffer, nullptr);
+	vkFreeMemory(m_device, m_positionBufferMemory, nullptr);
+
+	// background compiles still use the device, the layout and the shader modules
+	m_jobSystem.wait(m_pipelineCompiles);
+	printPipelineStats();
+	destroyPipelines();
+	if (rendersOffscreen())
+	{
+		if (m_config.dynamicResolution)
+			m_resolutionController.printSummary(m_swapChainExtent.width, m_swapChainExtent.height);
+		destroyPostProcessing();
+	}
+	if (m_config.visibilityBuffer)
+		destroyVisibilityBuffer();
+	destroyShadowResources();
 	vkDestroyPipelineLayout(m_device, m_pipelineLayout, nullptr);
+	vkDestroyShaderModule(m_device, m_vertShaderModule, nullptr);
+	vkDestroyShaderModule(m_device, m_fragShaderModule, nullptr);
+	vkDestroyShaderModule(m_device, m_depthPrepassVertShaderModule, nullptr);
+
+	savePipelineCache();
+	vkDestroyPipelineCache(m_device, m_pipelineCache, nullptr);
 
 	vkDestroyRenderPass(m_device, m_renderPass, nullptr);
+	if (m_earlyRenderPass != VK_NULL_HANDLE)
+	{
+		vkDestroyRenderPass(m_device, m_earlyRenderPass, nullptr);
+		vkDestroyRenderPass(m_device, m_lateRenderPass, nullptr);
+	}
 
 	//synchronization
 	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
@@ -100,6 +707,27 @@ void Application::cleanup()
 	{
 		vkDestroyBuffer(m_device, m_uniformBuffers[i], nullptr);
 		vkFreeMemory(m_device, m_uniformBuffersMemory[i], nullptr);
+
+		vkDestroyBuffer(m_device, m_instanceBuffers[i], nullptr);
+		vkFreeMemory(m_device, m_instanceBuffersMemory[i], nullptr);
+
+		vkDestroyBuffer(m_device, m_lightBuffers[i], nullptr);
+		vkFreeMemory(m_device, m_lightBuffersMemory[i], nullptr);
+		vkDestroyBuffer(m_device, m_clusterBuffers[i], nullptr);
+		vkFreeMemory(m_device, m_clusterBuffersMemory[i], nullptr);
+	}
+
+	if (m_timestampQueryPool != VK_NULL_HANDLE)
+		vkDestroyQueryPool(m_device, m_timestampQueryPool, nullptr);
+	if (m_statisticsQueryPool != VK_NULL_HANDLE)
+		vkDestroyQueryPool(m_device, m_statisticsQueryPool, nullptr);
+
+	destroyGpuDrivenResources();
+
+	for (size_t i = 0; i < m_readbackBuffers.size(); i++)
+	{
+		vkDestroyBuffer(m_device, m_readbackBuffers[i], nullptr);
+		vkFreeMemory(m_device, m_readbackBuffersMemory[i], nullptr);
 	}
 
 	vkDestroySampler(m_device, m_textureSampler, nullptr);
@@ -107,6 +735,7 @@ void Application::cleanup()
 	vkDestroyImage(m_device, m_textureImage, nullptr);
 	vkFreeMemory(m_device, m_textureImageMemory, nullptr);
 
+	destroyBindlessResources();
 	vkDestroyDescriptorPool(m_device, m_descriptorPool, nullptr);
 	vkDestroyDescriptorSetLayout(m_device, m_descriptorSetLayout, nullptr);
 	
@@ -120,12 +749,16 @@ void Application::cleanup()
 		destroyDebugUtilsMessengerEXT(m_vulkanInstance, m_debugMessenger, nullptr);
 	}
 
-	vkDestroySurfaceKHR(m_vulkanInstance, m_surface, nullptr);
+	if (m_surface != VK_NULL_HANDLE)
+		vkDestroySurfaceKHR(m_vulkanInstance, m_surface, nullptr);
 	vkDestroyInstance(m_vulkanInstance, nullptr);
 
 	//GLFW
-	glfwDestroyWindow(m_window);
-	glfwTerminate();
+	if (m_window != nullptr)
+	{
+		glfwDestroyWindow(m_window);
+		glfwTerminate();
+	}
 }
 
 void Application::createVulkanInstance()
@@ -144,6 +777,19 @@ void Application::createVulkanInstance()
 	appInfo.apiVersion = VK_API_VERSION_1_0;
 	appInfo.pNext = nullptr;
 
+	// descriptor indexing is core in 1.2. A 1.0 loader has no vkEnumerateInstanceVersion, the instance stays at 1.0 and
+	// the bindless path falls back when the device is created
+	if (m_config.bindless)
+	{
+		auto enumerateInstanceVersion = reinterpret_cast<PFN_vkEnumerateInstanceVersion>(vkGetInstanceProcAddr(nullptr, "vkEnumerateInstanceVersion"));
+		uint32_t loaderVersion = VK_API_VERSION_1_0;
+		if (enumerateInstanceVersion != nullptr)
+			enumerateInstanceVersion(&loaderVersion);
+		if (loaderVersion >= VK_API_VERSION_1_2)
+			appInfo.apiVersion = VK_API_VERSION_1_2;
+	}
+	m_instanceApiVersion = appInfo.apiVersion;
+
 	VkInstanceCreateInfo createInfo{};
 	createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
 	createInfo.pApplicationInfo = &appInfo;
@@ -223,6 +869,9 @@ void Application::initDebugMessengerCreateInfo(VkDebugUtilsMessengerCreateInfoEX
 
 void Application::createSurface()
 {
+	if (m_config.headless)
+		return;
+
 	if (glfwCreateWindowSurface(m_vulkanInstance, m_window, nullptr, &m_surface) != VK_SUCCESS)
 		throw std::runtime_error("Failed to create window surface");
 }
@@ -243,15 +892,25 @@ void Application::pickPhysicalDevice()
 		if (isDeviceSuitable(device))
 		{
 			m_physicalDevice = device;
-			m_msaaSamples = getMaxUsableSampleCount();
 			break;
 		}
 	}
 
-	//std::cout << std::endl << "Max usable sample count is: " << m_msaaSamples << std::endl;
-
 	if (m_physicalDevice == VK_NULL_HANDLE)
 		throw std::runtime_error("Failed to find a suitable GPU");
+
+	VkPhysicalDeviceFeatures supportedFeatures;
+	vkGetPhysicalDeviceFeatures(m_physicalDevice, &supportedFeatures);
+	m_supportsSampleShading = supportedFeatures.sampleRateShading;
+	m_supportsPipelineStatistics = supportedFeatures.pipelineStatisticsQuery;
+	m_usableSampleCounts = getUsableSampleCounts();
+
+	QualityTier tier;
+	tier.samples = static_cast<VkSampleCountFlagBits>(m_config.msaaSamples);
+	tier.sampleShading = m_config.sampleShading;
+	tier.antiAliasing = m_config.antiAliasing;
+	m_qualityTier = clampQualityTier(tier);
+	m_requestedTier = m_qualityTier;
 }
 
 void Application::createLogicalDevice()
@@ -274,16 +933,102 @@ void Application::createLogicalDevice()
 
 	VkPhysicalDeviceFeatures deviceFeatures{};
 	deviceFeatures.samplerAnisotropy = VK_TRUE;
-	deviceFeatures.sampleRateShading = VK_TRUE;
+	deviceFeatures.sampleRateShading = m_supportsSampleShading;
+	deviceFeatures.pipelineStatisticsQuery = m_supportsPipelineStatistics;
+
+	std::vector<const char*> enabledExtensions = deviceExtensions;
+
+	if (m_config.gpuDriven)
+	{
+		// both optional, without them the indirect path degrades to one indirect call per object
+		VkPhysicalDeviceFeatures supportedFeatures;
+		vkGetPhysicalDeviceFeatures(m_physicalDevice, &supportedFeatures);
+		m_supportsMultiDrawIndirect = supportedFeatures.multiDrawIndirect;
+		deviceFeatures.multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+
+		uint32_t extensionsCount;
+		vkEnumerateDeviceExtensionProperties(m_physicalDevice, nullptr, &extensionsCount, nullptr);
+		std::vector<VkExtensionProperties> availableExtensions(extensionsCount);
+		vkEnumerateDeviceExtensionProperties(m_physicalDevice, nullptr, &extensionsCount, availableExtensions.data());
+
+		for (const auto& extension : availableExtensions)
+		{
+			if (std::strcmp(extension.extensionName, VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME) == 0)
+				m_supportsDrawIndirectCount = m_supportsMultiDrawIndirect;
+		}
+
+		if (m_supportsDrawIndirectCount)
+			enabledExtensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+	}
+
+	if (m_config.visibilityBuffer)
+	{
+		// gl_PrimitiveID in a fragment shader, without it the ID pass can't tell the triangles of a draw apart
+		VkPhysicalDeviceFeatures supportedFeatures;
+		vkGetPhysicalDeviceFeatures(m_physicalDevice, &supportedFeatures);
+		if (!supportedFeatures.geometryShader)
+			throw std::runtime_error("The visibility buffer needs the geometryShader feature for gl_PrimitiveID");
+		deviceFeatures.geometryShader = VK_TRUE;
+	}
+
+	// textures and buffers in update-after-bind arrays, written while frames in flight use other slots of the same set.
+	// The shaders index with values that are the same for the whole draw, dynamic indexing is enough, no nonuniformEXT
+	VkPhysicalDeviceVulkan12Features vulkan12Features{};
+	vulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+	if (m_config.bindless)
+	{
+		VkPhysicalDeviceProperties deviceProperties;
+		vkGetPhysicalDeviceProperties(m_physicalDevice, &deviceProperties);
+		if (m_instanceApiVersion >= VK_API_VERSION_1_2 && deviceProperties.apiVersion >= VK_API_VERSION_1_2)
+		{
+			VkPhysicalDeviceVulkan12Features supported12{};
+			supported12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+			VkPhysicalDeviceFeatures2 supportedFeatures{};
+			supportedFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+			supportedFeatures.pNext = &supported12;
+			vkGetPhysicalDeviceFeatures2(m_physicalDevice, &supportedFeatures);
+
+			m_supportsBindless = supported12.runtimeDescriptorArray && supported12.descriptorBindingPartiallyBound
+				&& supported12.descriptorBindingSampledImageUpdateAfterBind && supported12.descriptorBindingStorageBufferUpdateAfterBind
+				&& supported12.descriptorBindingUpdateUnusedWhilePending && supportedFeatures.features.shaderSampledImageArrayDynamicIndexing
+				&& supportedFeatures.features.shaderStorageBufferArrayDynamicIndexing;
+
+			VkPhysicalDeviceVulkan12Properties limits{};
+			limits.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_PROPERTIES;
+			VkPhysicalDeviceProperties2 properties{};
+			properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+			properties.pNext = &limits;
+			vkGetPhysicalDeviceProperties2(m_physicalDevice, &properties);
+			m_bindlessTextureCapacity = std::min({ BINDLESS_TEXTURE_CAPACITY, limits.maxDescriptorSetUpdateAfterBindSampledImages,
+				limits.maxPerStageDescriptorUpdateAfterBindSampledImages, limits.maxDescriptorSetUpdateAfterBindSamplers,
+				limits.maxPerStageDescriptorUpdateAfterBindSamplers });
+			m_bindlessBufferCapacity = std::min({ BINDLESS_BUFFER_CAPACITY, limits.maxDescriptorSetUpdateAfterBindStorageBuffers,
+				limits.maxPerStageDescriptorUpdateAfterBindStorageBuffers });
+		}
+
+		if (m_supportsBindless)
+		{
+			vulkan12Features.runtimeDescriptorArray = VK_TRUE;
+			vulkan12Features.descriptorBindingPartiallyBound = VK_TRUE;
+			vulkan12Features.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+			vulkan12Features.descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE;
+			vulkan12Features.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+			deviceFeatures.shaderSampledImageArrayDynamicIndexing = VK_TRUE;
+			deviceFeatures.shaderStorageBufferArrayDynamicIndexing = VK_TRUE;
+		}
+		else
+			std::cout << "Descriptor indexing isn't supported, --bindless falls back to the per frame descriptor set" << std::endl;
+	}
 
 	VkDeviceCreateInfo createInfo{};
 	createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+	createInfo.pNext = m_supportsBindless ? &vulkan12Features : nullptr;
 	createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
 	createInfo.pQueueCreateInfos = queueCreateInfos.data();
 	createInfo.pEnabledFeatures = &deviceFeatures;
 
-	createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
-	createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+	createInfo.enabledExtensionCount = static_cast<uint32_t>(enabledExtensions.size());
+	createInfo.ppEnabledExtensionNames = enabledExtensions.data();
 
 	if (enableValidationLayers)
 	{
@@ -300,6 +1045,12 @@ void Application::createLogicalDevice()
 		throw std::runtime_error("Failed to create logical device");
 	}
 
+	if (m_supportsDrawIndirectCount)
+	{
+		m_vkCmdDrawIndexedIndirectCount = reinterpret_cast<PFN_vkCmdDrawIndexedIndirectCountKHR>(vkGetDeviceProcAddr(m_device, "vkCmdDrawIndexedIndirectCountKHR"));
+		m_supportsDrawIndirectCount = m_vkCmdDrawIndexedIndirectCount != nullptr;
+	}
+
 	vkGetDeviceQueue(m_device, indices.graphicsFamily.value(), 0, &m_graphicsQueue);
 	vkGetDeviceQueue(m_device, indices.presentFamily.value(), 0, &m_presentQueue);
 	vkGetDeviceQueue(m_device, indices.transferFamily.value(), 0, &m_transferQueue);
@@ -322,16 +1073,19 @@ bool Application::isDeviceSuitable(VkPhysicalDevice device)
 
 	bool extensionsSupported = checkDeviceExtensionSupport(device);
 
-	bool swapChainAdequate = false;
-	if (extensionsSupported)
+	bool swapChainAdequate = m_config.headless; // no swap chain at all in headless mode
+	if (extensionsSupported && !m_config.headless)
 	{
 		SwapChainSupportDetails swapChainSupport = querySwapChainSupport(device);
 		swapChainAdequate = !swapChainSupport.formats.empty() && !swapChainSupport.presentModes.empty();
 	}
 
-	return indices.isComplete() && extensionsSupported && swapChainAdequate &&
-		 (deviceProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU ||
-		 deviceProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU) &&
+	// CPU implementations (lavapipe, SwiftShader) are only picked for headless runs, e.g. on GPU-less CI machines
+	bool typeSupported = deviceProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU ||
+		deviceProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU ||
+		(m_config.headless && deviceProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_CPU);
+
+	return indices.isComplete() && extensionsSupported && swapChainAdequate && typeSupported &&
 		 deviceFeatures.samplerAnisotropy; // checking if enabled(modern GPUs should support it)
 }
 
@@ -409,7 +1163,10 @@ QueueFamilyIndices Application::findQueueFamilies(VkPhysicalDevice device)
 			indices.graphicsFamily = i;
 
 		VkBool32 presentSupport = false;
-		vkGetPhysicalDeviceSurfaceSupportKHR(device, i, m_surface, &presentSupport);
+		if (m_surface != VK_NULL_HANDLE)
+			vkGetPhysicalDeviceSurfaceSupportKHR(device, i, m_surface, &presentSupport);
+		else
+			presentSupport = (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0; // headless, frames never leave the graphics queue
 
 		if (presentSupport)
 			indices.presentFamily = i;
@@ -470,52 +1227,169 @@ void Application::createSwapChain()
 	createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
 	createInfo.presentMode = presentMode;
 	createInfo.clipped = VK_TRUE;
-	createInfo.oldSwapchain = VK_NULL_HANDLE;
+	// handing over the old swap chain lets the driver reuse its resources and keep presenting while we switch
+	VkSwapchainKHR oldSwapChain = m_swapChain;
+	createInfo.oldSwapchain = oldSwapChain;
 
 	if (vkCreateSwapchainKHR(m_device, &createInfo, nullptr, &m_swapChain) != VK_SUCCESS)
 	{
 		throw std::runtime_error("Failed to create swap chain");
 	}
 
+	if (oldSwapChain != VK_NULL_HANDLE)
+	{
+		VkDevice device = m_device;
+		deferDeletion([device, oldSwapChain]() { vkDestroySwapchainKHR(device, oldSwapChain, nullptr); });
+	}
+
 	vkGetSwapchainImagesKHR(m_device, m_swapChain, &imageCount, nullptr);
 	m_swapChainImages.resize(imageCount);
 	vkGetSwapchainImagesKHR(m_device, m_swapChain, &imageCount, m_swapChainImages.data());
 
 	m_swapChainImageFormat = surfaceFormat.format;
 	m_swapChainExtent = extent;
+	m_viewAspect = extent.width / static_cast<float>(extent.height);
 }
 
 void Application::recreateSwapChain()
 {
-	int width = 0, height = 0;
-	glfwGetFramebufferSize(m_window, &width, &height);
-	while (width == 0 || height == 0)
-	{
-		glfwGetFramebufferSize(m_window, &width, &height);
-		glfwWaitEvents();
-	}
+	// minimised, mainLoop sleeps until the window is restored and we get here again
+	if (isWindowMinimized())
+		return;
 
-	vkDeviceWaitIdle(m_device);
-	
-	cleanupSwapChain();
+	// no device idle here, resources still used by frames in flight are destroyed once those frames complete
+	retireSwapChainResources();
+	if (m_config.gpuDriven)
+		retireHizResources();
 
 	createSwapChain();
 	createImageViews();
 	createColorResources();
 	createDepthResources();
 	createFramebuffers();
+	createPostDescriptorSet();
+	createVisibilityDescriptorSet();
+	if (m_config.gpuDriven)
+		createHizResources();
+
+	m_framebufferResized = false;
 }
 
-void Application::cleanupSwapChain()
+void Application::retireSwapChainResources()
 {
-	vkDestroyImageView(m_device, m_depthImageView, nullptr);
-	vkDestroyImage(m_device, m_depthImage, nullptr);
-	vkFreeMemory(m_device, m_depthImageMemory, nullptr);
+	VkDevice device = m_device;
+	std::vector<VkFramebuffer> framebuffers = std::move(m_swapChainFramebuffers);
+	std::vector<VkImageView> imageViews = std::move(m_swapChainImageViews);
+	VkImageView depthImageView = m_depthImageView, colorImageView = m_colorImageView;
+	VkImage depthImage = m_depthImage, colorImage = m_colorImage;
+	VkDeviceMemory depthImageMemory = m_depthImageMemory, colorImageMemory = m_colorImageMemory;
+	std::vector<VkFramebuffer> postFramebuffers = std::move(m_postFramebuffers);
+	VkImageView sceneColorImageView = m_sceneColorImageView;
+	VkImage sceneColorImage = m_sceneColorImage;
+	VkDeviceMemory sceneColorImageMemory = m_sceneColorImageMemory;
+	VkDescriptorPool postDescriptorPool = m_postDescriptorPool;
+	std::array<VkFramebuffer, 2> historyFramebuffers = m_historyFramebuffers;
+	std::array<VkImageView, 2> historyImageViews = m_historyImageViews;
+	std::array<VkImage, 2> historyImages = m_historyImages;
+	std::array<VkDeviceMemory, 2> historyImagesMemory = m_historyImagesMemory;
+	std::vector<VkFramebuffer> visibilityFramebuffers = std::move(m_visibilityFramebuffers);
+	VkImageView triangleIdImageView = m_triangleIdImageView;
+	VkImage triangleIdImage = m_triangleIdImage;
+	VkDeviceMemory triangleIdImageMemory = m_triangleIdImageMemory;
+	VkDescriptorPool visibilityDescriptorPool = m_visibilityDescriptorPool;
+
+	m_swapChainFramebuffers.clear();
+	m_swapChainImageViews.clear();
+	m_postFramebuffers.clear();
+	m_historyFramebuffers = {};
+	m_visibilityFramebuffers.clear();
+
+	deferDeletion([=]()
+	{
+		// null unless rendering offscreen, destroying VK_NULL_HANDLE is a no-op
+		for (VkFramebuffer framebuffer : postFramebuffers)
+			vkDestroyFramebuffer(device, framebuffer, nullptr);
+		vkDestroyDescriptorPool(device, postDescriptorPool, nullptr);
+		vkDestroyImageView(device, sceneColorImageView, nullptr);
+		vkDestroyImage(device, sceneColorImage, nullptr);
+		vkFreeMemory(device, sceneColorImageMemory, nullptr);
+		for (size_t i = 0; i < historyImages.size(); i++)
+		{
+			vkDestroyFramebuffer(device, historyFramebuffers[i], nullptr);
+			vkDestroyImageView(device, historyImageViews[i], nullptr);
+			vkDestroyImage(device, historyImages[i], nullptr);
+			vkFreeMemory(device, historyImagesMemory[i], nullptr);
+		}
 
-	vkDestroyImageView(m_device, m_colorImageView, nullptr);
+		// null unless the visibility buffer is on
+		for (VkFramebuffer framebuffer : visibilityFramebuffers)
+			vkDestroyFramebuffer(device, framebuffer, nullptr);
+		vkDestroyDescriptorPool(device, visibilityDescriptorPool, nullptr);
+		vkDestroyImageView(device, triangleIdImageView, nullptr);
+		vkDestroyImage(device, triangleIdImage, nullptr);
+		vkFreeMemory(device, triangleIdImageMemory, nullptr);
+
+		vkDestroyImageView(device, depthImageView, nullptr);
+		vkDestroyImage(device, depthImage, nullptr);
+		vkFreeMemory(device, depthImageMemory, nullptr);
+
+		vkDestroyImageView(device, colorImageView, nullptr);
+		vkDestroyImage(device, colorImage, nullptr);
+		vkFreeMemory(device, colorImageMemory, nullptr);
+
+		for (VkFramebuffer framebuffer : framebuffers)
+			vkDestroyFramebuffer(device, framebuffer, nullptr);
+
+		for (VkImageView imageView : imageViews)
+			vkDestroyImageView(device, imageView, nullptr);
+	});
+	// the swap chain itself is retired by createSwapChain once it has been handed over as oldSwapchain
+
+	// the replacements may get the handles of images destroyed earlier, none of them is in any layout yet
+	m_frameGraph.forgetStates();
+}
+
+bool Application::isWindowMinimized()
+{
+	if (m_config.headless)
+		return false;
+
+	int width = 0, height = 0;
+	glfwGetFramebufferSize(m_window, &width, &height);
+	return width == 0 || height == 0;
+}
+
+void Application::cleanupSwapChain()
+{
+	vkDestroyImageView(m_device, m_depthImageView, nullptr);
+	vkDestroyImage(m_device, m_depthImage, nullptr);
+	vkFreeMemory(m_device, m_depthImageMemory, nullptr);
+
+	vkDestroyImageView(m_device, m_colorImageView, nullptr);
 	vkDestroyImage(m_device, m_colorImage, nullptr);
 	vkFreeMemory(m_device, m_colorImageMemory, nullptr);
 
+	for (VkFramebuffer framebuffer : m_postFramebuffers)
+		vkDestroyFramebuffer(m_device, framebuffer, nullptr);
+	vkDestroyDescriptorPool(m_device, m_postDescriptorPool, nullptr);
+	vkDestroyImageView(m_device, m_sceneColorImageView, nullptr);
+	vkDestroyImage(m_device, m_sceneColorImage, nullptr);
+	vkFreeMemory(m_device, m_sceneColorImageMemory, nullptr);
+	for (size_t i = 0; i < m_historyImages.size(); i++)
+	{
+		vkDestroyFramebuffer(m_device, m_historyFramebuffers[i], nullptr);
+		vkDestroyImageView(m_device, m_historyImageViews[i], nullptr);
+		vkDestroyImage(m_device, m_historyImages[i], nullptr);
+		vkFreeMemory(m_device, m_historyImagesMemory[i], nullptr);
+	}
+
+	for (VkFramebuffer framebuffer : m_visibilityFramebuffers)
+		vkDestroyFramebuffer(m_device, framebuffer, nullptr);
+	vkDestroyDescriptorPool(m_device, m_visibilityDescriptorPool, nullptr);
+	vkDestroyImageView(m_device, m_triangleIdImageView, nullptr);
+	vkDestroyImage(m_device, m_triangleIdImage, nullptr);
+	vkFreeMemory(m_device, m_triangleIdImageMemory, nullptr);
+
 	for (size_t i = 0; i < m_swapChainFramebuffers.size(); i++)
 	{
 		vkDestroyFramebuffer(m_device, m_swapChainFramebuffers[i], nullptr);
@@ -526,7 +1400,18 @@ void Application::cleanupSwapChain()
 		vkDestroyImageView(m_device, m_swapChainImageViews[i], nullptr);
 	}
 
-	vkDestroySwapchainKHR(m_device, m_swapChain, nullptr);
+	if (m_config.headless)
+	{
+		for (size_t i = 0; i < m_swapChainImages.size(); i++)
+		{
+			vkDestroyImage(m_device, m_swapChainImages[i], nullptr);
+			vkFreeMemory(m_device, m_offscreenImagesMemory[i], nullptr);
+		}
+	}
+	else
+	{
+		vkDestroySwapchainKHR(m_device, m_swapChain, nullptr);
+	}
 }
 
 SwapChainSupportDetails Application::querySwapChainSupport(VkPhysicalDevice device)
@@ -614,14 +1499,31 @@ void Application::createImageViews()
 
 void Application::createRenderPass()
 {
+	m_renderPass = buildRenderPass(ScenePass::Full);
+
+	if (m_config.gpuDriven)
+	{
+		m_earlyRenderPass = buildRenderPass(ScenePass::Early);
+		m_lateRenderPass = buildRenderPass(ScenePass::Late);
+	}
+}
+
+VkRenderPass Application::buildRenderPass(ScenePass pass)
+{
+	// the late pass continues where the early one stopped, only load/store ops differ so pipelines and framebuffers are shared.
+	// Attachments begin and end in their attachment layouts, the frame graph moves them in and out and orders the passes
+	bool load = pass == ScenePass::Late;
+	// without MSAA the swap chain image is the color attachment itself
+	bool resolve = m_qualityTier.samples != VK_SAMPLE_COUNT_1_BIT;
+
 	VkAttachmentDescription colorAttachment{};
 	colorAttachment.format = m_swapChainImageFormat;
-	colorAttachment.samples = m_msaaSamples;
-	colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR; // clear framebuffer before rendering
+	colorAttachment.samples = m_qualityTier.samples;
+	colorAttachment.loadOp = load ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR; // clear framebuffer before rendering
 	colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE; // store framebuffer after rendering
 	colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE; // optional
 	colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE; // optional
-	colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED; // image data layout before render pass starts
+	colorAttachment.initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL; // image data layout before render pass starts
 	colorAttachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL; // image data layout after render pass
 
 	VkAttachmentReference colorAttachmentRef{};
@@ -630,12 +1532,13 @@ void Application::createRenderPass()
 
 	VkAttachmentDescription depthAttachment{};
 	depthAttachment.format = findDepthFormat();
-	depthAttachment.samples = m_msaaSamples;
-	depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-	depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	depthAttachment.samples = m_qualityTier.samples;
+	depthAttachment.loadOp = load ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR;
+	// the Hi-Z pyramid is built from the early pass depth, the TAA pass reprojects with the final one
+	depthAttachment.storeOp = pass == ScenePass::Early || rendersOffscreen() ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
 	depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 	depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-	depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	depthAttachment.initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 	depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 
 	VkAttachmentReference depthAttachmentRef{};
@@ -646,11 +1549,12 @@ void Application::createRenderPass()
 	colorAttachmentResolve.format = m_swapChainImageFormat;
 	colorAttachmentResolve.samples = VK_SAMPLE_COUNT_1_BIT;
 	colorAttachmentResolve.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-	colorAttachmentResolve.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	// the early pass has to resolve as well to stay compatible, the late pass overwrites the result
+	colorAttachmentResolve.storeOp = pass == ScenePass::Early ? VK_ATTACHMENT_STORE_OP_DONT_CARE : VK_ATTACHMENT_STORE_OP_STORE;
 	colorAttachmentResolve.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 	colorAttachmentResolve.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-	colorAttachmentResolve.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	colorAttachmentResolve.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	colorAttachmentResolve.initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	colorAttachmentResolve.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
 	VkAttachmentReference colorAttachmentResolveRef{};
 	colorAttachmentResolveRef.attachment = 2;
@@ -661,54 +1565,313 @@ void Application::createRenderPass()
 	subpass.colorAttachmentCount = 1;
 	subpass.pColorAttachments = &colorAttachmentRef;
 	subpass.pDepthStencilAttachment = &depthAttachmentRef;
-	subpass.pResolveAttachments = &colorAttachmentResolveRef;
+	subpass.pResolveAttachments = resolve ? &colorAttachmentResolveRef : nullptr;
 
 	std::array<VkAttachmentDescription, 3> attachments = { colorAttachment, depthAttachment, colorAttachmentResolve };
 
 	VkRenderPassCreateInfo renderPassCreateInfo{};
 	renderPassCreateInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-	renderPassCreateInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+	renderPassCreateInfo.attachmentCount = resolve ? 3 : 2;
 	renderPassCreateInfo.pAttachments = attachments.data();
 	renderPassCreateInfo.subpassCount = 1;
 	renderPassCreateInfo.pSubpasses = &subpass;
 
-	VkSubpassDependency dependency{};
-	dependency.srcSubpass = VK_SUBPASS_EXTERNAL; // implicit subpass before render pass
-	dependency.dstSubpass = 0; // our subpass
-	dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT; // pipeline stage
-	dependency.srcAccessMask = 0; // access mask for the dependency
-	dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT; // pipeline stage
-	dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT; // access mask for the dependency
-
-	renderPassCreateInfo.dependencyCount = 1;
-	renderPassCreateInfo.pDependencies = &dependency;
-
-	if (vkCreateRenderPass(m_device, &renderPassCreateInfo, nullptr, &m_renderPass) != VK_SUCCESS)
+	VkRenderPass renderPass;
+	if (vkCreateRenderPass(m_device, &renderPassCreateInfo, nullptr, &renderPass) != VK_SUCCESS)
 	{
 		throw std::runtime_error("Failed to create render pass");
 	}
+
+	return renderPass;
 }
 
 void Application::createGraphicsPipeline()
 {
-	auto vertShaderCode = readFile("shaders/test_vert.spv");
-	auto fragShaderCode = readFile("shaders/test_frag.spv");
-	VkShaderModule vertShaderModule = createShaderModule(vertShaderCode);
-	VkShaderModule fragShaderModule = createShaderModule(fragShaderCode);
-	
+	// modules stay alive as long as the application, new permutations can be built at any time
+	m_vertShaderModule = createShaderModule(readFile("shaders/test_vert.spv"));
+	m_fragShaderModule = createShaderModule(readFile(m_supportsBindless ? "shaders/test_bindless_frag.spv" : "shaders/test_frag.spv"));
+	if (m_config.depthPrepass)
+		m_depthPrepassVertShaderModule = createShaderModule(readFile("shaders/depth_prepass_vert.spv"));
+
+	// the bindless set goes after the per frame one, pipelines that don't read it stay compatible with the layout
+	std::array<VkDescriptorSetLayout, 2> setLayouts = { m_descriptorSetLayout, m_bindlessSetLayout };
+
+	VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo{};
+	pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutCreateInfo.setLayoutCount = m_supportsBindless ? 2 : 1;
+	pipelineLayoutCreateInfo.pSetLayouts = setLayouts.data();
+
+	VkPushConstantRange pushConstantRange{};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(DrawPushConstants);
+
+	pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+	pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+
+	if (vkCreatePipelineLayout(m_device, &pipelineLayoutCreateInfo, nullptr, &m_pipelineLayout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create pipeline layout");
+	}
+
+	m_defaultPipelineKey = PipelineKey{};
+	setQualityTier(m_defaultPipelineKey, m_qualityTier);
+
+	// after the pre-pass depth holds the nearest surface of every sample already, only the fragments that produced it
+	// pass EQUAL and get shaded, there is nothing left to write
+	if (m_config.depthPrepass)
+	{
+		m_defaultPipelineKey.depthWriteEnable = VK_FALSE;
+		m_defaultPipelineKey.depthCompareOp = VK_COMPARE_OP_EQUAL;
+		m_depthPrepassPipeline = getPipeline(depthPrepassKey(m_defaultPipelineKey));
+	}
+
+	m_graphicsPipeline = getPipeline(m_defaultPipelineKey);
+	m_framePipeline = m_graphicsPipeline;
+}
+
+VkPipeline Application::getPipeline(const PipelineKey& key)
+{
+	while (true)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_pipelinesMutex);
+			m_pipelineStats.lookups++;
+
+			auto it = m_pipelines.find(key);
+			if (it == m_pipelines.end())
+				break;
+
+			if (it->second.state == PipelineState::Failed)
+				throw std::runtime_error("Failed to create graphics pipeline [" + describePipelineKey(key) + "]");
+
+			if (it->second.state == PipelineState::Ready)
+			{
+				m_pipelineStats.hits++;
+				it->second.uses++;
+				return it->second.pipeline;
+			}
+		}
+
+		// already compiling in the background, finishing it is cheaper than building it twice
+		m_jobSystem.wait(m_pipelineCompiles);
+	}
+
+	CpuTimer buildTimer;
+	VkPipeline pipeline = buildPipeline(key, m_pipelineCache);
+	double buildTimeMs = buildTimer.elapsedMs();
+
+	{
+		std::lock_guard<std::mutex> lock(m_pipelinesMutex);
+		m_pipelines.emplace(key, PipelineEntry{ pipeline, PipelineState::Ready, buildTimeMs, 1 });
+		m_pipelineStats.totalBuildTimeMs += buildTimeMs;
+		m_pipelineStats.worstBuildTimeMs = std::max(m_pipelineStats.worstBuildTimeMs, buildTimeMs);
+	}
+
+	std::cout << "Built pipeline permutation [" << describePipelineKey(key) << "] in " << buildTimeMs << " ms ("
+		<< (m_pipelineCacheWarm ? "warm" : "cold") << " pipeline cache)" << std::endl;
+
+	return pipeline;
+}
+
+VkPipeline Application::requestPipeline(const PipelineKey& key, VkPipeline fallback)
+{
+	std::lock_guard<std::mutex> lock(m_pipelinesMutex);
+	m_pipelineStats.lookups++;
+
+	auto it = m_pipelines.find(key);
+	if (it != m_pipelines.end() && it->second.state == PipelineState::Ready)
+	{
+		m_pipelineStats.hits++;
+		it->second.uses++;
+		return it->second.pipeline;
+	}
+
+	if (it == m_pipelines.end())
+	{
+		m_pipelines.emplace(key, PipelineEntry{});
+		compilePipelineAsync(key);
+	}
+
+	m_pipelineStats.fallbacks++;
+	return fallback;
+}
+
+void Application::compilePipelineAsync(const PipelineKey& key)
+{
+	m_pipelineStats.asyncBuilds++;
+
+	m_jobSystem.run([this, key]()
+	{
+		CpuTimer buildTimer;
+		VkPipeline pipeline = VK_NULL_HANDLE;
+
+		// a failed permutation keeps using the fallback, it must not take the renderer down
+		try
+		{
+			// creating pipelines doesn't need the cache externally synchronized, every compile builds into the shared one
+			pipeline = buildPipeline(key, m_pipelineCache);
+		}
+		catch (const std::exception& e)
+		{
+			std::cerr << e.what() << " [" << describePipelineKey(key) << "]" << std::endl;
+		}
+
+		double buildTimeMs = buildTimer.elapsedMs();
+
+		std::lock_guard<std::mutex> lock(m_pipelinesMutex);
+		PipelineEntry& entry = m_pipelines[key];
+		entry.pipeline = pipeline;
+		entry.state = pipeline != VK_NULL_HANDLE ? PipelineState::Ready : PipelineState::Failed;
+		entry.buildTimeMs = buildTimeMs;
+		m_pipelineStats.totalBuildTimeMs += buildTimeMs;
+		m_pipelineStats.worstBuildTimeMs = std::max(m_pipelineStats.worstBuildTimeMs, buildTimeMs);
+	}, &m_pipelineCompiles);
+}
+
+void Application::updatePipelineStress(double lastFrameTimeMs)
+{
+	PipelineStressRun& stress = m_pipelineStress;
+
+	if (m_frameNumber < PIPELINE_STRESS_START_FRAME)
+	{
+		// skip the first frames, they include swap chain and cache warm up
+		if (m_frameNumber > PIPELINE_STRESS_START_FRAME / 2)
+			stress.worstFrameBeforeMs = std::max(stress.worstFrameBeforeMs, lastFrameTimeMs);
+		return;
+	}
+
+	if (m_frameNumber == PIPELINE_STRESS_START_FRAME)
+	{
+		// every combination of a few render states and both specialization constants, minus the default
+		const VkCompareOp compareOps[] = { VK_COMPARE_OP_LESS, VK_COMPARE_OP_LESS_OR_EQUAL, VK_COMPARE_OP_ALWAYS, VK_COMPARE_OP_NOT_EQUAL };
+		const VkCullModeFlags cullModes[] = { VK_CULL_MODE_BACK_BIT, VK_CULL_MODE_NONE, VK_CULL_MODE_FRONT_BIT, VK_CULL_MODE_FRONT_AND_BACK };
+
+		for (VkCompareOp compareOp : compareOps)
+			for (VkCullModeFlags cullMode : cullModes)
+				for (VkBool32 blendEnable : { VK_FALSE, VK_TRUE })
+					for (VkBool32 depthWriteEnable : { VK_TRUE, VK_FALSE })
+						for (VkBool32 useTexture : { VK_TRUE, VK_FALSE })
+							for (VkBool32 useVertexColor : { VK_TRUE, VK_FALSE })
+							{
+								PipelineKey key = m_defaultPipelineKey;
+								key.depthCompareOp = compareOp;
+								key.cullMode = cullMode;
+								key.blendEnable = blendEnable;
+								key.depthWriteEnable = depthWriteEnable;
+								key.useTexture = useTexture;
+								key.useVertexColor = useVertexColor;
+
+								if (!(key == m_defaultPipelineKey) && stress.keys.size() < PIPELINE_STRESS_COUNT)
+									stress.keys.push_back(key);
+							}
+
+		stress.startFrame = m_frameNumber;
+		stress.timer = CpuTimer{};
+		std::cout << "Pipeline stress: introducing " << stress.keys.size() << " new permutations ("
+			<< (m_config.pipelineStress == PipelineStressMode::Async ? "async" : "sync") << ")" << std::endl;
+
+		if (m_config.pipelineStress == PipelineStressMode::Async)
+		{
+			for (const PipelineKey& key : stress.keys)
+			{
+				requestPipeline(key, VK_NULL_HANDLE);
+			}
+		}
+		else
+		{
+			for (const PipelineKey& key : stress.keys)
+			{
+				getPipeline(key);
+			}
+		}
+	}
+	else if (!stress.finished)
+	{
+		stress.worstFrameDuringMs = std::max(stress.worstFrameDuringMs, lastFrameTimeMs);
+	}
+
+	// cycle through the new permutations, one per frame
+	const PipelineKey& key = stress.keys[m_frameNumber % stress.keys.size()];
+	m_framePipeline = requestPipeline(key, m_graphicsPipeline);
+	if (m_framePipeline == m_graphicsPipeline)
+		stress.fallbackFrames++;
+
+	// the frame that introduced them is only measured once it is over, in the next call
+	if (!stress.finished && m_frameNumber > stress.startFrame && m_pipelineCompiles.isDone())
+	{
+		stress.finished = true;
+		std::cout << "Pipeline stress: " << stress.keys.size() << " permutations ready after " << stress.timer.elapsedMs() << " ms ("
+			<< m_frameNumber - stress.startFrame << " frames, " << stress.fallbackFrames << " drawn with the fallback pipeline), worst frame "
+			<< stress.worstFrameDuringMs << " ms, worst frame before " << stress.worstFrameBeforeMs << " ms" << std::endl;
+	}
+}
+
+void Application::destroyPipelines()
+{
+	for (auto& [key, entry] : m_pipelines)
+	{
+		vkDestroyPipeline(m_device, entry.pipeline, nullptr);
+	}
+	m_pipelines.clear();
+	m_graphicsPipeline = VK_NULL_HANDLE;
+}
+
+void Application::printPipelineStats()
+{
+	std::lock_guard<std::mutex> lock(m_pipelinesMutex);
+	double hitRate = m_pipelineStats.lookups > 0 ? 100.0 * m_pipelineStats.hits / m_pipelineStats.lookups : 0.0;
+
+	std::cout << "Pipelines: " << m_pipelines.size() << " permutations (" << m_pipelineStats.asyncBuilds << " compiled in the background), "
+		<< m_pipelineStats.lookups << " lookups, " << hitRate << "% cache hit rate, " << m_pipelineStats.fallbacks << " fallbacks, build time total "
+		<< m_pipelineStats.totalBuildTimeMs << " ms, worst " << m_pipelineStats.worstBuildTimeMs << " ms" << std::endl;
+
+	for (const auto& [key, entry] : m_pipelines)
+	{
+		std::cout << "  [" << describePipelineKey(key) << "] built in " << entry.buildTimeMs << " ms, used " << entry.uses << " times" << std::endl;
+	}
+}
+
+std::string Application::describePipelineKey(const PipelineKey& key)
+{
+	return "cull " + std::to_string(key.cullMode) + ", polygon " + std::to_string(key.polygonMode) +
+		", samples " + std::to_string(key.samples) + ", sample shading " + (key.sampleShadingEnable ? std::to_string(key.minSampleShading) : "off") +
+		", blend " + std::to_string(key.blendEnable) + ", depth test/write/op " + std::to_string(key.depthTestEnable) + "/" +
+		std::to_string(key.depthWriteEnable) + "/" + std::to_string(key.depthCompareOp) +
+		", texture " + std::to_string(key.useTexture) + ", vertex color " + std::to_string(key.useVertexColor) +
+		(key.depthPrepass ? ", depth pre-pass" : "");
+}
+
+VkPipeline Application::buildPipeline(const PipelineKey& key, VkPipelineCache cache)
+{
+	// constant_id 0 and 1 in test.frag, branches on them are folded away when the driver compiles the permutation
+	std::array<VkSpecializationMapEntry, 2> specializationEntries{};
+	specializationEntries[0].constantID = 0;
+	specializationEntries[0].offset = offsetof(PipelineKey, useTexture);
+	specializationEntries[0].size = sizeof(VkBool32);
+	specializationEntries[1].constantID = 1;
+	specializationEntries[1].offset = offsetof(PipelineKey, useVertexColor);
+	specializationEntries[1].size = sizeof(VkBool32);
+
+	VkSpecializationInfo specializationInfo{};
+	specializationInfo.mapEntryCount = static_cast<uint32_t>(specializationEntries.size());
+	specializationInfo.pMapEntries = specializationEntries.data();
+	specializationInfo.dataSize = sizeof(PipelineKey);
+	specializationInfo.pData = &key;
+
 	VkPipelineShaderStageCreateInfo vertShaderStageCreateInfo{};
 	vertShaderStageCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
 	vertShaderStageCreateInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-	vertShaderStageCreateInfo.module = vertShaderModule;
+	vertShaderStageCreateInfo.module = key.depthPrepass ? m_depthPrepassVertShaderModule : m_vertShaderModule;
 	vertShaderStageCreateInfo.pName = "main";
 	vertShaderStageCreateInfo.pSpecializationInfo = nullptr; // used to set constants in compile time, very useful if needed
 
 	VkPipelineShaderStageCreateInfo fragShaderStageCreateInfo{};
 	fragShaderStageCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
 	fragShaderStageCreateInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-	fragShaderStageCreateInfo.module = fragShaderModule;
+	fragShaderStageCreateInfo.module = m_fragShaderModule;
 	fragShaderStageCreateInfo.pName = "main";
-	fragShaderStageCreateInfo.pSpecializationInfo = nullptr; // same
+	fragShaderStageCreateInfo.pSpecializationInfo = &specializationInfo;
 
 	VkPipelineShaderStageCreateInfo shaderStages[] = { vertShaderStageCreateInfo, fragShaderStageCreateInfo };
 	
@@ -722,6 +1885,16 @@ void Application::createGraphicsPipeline()
 	vertexInputCreateInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size()); // setting up like this bcuz of vertex
 	vertexInputCreateInfo.pVertexAttributeDescriptions = attributeDescriptions.data(); // is array of 2 elements for now, maybe more later
 
+	// the pre-pass reads the packed position stream, 12 bytes a vertex instead of the whole Vertex
+	VkVertexInputBindingDescription positionBindingDescription{ 0, sizeof(glm::vec3), VK_VERTEX_INPUT_RATE_VERTEX };
+	VkVertexInputAttributeDescription positionAttributeDescription{ 0, 0, VK_FORMAT_R32G32B32_SFLOAT, 0 };
+	if (key.depthPrepass)
+	{
+		vertexInputCreateInfo.pVertexBindingDescriptions = &positionBindingDescription;
+		vertexInputCreateInfo.vertexAttributeDescriptionCount = 1;
+		vertexInputCreateInfo.pVertexAttributeDescriptions = &positionAttributeDescription;
+	}
+
 	VkPipelineInputAssemblyStateCreateInfo inputAssemblyCreateInfo{};
 	inputAssemblyCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
 	inputAssemblyCreateInfo.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
@@ -730,9 +1903,9 @@ void Application::createGraphicsPipeline()
 	//depth testing
 	VkPipelineDepthStencilStateCreateInfo depthStencilCreateInfo{};
 	depthStencilCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
-	depthStencilCreateInfo.depthTestEnable = VK_TRUE; // enable depth testing
-	depthStencilCreateInfo.depthWriteEnable = VK_TRUE; // enable writing to depth buffer
-	depthStencilCreateInfo.depthCompareOp = VK_COMPARE_OP_LESS; // comparison operator
+	depthStencilCreateInfo.depthTestEnable = key.depthTestEnable; // enable depth testing
+	depthStencilCreateInfo.depthWriteEnable = key.depthWriteEnable; // enable writing to depth buffer
+	depthStencilCreateInfo.depthCompareOp = key.depthCompareOp; // comparison operator
 	depthStencilCreateInfo.depthBoundsTestEnable = VK_FALSE; // bounds range test, not using this
 	//depthStencilCreateInfo.minDepthBounds = 0.0f; // optional
 	//depthStencilCreateInfo.maxDepthBounds = 1.0f; // optional
@@ -764,9 +1937,9 @@ void Application::createGraphicsPipeline()
 	rasterizationCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
 	rasterizationCreateInfo.depthClampEnable = VK_FALSE;
 	rasterizationCreateInfo.rasterizerDiscardEnable = VK_FALSE;
-	rasterizationCreateInfo.polygonMode = VK_POLYGON_MODE_FILL;
+	rasterizationCreateInfo.polygonMode = key.polygonMode;
 	rasterizationCreateInfo.lineWidth = 1.0f;
-	rasterizationCreateInfo.cullMode = VK_CULL_MODE_BACK_BIT;
+	rasterizationCreateInfo.cullMode = key.cullMode;
 	rasterizationCreateInfo.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
 	rasterizationCreateInfo.depthBiasEnable = VK_FALSE;
 	rasterizationCreateInfo.depthBiasConstantFactor = 0.0f; // optional
@@ -775,10 +1948,9 @@ void Application::createGraphicsPipeline()
 
 	VkPipelineMultisampleStateCreateInfo multisampleCreateInfo{};
 	multisampleCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-	multisampleCreateInfo.sampleShadingEnable = VK_TRUE;
-	multisampleCreateInfo.minSampleShading = .2f;
-	multisampleCreateInfo.rasterizationSamples = m_msaaSamples;
-	multisampleCreateInfo.minSampleShading = 1.0f; // optional
+	multisampleCreateInfo.sampleShadingEnable = key.sampleShadingEnable;
+	multisampleCreateInfo.rasterizationSamples = key.samples;
+	multisampleCreateInfo.minSampleShading = key.minSampleShading; // optional
 	multisampleCreateInfo.pSampleMask = nullptr; // optional
 	multisampleCreateInfo.alphaToCoverageEnable = VK_FALSE; // optional
 	multisampleCreateInfo.alphaToOneEnable = VK_FALSE; // optional
@@ -788,9 +1960,12 @@ void Application::createGraphicsPipeline()
 										  VK_COLOR_COMPONENT_G_BIT |
 										  VK_COLOR_COMPONENT_B_BIT |
 										  VK_COLOR_COMPONENT_A_BIT;
-	colorBlendAttachment.blendEnable = VK_FALSE;
-	colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
-	colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO;
+	if (key.depthPrepass)
+		colorBlendAttachment.colorWriteMask = 0; // same subpass as the main pass, the color attachment is there but left alone
+	colorBlendAttachment.blendEnable = key.blendEnable;
+	// classic alpha blending when enabled, ignored otherwise
+	colorBlendAttachment.srcColorBlendFactor = key.blendEnable ? VK_BLEND_FACTOR_SRC_ALPHA : VK_BLEND_FACTOR_ONE;
+	colorBlendAttachment.dstColorBlendFactor = key.blendEnable ? VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA : VK_BLEND_FACTOR_ZERO;
 	colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD; 		
 	colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
 	colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
@@ -821,21 +1996,9 @@ void Application::createGraphicsPipeline()
 	dynamicStateCreateInfo.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
 	dynamicStateCreateInfo.pDynamicStates = dynamicStates.data();
 
-	VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo{};
-	pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-	pipelineLayoutCreateInfo.setLayoutCount = 1;
-	pipelineLayoutCreateInfo.pSetLayouts = &m_descriptorSetLayout;
-	//pipelineLayoutCreateInfo.pushConstantRangeCount = 0; // optional
-	//pipelineLayoutCreateInfo.pPushConstantRanges = nullptr; // optional
-
-	if (vkCreatePipelineLayout(m_device, &pipelineLayoutCreateInfo, nullptr, &m_pipelineLayout) != VK_SUCCESS)
-	{
-		throw std::runtime_error("Failed to create pipeline layout");
-	}
-
 	VkGraphicsPipelineCreateInfo pipelineCreateInfo{};
 	pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-	pipelineCreateInfo.stageCount = 2;
+	pipelineCreateInfo.stageCount = key.depthPrepass ? 1 : 2;
 	pipelineCreateInfo.pStages = shaderStages;
 	pipelineCreateInfo.pVertexInputState = &vertexInputCreateInfo;
 	pipelineCreateInfo.pInputAssemblyState = &inputAssemblyCreateInfo;
@@ -853,13 +2016,149 @@ void Application::createGraphicsPipeline()
 	pipelineCreateInfo.basePipelineHandle = VK_NULL_HANDLE; // optional
 	pipelineCreateInfo.basePipelineIndex = -1; // optional
 
-	if (vkCreateGraphicsPipelines(m_device, VK_NULL_HANDLE, 1, &pipelineCreateInfo, nullptr, &m_graphicsPipeline) != VK_SUCCESS)
+	VkPipeline pipeline;
+	if (vkCreateGraphicsPipelines(m_device, cache, 1, &pipelineCreateInfo, nullptr, &pipeline) != VK_SUCCESS)
 	{
 		throw std::runtime_error("Failed to create graphics pipeline");
 	}
 
-	vkDestroyShaderModule(m_device, vertShaderModule, nullptr);
-	vkDestroyShaderModule(m_device, fragShaderModule, nullptr);
+	return pipeline;
+}
+
+void Application::createPipelineCache()
+{
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(m_physicalDevice, &properties);
+
+	std::vector<char> fileData;
+	try
+	{
+		fileData = readFile(m_pipelineCachePath);
+	}
+	catch (const std::runtime_error&)
+	{
+		// first launch, nothing cached yet
+	}
+
+	m_pipelineCacheWarm = !fileData.empty() && validatePipelineCacheData(fileData, properties);
+
+	VkPipelineCacheCreateInfo cacheCreateInfo{};
+	cacheCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	if (m_pipelineCacheWarm)
+	{
+		cacheCreateInfo.initialDataSize = fileData.size() - sizeof(PipelineCacheFileHeader);
+		cacheCreateInfo.pInitialData = fileData.data() + sizeof(PipelineCacheFileHeader);
+	}
+
+	if (vkCreatePipelineCache(m_device, &cacheCreateInfo, nullptr, &m_pipelineCache) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create pipeline cache");
+	}
+
+	std::cout << (m_pipelineCacheWarm ? "Loaded pipeline cache from " : "Starting with an empty pipeline cache, will be saved to ")
+		<< m_pipelineCachePath << std::endl;
+}
+
+bool Application::validatePipelineCacheData(const std::vector<char>& fileData, const VkPhysicalDeviceProperties& properties)
+{
+	if (fileData.size() < sizeof(PipelineCacheFileHeader))
+		return false;
+
+	PipelineCacheFileHeader fileHeader;
+	memcpy(&fileHeader, fileData.data(), sizeof(fileHeader));
+
+	if (fileHeader.magic != PIPELINE_CACHE_MAGIC || fileHeader.fileVersion != PIPELINE_CACHE_FILE_VERSION ||
+		fileHeader.dataSize != fileData.size() - sizeof(PipelineCacheFileHeader))
+	{
+		std::cout << "Pipeline cache file is corrupted, ignoring it" << std::endl;
+		return false;
+	}
+
+	if (fileHeader.vendorID != properties.vendorID || fileHeader.deviceID != properties.deviceID ||
+		fileHeader.driverVersion != properties.driverVersion ||
+		memcmp(fileHeader.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) != 0)
+	{
+		std::cout << "Pipeline cache was written by a different device or driver, ignoring it" << std::endl;
+		return false;
+	}
+
+	// Vulkan blob header (VkPipelineCacheHeaderVersionOne): size, version, vendor, device, uuid
+	const size_t vulkanHeaderSize = 16 + VK_UUID_SIZE;
+	const char* blob = fileData.data() + sizeof(PipelineCacheFileHeader);
+	if (fileHeader.dataSize < vulkanHeaderSize)
+		return false;
+
+	uint32_t headerSize, headerVersion, vendorID, deviceID;
+	memcpy(&headerSize, blob + 0, 4);
+	memcpy(&headerVersion, blob + 4, 4);
+	memcpy(&vendorID, blob + 8, 4);
+	memcpy(&deviceID, blob + 12, 4);
+
+	return headerSize >= vulkanHeaderSize && headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+		vendorID == properties.vendorID && deviceID == properties.deviceID &&
+		memcmp(blob + 16, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+void Application::savePipelineCache()
+{
+	std::lock_guard<std::mutex> lock(m_pipelineCacheMutex);
+
+	size_t dataSize = 0;
+	if (vkGetPipelineCacheData(m_device, m_pipelineCache, &dataSize, nullptr) != VK_SUCCESS || dataSize == 0)
+		return;
+
+	std::vector<char> fileData(sizeof(PipelineCacheFileHeader) + dataSize);
+	if (vkGetPipelineCacheData(m_device, m_pipelineCache, &dataSize, fileData.data() + sizeof(PipelineCacheFileHeader)) != VK_SUCCESS)
+		return;
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(m_physicalDevice, &properties);
+
+	PipelineCacheFileHeader fileHeader{};
+	fileHeader.magic = PIPELINE_CACHE_MAGIC;
+	fileHeader.fileVersion = PIPELINE_CACHE_FILE_VERSION;
+	fileHeader.vendorID = properties.vendorID;
+	fileHeader.deviceID = properties.deviceID;
+	fileHeader.driverVersion = properties.driverVersion;
+	memcpy(fileHeader.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE);
+	fileHeader.dataSize = dataSize;
+	memcpy(fileData.data(), &fileHeader, sizeof(fileHeader));
+
+	// write next to the real file and swap it in, a crash mid-write must never leave a truncated cache behind
+	std::string tempPath = m_pipelineCachePath + ".tmp";
+	{
+		std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+		if (!file.is_open())
+		{
+			std::cout << "Failed to write pipeline cache" << std::endl;
+			return;
+		}
+
+		file.write(fileData.data(), sizeof(PipelineCacheFileHeader) + dataSize);
+		if (!file.good())
+		{
+			std::cout << "Failed to write pipeline cache" << std::endl;
+			return;
+		}
+	}
+
+	std::error_code error;
+	std::filesystem::rename(tempPath, m_pipelineCachePath, error);
+	if (error)
+		std::cout << "Failed to replace pipeline cache: " << error.message() << std::endl;
+}
+
+void Application::mergePipelineCache(VkPipelineCache sourceCache)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_pipelineCacheMutex);
+		if (vkMergePipelineCaches(m_device, m_pipelineCache, 1, &sourceCache) != VK_SUCCESS)
+		{
+			std::cout << "Failed to merge pipeline cache" << std::endl;
+		}
+	}
+
+	vkDestroyPipelineCache(m_device, sourceCache, nullptr);
 }
 
 void Application::createFramebuffers()
@@ -868,19 +2167,26 @@ void Application::createFramebuffers()
 
 	for (int i = 0; i < m_swapChainImageViews.size(); i++)
 	{
+		// offscreen, every image shares the scene color target and only the post pass differs per image
+		VkImageView target = rendersOffscreen() ? m_sceneColorImageView : m_swapChainImageViews[i];
 		std::array<VkImageView, 3> attachments = {
 			m_colorImageView,
 			m_depthImageView,
-			m_swapChainImageViews[i]
+			target
 		};
 
+		// no MSAA, no resolve: color goes straight into the target
+		bool resolve = m_qualityTier.samples != VK_SAMPLE_COUNT_1_BIT;
+		if (!resolve)
+			attachments[0] = target;
+
 		VkFramebufferCreateInfo framebufferCreateInfo{};
 		framebufferCreateInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
 		framebufferCreateInfo.renderPass = m_renderPass;
-		framebufferCreateInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+		framebufferCreateInfo.attachmentCount = resolve ? 3 : 2;
 		framebufferCreateInfo.pAttachments = attachments.data();
-		framebufferCreateInfo.width = m_swapChainExtent.width;
-		framebufferCreateInfo.height = m_swapChainExtent.height;
+		framebufferCreateInfo.width = m_sceneExtent.width;
+		framebufferCreateInfo.height = m_sceneExtent.height;
 		framebufferCreateInfo.layers = 1;
 
 		if (vkCreateFramebuffer(m_device, &framebufferCreateInfo, nullptr, &m_swapChainFramebuffers[i]) != VK_SUCCESS)
@@ -888,6 +2194,71 @@ void Application::createFramebuffers()
 			throw std::runtime_error("Failed to create framebuffer");
 		}
 	}	
+
+	if (m_config.visibilityBuffer)
+	{
+		m_visibilityFramebuffers.resize(m_swapChainImageViews.size());
+		for (size_t i = 0; i < m_swapChainImageViews.size(); i++)
+		{
+			std::array<VkImageView, 3> attachments = {
+				m_triangleIdImageView,
+				m_depthImageView,
+				rendersOffscreen() ? m_sceneColorImageView : m_swapChainImageViews[i]
+			};
+
+			VkFramebufferCreateInfo framebufferCreateInfo{};
+			framebufferCreateInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+			framebufferCreateInfo.renderPass = m_visibilityRenderPass;
+			framebufferCreateInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+			framebufferCreateInfo.pAttachments = attachments.data();
+			framebufferCreateInfo.width = m_sceneExtent.width;
+			framebufferCreateInfo.height = m_sceneExtent.height;
+			framebufferCreateInfo.layers = 1;
+
+			if (vkCreateFramebuffer(m_device, &framebufferCreateInfo, nullptr, &m_visibilityFramebuffers[i]) != VK_SUCCESS)
+			{
+				throw std::runtime_error("Failed to create visibility buffer framebuffer");
+			}
+		}
+	}
+
+	if (!rendersOffscreen())
+		return;
+
+	m_postFramebuffers.resize(m_swapChainImageViews.size());
+	for (size_t i = 0; i < m_swapChainImageViews.size(); i++)
+	{
+		VkFramebufferCreateInfo framebufferCreateInfo{};
+		framebufferCreateInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+		framebufferCreateInfo.renderPass = m_postRenderPass;
+		framebufferCreateInfo.attachmentCount = 1;
+		framebufferCreateInfo.pAttachments = &m_swapChainImageViews[i];
+		framebufferCreateInfo.width = m_swapChainExtent.width;
+		framebufferCreateInfo.height = m_swapChainExtent.height;
+		framebufferCreateInfo.layers = 1;
+
+		if (vkCreateFramebuffer(m_device, &framebufferCreateInfo, nullptr, &m_postFramebuffers[i]) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create post process framebuffer");
+		}
+	}
+
+	for (size_t i = 0; i < m_historyImageViews.size(); i++)
+	{
+		VkFramebufferCreateInfo framebufferCreateInfo{};
+		framebufferCreateInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+		framebufferCreateInfo.renderPass = m_taaRenderPass;
+		framebufferCreateInfo.attachmentCount = 1;
+		framebufferCreateInfo.pAttachments = &m_historyImageViews[i];
+		framebufferCreateInfo.width = m_sceneExtent.width;
+		framebufferCreateInfo.height = m_sceneExtent.height;
+		framebufferCreateInfo.layers = 1;
+
+		if (vkCreateFramebuffer(m_device, &framebufferCreateInfo, nullptr, &m_historyFramebuffers[i]) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create TAA history framebuffer");
+		}
+	}
 }
 
 void Application::createCommandPools()
@@ -932,7 +2303,7 @@ void Application::createCommandBuffers()
 	}
 }
 
-void Application::recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex)
+void Application::recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex, const FramePacket& packet)
 {
 	VkCommandBufferBeginInfo commandBufferBeginInfo{};
 	commandBufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
@@ -944,14 +2315,145 @@ void Application::recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t im
 		throw std::runtime_error("Failed to begin recording command buffer");
 	}
 
+	// picked by updateUniformBuffer and fixed for the whole frame, the scene passes, the Hi-Z build and the upscale all use it
+	if (m_config.dynamicResolution)
+		m_frameStats.addRenderExtent(m_renderExtent.width, m_renderExtent.height);
+
+	uint32_t firstTimestamp = TIMESTAMPS_PER_FRAME * m_currentFrame;
+	if (m_timestampQueryPool != VK_NULL_HANDLE)
+	{
+		vkCmdResetQueryPool(commandBuffer, m_timestampQueryPool, firstTimestamp, TIMESTAMPS_PER_FRAME);
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, m_timestampQueryPool, firstTimestamp);
+	}
+
+	m_frameDescriptorBinds = 0;
+	declareFrameGraph(imageIndex, packet);
+	m_frameGraph.compile();
+	m_frameGraph.execute(commandBuffer);
+	m_frameStats.addDescriptorBinds(m_frameDescriptorBinds, m_bindlessTextureSlots.usedCount() + m_bindlessBufferSlots.usedCount());
+
+	// after the frame dump copy as well, if there is one
+	if (m_timestampQueryPool != VK_NULL_HANDLE)
+	{
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_timestampQueryPool, firstTimestamp + 2);
+		m_timestampsWritten[m_currentFrame] = true;
+
+		bool measured = m_config.qualitySweep && !m_qualitySweep.finished && m_frameNumber - m_qualitySweep.tierStartFrame >= QUALITY_SWEEP_WARMUP_FRAMES;
+		m_timestampSweepTiers[m_currentFrame] = measured ? static_cast<int>(m_qualitySweep.current) : -1;
+	}
+
+	if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to record command buffer");
+	}
+}
+
+void Application::declareFrameGraph(uint32_t imageIndex, const FramePacket& packet)
+{
+	// passes record from execute, everything they capture has to outlive it
+	m_frameGraph.reset();
+
+	VkImageSubresourceRange colorRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+	VkImageSubresourceRange depthRange{ VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 1 };
+	if (hasStencilComponent(findDepthFormat()))
+		depthRange.aspectMask |= VK_IMAGE_ASPECT_STENCIL_BIT;
+
+	// a swap chain image is only ours once the acquire semaphore signalled, which the submit waits for at the color
+	// attachment output stage. Headless frames are never presented, they are left ready to be copied out instead
+	ResourceUsage outputUsage = m_config.headless ? ResourceUsage::TransferSrc : ResourceUsage::Present;
+	RenderGraph::Resource output = m_frameGraph.importImage("swap chain image", m_swapChainImages[imageIndex], colorRange,
+		m_config.headless ? ResourceUsage::None : ResourceUsage::Present, outputUsage);
+	RenderGraph::Resource depth = m_frameGraph.importImage("depth", m_depthImage, depthRange, ResourceUsage::None);
+	RenderGraph::Resource sceneColor = rendersOffscreen() ? m_frameGraph.importImage("scene color", m_sceneColorImage, colorRange, ResourceUsage::None) : output;
+
+	// every path samples the shadow maps, whatever changed is redrawn before any of them starts. The cached cascades
+	// outlive the frame, the shadow render pass orders itself against the previous frame's sampling
+	if (m_config.shadows)
+		m_frameGraph.addPass("shadows", [this, &packet](VkCommandBuffer commandBuffer) { recordShadowPasses(commandBuffer, packet); }).sideEffect();
+
+	RenderGraph::PassBuilder scenePass = m_frameGraph.addPass("scene", [this, imageIndex, &packet](VkCommandBuffer commandBuffer)
+	{
+		uint32_t firstTimestamp = TIMESTAMPS_PER_FRAME * m_currentFrame;
+		if (m_timestampQueryPool != VK_NULL_HANDLE)
+			vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_timestampQueryPool, firstTimestamp + 1);
+
+		// fragment shader invocations of whichever path draws the scene, the shadow and post passes aren't counted
+		if (m_statisticsQueryPool != VK_NULL_HANDLE)
+		{
+			vkCmdResetQueryPool(commandBuffer, m_statisticsQueryPool, m_currentFrame, 1);
+			vkCmdBeginQuery(commandBuffer, m_statisticsQueryPool, m_currentFrame, 0);
+		}
+
+		if (m_config.gpuDriven)
+		{
+			// culling and command generation happen between render passes, compute can't run inside one
+			recordGpuDrivenFrame(commandBuffer, imageIndex, packet);
+		}
+		else if (m_config.visibilityBuffer)
+		{
+			recordVisibilityFrame(commandBuffer, imageIndex, packet);
+		}
+		else
+		{
+			beginScenePass(commandBuffer, m_renderPass, imageIndex);
+			recordBatchedDraws(commandBuffer, packet);
+			vkCmdEndRenderPass(commandBuffer);
+		}
+
+		if (m_statisticsQueryPool != VK_NULL_HANDLE)
+		{
+			vkCmdEndQuery(commandBuffer, m_statisticsQueryPool, m_currentFrame);
+			m_statisticsWritten[m_currentFrame] = true;
+		}
+	});
+	scenePass.write(sceneColor, ResourceUsage::ColorAttachment).write(depth, ResourceUsage::DepthAttachment);
+	if (m_colorImage != VK_NULL_HANDLE)
+		scenePass.write(m_frameGraph.importImage("multisampled color", m_colorImage, colorRange, ResourceUsage::None), ResourceUsage::ColorAttachment);
+	if (m_config.visibilityBuffer)
+	{
+		// written by the ID subpass, read by the resolve subpass
+		RenderGraph::Resource triangleIds = m_frameGraph.importImage("triangle IDs", m_triangleIdImage, colorRange, ResourceUsage::None);
+		scenePass.write(triangleIds, ResourceUsage::ColorAttachment).read(triangleIds, ResourceUsage::InputAttachment);
+	}
+
+	// the history written here is what the next frame reads, it has to stay around and readable
+	RenderGraph::Resource upscaleSource = sceneColor;
+	if (m_qualityTier.antiAliasing == PostAntiAliasing::Taa)
+	{
+		RenderGraph::Resource history = m_frameGraph.importImage("history", m_historyImages[m_historyIndex], colorRange, ResourceUsage::None);
+		RenderGraph::Resource target = m_frameGraph.importImage("history target", m_historyImages[1 - m_historyIndex], colorRange, ResourceUsage::None,
+			ResourceUsage::FragmentSampled);
+		m_frameGraph.addPass("taa", [this](VkCommandBuffer commandBuffer) { recordTaaPass(commandBuffer); })
+			.read(sceneColor, ResourceUsage::FragmentSampled).read(depth, ResourceUsage::DepthSampled).read(history, ResourceUsage::FragmentSampled)
+			.write(target, ResourceUsage::ColorAttachment);
+		upscaleSource = target;
+	}
+
+	if (rendersOffscreen())
+	{
+		m_frameGraph.addPass("post", [this, imageIndex](VkCommandBuffer commandBuffer) { recordPostPass(commandBuffer, imageIndex); })
+			.read(upscaleSource, ResourceUsage::FragmentSampled).write(output, ResourceUsage::ColorAttachment);
+	}
+
+	if (m_config.headless && m_pendingFrameDumps[m_currentFrame].has_value())
+	{
+		RenderGraph::Resource readback = m_frameGraph.importBuffer("frame dump", m_readbackBuffers[m_currentFrame], ResourceUsage::None, ResourceUsage::HostRead);
+		m_frameGraph.addPass("frame dump", [this, imageIndex](VkCommandBuffer commandBuffer) { recordFrameReadback(commandBuffer, imageIndex); })
+			.read(output, ResourceUsage::TransferSrc).write(readback, ResourceUsage::TransferDst);
+	}
+}
+
+void Application::beginScenePass(VkCommandBuffer commandBuffer, VkRenderPass renderPass, uint32_t imageIndex)
+{
 	VkRenderPassBeginInfo renderPassBeginInfo{};
 	renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-	renderPassBeginInfo.renderPass = m_renderPass;
+	renderPassBeginInfo.renderPass = renderPass;
 	renderPassBeginInfo.framebuffer = m_swapChainFramebuffers[imageIndex];
 
 	renderPassBeginInfo.renderArea.offset = { 0, 0 };
-	renderPassBeginInfo.renderArea.extent = m_swapChainExtent;
+	renderPassBeginInfo.renderArea.extent = m_renderExtent;
 
+	// ignored by passes that load their attachments
 	std::array<VkClearValue, 2> clearValues{};
 	clearValues[0].color = { 0.2f, 0.2f, 0.2f, 1.0f }; // color
 	clearValues[1].depthStencil = { 1.0f, 0 }; // depth
@@ -961,20 +2463,22 @@ void Application::recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t im
 
 	vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
 
-	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_graphicsPipeline);
+	// VK_NULL_HANDLE: the permutation for this frame is still compiling and there is no fallback, skip the draws
+	if (m_framePipeline != VK_NULL_HANDLE)
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_framePipeline);
 
 	VkViewport viewport{};
 	viewport.x = 0.0f;
 	viewport.y = 0.0f;
-	viewport.width = static_cast<float>(m_swapChainExtent.width);
-	viewport.height = static_cast<float>(m_swapChainExtent.height);
+	viewport.width = static_cast<float>(m_renderExtent.width);
+	viewport.height = static_cast<float>(m_renderExtent.height);
 	viewport.minDepth = 0.0f;
 	viewport.maxDepth = 1.0f;
 	vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
 
 	VkRect2D scissor{};
 	scissor.offset = { 0, 0 };
-	scissor.extent = m_swapChainExtent;
+	scissor.extent = m_renderExtent;
 	vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 
 	VkBuffer vertexBuffers[] = { m_vertexBuffer };
@@ -982,33 +2486,113 @@ void Application::recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t im
 	vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
 	vkCmdBindIndexBuffer(commandBuffer, m_indexBuffer, 0, VK_INDEX_TYPE_UINT32);
 
-	//if (imageIndex >= m_descriptorSets.size()) {
-	//	throw std::out_of_range("Descriptor set index out of range");
-	//}
+	// descriptor sets (and the uniform buffers behind them) are per frame in flight, not per swap chain image. The
+	// bindless set is the same for every frame and every material, it goes along in the same call
+	std::array<VkDescriptorSet, 2> descriptorSets = { m_descriptorSets[m_currentFrame], m_bindlessDescriptorSet };
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipelineLayout, 0, m_supportsBindless ? 2 : 1, descriptorSets.data(), 0, nullptr);
+	m_frameDescriptorBinds++;
+}
 
-	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipelineLayout, 0, 1, &m_descriptorSets[imageIndex], 0, nullptr);
-	//vkCmdDraw(commandBuffer, static_cast<uint32_t>(vertices.size()), 1, 0, 0);
-	vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(m_indices.size()), 1, 0, 0, 0);
+void Application::recordBatchedDraws(VkCommandBuffer commandBuffer, const FramePacket& packet)
+{
+	// identical mesh + material draws collapse into one instanced draw, the transforms go to this frame's instance buffer
+	uint32_t instanceCount = m_instanceBatcher.build(packet.drawList, packet.transforms, m_mappedInstanceBuffersMemory[m_currentFrame], m_instanceBufferCapacity);
+	if (instanceCount < packet.drawList.size())
+		std::cout << "Instance buffer full, dropped " << packet.drawList.size() - instanceCount << " draws" << std::endl;
+
+	// depth first, the draws below then only shade the fragments that end up visible
+	if (m_config.depthPrepass && m_framePipeline != VK_NULL_HANDLE)
+		recordDepthPrepass(commandBuffer);
+
+	DrawPushConstants pushConstants{};
+	pushConstants.model = glm::mat4(1.0f);
+
+	// batches come in draw list order, sorted by draw key unless that's turned off. Only state that differs from the
+	// previous draw is set: the frame pipeline is bound once by beginScenePass, push constants stay valid across draws
+	// with the same layout and every mesh lives in the one vertex/index buffer, so a mesh switch is just another offset
+	uint32_t boundMaterial = UINT32_MAX;
+	uint32_t boundFirstIndex = UINT32_MAX;
+	uint32_t materialBinds = 0, meshSwitches = 0;
+
+	uint32_t drawCalls = 0;
+	for (const InstanceBatch& batch : m_instanceBatcher.batches())
+	{
+		if (m_framePipeline == VK_NULL_HANDLE)
+			break;
 
-	vkCmdEndRenderPass(commandBuffer);
+		if (batch.materialIndex != boundMaterial)
+		{
+			pushConstants.materialIndex = batch.materialIndex;
+			vkCmdPushConstants(commandBuffer, m_pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(pushConstants), &pushConstants);
+			boundMaterial = batch.materialIndex;
+			materialBinds++;
+		}
 
-	if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
-	{
-		throw std::runtime_error("Failed to record command buffer");
+		if (batch.firstIndex != boundFirstIndex)
+		{
+			// the ID pass numbers triangles across the whole index buffer, so it needs to know where the mesh starts
+			if (m_config.visibilityBuffer)
+			{
+				pushConstants.firstTriangle = batch.firstIndex / 3;
+				vkCmdPushConstants(commandBuffer, m_pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(pushConstants), &pushConstants);
+			}
+			boundFirstIndex = batch.firstIndex;
+			meshSwitches++;
+		}
+
+		vkCmdDrawIndexed(commandBuffer, batch.indexCount, batch.instanceCount, batch.firstIndex, 0, batch.firstInstance);
+		drawCalls++;
 	}
+	m_frameStats.addDrawCounts(drawCalls, drawCalls > 0 ? instanceCount : 0, packet.culledObjects);
+	m_frameStats.addStateChanges(drawCalls, drawCalls > 0 ? 1 : 0, materialBinds, meshSwitches);
+	if (!packet.occluders.empty())
+		m_frameStats.addOcclusionCulling(packet.occludedObjects, packet.frustumCulledTriangles, packet.occludedTriangles);
+}
+
+void Application::recordDepthPrepass(VkCommandBuffer commandBuffer)
+{
+	// the batches the main pass draws, inside the same render pass, so depth never leaves the tile between the two.
+	// The material doesn't matter for depth, only the model matrix is read
+	DrawPushConstants pushConstants{};
+	pushConstants.model = glm::mat4(1.0f);
+
+	VkDeviceSize offset = 0;
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_depthPrepassPipeline);
+	vkCmdBindVertexBuffers(commandBuffer, 0, 1, &m_positionBuffer, &offset);
+	vkCmdPushConstants(commandBuffer, m_pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(pushConstants), &pushConstants);
+
+	for (const InstanceBatch& batch : m_instanceBatcher.batches())
+		vkCmdDrawIndexed(commandBuffer, batch.indexCount, batch.instanceCount, batch.firstIndex, 0, batch.firstInstance);
+
+	// back to what beginScenePass bound, the descriptor set stays, both pipelines share the layout
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_framePipeline);
+	vkCmdBindVertexBuffers(commandBuffer, 0, 1, &m_vertexBuffer, &offset);
 }
 
 void Application::drawFrame()
 {
+	CpuTimer stageTimer;
+
 	vkWaitForFences(m_device, 1, &m_inFlightFences[m_currentFrame], VK_TRUE, UINT64_MAX);
+	flushDeletionQueue(false);
+	readGpuFrameTime(m_currentFrame);
+	readPipelineStatistics(m_currentFrame);
+	readGpuCullResults(m_currentFrame);
 
 	uint32_t imageIndex;
 	VkResult result = vkAcquireNextImageKHR(m_device, m_swapChain, UINT64_MAX, m_imageAvailableSemaphores[m_currentFrame], VK_NULL_HANDLE, &imageIndex);
 	//std::cout << imageIndex << std::endl;
 
+	// recreating on every event while the window is still being dragged is what causes the hitch,
+	// so an out of date swap chain just skips frames until resizing settles down
+	bool resizeSettled = std::chrono::steady_clock::now() - m_lastResizeEvent >= RESIZE_DEBOUNCE;
+
 	if (result == VK_ERROR_OUT_OF_DATE_KHR)
 	{
-		recreateSwapChain();
+		if (resizeSettled)
+		{
+			recreateSwapChain();
+		}
 		return;
 	}
 	else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR)
@@ -1016,11 +2600,17 @@ void Application::drawFrame()
 		throw std::runtime_error("Failed to acquire swap chain image");
 	}
 
-	updateUniformBuffer(m_currentFrame);
+	m_frameStats.addStageTime(FrameStage::Wait, stageTimer.restartMs());
+
+	const FramePacket& packet = acquireFramePacket();
+
+	updateUniformBuffer(m_currentFrame, packet);
 
 	vkResetFences(m_device, 1, &m_inFlightFences[m_currentFrame]);
 	vkResetCommandBuffer(m_commandBuffers[m_currentFrame], 0);
-	recordCommandBuffer(m_commandBuffers[m_currentFrame], imageIndex);
+	recordCommandBuffer(m_commandBuffers[m_currentFrame], imageIndex, packet);
+
+	m_frameStats.addStageTime(FrameStage::Record, stageTimer.restartMs());
 
 	VkSubmitInfo submitInfo{};
 	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
@@ -1056,10 +2646,16 @@ void Application::drawFrame()
 
 	result = vkQueuePresentKHR(m_presentQueue, &presentInfo);
 
+	m_frameStats.addStageTime(FrameStage::Submit, stageTimer.restartMs());
+
+	resizeSettled = std::chrono::steady_clock::now() - m_lastResizeEvent >= RESIZE_DEBOUNCE;
+
 	if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || m_framebufferResized)
 	{
-		m_framebufferResized = false;
-		recreateSwapChain();
+		if (resizeSettled)
+		{
+			recreateSwapChain();
+		}
 	}
 	else if (result != VK_SUCCESS)
 	{
@@ -1067,6 +2663,166 @@ void Application::drawFrame()
 	}
 
 	m_currentFrame = (m_currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+	m_frameNumber++;
+}
+
+const FramePacket& Application::acquireFramePacket()
+{
+	// pick up the newest packet, if the simulation hasn't produced one yet we simply redraw the previous one
+	if (m_framePackets.consume())
+	{
+		const FramePacket& latest = m_framePackets.readBuffer();
+		m_frameStats.addStageTime(FrameStage::Simulation, latest.simulationTimeMs);
+		m_frameStats.addStageTime(FrameStage::Culling, latest.cullTimeMs);
+		if (!latest.lights.empty())
+		{
+			m_frameStats.addStageTime(FrameStage::Lighting, latest.lightTimeMs);
+			m_frameStats.addLightClusters(static_cast<uint32_t>(latest.lights.size()), static_cast<uint32_t>(latest.lightClusters.lightIndices.size()),
+				latest.lightClusters.droppedLights);
+		}
+		if (m_config.sortDraws && !m_config.gpuDriven)
+			m_frameStats.addStageTime(FrameStage::Sorting, latest.sortTimeMs);
+		if (m_config.shadows)
+			m_frameStats.addStageTime(FrameStage::Shadows, latest.shadowTimeMs);
+		m_consumedPacket.store(latest.simulationFrame, std::memory_order_release);
+		m_consumedPacket.notify_one();
+	}
+
+	return m_framePackets.readBuffer();
+}
+
+void Application::createOffscreenTargets()
+{
+	m_swapChainImageFormat = findSupportedFormat({ VK_FORMAT_B8G8R8A8_SRGB, VK_FORMAT_R8G8B8A8_SRGB },
+		VK_IMAGE_TILING_OPTIMAL, VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT);
+	m_swapChainExtent = { m_width, m_height };
+	m_viewAspect = m_width / static_cast<float>(m_height);
+
+	// one image per frame in flight, the frame fence then also tells us when an image can be reused
+	m_swapChainImages.resize(MAX_FRAMES_IN_FLIGHT);
+	m_offscreenImagesMemory.resize(MAX_FRAMES_IN_FLIGHT);
+
+	for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+	{
+		createImage(m_swapChainExtent.width, m_swapChainExtent.height, 1, VK_SAMPLE_COUNT_1_BIT, m_swapChainImageFormat, VK_IMAGE_TILING_OPTIMAL,
+			VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			m_swapChainImages[i], m_offscreenImagesMemory[i]);
+	}
+}
+
+void Application::drawOffscreenFrame()
+{
+	CpuTimer stageTimer;
+
+	vkWaitForFences(m_device, 1, &m_inFlightFences[m_currentFrame], VK_TRUE, UINT64_MAX);
+	flushDeletionQueue(false);
+	readGpuFrameTime(m_currentFrame);
+	readPipelineStatistics(m_currentFrame);
+	readGpuCullResults(m_currentFrame);
+	writePendingFrameDump(m_currentFrame);
+
+	uint32_t imageIndex = m_currentFrame;
+
+	m_frameStats.addStageTime(FrameStage::Wait, stageTimer.restartMs());
+
+	const FramePacket& packet = acquireFramePacket();
+
+	updateUniformBuffer(m_currentFrame, packet);
+
+	if (!m_config.dumpDirectory.empty() && m_frameNumber % m_config.dumpInterval == 0)
+	{
+		m_pendingFrameDumps[m_currentFrame] = m_frameNumber;
+	}
+
+	vkResetFences(m_device, 1, &m_inFlightFences[m_currentFrame]);
+	vkResetCommandBuffer(m_commandBuffers[m_currentFrame], 0);
+	recordCommandBuffer(m_commandBuffers[m_currentFrame], imageIndex, packet);
+
+	m_frameStats.addStageTime(FrameStage::Record, stageTimer.restartMs());
+
+	VkSubmitInfo submitInfo{};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &m_commandBuffers[m_currentFrame];
+
+	if (vkQueueSubmit(m_graphicsQueue, 1, &submitInfo, m_inFlightFences[m_currentFrame]) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to submit draw command buffer");
+	}
+
+	m_frameStats.addStageTime(FrameStage::Submit, stageTimer.restartMs());
+
+	m_currentFrame = (m_currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+	m_frameNumber++;
+}
+
+void Application::createReadbackBuffers()
+{
+	m_pendingFrameDumps.resize(MAX_FRAMES_IN_FLIGHT);
+
+	if (!m_config.headless || m_config.dumpDirectory.empty())
+		return;
+
+	std::filesystem::create_directories(m_config.dumpDirectory);
+
+	VkDeviceSize bufferSize = static_cast<VkDeviceSize>(m_swapChainExtent.width) * m_swapChainExtent.height * 4;
+
+	m_readbackBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+	m_readbackBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+	m_mappedReadbackBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+
+	for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+	{
+		createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			m_readbackBuffers[i], m_readbackBuffersMemory[i]);
+
+		vkMapMemory(m_device, m_readbackBuffersMemory[i], 0, bufferSize, 0, &m_mappedReadbackBuffersMemory[i]);
+	}
+}
+
+void Application::recordFrameReadback(VkCommandBuffer commandBuffer, uint32_t imageIndex)
+{
+	// the frame graph moved the image to TRANSFER_SRC_OPTIMAL after the last write and makes the copy visible to the host
+	VkBufferImageCopy region{};
+	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	region.imageSubresource.layerCount = 1;
+	region.imageExtent = { m_swapChainExtent.width, m_swapChainExtent.height, 1 };
+
+	vkCmdCopyImageToBuffer(commandBuffer, m_swapChainImages[imageIndex], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, m_readbackBuffers[m_currentFrame], 1, &region);
+}
+
+void Application::writePendingFrameDump(uint32_t frameSlot)
+{
+	if (!m_pendingFrameDumps[frameSlot].has_value())
+		return;
+
+	uint64_t frameNumber = m_pendingFrameDumps[frameSlot].value();
+	m_pendingFrameDumps[frameSlot].reset();
+
+	std::filesystem::path path = std::filesystem::path(m_config.dumpDirectory) / ("frame_" + std::to_string(frameNumber) + ".ppm");
+	std::ofstream file(path, std::ios::binary);
+
+	if (!file.is_open())
+		throw std::runtime_error("Failed to open frame dump file");
+
+	uint32_t width = m_swapChainExtent.width, height = m_swapChainExtent.height;
+	bool bgra = m_swapChainImageFormat == VK_FORMAT_B8G8R8A8_SRGB;
+	const uint8_t* pixels = static_cast<const uint8_t*>(m_mappedReadbackBuffersMemory[frameSlot]);
+
+	file << "P6\n" << width << " " << height << "\n255\n";
+
+	std::vector<char> row(width * 3);
+	for (uint32_t y = 0; y < height; y++)
+	{
+		for (uint32_t x = 0; x < width; x++)
+		{
+			const uint8_t* pixel = pixels + (static_cast<size_t>(y) * width + x) * 4;
+			row[x * 3 + 0] = static_cast<char>(bgra ? pixel[2] : pixel[0]);
+			row[x * 3 + 1] = static_cast<char>(pixel[1]);
+			row[x * 3 + 2] = static_cast<char>(bgra ? pixel[0] : pixel[2]);
+		}
+		file.write(row.data(), row.size());
+	}
 }
 
 void Application::createSyncObjects()
@@ -1093,6 +2849,26 @@ void Application::createSyncObjects()
 	}
 }
 
+void Application::deferDeletion(std::function<void()>&& deleter)
+{
+	m_deletionQueue.push_back({ m_frameNumber, std::move(deleter) });
+}
+
+void Application::flushDeletionQueue(bool force)
+{
+	// frames finish in submission order, so once the fence of this frame slot has been waited on
+	// every frame older than MAX_FRAMES_IN_FLIGHT is done with its resources
+	while (!m_deletionQueue.empty() && (force || m_deletionQueue.front().frameNumber + MAX_FRAMES_IN_FLIGHT <= m_frameNumber))
+	{
+		m_deletionQueue.front().deleter();
+		m_deletionQueue.pop_front();
+	}
+
+	// released bindless slots wait for the same frames before they are written again
+	m_bindlessTextureSlots.collect(m_frameNumber);
+	m_bindlessBufferSlots.collect(m_frameNumber);
+}
+
 void Application::generateMipmaps(VkImage image, VkFormat format, uint32_t texWidth, uint32_t texHeight, uint32_t mipLevels)
 {
 	VkFormatProperties formatProperties;
@@ -1104,32 +2880,30 @@ void Application::generateMipmaps(VkImage image, VkFormat format, uint32_t texWi
 
 	VkCommandBuffer commandBuffer = beginSingleTimeCommands();
 
-	VkImageMemoryBarrier barrier{};
-	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-	barrier.image = image;
-	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	barrier.subresourceRange.baseArrayLayer = 0;
-	barrier.subresourceRange.layerCount = 1;
-	barrier.subresourceRange.levelCount = 1;
-
-	int32_t mipWidth = texHeight;
+	// level i - 1 becomes the blit source while the one before it, done with, goes to the shaders, in one barrier
+	VkImageSubresourceRange level{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+	std::array<VkImageMemoryBarrier, 2> barriers{};
+
+	int32_t mipWidth = texWidth;
 	int32_t mipHeight = texHeight;
 
 	for (uint32_t i = 1; i < mipLevels; i++)
 	{
-		barrier.subresourceRange.baseMipLevel = i - 1;
-		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-		barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-		barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		level.baseMipLevel = i - 1;
+		barriers[0] = RenderGraph::imageBarrier(image, level, ResourceUsage::TransferDst, ResourceUsage::TransferSrc);
+		uint32_t barrierCount = 1;
+		if (i > 1)
+		{
+			level.baseMipLevel = i - 2;
+			barriers[1] = RenderGraph::imageBarrier(image, level, ResourceUsage::TransferSrc, ResourceUsage::FragmentSampled);
+			barrierCount = 2;
+		}
 
 		vkCmdPipelineBarrier(commandBuffer,
-			VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+			VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT | (i > 1 ? VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT : 0), 0,
 			0, nullptr,
 			0, nullptr,
-			1, &barrier);
+			barrierCount, barriers.data());
 
 		VkImageBlit blit{};
 		blit.srcOffsets[0] = { 0, 0, 0 };
@@ -1151,32 +2925,25 @@ void Application::generateMipmaps(VkImage image, VkFormat format, uint32_t texWi
 			1, &blit,
 			VK_FILTER_LINEAR);
 
-		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-		barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-		barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-
-		vkCmdPipelineBarrier(commandBuffer,
-			VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
-			0, nullptr,
-			0, nullptr,
-			1, &barrier);
-
 		if (mipWidth > 1) mipWidth /= 2;
 		if (mipHeight > 1) mipHeight /= 2;
 	}
 
-	barrier.subresourceRange.baseMipLevel = mipLevels - 1;
-	barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-	barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	// the last blit source and the last level, which nothing blits from
+	uint32_t barrierCount = 0;
+	if (mipLevels > 1)
+	{
+		level.baseMipLevel = mipLevels - 2;
+		barriers[barrierCount++] = RenderGraph::imageBarrier(image, level, ResourceUsage::TransferSrc, ResourceUsage::FragmentSampled);
+	}
+	level.baseMipLevel = mipLevels - 1;
+	barriers[barrierCount++] = RenderGraph::imageBarrier(image, level, ResourceUsage::TransferDst, ResourceUsage::FragmentSampled);
 
 	vkCmdPipelineBarrier(commandBuffer,
 		VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
 		0, nullptr,
 		0, nullptr,
-		1, &barrier);
+		barrierCount, barriers.data());
 
 	endSingleTimeCommands(commandBuffer);
 }
@@ -1186,344 +2953,2755 @@ void Application::createColorResources()
 	VkFormat colorFormat = m_swapChainImageFormat;
 	std::cout << std::endl << "Swap chain image format is: " << colorFormat << std::endl;
 
-	createImage(m_swapChainExtent.width, m_swapChainExtent.height, 1, m_msaaSamples, colorFormat, VK_IMAGE_TILING_OPTIMAL,
-		VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-		m_colorImage, m_colorImageMemory);
+	// first of the swap chain dependent resources, depth and framebuffers use the extent picked here
+	m_sceneExtent = m_swapChainExtent;
+	if (rendersOffscreen())
+	{
+		float maxScale = m_resolutionController.settings().maxScale;
+		m_sceneExtent.width = std::max(1u, static_cast<uint32_t>(m_swapChainExtent.width * maxScale + 0.5f));
+		m_sceneExtent.height = std::max(1u, static_cast<uint32_t>(m_swapChainExtent.height * maxScale + 0.5f));
+
+		createImage(m_sceneExtent.width, m_sceneExtent.height, 1, VK_SAMPLE_COUNT_1_BIT, colorFormat, VK_IMAGE_TILING_OPTIMAL,
+			VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_sceneColorImage, m_sceneColorImageMemory);
+		m_sceneColorImageView = createImageView(m_sceneColorImage, colorFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+
+		// allocated even while TAA is off, the A key switches it on without a rebuild
+		for (size_t i = 0; i < m_historyImages.size(); i++)
+		{
+			createImage(m_sceneExtent.width, m_sceneExtent.height, 1, VK_SAMPLE_COUNT_1_BIT, HISTORY_FORMAT, VK_IMAGE_TILING_OPTIMAL,
+				VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_historyImages[i], m_historyImagesMemory[i]);
+			m_historyImageViews[i] = createImageView(m_historyImages[i], HISTORY_FORMAT, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+		}
+		m_historyValid = false;
+	}
+	updateRenderExtent();
+
+	// never leaves the tile on tilers, the resolve subpass reads it where the ID subpass left it
+	if (m_config.visibilityBuffer)
+	{
+		createImage(m_sceneExtent.width, m_sceneExtent.height, 1, VK_SAMPLE_COUNT_1_BIT, TRIANGLE_ID_FORMAT, VK_IMAGE_TILING_OPTIMAL,
+			VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_triangleIdImage, m_triangleIdImageMemory);
+		m_triangleIdImageView = createImageView(m_triangleIdImage, TRIANGLE_ID_FORMAT, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+	}
+
+	// single sampled frames render into the target directly
+	if (m_qualityTier.samples == VK_SAMPLE_COUNT_1_BIT)
+	{
+		m_colorImage = VK_NULL_HANDLE;
+		m_colorImageMemory = VK_NULL_HANDLE;
+		m_colorImageView = VK_NULL_HANDLE;
+		return;
+	}
+
+	// the gpu driven path keeps the multisampled color between its early and late render pass
+	VkImageUsageFlags usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | (m_config.gpuDriven ? 0 : VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT);
+	createImage(m_sceneExtent.width, m_sceneExtent.height, 1, m_qualityTier.samples, colorFormat, VK_IMAGE_TILING_OPTIMAL,
+		usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_colorImage, m_colorImageMemory);
 	m_colorImageView = createImageView(m_colorImage, colorFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1);
 }
 
-void Application::loadModel()
+void Application::createPostProcessing()
 {
-	tinyobj::attrib_t attrib;
-	std::vector<tinyobj::shape_t> shapes;
-	std::vector<tinyobj::material_t> materials;
-	std::string warn, err;
+	// writes every pixel of the swap chain image, nothing to load
+	VkAttachmentDescription colorAttachment{};
+	colorAttachment.format = m_swapChainImageFormat;
+	colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+	colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	colorAttachment.initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	colorAttachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
-	if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, m_modelPath.c_str()))
+	VkAttachmentReference colorAttachmentRef{ 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+
+	VkSubpassDescription subpass{};
+	subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	subpass.colorAttachmentCount = 1;
+	subpass.pColorAttachments = &colorAttachmentRef;
+
+	// the acquire, the scene color and the previous frame's history are ordered by the frame graph
+	VkRenderPassCreateInfo renderPassCreateInfo{};
+	renderPassCreateInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+	renderPassCreateInfo.attachmentCount = 1;
+	renderPassCreateInfo.pAttachments = &colorAttachment;
+	renderPassCreateInfo.subpassCount = 1;
+	renderPassCreateInfo.pSubpasses = &subpass;
+
+	if (vkCreateRenderPass(m_device, &renderPassCreateInfo, nullptr, &m_postRenderPass) != VK_SUCCESS)
 	{
-		throw std::runtime_error(warn + err);
+		throw std::runtime_error("Failed to create post process render pass");
 	}
 
-	std::unordered_map<Vertex, uint32_t> uniqueVertices{};
+	// TAA overwrites every rendered texel of its target, which the previous frame's TAA pass read as its history
+	VkAttachmentDescription historyAttachment = colorAttachment;
+	historyAttachment.format = HISTORY_FORMAT;
+	renderPassCreateInfo.pAttachments = &historyAttachment;
 
-	for (const auto& shape : shapes)
+	if (vkCreateRenderPass(m_device, &renderPassCreateInfo, nullptr, &m_taaRenderPass) != VK_SUCCESS)
 	{
-		for (const auto& index : shape.mesh.indices)
-		{
-			Vertex vertex{};
+		throw std::runtime_error("Failed to create TAA render pass");
+	}
 
-			vertex.position =
-			{
-				attrib.vertices[3 * index.vertex_index + 0],
-				attrib.vertices[3 * index.vertex_index + 1],
-				attrib.vertices[3 * index.vertex_index + 2]
-			};
+	VkDescriptorSetLayoutBinding sceneColorBinding{};
+	sceneColorBinding.binding = 0;
+	sceneColorBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	sceneColorBinding.descriptorCount = 1;
+	sceneColorBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
 
-			vertex.texCoord = 
-			{
-				attrib.texcoords[2 * index.texcoord_index + 0],
-				1.0f - attrib.texcoords[2 * index.texcoord_index + 1]
-			};
+	VkDescriptorSetLayoutCreateInfo layoutCreateInfo{};
+	layoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutCreateInfo.bindingCount = 1;
+	layoutCreateInfo.pBindings = &sceneColorBinding;
 
-			vertex.color = { 1.0f, 1.0f, 1.0f };
+	if (vkCreateDescriptorSetLayout(m_device, &layoutCreateInfo, nullptr, &m_postDescriptorSetLayout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create post process descriptor set layout");
+	}
 
-			if (uniqueVertices.count(vertex) == 0) {
-				uniqueVertices[vertex] = static_cast<uint32_t>(m_vertices.size());
-				m_vertices.push_back(vertex);
-			}
+	// scene color, scene depth, history to blend with
+	std::array<VkDescriptorSetLayoutBinding, 3> taaBindings{};
+	for (uint32_t i = 0; i < taaBindings.size(); i++)
+	{
+		taaBindings[i] = sceneColorBinding;
+		taaBindings[i].binding = i;
+	}
+	layoutCreateInfo.bindingCount = static_cast<uint32_t>(taaBindings.size());
+	layoutCreateInfo.pBindings = taaBindings.data();
 
-			m_indices.push_back(uniqueVertices[vertex]);
-		}
+	if (vkCreateDescriptorSetLayout(m_device, &layoutCreateInfo, nullptr, &m_taaDescriptorSetLayout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create TAA descriptor set layout");
 	}
 
-	std::cout << "Current model has: " << m_vertices.size() << " vertices" << std::endl;
-	std::cout << "Current model has: " << m_indices.size() << " indices" << std::endl;
-}
+	VkPushConstantRange pushConstantRange{};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(UpscalePushConstants);
 
-void Application::createVertexBuffer()
-{
-	VkDeviceSize bufferSize = sizeof(m_vertices[0]) * m_vertices.size();
+	VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo{};
+	pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutCreateInfo.setLayoutCount = 1;
+	pipelineLayoutCreateInfo.pSetLayouts = &m_postDescriptorSetLayout;
+	pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+	pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
 
-	VkBuffer stagingBuffer;
-	VkDeviceMemory stagingBufferMemory;
-	createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-				stagingBuffer, stagingBufferMemory);
+	if (vkCreatePipelineLayout(m_device, &pipelineLayoutCreateInfo, nullptr, &m_postPipelineLayout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create post process pipeline layout");
+	}
+
+	pushConstantRange.size = sizeof(TaaPushConstants);
+	pipelineLayoutCreateInfo.pSetLayouts = &m_taaDescriptorSetLayout;
+
+	if (vkCreatePipelineLayout(m_device, &pipelineLayoutCreateInfo, nullptr, &m_taaPipelineLayout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create TAA pipeline layout");
+	}
+
+	VkSamplerCreateInfo samplerCreateInfo{};
+	samplerCreateInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	samplerCreateInfo.magFilter = VK_FILTER_LINEAR;
+	samplerCreateInfo.minFilter = VK_FILTER_LINEAR;
+	samplerCreateInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	samplerCreateInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerCreateInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerCreateInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+
+	if (vkCreateSampler(m_device, &samplerCreateInfo, nullptr, &m_postSampler) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create post process sampler");
+	}
+
+	// fullscreen triangle, no vertex input, no depth, viewport and scissor set when recording
+	auto createFullscreenPipeline = [this](VkShaderModule vertShaderModule, VkShaderModule fragShaderModule, const VkSpecializationInfo* specializationInfo,
+		VkPipelineLayout layout, VkRenderPass renderPass)
+	{
+		std::array<VkPipelineShaderStageCreateInfo, 2> shaderStages{};
+		shaderStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		shaderStages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+		shaderStages[0].module = vertShaderModule;
+		shaderStages[0].pName = "main";
+		shaderStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		shaderStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+		shaderStages[1].module = fragShaderModule;
+		shaderStages[1].pName = "main";
+		shaderStages[1].pSpecializationInfo = specializationInfo;
+
+		VkPipelineVertexInputStateCreateInfo vertexInputCreateInfo{};
+		vertexInputCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+
+		VkPipelineInputAssemblyStateCreateInfo inputAssemblyCreateInfo{};
+		inputAssemblyCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+		inputAssemblyCreateInfo.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+		VkPipelineViewportStateCreateInfo viewportStateCreateInfo{};
+		viewportStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+		viewportStateCreateInfo.viewportCount = 1;
+		viewportStateCreateInfo.scissorCount = 1;
+
+		VkPipelineRasterizationStateCreateInfo rasterizationCreateInfo{};
+		rasterizationCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+		rasterizationCreateInfo.polygonMode = VK_POLYGON_MODE_FILL;
+		rasterizationCreateInfo.cullMode = VK_CULL_MODE_NONE;
+		rasterizationCreateInfo.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+		rasterizationCreateInfo.lineWidth = 1.0f;
+
+		VkPipelineMultisampleStateCreateInfo multisampleCreateInfo{};
+		multisampleCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+		multisampleCreateInfo.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+		VkPipelineColorBlendAttachmentState colorBlendAttachment{};
+		colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+
+		VkPipelineColorBlendStateCreateInfo colorBlendCreateInfo{};
+		colorBlendCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+		colorBlendCreateInfo.attachmentCount = 1;
+		colorBlendCreateInfo.pAttachments = &colorBlendAttachment;
+
+		std::array<VkDynamicState, 2> dynamicStates = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+		VkPipelineDynamicStateCreateInfo dynamicStateCreateInfo{};
+		dynamicStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+		dynamicStateCreateInfo.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
+		dynamicStateCreateInfo.pDynamicStates = dynamicStates.data();
+
+		VkGraphicsPipelineCreateInfo pipelineCreateInfo{};
+		pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+		pipelineCreateInfo.stageCount = static_cast<uint32_t>(shaderStages.size());
+		pipelineCreateInfo.pStages = shaderStages.data();
+		pipelineCreateInfo.pVertexInputState = &vertexInputCreateInfo;
+		pipelineCreateInfo.pInputAssemblyState = &inputAssemblyCreateInfo;
+		pipelineCreateInfo.pViewportState = &viewportStateCreateInfo;
+		pipelineCreateInfo.pRasterizationState = &rasterizationCreateInfo;
+		pipelineCreateInfo.pMultisampleState = &multisampleCreateInfo;
+		pipelineCreateInfo.pColorBlendState = &colorBlendCreateInfo;
+		pipelineCreateInfo.pDynamicState = &dynamicStateCreateInfo;
+		pipelineCreateInfo.layout = layout;
+		pipelineCreateInfo.renderPass = renderPass;
+		pipelineCreateInfo.subpass = 0;
+
+		VkPipeline pipeline;
+		if (vkCreateGraphicsPipelines(m_device, m_pipelineCache, 1, &pipelineCreateInfo, nullptr, &pipeline) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create post process pipeline");
+		}
+		return pipeline;
+	};
+
+	VkShaderModule vertShaderModule = createShaderModule(readFile("shaders/fullscreen_vert.spv"));
+	VkShaderModule upscaleShaderModule = createShaderModule(readFile("shaders/upscale_frag.spv"));
+	VkShaderModule taaShaderModule = createShaderModule(readFile("shaders/taa_frag.spv"));
+
+	// constant_id 0 of upscale.frag picks the filter, constant_id 1 turns FXAA on
+	std::array<VkSpecializationMapEntry, 2> specializationEntries{};
+	specializationEntries[0] = { 0, 0, sizeof(VkBool32) };
+	specializationEntries[1] = { 1, sizeof(VkBool32), sizeof(VkBool32) };
+	for (uint32_t fxaa = 0; fxaa < m_upscalePipelines.size(); fxaa++)
+	{
+		for (uint32_t filter = 0; filter < m_upscalePipelines[fxaa].size(); filter++)
+		{
+			std::array<VkBool32, 2> constants = { filter == static_cast<uint32_t>(UpscaleFilter::EdgeAdaptive) ? VK_TRUE : VK_FALSE, fxaa ? VK_TRUE : VK_FALSE };
+			VkSpecializationInfo specializationInfo{ static_cast<uint32_t>(specializationEntries.size()), specializationEntries.data(), sizeof(constants), constants.data() };
+			m_upscalePipelines[fxaa][filter] = createFullscreenPipeline(vertShaderModule, upscaleShaderModule, &specializationInfo, m_postPipelineLayout, m_postRenderPass);
+		}
+	}
+	m_taaPipeline = createFullscreenPipeline(vertShaderModule, taaShaderModule, nullptr, m_taaPipelineLayout, m_taaRenderPass);
+
+	vkDestroyShaderModule(m_device, taaShaderModule, nullptr);
+	vkDestroyShaderModule(m_device, upscaleShaderModule, nullptr);
+	vkDestroyShaderModule(m_device, vertShaderModule, nullptr);
+
+	if (m_config.dynamicResolution)
+	{
+		const ResolutionSettings& settings = m_resolutionController.settings();
+		std::cout << "Dynamic resolution: scale " << settings.minScale << " - " << settings.maxScale << ", GPU budget " << settings.budgetMs << " ms" << std::endl;
+	}
+}
+
+void Application::destroyPostProcessing()
+{
+	for (const auto& pipelines : m_upscalePipelines)
+	{
+		for (VkPipeline pipeline : pipelines)
+			vkDestroyPipeline(m_device, pipeline, nullptr);
+	}
+	vkDestroyPipeline(m_device, m_taaPipeline, nullptr);
+	vkDestroyPipelineLayout(m_device, m_taaPipelineLayout, nullptr);
+	vkDestroyPipelineLayout(m_device, m_postPipelineLayout, nullptr);
+	vkDestroyDescriptorSetLayout(m_device, m_taaDescriptorSetLayout, nullptr);
+	vkDestroyDescriptorSetLayout(m_device, m_postDescriptorSetLayout, nullptr);
+	vkDestroySampler(m_device, m_postSampler, nullptr);
+	vkDestroyRenderPass(m_device, m_taaRenderPass, nullptr);
+	vkDestroyRenderPass(m_device, m_postRenderPass, nullptr);
+}
+
+void Application::createPostDescriptorSet()
+{
+	if (!rendersOffscreen())
+		return;
+
+	// own pool, retired together with the scene color and history images the sets point at.
+	// The output pass reads the scene color or either history, the TAA pass reads color, depth and a history
+	VkDescriptorPoolSize poolSize{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1 + 2 + 2 * 3 };
+
+	VkDescriptorPoolCreateInfo descriptorPoolCreateInfo{};
+	descriptorPoolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	descriptorPoolCreateInfo.poolSizeCount = 1;
+	descriptorPoolCreateInfo.pPoolSizes = &poolSize;
+	descriptorPoolCreateInfo.maxSets = 1 + 2 + 2;
+
+	if (vkCreateDescriptorPool(m_device, &descriptorPoolCreateInfo, nullptr, &m_postDescriptorPool) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create post process descriptor pool");
+	}
+
+	std::array<VkDescriptorSetLayout, 3> postLayouts;
+	postLayouts.fill(m_postDescriptorSetLayout);
+	std::array<VkDescriptorSet, 3> postSets;
+
+	VkDescriptorSetAllocateInfo descriptorSetAllocInfo{};
+	descriptorSetAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	descriptorSetAllocInfo.descriptorPool = m_postDescriptorPool;
+	descriptorSetAllocInfo.descriptorSetCount = static_cast<uint32_t>(postSets.size());
+	descriptorSetAllocInfo.pSetLayouts = postLayouts.data();
+
+	if (vkAllocateDescriptorSets(m_device, &descriptorSetAllocInfo, postSets.data()) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to allocate post process descriptor sets");
+	}
+	m_postDescriptorSet = postSets[0];
+	m_historyDescriptorSets = { postSets[1], postSets[2] };
+
+	std::array<VkDescriptorImageInfo, 3> postInfos = {
+		VkDescriptorImageInfo{ m_postSampler, m_sceneColorImageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL },
+		VkDescriptorImageInfo{ m_postSampler, m_historyImageViews[0], VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL },
+		VkDescriptorImageInfo{ m_postSampler, m_historyImageViews[1], VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL }
+	};
+
+	std::vector<VkWriteDescriptorSet> descriptorWrites;
+	for (size_t i = 0; i < postSets.size(); i++)
+	{
+		VkWriteDescriptorSet descriptorWrite{};
+		descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrite.dstSet = postSets[i];
+		descriptorWrite.dstBinding = 0;
+		descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		descriptorWrite.descriptorCount = 1;
+		descriptorWrite.pImageInfo = &postInfos[i];
+		descriptorWrites.push_back(descriptorWrite);
+	}
+
+	// TAA forces a single sample, a multisampled depth buffer can't be bound as a plain sampler2D
+	m_taaDescriptorSets = {};
+	std::array<std::array<VkDescriptorImageInfo, 3>, 2> taaInfos;
+	if (m_qualityTier.samples == VK_SAMPLE_COUNT_1_BIT)
+	{
+		std::array<VkDescriptorSetLayout, 2> taaLayouts = { m_taaDescriptorSetLayout, m_taaDescriptorSetLayout };
+		descriptorSetAllocInfo.descriptorSetCount = static_cast<uint32_t>(taaLayouts.size());
+		descriptorSetAllocInfo.pSetLayouts = taaLayouts.data();
+
+		if (vkAllocateDescriptorSets(m_device, &descriptorSetAllocInfo, m_taaDescriptorSets.data()) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to allocate TAA descriptor sets");
+		}
+
+		// depth is read with texelFetch, the bilinear sampler never filters it
+		for (size_t i = 0; i < m_taaDescriptorSets.size(); i++)
+		{
+			taaInfos[i] = {
+				VkDescriptorImageInfo{ m_postSampler, m_sceneColorImageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL },
+				VkDescriptorImageInfo{ m_postSampler, m_depthImageView, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL },
+				VkDescriptorImageInfo{ m_postSampler, m_historyImageViews[1 - i], VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL }
+			};
+
+			VkWriteDescriptorSet descriptorWrite{};
+			descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrite.dstSet = m_taaDescriptorSets[i];
+			descriptorWrite.dstBinding = 0;
+			descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+			descriptorWrite.descriptorCount = static_cast<uint32_t>(taaInfos[i].size());
+			descriptorWrite.pImageInfo = taaInfos[i].data();
+			descriptorWrites.push_back(descriptorWrite);
+		}
+	}
+
+	vkUpdateDescriptorSets(m_device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+}
+
+void Application::updateRenderExtent()
+{
+	if (!rendersOffscreen())
+	{
+		m_renderExtent = m_sceneExtent;
+		return;
+	}
+
+	// the targets were sized for the largest scale, rounding must not take us past them
+	float scale = m_resolutionController.scale();
+	m_renderExtent.width = std::clamp(static_cast<uint32_t>(m_swapChainExtent.width * scale + 0.5f), 1u, m_sceneExtent.width);
+	m_renderExtent.height = std::clamp(static_cast<uint32_t>(m_swapChainExtent.height * scale + 0.5f), 1u, m_sceneExtent.height);
+}
+
+void Application::recordTaaPass(VkCommandBuffer commandBuffer)
+{
+	uint32_t target = 1 - m_historyIndex;
+
+	VkRenderPassBeginInfo renderPassBeginInfo{};
+	renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+	renderPassBeginInfo.renderPass = m_taaRenderPass;
+	renderPassBeginInfo.framebuffer = m_historyFramebuffers[target];
+	renderPassBeginInfo.renderArea.offset = { 0, 0 };
+	renderPassBeginInfo.renderArea.extent = m_renderExtent;
+	vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+	// texel for texel with the scene targets, at the render extent
+	VkViewport viewport{ 0.0f, 0.0f, static_cast<float>(m_renderExtent.width), static_cast<float>(m_renderExtent.height), 0.0f, 1.0f };
+	VkRect2D scissor{ { 0, 0 }, m_renderExtent };
+	vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+	vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+	TaaPushConstants pushConstants{};
+	glm::vec2 sceneSize(m_sceneExtent.width, m_sceneExtent.height);
+	glm::vec2 renderSize(m_renderExtent.width, m_renderExtent.height);
+	glm::vec2 historySize(m_historyExtent.width, m_historyExtent.height);
+	pushConstants.reprojection = m_taaReprojection;
+	pushConstants.uvScale = renderSize / sceneSize;
+	pushConstants.historyUvScale = historySize / sceneSize;
+	pushConstants.historyUvClamp = (historySize - 0.5f) / sceneSize;
+	pushConstants.texelSize = 1.0f / sceneSize;
+	pushConstants.currentWeight = m_historyValid ? TAA_CURRENT_WEIGHT : 1.0f;
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_taaPipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_taaPipelineLayout, 0, 1, &m_taaDescriptorSets[target], 0, nullptr);
+	m_frameDescriptorBinds++;
+	vkCmdPushConstants(commandBuffer, m_taaPipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(pushConstants), &pushConstants);
+	vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+
+	vkCmdEndRenderPass(commandBuffer);
+
+	m_historyIndex = target;
+	m_historyExtent = m_renderExtent;
+	m_historyValid = true;
+}
+
+void Application::recordPostPass(VkCommandBuffer commandBuffer, uint32_t imageIndex)
+{
+	VkRenderPassBeginInfo renderPassBeginInfo{};
+	renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+	renderPassBeginInfo.renderPass = m_postRenderPass;
+	renderPassBeginInfo.framebuffer = m_postFramebuffers[imageIndex];
+	renderPassBeginInfo.renderArea.offset = { 0, 0 };
+	renderPassBeginInfo.renderArea.extent = m_swapChainExtent;
+	vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+	VkViewport viewport{ 0.0f, 0.0f, static_cast<float>(m_swapChainExtent.width), static_cast<float>(m_swapChainExtent.height), 0.0f, 1.0f };
+	VkRect2D scissor{ { 0, 0 }, m_swapChainExtent };
+	vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+	vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+	UpscalePushConstants pushConstants{};
+	glm::vec2 sceneSize(m_sceneExtent.width, m_sceneExtent.height);
+	glm::vec2 renderSize(m_renderExtent.width, m_renderExtent.height);
+	pushConstants.uvScale = renderSize / sceneSize;
+	pushConstants.uvClamp = (renderSize - 0.5f) / sceneSize;
+	pushConstants.texelSize = 1.0f / sceneSize;
+	pushConstants.sharpness = 0.5f;
+
+	// TAA leaves its result in the history just written, at the same extent and texel size as the scene color
+	bool taa = m_qualityTier.antiAliasing == PostAntiAliasing::Taa;
+	bool fxaa = m_qualityTier.antiAliasing == PostAntiAliasing::Fxaa;
+	VkDescriptorSet source = taa ? m_historyDescriptorSets[m_historyIndex] : m_postDescriptorSet;
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_upscalePipelines[fxaa][static_cast<size_t>(m_upscaleFilter)]);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_postPipelineLayout, 0, 1, &source, 0, nullptr);
+	m_frameDescriptorBinds++;
+	vkCmdPushConstants(commandBuffer, m_postPipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(pushConstants), &pushConstants);
+	vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+
+	vkCmdEndRenderPass(commandBuffer);
+}
+
+void Application::createVisibilityBuffer()
+{
+	// IDs: cleared to 0, read by the resolve subpass and dropped afterwards
+	VkAttachmentDescription idAttachment{};
+	idAttachment.format = TRIANGLE_ID_FORMAT;
+	idAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+	idAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	idAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	idAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	idAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	idAttachment.initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	idAttachment.finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+	// depth and target are left like the ones of the forward scene pass, the frame graph can't tell the difference
+	VkAttachmentDescription depthAttachment{};
+	depthAttachment.format = findDepthFormat();
+	depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+	depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	depthAttachment.storeOp = rendersOffscreen() ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	depthAttachment.initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+	depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+	// the resolve writes every pixel of the render area, background included
+	VkAttachmentDescription targetAttachment{};
+	targetAttachment.format = m_swapChainImageFormat;
+	targetAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+	targetAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	targetAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	targetAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	targetAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	targetAttachment.initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	targetAttachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+	VkAttachmentReference idOutputRef{ 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+	VkAttachmentReference depthRef{ 1, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL };
+	VkAttachmentReference idInputRef{ 0, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+	VkAttachmentReference targetRef{ 2, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+
+	std::array<VkSubpassDescription, 2> subpasses{};
+	subpasses[0].pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	subpasses[0].colorAttachmentCount = 1;
+	subpasses[0].pColorAttachments = &idOutputRef;
+	subpasses[0].pDepthStencilAttachment = &depthRef;
+	subpasses[1].pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	subpasses[1].inputAttachmentCount = 1;
+	subpasses[1].pInputAttachments = &idInputRef;
+	subpasses[1].colorAttachmentCount = 1;
+	subpasses[1].pColorAttachments = &targetRef;
+
+	// every pixel only reads its own ID. Everything outside the render pass is ordered by the frame graph
+	VkSubpassDependency idDependency{ 0, 1, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+		VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_ACCESS_INPUT_ATTACHMENT_READ_BIT, VK_DEPENDENCY_BY_REGION_BIT };
+
+	std::array<VkAttachmentDescription, 3> attachments = { idAttachment, depthAttachment, targetAttachment };
+
+	VkRenderPassCreateInfo renderPassCreateInfo{};
+	renderPassCreateInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+	renderPassCreateInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+	renderPassCreateInfo.pAttachments = attachments.data();
+	renderPassCreateInfo.subpassCount = static_cast<uint32_t>(subpasses.size());
+	renderPassCreateInfo.pSubpasses = subpasses.data();
+	renderPassCreateInfo.dependencyCount = 1;
+	renderPassCreateInfo.pDependencies = &idDependency;
+
+	if (vkCreateRenderPass(m_device, &renderPassCreateInfo, nullptr, &m_visibilityRenderPass) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create visibility buffer render pass");
+	}
+
+	VkDescriptorSetLayoutBinding idBinding{};
+	idBinding.binding = 0;
+	idBinding.descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+	idBinding.descriptorCount = 1;
+	idBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+	VkDescriptorSetLayoutCreateInfo layoutCreateInfo{};
+	layoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutCreateInfo.bindingCount = 1;
+	layoutCreateInfo.pBindings = &idBinding;
+
+	if (vkCreateDescriptorSetLayout(m_device, &layoutCreateInfo, nullptr, &m_visibilityDescriptorSetLayout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create visibility buffer descriptor set layout");
+	}
+
+	// the scene set for the vertices, lights and texture, then the IDs
+	std::array<VkDescriptorSetLayout, 2> setLayouts = { m_descriptorSetLayout, m_visibilityDescriptorSetLayout };
+
+	VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo{};
+	pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutCreateInfo.setLayoutCount = static_cast<uint32_t>(setLayouts.size());
+	pipelineLayoutCreateInfo.pSetLayouts = setLayouts.data();
+
+	if (vkCreatePipelineLayout(m_device, &pipelineLayoutCreateInfo, nullptr, &m_resolvePipelineLayout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create visibility buffer resolve pipeline layout");
+	}
+
+	// single sampled, viewport and scissor set when recording
+	auto createPipeline = [this](VkShaderModule vertShaderModule, VkShaderModule fragShaderModule, const VkPipelineVertexInputStateCreateInfo& vertexInputCreateInfo,
+		const VkPipelineDepthStencilStateCreateInfo& depthStencilCreateInfo, VkCullModeFlags cullMode, VkPipelineLayout layout, uint32_t subpass)
+	{
+		std::array<VkPipelineShaderStageCreateInfo, 2> shaderStages{};
+		shaderStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		shaderStages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+		shaderStages[0].module = vertShaderModule;
+		shaderStages[0].pName = "main";
+		shaderStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		shaderStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+		shaderStages[1].module = fragShaderModule;
+		shaderStages[1].pName = "main";
+
+		VkPipelineInputAssemblyStateCreateInfo inputAssemblyCreateInfo{};
+		inputAssemblyCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+		inputAssemblyCreateInfo.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+		VkPipelineViewportStateCreateInfo viewportStateCreateInfo{};
+		viewportStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+		viewportStateCreateInfo.viewportCount = 1;
+		viewportStateCreateInfo.scissorCount = 1;
+
+		VkPipelineRasterizationStateCreateInfo rasterizationCreateInfo{};
+		rasterizationCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+		rasterizationCreateInfo.polygonMode = VK_POLYGON_MODE_FILL;
+		rasterizationCreateInfo.cullMode = cullMode;
+		rasterizationCreateInfo.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+		rasterizationCreateInfo.lineWidth = 1.0f;
+
+		VkPipelineMultisampleStateCreateInfo multisampleCreateInfo{};
+		multisampleCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+		multisampleCreateInfo.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+		VkPipelineColorBlendAttachmentState colorBlendAttachment{};
+		colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+
+		VkPipelineColorBlendStateCreateInfo colorBlendCreateInfo{};
+		colorBlendCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+		colorBlendCreateInfo.attachmentCount = 1;
+		colorBlendCreateInfo.pAttachments = &colorBlendAttachment;
+
+		std::array<VkDynamicState, 2> dynamicStates = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+		VkPipelineDynamicStateCreateInfo dynamicStateCreateInfo{};
+		dynamicStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+		dynamicStateCreateInfo.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
+		dynamicStateCreateInfo.pDynamicStates = dynamicStates.data();
+
+		VkGraphicsPipelineCreateInfo pipelineCreateInfo{};
+		pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+		pipelineCreateInfo.stageCount = static_cast<uint32_t>(shaderStages.size());
+		pipelineCreateInfo.pStages = shaderStages.data();
+		pipelineCreateInfo.pVertexInputState = &vertexInputCreateInfo;
+		pipelineCreateInfo.pInputAssemblyState = &inputAssemblyCreateInfo;
+		pipelineCreateInfo.pViewportState = &viewportStateCreateInfo;
+		pipelineCreateInfo.pRasterizationState = &rasterizationCreateInfo;
+		pipelineCreateInfo.pMultisampleState = &multisampleCreateInfo;
+		pipelineCreateInfo.pDepthStencilState = &depthStencilCreateInfo;
+		pipelineCreateInfo.pColorBlendState = &colorBlendCreateInfo;
+		pipelineCreateInfo.pDynamicState = &dynamicStateCreateInfo;
+		pipelineCreateInfo.layout = layout;
+		pipelineCreateInfo.renderPass = m_visibilityRenderPass;
+		pipelineCreateInfo.subpass = subpass;
+
+		VkPipeline pipeline;
+		if (vkCreateGraphicsPipelines(m_device, m_pipelineCache, 1, &pipelineCreateInfo, nullptr, &pipeline) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create visibility buffer pipeline");
+		}
+		return pipeline;
+	};
+
+	// the ID pass only fetches positions, with the stride of the full vertex
+	VkVertexInputBindingDescription bindingDescription = Vertex::getBindingDescription();
+	VkVertexInputAttributeDescription positionDescription = Vertex::getAttributeDescriptions()[0];
+
+	VkPipelineVertexInputStateCreateInfo idVertexInput{};
+	idVertexInput.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+	idVertexInput.vertexBindingDescriptionCount = 1;
+	idVertexInput.pVertexBindingDescriptions = &bindingDescription;
+	idVertexInput.vertexAttributeDescriptionCount = 1;
+	idVertexInput.pVertexAttributeDescriptions = &positionDescription;
+
+	VkPipelineDepthStencilStateCreateInfo idDepthStencil{};
+	idDepthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+	idDepthStencil.depthTestEnable = VK_TRUE;
+	idDepthStencil.depthWriteEnable = VK_TRUE;
+	idDepthStencil.depthCompareOp = VK_COMPARE_OP_LESS;
+
+	// fullscreen triangle, the resolve subpass has no depth attachment
+	VkPipelineVertexInputStateCreateInfo resolveVertexInput{};
+	resolveVertexInput.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+
+	VkPipelineDepthStencilStateCreateInfo resolveDepthStencil{};
+	resolveDepthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+
+	VkShaderModule idVertShaderModule = createShaderModule(readFile("shaders/visibility_vert.spv"));
+	VkShaderModule idFragShaderModule = createShaderModule(readFile("shaders/visibility_frag.spv"));
+	VkShaderModule fullscreenShaderModule = createShaderModule(readFile("shaders/fullscreen_vert.spv"));
+	VkShaderModule resolveShaderModule = createShaderModule(readFile("shaders/visibility_resolve_frag.spv"));
+
+	m_triangleIdPipeline = createPipeline(idVertShaderModule, idFragShaderModule, idVertexInput, idDepthStencil, m_defaultPipelineKey.cullMode, m_pipelineLayout, 0);
+	m_resolvePipeline = createPipeline(fullscreenShaderModule, resolveShaderModule, resolveVertexInput, resolveDepthStencil, VK_CULL_MODE_NONE, m_resolvePipelineLayout, 1);
+
+	vkDestroyShaderModule(m_device, resolveShaderModule, nullptr);
+	vkDestroyShaderModule(m_device, fullscreenShaderModule, nullptr);
+	vkDestroyShaderModule(m_device, idFragShaderModule, nullptr);
+	vkDestroyShaderModule(m_device, idVertShaderModule, nullptr);
+
+	std::cout << "Visibility buffer: triangle IDs, shaded in a fullscreen resolve" << std::endl;
+}
+
+void Application::destroyVisibilityBuffer()
+{
+	vkDestroyPipeline(m_device, m_resolvePipeline, nullptr);
+	vkDestroyPipeline(m_device, m_triangleIdPipeline, nullptr);
+	vkDestroyPipelineLayout(m_device, m_resolvePipelineLayout, nullptr);
+	vkDestroyDescriptorSetLayout(m_device, m_visibilityDescriptorSetLayout, nullptr);
+	vkDestroyRenderPass(m_device, m_visibilityRenderPass, nullptr);
+}
+
+void Application::createVisibilityDescriptorSet()
+{
+	if (!m_config.visibilityBuffer)
+		return;
+
+	// own pool, retired together with the ID image the set points at
+	VkDescriptorPoolSize poolSize{ VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, 1 };
+
+	VkDescriptorPoolCreateInfo descriptorPoolCreateInfo{};
+	descriptorPoolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	descriptorPoolCreateInfo.poolSizeCount = 1;
+	descriptorPoolCreateInfo.pPoolSizes = &poolSize;
+	descriptorPoolCreateInfo.maxSets = 1;
+
+	if (vkCreateDescriptorPool(m_device, &descriptorPoolCreateInfo, nullptr, &m_visibilityDescriptorPool) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create visibility buffer descriptor pool");
+	}
+
+	VkDescriptorSetAllocateInfo descriptorSetAllocInfo{};
+	descriptorSetAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	descriptorSetAllocInfo.descriptorPool = m_visibilityDescriptorPool;
+	descriptorSetAllocInfo.descriptorSetCount = 1;
+	descriptorSetAllocInfo.pSetLayouts = &m_visibilityDescriptorSetLayout;
+
+	if (vkAllocateDescriptorSets(m_device, &descriptorSetAllocInfo, &m_visibilityDescriptorSet) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to allocate visibility buffer descriptor set");
+	}
+
+	VkDescriptorImageInfo imageInfo{ VK_NULL_HANDLE, m_triangleIdImageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+
+	VkWriteDescriptorSet descriptorWrite{};
+	descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	descriptorWrite.dstSet = m_visibilityDescriptorSet;
+	descriptorWrite.dstBinding = 0;
+	descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+	descriptorWrite.descriptorCount = 1;
+	descriptorWrite.pImageInfo = &imageInfo;
+
+	vkUpdateDescriptorSets(m_device, 1, &descriptorWrite, 0, nullptr);
+}
+
+void Application::recordVisibilityFrame(VkCommandBuffer commandBuffer, uint32_t imageIndex, const FramePacket& packet)
+{
+	VkRenderPassBeginInfo renderPassBeginInfo{};
+	renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+	renderPassBeginInfo.renderPass = m_visibilityRenderPass;
+	renderPassBeginInfo.framebuffer = m_visibilityFramebuffers[imageIndex];
+	renderPassBeginInfo.renderArea.offset = { 0, 0 };
+	renderPassBeginInfo.renderArea.extent = m_renderExtent;
+
+	// IDs to 0, no triangle. The target isn't cleared, the resolve writes the background itself
+	std::array<VkClearValue, 2> clearValues{};
+	clearValues[1].depthStencil = { 1.0f, 0 };
+	renderPassBeginInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
+	renderPassBeginInfo.pClearValues = clearValues.data();
+
+	vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+	// both subpasses cover the render extent, dynamic state carries over into the next subpass
+	VkViewport viewport{ 0.0f, 0.0f, static_cast<float>(m_renderExtent.width), static_cast<float>(m_renderExtent.height), 0.0f, 1.0f };
+	VkRect2D scissor{ { 0, 0 }, m_renderExtent };
+	vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+	vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+	VkDeviceSize offset = 0;
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_triangleIdPipeline);
+	vkCmdBindVertexBuffers(commandBuffer, 0, 1, &m_vertexBuffer, &offset);
+	vkCmdBindIndexBuffer(commandBuffer, m_indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipelineLayout, 0, 1, &m_descriptorSets[m_currentFrame], 0, nullptr);
+	m_frameDescriptorBinds++;
+	recordBatchedDraws(commandBuffer, packet);
+
+	// one shaded fragment per pixel, however many triangles the ID pass drew over it. The resolve layout has no push
+	// constants, so set 0 isn't compatible with the one bound above and is bound again
+	vkCmdNextSubpass(commandBuffer, VK_SUBPASS_CONTENTS_INLINE);
+
+	std::array<VkDescriptorSet, 2> resolveSets = { m_descriptorSets[m_currentFrame], m_visibilityDescriptorSet };
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_resolvePipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_resolvePipelineLayout, 0, static_cast<uint32_t>(resolveSets.size()), resolveSets.data(), 0, nullptr);
+	m_frameDescriptorBinds++;
+	vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+
+	vkCmdEndRenderPass(commandBuffer);
+}
+
+void Application::createShadowResources()
+{
+	// linear filtering turns the depth comparison into 2x2 PCF, where the format supports it
+	m_shadowFormat = findSupportedFormat({ VK_FORMAT_D32_SFLOAT, VK_FORMAT_D16_UNORM }, VK_IMAGE_TILING_OPTIMAL,
+		VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT);
+	VkFormatProperties formatProperties;
+	vkGetPhysicalDeviceFormatProperties(m_physicalDevice, m_shadowFormat, &formatProperties);
+	bool linearFilter = (formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT) != 0;
+
+	uint32_t mapSize = m_config.shadows ? ShadowCascades::MAP_SIZE : 1;
+	createImage(mapSize, mapSize, 1, VK_SAMPLE_COUNT_1_BIT, m_shadowFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_shadowImage, m_shadowImageMemory, ShadowCascades::CASCADE_COUNT);
+
+	VkImageViewCreateInfo viewCreateInfo{};
+	viewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	viewCreateInfo.image = m_shadowImage;
+	viewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+	viewCreateInfo.format = m_shadowFormat;
+	viewCreateInfo.subresourceRange = { VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, ShadowCascades::CASCADE_COUNT };
+
+	if (vkCreateImageView(m_device, &viewCreateInfo, nullptr, &m_shadowImageView) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create shadow map view");
+	}
+
+	// the descriptor covers every layer, the shadow passes leave theirs in the same layout
+	transitionImageLayout(m_shadowImage, viewCreateInfo.subresourceRange, ResourceUsage::None, ResourceUsage::FragmentSampled);
+
+	// outside the map counts as lit, the border is the far plane
+	VkSamplerCreateInfo samplerCreateInfo{};
+	samplerCreateInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	samplerCreateInfo.magFilter = linearFilter ? VK_FILTER_LINEAR : VK_FILTER_NEAREST;
+	samplerCreateInfo.minFilter = samplerCreateInfo.magFilter;
+	samplerCreateInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	samplerCreateInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
+	samplerCreateInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
+	samplerCreateInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
+	samplerCreateInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
+	samplerCreateInfo.compareEnable = VK_TRUE;
+	samplerCreateInfo.compareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+	samplerCreateInfo.maxLod = 0.0f;
+
+	if (vkCreateSampler(m_device, &samplerCreateInfo, nullptr, &m_shadowSampler) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create shadow map sampler");
+	}
+
+	if (!m_config.shadows)
+		return;
+
+	// cleared and written by one pass per cascade, sampled by every scene path afterwards
+	VkAttachmentDescription depthAttachment{};
+	depthAttachment.format = m_shadowFormat;
+	depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+	depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	depthAttachment.finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+	VkAttachmentReference depthRef{ 0, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL };
+
+	VkSubpassDescription subpass{};
+	subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	subpass.pDepthStencilAttachment = &depthRef;
+
+	// the layer is shared by the frames in flight, the previous frame may still be sampling it
+	std::array<VkSubpassDependency, 2> dependencies{};
+	dependencies[0] = { VK_SUBPASS_EXTERNAL, 0, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+		0, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, 0 };
+	dependencies[1] = { 0, VK_SUBPASS_EXTERNAL, VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+		VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT, 0 };
+
+	VkRenderPassCreateInfo renderPassCreateInfo{};
+	renderPassCreateInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+	renderPassCreateInfo.attachmentCount = 1;
+	renderPassCreateInfo.pAttachments = &depthAttachment;
+	renderPassCreateInfo.subpassCount = 1;
+	renderPassCreateInfo.pSubpasses = &subpass;
+	renderPassCreateInfo.dependencyCount = static_cast<uint32_t>(dependencies.size());
+	renderPassCreateInfo.pDependencies = dependencies.data();
+
+	if (vkCreateRenderPass(m_device, &renderPassCreateInfo, nullptr, &m_shadowRenderPass) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create shadow render pass");
+	}
+
+	for (uint32_t c = 0; c < ShadowCascades::CASCADE_COUNT; c++)
+	{
+		viewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		viewCreateInfo.subresourceRange.baseArrayLayer = c;
+		viewCreateInfo.subresourceRange.layerCount = 1;
+
+		if (vkCreateImageView(m_device, &viewCreateInfo, nullptr, &m_shadowLayerViews[c]) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create shadow map layer view");
+		}
+
+		VkFramebufferCreateInfo framebufferCreateInfo{};
+		framebufferCreateInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+		framebufferCreateInfo.renderPass = m_shadowRenderPass;
+		framebufferCreateInfo.attachmentCount = 1;
+		framebufferCreateInfo.pAttachments = &m_shadowLayerViews[c];
+		framebufferCreateInfo.width = ShadowCascades::MAP_SIZE;
+		framebufferCreateInfo.height = ShadowCascades::MAP_SIZE;
+		framebufferCreateInfo.layers = 1;
+
+		if (vkCreateFramebuffer(m_device, &framebufferCreateInfo, nullptr, &m_shadowFramebuffers[c]) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create shadow framebuffer");
+		}
+	}
+
+	// the scene set for the instance transforms, the cascade's matrix as a push constant
+	VkPushConstantRange pushConstantRange{ VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(ShadowPushConstants) };
+
+	VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo{};
+	pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutCreateInfo.setLayoutCount = 1;
+	pipelineLayoutCreateInfo.pSetLayouts = &m_descriptorSetLayout;
+	pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+	pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+
+	if (vkCreatePipelineLayout(m_device, &pipelineLayoutCreateInfo, nullptr, &m_shadowPipelineLayout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create shadow pipeline layout");
+	}
+
+	// depth only: no fragment shader, positions only with the stride of the full vertex
+	VkShaderModule shadowShaderModule = createShaderModule(readFile("shaders/shadow_vert.spv"));
+
+	VkPipelineShaderStageCreateInfo shaderStage{};
+	shaderStage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	shaderStage.stage = VK_SHADER_STAGE_VERTEX_BIT;
+	shaderStage.module = shadowShaderModule;
+	shaderStage.pName = "main";
+
+	VkVertexInputBindingDescription bindingDescription = Vertex::getBindingDescription();
+	VkVertexInputAttributeDescription positionDescription = Vertex::getAttributeDescriptions()[0];
+
+	VkPipelineVertexInputStateCreateInfo vertexInputCreateInfo{};
+	vertexInputCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+	vertexInputCreateInfo.vertexBindingDescriptionCount = 1;
+	vertexInputCreateInfo.pVertexBindingDescriptions = &bindingDescription;
+	vertexInputCreateInfo.vertexAttributeDescriptionCount = 1;
+	vertexInputCreateInfo.pVertexAttributeDescriptions = &positionDescription;
+
+	VkPipelineInputAssemblyStateCreateInfo inputAssemblyCreateInfo{};
+	inputAssemblyCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+	inputAssemblyCreateInfo.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+	VkPipelineViewportStateCreateInfo viewportStateCreateInfo{};
+	viewportStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+	viewportStateCreateInfo.viewportCount = 1;
+	viewportStateCreateInfo.scissorCount = 1;
+
+	// both faces, the model isn't closed. The bias pushes the stored depth back by about a texel's slope, against acne
+	VkPipelineRasterizationStateCreateInfo rasterizationCreateInfo{};
+	rasterizationCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+	rasterizationCreateInfo.polygonMode = VK_POLYGON_MODE_FILL;
+	rasterizationCreateInfo.cullMode = VK_CULL_MODE_NONE;
+	rasterizationCreateInfo.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+	rasterizationCreateInfo.depthBiasEnable = VK_TRUE;
+	rasterizationCreateInfo.depthBiasConstantFactor = SHADOW_DEPTH_BIAS;
+	rasterizationCreateInfo.depthBiasSlopeFactor = SHADOW_SLOPE_BIAS;
+	rasterizationCreateInfo.lineWidth = 1.0f;
+
+	VkPipelineMultisampleStateCreateInfo multisampleCreateInfo{};
+	multisampleCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+	multisampleCreateInfo.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+	VkPipelineDepthStencilStateCreateInfo depthStencilCreateInfo{};
+	depthStencilCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+	depthStencilCreateInfo.depthTestEnable = VK_TRUE;
+	depthStencilCreateInfo.depthWriteEnable = VK_TRUE;
+	depthStencilCreateInfo.depthCompareOp = VK_COMPARE_OP_LESS;
+
+	VkPipelineColorBlendStateCreateInfo colorBlendCreateInfo{};
+	colorBlendCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+
+	std::array<VkDynamicState, 2> dynamicStates = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+	VkPipelineDynamicStateCreateInfo dynamicStateCreateInfo{};
+	dynamicStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+	dynamicStateCreateInfo.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
+	dynamicStateCreateInfo.pDynamicStates = dynamicStates.data();
+
+	VkGraphicsPipelineCreateInfo pipelineCreateInfo{};
+	pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+	pipelineCreateInfo.stageCount = 1;
+	pipelineCreateInfo.pStages = &shaderStage;
+	pipelineCreateInfo.pVertexInputState = &vertexInputCreateInfo;
+	pipelineCreateInfo.pInputAssemblyState = &inputAssemblyCreateInfo;
+	pipelineCreateInfo.pViewportState = &viewportStateCreateInfo;
+	pipelineCreateInfo.pRasterizationState = &rasterizationCreateInfo;
+	pipelineCreateInfo.pMultisampleState = &multisampleCreateInfo;
+	pipelineCreateInfo.pDepthStencilState = &depthStencilCreateInfo;
+	pipelineCreateInfo.pColorBlendState = &colorBlendCreateInfo;
+	pipelineCreateInfo.pDynamicState = &dynamicStateCreateInfo;
+	pipelineCreateInfo.layout = m_shadowPipelineLayout;
+	pipelineCreateInfo.renderPass = m_shadowRenderPass;
+	pipelineCreateInfo.subpass = 0;
+
+	if (vkCreateGraphicsPipelines(m_device, m_pipelineCache, 1, &pipelineCreateInfo, nullptr, &m_shadowPipeline) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create shadow pipeline");
+	}
+
+	vkDestroyShaderModule(m_device, shadowShaderModule, nullptr);
+
+	std::cout << "Shadows: " << ShadowCascades::CASCADE_COUNT << " cascades of " << ShadowCascades::MAP_SIZE << "x" << ShadowCascades::MAP_SIZE
+		<< (linearFilter ? ", 2x2 PCF" : ", no PCF") << ", far cascades every " << m_config.shadowFarInterval << " frames at most" << std::endl;
+}
+
+void Application::destroyShadowResources()
+{
+	vkDestroyPipeline(m_device, m_shadowPipeline, nullptr);
+	vkDestroyPipelineLayout(m_device, m_shadowPipelineLayout, nullptr);
+	for (uint32_t c = 0; c < ShadowCascades::CASCADE_COUNT; c++)
+	{
+		vkDestroyFramebuffer(m_device, m_shadowFramebuffers[c], nullptr);
+		vkDestroyImageView(m_device, m_shadowLayerViews[c], nullptr);
+	}
+	vkDestroyRenderPass(m_device, m_shadowRenderPass, nullptr);
+	vkDestroySampler(m_device, m_shadowSampler, nullptr);
+	vkDestroyImageView(m_device, m_shadowImageView, nullptr);
+	vkDestroyImage(m_device, m_shadowImage, nullptr);
+	vkFreeMemory(m_device, m_shadowImageMemory, nullptr);
+}
+
+uint32_t Application::selectShadowCascades(const FramePacket& packet)
+{
+	uint32_t redraw = 0;
+	uint32_t interval = m_config.shadowFarInterval;
+	for (uint32_t c = 0; c < ShadowCascades::CASCADE_COUNT; c++)
+	{
+		const ShadowCascadePacket& cascade = packet.shadowCascades[c];
+		CachedShadowCascade& cached = m_shadowCache[c];
+
+		// same projection and nothing moved in reach, the layer would come out the same
+		if (cached.valid && cached.generation == cascade.generation && cached.viewProj == cascade.viewProj)
+			continue;
+
+		// far cascades cover a lot of casters at coarse texels, a few frames late is hardly visible. They take turns,
+		// the shader keeps using the matrix their layer was rendered with meanwhile
+		bool farCascade = c >= SHADOW_FIRST_ROUND_ROBIN_CASCADE;
+		if (cached.valid && farCascade && m_frameNumber % interval != (c - SHADOW_FIRST_ROUND_ROBIN_CASCADE) % interval)
+			continue;
+
+		cached = { cascade.viewProj, cascade.generation, true };
+		redraw |= 1u << c;
+	}
+	return redraw;
+}
+
+void Application::recordShadowPasses(VkCommandBuffer commandBuffer, const FramePacket& packet)
+{
+	uint32_t redrawnCascades = 0, drawCalls = 0, instances = 0;
+
+	// bound once, the state carries over from one cascade's render pass to the next
+	if (m_shadowRedraw != 0)
+	{
+		VkDeviceSize offset = 0;
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_shadowPipeline);
+		vkCmdBindVertexBuffers(commandBuffer, 0, 1, &m_vertexBuffer, &offset);
+		vkCmdBindIndexBuffer(commandBuffer, m_indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_shadowPipelineLayout, 0, 1, &m_descriptorSets[m_currentFrame], 0, nullptr);
+		m_frameDescriptorBinds++;
+
+		VkViewport viewport{ 0.0f, 0.0f, static_cast<float>(ShadowCascades::MAP_SIZE), static_cast<float>(ShadowCascades::MAP_SIZE), 0.0f, 1.0f };
+		VkRect2D scissor{ { 0, 0 }, { ShadowCascades::MAP_SIZE, ShadowCascades::MAP_SIZE } };
+		vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+		vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+	}
+
+	for (uint32_t c = 0; c < ShadowCascades::CASCADE_COUNT; c++)
+	{
+		if ((m_shadowRedraw & (1u << c)) == 0)
+			continue;
+
+		// every cascade batches its casters into its own range of this frame's instance buffer, after the scene's
+		const ShadowCascadePacket& cascade = packet.shadowCascades[c];
+		uint32_t firstInstance = m_instanceBufferCapacity * (1 + c);
+		uint32_t instanceCount = m_shadowBatcher.build(cascade.casters, packet.transforms, m_mappedInstanceBuffersMemory[m_currentFrame] + firstInstance,
+			m_instanceBufferCapacity);
+		if (instanceCount < cascade.casters.size())
+			std::cout << "Instance buffer full, dropped " << cascade.casters.size() - instanceCount << " shadow casters" << std::endl;
+
+		VkRenderPassBeginInfo renderPassBeginInfo{};
+		renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+		renderPassBeginInfo.renderPass = m_shadowRenderPass;
+		renderPassBeginInfo.framebuffer = m_shadowFramebuffers[c];
+		renderPassBeginInfo.renderArea.offset = { 0, 0 };
+		renderPassBeginInfo.renderArea.extent = { ShadowCascades::MAP_SIZE, ShadowCascades::MAP_SIZE };
+
+		VkClearValue clearValue{};
+		clearValue.depthStencil = { 1.0f, 0 };
+		renderPassBeginInfo.clearValueCount = 1;
+		renderPassBeginInfo.pClearValues = &clearValue;
+
+		vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+		ShadowPushConstants pushConstants{ cascade.viewProj };
+		vkCmdPushConstants(commandBuffer, m_shadowPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(pushConstants), &pushConstants);
+
+		for (const InstanceBatch& batch : m_shadowBatcher.batches())
+		{
+			vkCmdDrawIndexed(commandBuffer, batch.indexCount, batch.instanceCount, batch.firstIndex, 0, firstInstance + batch.firstInstance);
+			drawCalls++;
+		}
+
+		vkCmdEndRenderPass(commandBuffer);
+		redrawnCascades++;
+		instances += instanceCount;
+	}
+
+	m_frameStats.addShadows(redrawnCascades, ShadowCascades::CASCADE_COUNT - redrawnCascades, drawCalls, instances, packet.shadowMovedObjects);
+}
+
+void Application::createBindlessSetLayout()
+{
+	//textures, whatever materials sample
+	std::array<VkDescriptorSetLayoutBinding, 2> bindings{};
+	bindings[0].binding = 0;
+	bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	bindings[0].descriptorCount = m_bindlessTextureCapacity;
+	bindings[0].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+	//storage buffers, the material table
+	bindings[1].binding = 1;
+	bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	bindings[1].descriptorCount = m_bindlessBufferCapacity;
+	bindings[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+	// only the slots handed out are ever written, and they are written while frames in flight read the others
+	VkDescriptorBindingFlags bindingFlags = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT
+		| VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT;
+	std::array<VkDescriptorBindingFlags, 2> flags = { bindingFlags, bindingFlags };
+
+	VkDescriptorSetLayoutBindingFlagsCreateInfo flagsCreateInfo{};
+	flagsCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+	flagsCreateInfo.bindingCount = static_cast<uint32_t>(flags.size());
+	flagsCreateInfo.pBindingFlags = flags.data();
+
+	VkDescriptorSetLayoutCreateInfo layoutCreateInfo{};
+	layoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutCreateInfo.pNext = &flagsCreateInfo;
+	layoutCreateInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+	layoutCreateInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+	layoutCreateInfo.pBindings = bindings.data();
+
+	if (vkCreateDescriptorSetLayout(m_device, &layoutCreateInfo, nullptr, &m_bindlessSetLayout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create bindless descriptor set layout");
+	}
+}
+
+void Application::createBindlessResources()
+{
+	std::array<VkDescriptorPoolSize, 2> poolSizes{};
+	poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	poolSizes[0].descriptorCount = m_bindlessTextureCapacity;
+	poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSizes[1].descriptorCount = m_bindlessBufferCapacity;
+
+	// one set for all frames in flight, the slots are what is per resource
+	VkDescriptorPoolCreateInfo poolCreateInfo{};
+	poolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolCreateInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+	poolCreateInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+	poolCreateInfo.pPoolSizes = poolSizes.data();
+	poolCreateInfo.maxSets = 1;
+
+	if (vkCreateDescriptorPool(m_device, &poolCreateInfo, nullptr, &m_bindlessDescriptorPool) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create bindless descriptor pool");
+	}
+
+	VkDescriptorSetAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = m_bindlessDescriptorPool;
+	allocInfo.descriptorSetCount = 1;
+	allocInfo.pSetLayouts = &m_bindlessSetLayout;
+
+	if (vkAllocateDescriptorSets(m_device, &allocInfo, &m_bindlessDescriptorSet) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to allocate bindless descriptor set");
+	}
+
+	m_bindlessTextureSlots = DescriptorSlots(m_bindlessTextureCapacity, static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT));
+	m_bindlessBufferSlots = DescriptorSlots(m_bindlessBufferCapacity, static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT));
+
+	// the model comes with one texture, every material samples it until materials bring their own
+	uint32_t sceneTextureSlot = registerBindlessTexture(m_textureImageView, m_textureSampler);
+
+	// material index to texture slot, uploaded once like the vertices
+	std::vector<uint32_t> materialTable(MATERIAL_TABLE_SIZE, sceneTextureSlot);
+	VkDeviceSize bufferSize = sizeof(uint32_t) * materialTable.size();
+
+	VkBuffer stagingBuffer;
+	VkDeviceMemory stagingBufferMemory;
+	createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		stagingBuffer, stagingBufferMemory);
+
+	void* data;
+	vkMapMemory(m_device, stagingBufferMemory, 0, bufferSize, 0, &data);
+	memcpy(data, materialTable.data(), (size_t)bufferSize);
+	vkUnmapMemory(m_device, stagingBufferMemory);
+
+	createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		m_materialTableBuffer, m_materialTableMemory);
+
+	copyBuffer(stagingBuffer, m_materialTableBuffer, bufferSize);
+
+	vkDestroyBuffer(m_device, stagingBuffer, nullptr);
+	vkFreeMemory(m_device, stagingBufferMemory, nullptr);
+
+	m_materialTableSlot = registerBindlessBuffer(m_materialTableBuffer);
+
+	std::cout << "Bindless descriptors: " << m_bindlessTextureCapacity << " texture slots, " << m_bindlessBufferCapacity << " buffer slots" << std::endl;
+}
+
+void Application::destroyBindlessResources()
+{
+	// all null without descriptor indexing
+	vkDestroyBuffer(m_device, m_materialTableBuffer, nullptr);
+	vkFreeMemory(m_device, m_materialTableMemory, nullptr);
+	vkDestroyDescriptorPool(m_device, m_bindlessDescriptorPool, nullptr);
+	vkDestroyDescriptorSetLayout(m_device, m_bindlessSetLayout, nullptr);
+}
+
+uint32_t Application::registerBindlessTexture(VkImageView imageView, VkSampler sampler)
+{
+	uint32_t slot = m_bindlessTextureSlots.allocate();
+	if (slot == DescriptorSlots::INVALID_SLOT)
+		throw std::runtime_error("Bindless texture array is full");
+
+	// nothing in flight reads a slot that was just handed out, update-after-bind lets it be written while they run
+	VkDescriptorImageInfo imageInfo{ sampler, imageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+
+	VkWriteDescriptorSet descriptorWrite{};
+	descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	descriptorWrite.dstSet = m_bindlessDescriptorSet;
+	descriptorWrite.dstBinding = 0;
+	descriptorWrite.dstArrayElement = slot;
+	descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	descriptorWrite.descriptorCount = 1;
+	descriptorWrite.pImageInfo = &imageInfo;
+	vkUpdateDescriptorSets(m_device, 1, &descriptorWrite, 0, nullptr);
+
+	return slot;
+}
+
+uint32_t Application::registerBindlessBuffer(VkBuffer buffer)
+{
+	uint32_t slot = m_bindlessBufferSlots.allocate();
+	if (slot == DescriptorSlots::INVALID_SLOT)
+		throw std::runtime_error("Bindless buffer array is full");
+
+	VkDescriptorBufferInfo bufferInfo{ buffer, 0, VK_WHOLE_SIZE };
+
+	VkWriteDescriptorSet descriptorWrite{};
+	descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	descriptorWrite.dstSet = m_bindlessDescriptorSet;
+	descriptorWrite.dstBinding = 1;
+	descriptorWrite.dstArrayElement = slot;
+	descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	descriptorWrite.descriptorCount = 1;
+	descriptorWrite.pBufferInfo = &bufferInfo;
+	vkUpdateDescriptorSets(m_device, 1, &descriptorWrite, 0, nullptr);
+
+	return slot;
+}
+
+void Application::loadModel()
+{
+	tinyobj::attrib_t attrib;
+	std::vector<tinyobj::shape_t> shapes;
+	std::vector<tinyobj::material_t> materials;
+	std::string warn, err;
+
+	if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, m_modelPath.c_str()))
+	{
+		throw std::runtime_error(warn + err);
+	}
+
+	std::unordered_map<Vertex, uint32_t> uniqueVertices{};
+
+	for (const auto& shape : shapes)
+	{
+		for (const auto& index : shape.mesh.indices)
+		{
+			Vertex vertex{};
+
+			vertex.position =
+			{
+				attrib.vertices[3 * index.vertex_index + 0],
+				attrib.vertices[3 * index.vertex_index + 1],
+				attrib.vertices[3 * index.vertex_index + 2]
+			};
+
+			vertex.texCoord = 
+			{
+				attrib.texcoords[2 * index.texcoord_index + 0],
+				1.0f - attrib.texcoords[2 * index.texcoord_index + 1]
+			};
+
+			vertex.color = { 1.0f, 1.0f, 1.0f };
+
+			if (index.normal_index >= 0)
+			{
+				vertex.normal =
+				{
+					attrib.normals[3 * index.normal_index + 0],
+					attrib.normals[3 * index.normal_index + 1],
+					attrib.normals[3 * index.normal_index + 2]
+				};
+			}
+
+			if (uniqueVertices.count(vertex) == 0) {
+				uniqueVertices[vertex] = static_cast<uint32_t>(m_vertices.size());
+				m_vertices.push_back(vertex);
+			}
+
+			m_indices.push_back(uniqueVertices[vertex]);
+		}
+	}
+
+	// models without normals get smooth ones, the area weighted face normals of every triangle a vertex is part of
+	if (attrib.normals.empty())
+	{
+		for (size_t i = 0; i + 2 < m_indices.size(); i += 3)
+		{
+			Vertex& a = m_vertices[m_indices[i]];
+			Vertex& b = m_vertices[m_indices[i + 1]];
+			Vertex& c = m_vertices[m_indices[i + 2]];
+			glm::vec3 faceNormal = glm::cross(b.position - a.position, c.position - a.position);
+			a.normal += faceNormal;
+			b.normal += faceNormal;
+			c.normal += faceNormal;
+		}
+
+		for (Vertex& vertex : m_vertices)
+			vertex.normal = glm::length(vertex.normal) > 0.0f ? glm::normalize(vertex.normal) : glm::vec3(0.0f, 0.0f, 1.0f);
+	}
+
+	std::cout << "Current model has: " << m_vertices.size() << " vertices" << std::endl;
+	std::cout << "Current model has: " << m_indices.size() << " indices" << std::endl;
+
+	// the depth pre-pass only needs positions, packed on their own they take a quarter of the bandwidth of whole vertices
+	if (m_config.depthPrepass)
+	{
+		m_positions.resize(m_vertices.size());
+		for (size_t i = 0; i < m_vertices.size(); i++)
+			m_positions[i] = m_vertices[i].position;
+	}
+
+	m_meshBounds = computeMeshBounds(&m_vertices[0].position, m_vertices.size(), sizeof(Vertex));
+
+	// the model isn't a solid block, keep the occluder well inside it so it never hides what shows through
+	glm::vec3 center = 0.5f * (m_meshBounds.aabb.min + m_meshBounds.aabb.max);
+	glm::vec3 halfSize = 0.5f * (m_meshBounds.aabb.max - m_meshBounds.aabb.min);
+	Aabb occluderBox{ center - halfSize * glm::vec3(0.8f, 0.8f, 1.0f), center + halfSize * glm::vec3(0.8f, 0.8f, 1.0f) };
+	occluderBox.max.z = m_meshBounds.aabb.min.z + 0.9f * (m_meshBounds.aabb.max.z - m_meshBounds.aabb.min.z);
+	m_buildingOccluder = makeBoxOccluder(occluderBox);
+}
+
+void Application::createVertexBuffer()
+{
+	VkDeviceSize bufferSize = sizeof(m_vertices[0]) * m_vertices.size();
+
+	VkBuffer stagingBuffer;
+	VkDeviceMemory stagingBufferMemory;
+	createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+				stagingBuffer, stagingBufferMemory);
+
+	void* data;
+	vkMapMemory(m_device, stagingBufferMemory, 0, bufferSize, 0, &data);
+	memcpy(data, m_vertices.data(), (size_t)bufferSize);
+	vkUnmapMemory(m_device, stagingBufferMemory);
+
+	// storage as well, the visibility buffer resolve fetches the vertices of the triangle it shades
+	createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		m_vertexBuffer, m_vertexBufferMemory);
+
+	copyBuffer(stagingBuffer, m_vertexBuffer, bufferSize);
+
+	vkDestroyBuffer(m_device, stagingBuffer, nullptr);
+	vkFreeMemory(m_device, stagingBufferMemory, nullptr);
+}
+
+void Application::createPositionBuffer()
+{
+	VkDeviceSize bufferSize = sizeof(m_positions[0]) * m_positions.size();
+
+	VkBuffer stagingBuffer;
+	VkDeviceMemory stagingBufferMemory;
+	createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		stagingBuffer, stagingBufferMemory);
+
+	void* data;
+	vkMapMemory(m_device, stagingBufferMemory, 0, bufferSize, 0, &data);
+	memcpy(data, m_positions.data(), (size_t)bufferSize);
+	vkUnmapMemory(m_device, stagingBufferMemory);
+
+	createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		m_positionBuffer, m_positionBufferMemory);
+
+	copyBuffer(stagingBuffer, m_positionBuffer, bufferSize);
+
+	vkDestroyBuffer(m_device, stagingBuffer, nullptr);
+	vkFreeMemory(m_device, stagingBufferMemory, nullptr);
+
+	std::cout << "Depth pre-pass: position stream of " << bufferSize / 1024 << " KB, vertices are " << sizeof(Vertex) * m_vertices.size() / 1024
+		<< " KB" << std::endl;
+}
+
+VkShaderModule Application::createShaderModule(const std::vector<char>& bytecode)
+{
+	VkShaderModuleCreateInfo createInfo{};
+	createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	createInfo.codeSize = bytecode.size();
+	createInfo.pCode = reinterpret_cast<const uint32_t*>(bytecode.data());
+
+	VkShaderModule shaderModule;
+	if (vkCreateShaderModule(m_device, &createInfo, nullptr, &shaderModule) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create shader module");
+	}
+
+	return shaderModule;
+}
+
+VkSampleCountFlags Application::getUsableSampleCounts()
+{
+	VkPhysicalDeviceProperties physicalDeviceProperties;
+	vkGetPhysicalDeviceProperties(m_physicalDevice, &physicalDeviceProperties);
+
+	return physicalDeviceProperties.limits.framebufferColorSampleCounts &
+		   physicalDeviceProperties.limits.framebufferDepthSampleCounts;
+}
+
+void Application::createIndexBuffer()
+{
+	VkDeviceSize bufferSize = sizeof(m_indices[0]) * m_indices.size();
+	VkBuffer stagingBuffer;
+	VkDeviceMemory stagingBufferMemory;
+	createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		stagingBuffer, stagingBufferMemory);
+
+	void* data;
+	vkMapMemory(m_device, stagingBufferMemory, 0, bufferSize, 0, &data);
+	memcpy(data, m_indices.data(), (size_t)bufferSize);
+	vkUnmapMemory(m_device, stagingBufferMemory);
+
+	createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		m_indexBuffer, m_indexBufferMemory);
+
+	copyBuffer(stagingBuffer, m_indexBuffer, bufferSize);
+
+	vkDestroyBuffer(m_device, stagingBuffer, nullptr);
+	vkFreeMemory(m_device, stagingBufferMemory, nullptr);
+}
+
+void Application::createDescriptorSetLayout()
+{
+	//global ubo
+	VkDescriptorSetLayoutBinding uboLayoutBinding{};
+	uboLayoutBinding.binding = 0; // binding number in shader
+	uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	uboLayoutBinding.descriptorCount = 1; // number of descriptors, if there would be an array of ubos, this would be > 1
+
+	uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT; // shader stages to bind to, the fragment shader reads the cluster grid
+	uboLayoutBinding.pImmutableSamplers = nullptr; // optional
+
+	//sampler
+	VkDescriptorSetLayoutBinding samplerLayoutBinding{};
+	samplerLayoutBinding.binding = 1; // binding number in shader
+	samplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	samplerLayoutBinding.descriptorCount = 1;
+	samplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	samplerLayoutBinding.pImmutableSamplers = nullptr;
+
+	//instance transforms
+	VkDescriptorSetLayoutBinding instanceLayoutBinding{};
+	instanceLayoutBinding.binding = 2;
+	instanceLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	instanceLayoutBinding.descriptorCount = 1;
+	instanceLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT; // the visibility buffer resolve transforms the vertices it fetches
+	instanceLayoutBinding.pImmutableSamplers = nullptr;
+
+	//point lights and their cluster lists
+	VkDescriptorSetLayoutBinding lightLayoutBinding{};
+	lightLayoutBinding.binding = 3;
+	lightLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	lightLayoutBinding.descriptorCount = 1;
+	lightLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	lightLayoutBinding.pImmutableSamplers = nullptr;
+
+	VkDescriptorSetLayoutBinding clusterLayoutBinding = lightLayoutBinding;
+	clusterLayoutBinding.binding = 4;
+
+	//vertices and indices, read by the visibility buffer resolve
+	VkDescriptorSetLayoutBinding vertexLayoutBinding = lightLayoutBinding;
+	vertexLayoutBinding.binding = 5;
+	VkDescriptorSetLayoutBinding indexLayoutBinding = lightLayoutBinding;
+	indexLayoutBinding.binding = 6;
+
+	//cascaded shadow maps, a depth comparison sampler over all layers
+	VkDescriptorSetLayoutBinding shadowLayoutBinding = samplerLayoutBinding;
+	shadowLayoutBinding.binding = 7;
+
+	std::array<VkDescriptorSetLayoutBinding, 8> bindings = { uboLayoutBinding, samplerLayoutBinding, instanceLayoutBinding, lightLayoutBinding, clusterLayoutBinding,
+		vertexLayoutBinding, indexLayoutBinding, shadowLayoutBinding };
+	VkDescriptorSetLayoutCreateInfo layoutCreateInfo{};
+	layoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutCreateInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+	layoutCreateInfo.pBindings = bindings.data();
+
+	if (vkCreateDescriptorSetLayout(m_device, &layoutCreateInfo, nullptr, &m_descriptorSetLayout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create descriptor set layout");
+	}
+}
+
+std::vector<const char*> Application::getRequiredExtensions()
+{
+	uint32_t glfwExtensionCount = 0;
+	const char** glfwExtensions = { 0 };
+	if (!m_config.headless) // no window, no surface extensions needed
+		glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+
+	std::vector<const char*> extensions(glfwExtensions, glfwExtensions + glfwExtensionCount);
+	if (enableValidationLayers)
+		extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
+
+	return extensions;
+}
+
+
+bool Application::CheckWindowExtensionsMatchVulkanExtensions(
+	const std::vector<const char*> glfwExts,														 
+	const std::vector<VkExtensionProperties>& vulkanExts)
+{
+	if (glfwExts.size() > vulkanExts.size())
+		return false;
+
+	/*
+	for (const char* glfwExt : glfwExts)
+		std::cout << "GLFW Extension: " << glfwExt << std::endl;
+	*/
+	
+	/*
+	for (const VkExtensionProperties& vulkanExt : vulkanExts)
+		std::cout << "Vulkan Extension: " << vulkanExt.extensionName << std::endl;
+	*/
+
+	for (const char* glfwExt : glfwExts)
+	{
+		bool extensionFound = false;
+
+		for (const VkExtensionProperties& vulkanExt : vulkanExts)
+		{
+
+			if (std::strcmp(glfwExt, vulkanExt.extensionName))
+			{
+				extensionFound = true;
+				break;
+			}
+		}
+
+		if (!extensionFound)
+			return false;
+	}
+
+	return true;
+}
+
+void Application::createDescriptorPool()
+{
+	std::array<VkDescriptorPoolSize, 3> poolSizes{};
+	//Global UBO
+	poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	poolSizes[0].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+	//Texture and shadow map samplers
+	poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	poolSizes[1].descriptorCount = static_cast<uint32_t>(2 * MAX_FRAMES_IN_FLIGHT);
+	//Instance transforms, lights, light clusters, vertices, indices
+	poolSizes[2].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSizes[2].descriptorCount = static_cast<uint32_t>(5 * MAX_FRAMES_IN_FLIGHT);
+
+	VkDescriptorPoolCreateInfo descriptorPoolCreateInfo{};
+	descriptorPoolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	descriptorPoolCreateInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+	descriptorPoolCreateInfo.pPoolSizes = poolSizes.data();
+	descriptorPoolCreateInfo.maxSets = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+
+	if (vkCreateDescriptorPool(m_device, &descriptorPoolCreateInfo, nullptr, &m_descriptorPool) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create descriptor pool");
+	}
+}
+
+void Application::createDescriptorSets()
+{
+	std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT, m_descriptorSetLayout);
+	
+	VkDescriptorSetAllocateInfo descriptorSetAllocInfo{};
+	descriptorSetAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	descriptorSetAllocInfo.descriptorPool = m_descriptorPool;
+	descriptorSetAllocInfo.descriptorSetCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+	descriptorSetAllocInfo.pSetLayouts = layouts.data();
+
+	m_descriptorSets.resize(MAX_FRAMES_IN_FLIGHT);
+	if (vkAllocateDescriptorSets(m_device, &descriptorSetAllocInfo, m_descriptorSets.data()) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to allocate descriptor sets");
+	}
+
+	for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+	{
+		VkDescriptorBufferInfo bufferInfo{};
+		bufferInfo.buffer = m_uniformBuffers[i];
+		bufferInfo.offset = 0;
+		bufferInfo.range = sizeof(GlobalUBO);
+
+		VkDescriptorImageInfo imageInfo{};
+		imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		imageInfo.imageView = m_textureImageView;
+		imageInfo.sampler = m_textureSampler;
+
+		VkDescriptorBufferInfo instanceBufferInfo{};
+		instanceBufferInfo.buffer = m_instanceBuffers[i];
+		instanceBufferInfo.offset = 0;
+		instanceBufferInfo.range = VK_WHOLE_SIZE;
+
+		VkDescriptorBufferInfo lightBufferInfo{};
+		lightBufferInfo.buffer = m_lightBuffers[i];
+		lightBufferInfo.offset = 0;
+		lightBufferInfo.range = VK_WHOLE_SIZE;
+
+		VkDescriptorBufferInfo clusterBufferInfo{};
+		clusterBufferInfo.buffer = m_clusterBuffers[i];
+		clusterBufferInfo.offset = 0;
+		clusterBufferInfo.range = VK_WHOLE_SIZE;
+
+		VkDescriptorBufferInfo vertexBufferInfo{ m_vertexBuffer, 0, VK_WHOLE_SIZE };
+		VkDescriptorBufferInfo indexBufferInfo{ m_indexBuffer, 0, VK_WHOLE_SIZE };
+		VkDescriptorImageInfo shadowImageInfo{ m_shadowSampler, m_shadowImageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+
+		std::array<VkWriteDescriptorSet, 8> descriptorWrites{};
+		descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[0].dstSet = m_descriptorSets[i];
+		descriptorWrites[0].dstBinding = 0; // binding number in shader
+		descriptorWrites[0].dstArrayElement = 0; // index in array of descriptors
+		descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+		descriptorWrites[0].descriptorCount = 1; // number of descriptors
+		descriptorWrites[0].pBufferInfo = &bufferInfo; // buffer info
+		//descriptorWrite.pImageInfo = nullptr; // optional
+		//descriptorWrite.pTexelBufferView = nullptr; // optional
+
+		descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[1].dstSet = m_descriptorSets[i];
+		descriptorWrites[1].dstBinding = 1;
+		descriptorWrites[1].dstArrayElement = 0;
+		descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		descriptorWrites[1].descriptorCount = 1;
+		descriptorWrites[1].pImageInfo = &imageInfo;
+
+		descriptorWrites[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[2].dstSet = m_descriptorSets[i];
+		descriptorWrites[2].dstBinding = 2;
+		descriptorWrites[2].dstArrayElement = 0;
+		descriptorWrites[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		descriptorWrites[2].descriptorCount = 1;
+		descriptorWrites[2].pBufferInfo = &instanceBufferInfo;
+
+		descriptorWrites[3] = descriptorWrites[2];
+		descriptorWrites[3].dstBinding = 3;
+		descriptorWrites[3].pBufferInfo = &lightBufferInfo;
+
+		descriptorWrites[4] = descriptorWrites[2];
+		descriptorWrites[4].dstBinding = 4;
+		descriptorWrites[4].pBufferInfo = &clusterBufferInfo;
+
+		descriptorWrites[5] = descriptorWrites[2];
+		descriptorWrites[5].dstBinding = 5;
+		descriptorWrites[5].pBufferInfo = &vertexBufferInfo;
+
+		descriptorWrites[6] = descriptorWrites[2];
+		descriptorWrites[6].dstBinding = 6;
+		descriptorWrites[6].pBufferInfo = &indexBufferInfo;
+
+		descriptorWrites[7] = descriptorWrites[1];
+		descriptorWrites[7].dstBinding = 7;
+		descriptorWrites[7].pImageInfo = &shadowImageInfo;
+
+		vkUpdateDescriptorSets(m_device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+	}
+}
+
+void Application::framebufferResizeCallback(GLFWwindow* window, int width, int height)
+{
+	auto app = reinterpret_cast<Application*>(glfwGetWindowUserPointer(window));
+	app->m_framebufferResized = true;
+	app->m_lastResizeEvent = std::chrono::steady_clock::now();
+}
+
+void Application::keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods)
+{
+	auto app = reinterpret_cast<Application*>(glfwGetWindowUserPointer(window));
+	if (action != GLFW_PRESS || app->m_config.qualitySweep)
+		return;
+
+	// M: 1x, 2x, 4x, 8x MSAA and around, N: sample shading off, half the samples, every sample, U: upscale filter,
+	// A: post process AA off, FXAA, TAA (which drops MSAA, M does nothing while it is on)
+	QualityTier tier = app->m_requestedTier;
+	if (key == GLFW_KEY_M)
+	{
+		do
+		{
+			tier.samples = tier.samples >= VK_SAMPLE_COUNT_8_BIT ? VK_SAMPLE_COUNT_1_BIT : static_cast<VkSampleCountFlagBits>(tier.samples << 1);
+		} while (!(app->m_usableSampleCounts & tier.samples));
+	}
+	else if (key == GLFW_KEY_N)
+	{
+		tier.sampleShading = tier.sampleShading >= 1.0f ? 0.0f : tier.sampleShading + 0.5f;
+	}
+	else if (key == GLFW_KEY_U && app->rendersOffscreen())
+	{
+		// no rebuild needed, both filters have their pipeline already
+		uint32_t filter = (static_cast<uint32_t>(app->m_upscaleFilter) + 1) % static_cast<uint32_t>(UpscaleFilter::Count);
+		app->m_upscaleFilter = static_cast<UpscaleFilter>(filter);
+		std::cout << "Upscale filter: " << (app->m_upscaleFilter == UpscaleFilter::Bilinear ? "bilinear" : "edge adaptive") << std::endl;
+		return;
+	}
+	else if (key == GLFW_KEY_A && app->rendersOffscreen())
+	{
+		uint32_t antiAliasing = (static_cast<uint32_t>(tier.antiAliasing) + 1) % static_cast<uint32_t>(PostAntiAliasing::Count);
+		tier.antiAliasing = static_cast<PostAntiAliasing>(antiAliasing);
+	}
+	else
+	{
+		return;
+	}
+
+	app->m_requestedTier = app->clampQualityTier(tier);
+}
+
+QualityTier Application::clampQualityTier(QualityTier tier) const
+{
+	// the counts below the largest usable one aren't guaranteed to be usable as well, walk down to the next one that is
+	while (tier.samples > VK_SAMPLE_COUNT_1_BIT && !(m_usableSampleCounts & tier.samples))
+		tier.samples = static_cast<VkSampleCountFlagBits>(tier.samples >> 1);
+	if (tier.samples < VK_SAMPLE_COUNT_1_BIT)
+		tier.samples = VK_SAMPLE_COUNT_1_BIT;
+
+	// post process AA works on the offscreen scene color, TAA reprojects with a single sampled depth buffer
+	if (!rendersOffscreen())
+		tier.antiAliasing = PostAntiAliasing::None;
+	if (tier.antiAliasing == PostAntiAliasing::Taa)
+		tier.samples = VK_SAMPLE_COUNT_1_BIT;
+	// the visibility buffer holds one triangle per pixel, there is nothing to resolve samples from
+	if (m_config.visibilityBuffer)
+		tier.samples = VK_SAMPLE_COUNT_1_BIT;
+
+	// sample shading means nothing with a single sample
+	if (!m_supportsSampleShading || tier.samples == VK_SAMPLE_COUNT_1_BIT)
+		tier.sampleShading = 0.0f;
+	tier.sampleShading = std::clamp(tier.sampleShading, 0.0f, 1.0f);
+	return tier;
+}
+
+void Application::applyQualityTier()
+{
+	QualityTier tier = m_requestedTier;
+
+	// background compiles build against m_renderPass
+	m_jobSystem.wait(m_pipelineCompiles);
+
+	if (tier.samples != m_qualityTier.samples)
+	{
+		// like a resize, frames still in flight finish with the old attachments, the swap chain itself stays
+		retireSwapChainResources();
+		retireRenderPasses();
+		if (m_config.gpuDriven)
+			retireHizResources();
+
+		m_qualityTier.samples = tier.samples;
+		createImageViews();
+		createRenderPass();
+		createColorResources();
+		createDepthResources();
+		createFramebuffers();
+		createPostDescriptorSet();
+		createVisibilityDescriptorSet();
+		if (m_config.gpuDriven)
+			createHizResources();
+	}
+	// whatever the history holds was rendered without jitter, or not at all
+	if (tier.antiAliasing != m_qualityTier.antiAliasing)
+		m_historyValid = false;
+	m_qualityTier = tier;
+
+	// permutations of other tiers stay cached, switching back doesn't build anything
+	setQualityTier(m_defaultPipelineKey, tier);
+	for (PipelineKey& key : m_pipelineStress.keys)
+		setQualityTier(key, tier);
+	m_graphicsPipeline = getPipeline(m_defaultPipelineKey);
+	m_framePipeline = m_graphicsPipeline;
+	if (m_config.depthPrepass)
+		m_depthPrepassPipeline = getPipeline(depthPrepassKey(m_defaultPipelineKey));
+
+	std::cout << "Quality tier: " << describeQualityTier(tier) << std::endl;
+}
+
+void Application::retireRenderPasses()
+{
+	VkDevice device = m_device;
+	VkRenderPass renderPass = m_renderPass, earlyRenderPass = m_earlyRenderPass, lateRenderPass = m_lateRenderPass;
+	m_renderPass = m_earlyRenderPass = m_lateRenderPass = VK_NULL_HANDLE;
+
+	deferDeletion([=]()
+	{
+		vkDestroyRenderPass(device, renderPass, nullptr);
+		vkDestroyRenderPass(device, earlyRenderPass, nullptr);
+		vkDestroyRenderPass(device, lateRenderPass, nullptr);
+	});
+}
+
+void Application::updateQualitySweep()
+{
+	QualitySweep& sweep = m_qualitySweep;
+	if (sweep.finished)
+		return;
+
+	if (sweep.tiers.empty())
+	{
+		// every usable sample count, each with sample shading off, at half and at every sample
+		for (VkSampleCountFlagBits samples : { VK_SAMPLE_COUNT_1_BIT, VK_SAMPLE_COUNT_2_BIT, VK_SAMPLE_COUNT_4_BIT, VK_SAMPLE_COUNT_8_BIT })
+		{
+			for (float sampleShading : { 0.0f, 0.5f, 1.0f })
+			{
+				QualityTier tier = clampQualityTier({ samples, sampleShading });
+				if (tier.samples == samples && tier.sampleShading == sampleShading)
+					sweep.tiers.push_back(tier);
+			}
+		}
+
+		// then the post process alternatives, on top of a single sample
+		for (PostAntiAliasing antiAliasing : { PostAntiAliasing::Fxaa, PostAntiAliasing::Taa })
+		{
+			QualityTier tier = clampQualityTier({ VK_SAMPLE_COUNT_1_BIT, 0.0f, antiAliasing });
+			if (tier.antiAliasing == antiAliasing)
+				sweep.tiers.push_back(tier);
+		}
+
+		sweep.gpuTimes.resize(sweep.tiers.size());
+		sweep.tierStartFrame = m_frameNumber;
+		m_requestedTier = sweep.tiers[0];
+		return;
+	}
+
+	if (m_frameNumber - sweep.tierStartFrame < QUALITY_SWEEP_FRAMES)
+		return;
+
+	if (++sweep.current == sweep.tiers.size())
+	{
+		sweep.finished = true;
+		printQualitySweep();
+		return;
+	}
+
+	sweep.tierStartFrame = m_frameNumber;
+	m_requestedTier = sweep.tiers[sweep.current];
+}
+
+void Application::printQualitySweep()
+{
+	if (m_timestampQueryPool == VK_NULL_HANDLE)
+	{
+		std::cout << "Quality sweep: no GPU timestamps on this device, nothing measured" << std::endl;
+		return;
+	}
+
+	// one row per sample count and post process AA, one column per sample shading setting
+	std::cout << "Quality sweep at " << m_swapChainExtent.width << "x" << m_swapChainExtent.height << ", GPU ms per frame (average / worst) over "
+		<< QUALITY_SWEEP_FRAMES - QUALITY_SWEEP_WARMUP_FRAMES << " frames per tier:" << std::endl;
+	std::cout << "  tier     | shading off     | shading 0.5     | shading 1.0" << std::endl;
+
+	for (size_t i = 0; i < m_qualitySweep.tiers.size(); i++)
+	{
+		const QualityTier& tier = m_qualitySweep.tiers[i];
+		const GpuTimes& times = m_qualitySweep.gpuTimes[i];
+
+		if (tier.sampleShading == 0.0f)
+		{
+			std::string label = std::to_string(tier.samples) + "x";
+			if (tier.antiAliasing == PostAntiAliasing::Fxaa)
+				label += " FXAA";
+			else if (tier.antiAliasing == PostAntiAliasing::Taa)
+				label += " TAA";
+
+			char row[32];
+			std::snprintf(row, sizeof(row), "  %-8s", label.c_str());
+			std::cout << row;
+		}
+
+		char cell[32];
+		std::snprintf(cell, sizeof(cell), " | %6.3f / %6.3f", times.count > 0 ? times.totalMs / times.count : 0.0, times.worstMs);
+		std::cout << cell;
+
+		bool rowEnds = i + 1 == m_qualitySweep.tiers.size() || m_qualitySweep.tiers[i + 1].sampleShading == 0.0f;
+		if (rowEnds)
+			std::cout << std::endl;
+	}
+}
+
+VKAPI_ATTR VkBool32 VKAPI_CALL Application::debugCallback(
+	VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
+	VkDebugUtilsMessageTypeFlagsEXT messageType,
+	const VkDebugUtilsMessengerCallbackDataEXT* pCallbackData,
+	void* userData)
+{
+	std::cerr << "Validation Layer: " << pCallbackData->pMessage << std::endl;
+
+	return VK_FALSE;
+}
+
+void Application::updateUniformBuffer(uint32_t currentImage, const FramePacket& packet)
+{
+	// the TAA jitter is a fraction of a texel at this frame's render extent
+	updateRenderExtent();
+
+	GlobalUBO ubo{};
+	ubo.view = packet.view;
+	// projection depends on the swap chain extent, which only the render thread knows about
+	ubo.proj = projectionFor(packet, m_swapChainExtent.width / (float)m_swapChainExtent.height);
+	glm::mat4 viewProj = ubo.proj * ubo.view;
+
+	if (m_qualityTier.antiAliasing == PostAntiAliasing::Taa)
+	{
+		// shifts the whole image by up to half a texel, a different position every frame, the history accumulates them
+		uint32_t phase = static_cast<uint32_t>(m_frameNumber % TAA_JITTER_PHASES) + 1;
+		ubo.proj[2][0] += (halton(phase, 2) - 0.5f) * 2.0f / m_renderExtent.width;
+		ubo.proj[2][1] += (halton(phase, 3) - 0.5f) * 2.0f / m_renderExtent.height;
+	}
+	ubo.viewProj = ubo.proj * ubo.view;
+
+	// the history converges towards the unjittered image, so it is reprojected with the unjittered matrix
+	m_taaReprojection = m_previousViewProj * glm::inverse(ubo.viewProj);
+	m_previousViewProj = viewProj;
+
+	// gl_FragCoord runs over the render extent, the clusters split it into GRID_X x GRID_Y tiles
+	glm::vec2 slice = LightClusters::sliceScaleBias(packet.nearPlane, packet.farPlane);
+	ubo.clusterGrid = glm::uvec4(LightClusters::GRID_X, LightClusters::GRID_Y, LightClusters::GRID_Z, static_cast<uint32_t>(packet.lights.size()));
+	ubo.clusterParams = glm::vec4(slice, 1.0f / m_renderExtent.width, 1.0f / m_renderExtent.height);
+
+	// the splits follow the packet, the matrices what the layers hold, a far cascade waiting for its turn keeps the old one
+	if (m_config.shadows)
+	{
+		m_shadowRedraw = selectShadowCascades(packet);
+		for (uint32_t c = 0; c < ShadowCascades::CASCADE_COUNT; c++)
+		{
+			ubo.shadowViewProj[c] = m_shadowCache[c].viewProj;
+			ubo.shadowSplits[c] = packet.shadowCascades[c].splitDepth;
+		}
+		ubo.sunDirection = glm::vec4(-glm::normalize(SUN_DIRECTION), SUN_INTENSITY);
+	}
+
+	// only read by the bindless frame shader
+	ubo.bindless = glm::uvec4(m_materialTableSlot, 0, 0, 0);
+
+	memcpy(m_mappedUniformBuffersMemory[currentImage], &ubo, sizeof(ubo));
+	writeLightBuffers(currentImage, packet);
+}
+
+void Application::createGpuDrivenResources()
+{
+	// the cull pass is recorded into the graphics command buffer
+	uint32_t familyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(m_physicalDevice, &familyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> families(familyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(m_physicalDevice, &familyCount, families.data());
+	if (!(families[findQueueFamilies(m_physicalDevice).graphicsFamily.value()].queueFlags & VK_QUEUE_COMPUTE_BIT))
+	{
+		throw std::runtime_error("GPU driven rendering needs a graphics queue with compute support");
+	}
+
+	VkDeviceSize objectBufferSize = sizeof(GpuObject) * m_instanceBufferCapacity;
+	VkDeviceSize commandBufferSize = 2 * sizeof(VkDrawIndexedIndirectCommand) * m_instanceBufferCapacity; // one region per CullPhase
+
+	m_gpuObjectBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+	m_gpuObjectBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+	m_mappedGpuObjectBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+	m_drawCommandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+	m_drawCommandBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+	m_drawCountBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+	m_drawCountBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+	m_drawCountReadbackBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+	m_drawCountReadbackBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+	m_mappedDrawCountReadbackMemory.resize(MAX_FRAMES_IN_FLIGHT);
+	m_gpuObjectCounts.assign(MAX_FRAMES_IN_FLIGHT, 0);
+
+	for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+	{
+		createBuffer(objectBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			m_gpuObjectBuffers[i], m_gpuObjectBuffersMemory[i]);
+		void* mapped;
+		vkMapMemory(m_device, m_gpuObjectBuffersMemory[i], 0, objectBufferSize, 0, &mapped);
+		m_mappedGpuObjectBuffersMemory[i] = static_cast<GpuObject*>(mapped);
+
+		createBuffer(commandBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			m_drawCommandBuffers[i], m_drawCommandBuffersMemory[i]);
+
+		createBuffer(sizeof(GpuCullCounters), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_drawCountBuffers[i], m_drawCountBuffersMemory[i]);
+
+		createBuffer(sizeof(GpuCullCounters), VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			m_drawCountReadbackBuffers[i], m_drawCountReadbackBuffersMemory[i]);
+		vkMapMemory(m_device, m_drawCountReadbackBuffersMemory[i], 0, sizeof(GpuCullCounters), 0, &mapped);
+		m_mappedDrawCountReadbackMemory[i] = static_cast<GpuCullCounters*>(mapped);
+	}
+
+	// not per frame, the late phase of one frame feeds the early phase of the next
+	createBuffer(sizeof(uint32_t) * m_instanceBufferCapacity, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		m_visibilityBuffer, m_visibilityBufferMemory);
+	m_visibilityCleared = false;
+
+	//descriptors, instance transforms + objects in, draw commands + counters out, frame constants, visibility history
+	std::array<VkDescriptorSetLayoutBinding, 6> bindings{};
+	for (uint32_t i = 0; i < bindings.size(); i++)
+	{
+		bindings[i].binding = i;
+		bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		bindings[i].descriptorCount = 1;
+		bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	}
+	bindings[4].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+
+	VkDescriptorSetLayoutCreateInfo layoutCreateInfo{};
+	layoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutCreateInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+	layoutCreateInfo.pBindings = bindings.data();
+
+	if (vkCreateDescriptorSetLayout(m_device, &layoutCreateInfo, nullptr, &m_cullDescriptorSetLayout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create cull descriptor set layout");
+	}
+
+	std::array<VkDescriptorPoolSize, 2> poolSizes{};
+	poolSizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSizes[0].descriptorCount = static_cast<uint32_t>((bindings.size() - 1) * MAX_FRAMES_IN_FLIGHT);
+	poolSizes[1].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	poolSizes[1].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+
+	VkDescriptorPoolCreateInfo descriptorPoolCreateInfo{};
+	descriptorPoolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	descriptorPoolCreateInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+	descriptorPoolCreateInfo.pPoolSizes = poolSizes.data();
+	descriptorPoolCreateInfo.maxSets = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+
+	if (vkCreateDescriptorPool(m_device, &descriptorPoolCreateInfo, nullptr, &m_cullDescriptorPool) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create cull descriptor pool");
+	}
+
+	std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT, m_cullDescriptorSetLayout);
+	VkDescriptorSetAllocateInfo descriptorSetAllocInfo{};
+	descriptorSetAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	descriptorSetAllocInfo.descriptorPool = m_cullDescriptorPool;
+	descriptorSetAllocInfo.descriptorSetCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+	descriptorSetAllocInfo.pSetLayouts = layouts.data();
+
+	m_cullDescriptorSets.resize(MAX_FRAMES_IN_FLIGHT);
+	if (vkAllocateDescriptorSets(m_device, &descriptorSetAllocInfo, m_cullDescriptorSets.data()) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to allocate cull descriptor sets");
+	}
+
+	for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+	{
+		std::array<VkDescriptorBufferInfo, 6> bufferInfos{};
+		bufferInfos[0] = { m_instanceBuffers[i], 0, VK_WHOLE_SIZE };
+		bufferInfos[1] = { m_gpuObjectBuffers[i], 0, VK_WHOLE_SIZE };
+		bufferInfos[2] = { m_drawCommandBuffers[i], 0, VK_WHOLE_SIZE };
+		bufferInfos[3] = { m_drawCountBuffers[i], 0, VK_WHOLE_SIZE };
+		bufferInfos[4] = { m_uniformBuffers[i], 0, sizeof(GlobalUBO) };
+		bufferInfos[5] = { m_visibilityBuffer, 0, VK_WHOLE_SIZE };
+
+		std::array<VkWriteDescriptorSet, 6> descriptorWrites{};
+		for (uint32_t binding = 0; binding < descriptorWrites.size(); binding++)
+		{
+			descriptorWrites[binding].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrites[binding].dstSet = m_cullDescriptorSets[i];
+			descriptorWrites[binding].dstBinding = binding;
+			descriptorWrites[binding].descriptorType = bindings[binding].descriptorType;
+			descriptorWrites[binding].descriptorCount = 1;
+			descriptorWrites[binding].pBufferInfo = &bufferInfos[binding];
+		}
+
+		vkUpdateDescriptorSets(m_device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+	}
+
+	createCullPipeline();
+	createHizResources();
+
+	std::cout << "GPU driven rendering: " << (m_supportsDrawIndirectCount ? "compacted draws with indirect count" :
+		m_supportsMultiDrawIndirect ? "multi draw indirect without count" : "one indirect draw per object") << ", two phase Hi-Z occlusion culling" << std::endl;
+}
+
+void Application::createCullPipeline()
+{
+	// Hi-Z descriptors, set layouts are fixed, the sets themselves follow the swap chain (createHizResources)
+	std::array<VkDescriptorSetLayoutBinding, 3> buildBindings{};
+	for (uint32_t i = 0; i < buildBindings.size(); i++)
+	{
+		buildBindings[i].binding = i;
+		buildBindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+		buildBindings[i].descriptorCount = 1;
+		buildBindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	}
+	buildBindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER; // depth buffer
+
+	VkDescriptorSetLayoutBinding sampleBinding = buildBindings[0];
+
+	VkDescriptorSetLayoutCreateInfo layoutCreateInfo{};
+	layoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutCreateInfo.bindingCount = static_cast<uint32_t>(buildBindings.size());
+	layoutCreateInfo.pBindings = buildBindings.data();
+
+	if (vkCreateDescriptorSetLayout(m_device, &layoutCreateInfo, nullptr, &m_hizBuildDescriptorSetLayout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create Hi-Z descriptor set layout");
+	}
+
+	layoutCreateInfo.bindingCount = 1;
+	layoutCreateInfo.pBindings = &sampleBinding;
+
+	if (vkCreateDescriptorSetLayout(m_device, &layoutCreateInfo, nullptr, &m_hizSampleDescriptorSetLayout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create Hi-Z descriptor set layout");
+	}
+
+	VkSamplerCreateInfo samplerCreateInfo{};
+	samplerCreateInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	samplerCreateInfo.magFilter = VK_FILTER_NEAREST;
+	samplerCreateInfo.minFilter = VK_FILTER_NEAREST;
+	samplerCreateInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	samplerCreateInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerCreateInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerCreateInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerCreateInfo.maxLod = VK_LOD_CLAMP_NONE;
+
+	if (vkCreateSampler(m_device, &samplerCreateInfo, nullptr, &m_hizSampler) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create Hi-Z sampler");
+	}
+
+	VkPushConstantRange pushConstantRange{};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(CullPushConstants);
+
+	std::array<VkDescriptorSetLayout, 2> cullSetLayouts = { m_cullDescriptorSetLayout, m_hizSampleDescriptorSetLayout };
+
+	VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo{};
+	pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutCreateInfo.setLayoutCount = static_cast<uint32_t>(cullSetLayouts.size());
+	pipelineLayoutCreateInfo.pSetLayouts = cullSetLayouts.data();
+	pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+	pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+
+	if (vkCreatePipelineLayout(m_device, &pipelineLayoutCreateInfo, nullptr, &m_cullPipelineLayout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create cull pipeline layout");
+	}
+
+	pushConstantRange.size = sizeof(HizPushConstants);
+	pipelineLayoutCreateInfo.setLayoutCount = 1;
+	pipelineLayoutCreateInfo.pSetLayouts = &m_hizBuildDescriptorSetLayout;
+
+	if (vkCreatePipelineLayout(m_device, &pipelineLayoutCreateInfo, nullptr, &m_hizPipelineLayout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create Hi-Z pipeline layout");
+	}
+
+	auto createComputePipeline = [this](const std::string& path, VkPipelineLayout layout, const VkSpecializationInfo* specializationInfo)
+	{
+		VkShaderModule shaderModule = createShaderModule(readFile(path));
+
+		VkComputePipelineCreateInfo pipelineCreateInfo{};
+		pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+		pipelineCreateInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		pipelineCreateInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+		pipelineCreateInfo.stage.module = shaderModule;
+		pipelineCreateInfo.stage.pName = "main";
+		pipelineCreateInfo.stage.pSpecializationInfo = specializationInfo;
+		pipelineCreateInfo.layout = layout;
+
+		VkPipeline pipeline;
+		VkResult result = vkCreateComputePipelines(m_device, m_pipelineCache, 1, &pipelineCreateInfo, nullptr, &pipeline);
+		vkDestroyShaderModule(m_device, shaderModule, nullptr);
+
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create compute pipeline from " + path);
+		}
+		return pipeline;
+	};
+
+	// compaction needs the count to be read by the GPU, otherwise culled objects keep their slot with instanceCount 0
+	VkBool32 compact = m_supportsDrawIndirectCount ? VK_TRUE : VK_FALSE;
+	VkSpecializationMapEntry specializationEntry{ 0, 0, sizeof(VkBool32) };
+	VkSpecializationInfo specializationInfo{};
+	specializationInfo.mapEntryCount = 1;
+	specializationInfo.pMapEntries = &specializationEntry;
+	specializationInfo.dataSize = sizeof(compact);
+	specializationInfo.pData = &compact;
+
+	m_cullPipeline = createComputePipeline("shaders/cull_comp.spv", m_cullPipelineLayout, &specializationInfo);
+	// sampler2DMS can't be used on a single sampled depth buffer and vice versa, the quality tier picks one per frame
+	m_hizPipeline = createComputePipeline("shaders/hiz_comp.spv", m_hizPipelineLayout, nullptr);
+	m_hizMsPipeline = createComputePipeline("shaders/hiz_ms_comp.spv", m_hizPipelineLayout, nullptr);
+}
+
+void Application::createHizResources()
+{
+	// power of two so every level halves exactly, level 0 then covers up to 2x2 depth texels at the largest render extent
+	m_hizExtent = { std::bit_floor(m_sceneExtent.width), std::bit_floor(m_sceneExtent.height) };
+	m_hizLevels = std::min(HIZ_MAX_LEVELS, static_cast<uint32_t>(std::bit_width(std::max(m_hizExtent.width, m_hizExtent.height))));
+
+	createImage(m_hizExtent.width, m_hizExtent.height, m_hizLevels, VK_SAMPLE_COUNT_1_BIT, VK_FORMAT_R32_SFLOAT, VK_IMAGE_TILING_OPTIMAL,
+		VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_hizImage, m_hizImageMemory);
+	m_hizImageView = createImageView(m_hizImage, VK_FORMAT_R32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, m_hizLevels);
+
+	m_hizLevelViews.resize(m_hizLevels);
+	for (uint32_t level = 0; level < m_hizLevels; level++)
+	{
+		VkImageViewCreateInfo imageViewCreateInfo{};
+		imageViewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		imageViewCreateInfo.image = m_hizImage;
+		imageViewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		imageViewCreateInfo.format = VK_FORMAT_R32_SFLOAT;
+		imageViewCreateInfo.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, level, 1, 0, 1 };
+
+		if (vkCreateImageView(m_device, &imageViewCreateInfo, nullptr, &m_hizLevelViews[level]) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create Hi-Z level view");
+		}
+	}
+
+	// one build set per level plus the set the cull pass samples from, retired together with the views they point at
+	std::array<VkDescriptorPoolSize, 2> poolSizes{};
+	poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	poolSizes[0].descriptorCount = m_hizLevels + 1;
+	poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	poolSizes[1].descriptorCount = 2 * m_hizLevels;
+
+	VkDescriptorPoolCreateInfo descriptorPoolCreateInfo{};
+	descriptorPoolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	descriptorPoolCreateInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+	descriptorPoolCreateInfo.pPoolSizes = poolSizes.data();
+	descriptorPoolCreateInfo.maxSets = m_hizLevels + 1;
+
+	if (vkCreateDescriptorPool(m_device, &descriptorPoolCreateInfo, nullptr, &m_hizDescriptorPool) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create Hi-Z descriptor pool");
+	}
+
+	std::vector<VkDescriptorSetLayout> layouts(m_hizLevels, m_hizBuildDescriptorSetLayout);
+	layouts.push_back(m_hizSampleDescriptorSetLayout);
+
+	VkDescriptorSetAllocateInfo descriptorSetAllocInfo{};
+	descriptorSetAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	descriptorSetAllocInfo.descriptorPool = m_hizDescriptorPool;
+	descriptorSetAllocInfo.descriptorSetCount = static_cast<uint32_t>(layouts.size());
+	descriptorSetAllocInfo.pSetLayouts = layouts.data();
+
+	std::vector<VkDescriptorSet> descriptorSets(layouts.size());
+	if (vkAllocateDescriptorSets(m_device, &descriptorSetAllocInfo, descriptorSets.data()) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to allocate Hi-Z descriptor sets");
+	}
+	m_hizSampleDescriptorSet = descriptorSets.back();
+	descriptorSets.pop_back();
+	m_hizBuildDescriptorSets = std::move(descriptorSets);
+
+	VkDescriptorImageInfo depthInfo{ m_hizSampler, m_depthImageView, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL };
+	VkDescriptorImageInfo pyramidInfo{ m_hizSampler, m_hizImageView, VK_IMAGE_LAYOUT_GENERAL };
+
+	for (uint32_t level = 0; level < m_hizLevels; level++)
+	{
+		// level 0 reads the depth buffer, its source binding only has to be valid
+		VkDescriptorImageInfo sourceInfo{ VK_NULL_HANDLE, m_hizLevelViews[level > 0 ? level - 1 : 0], VK_IMAGE_LAYOUT_GENERAL };
+		VkDescriptorImageInfo destInfo{ VK_NULL_HANDLE, m_hizLevelViews[level], VK_IMAGE_LAYOUT_GENERAL };
+		std::array<const VkDescriptorImageInfo*, 3> imageInfos = { &depthInfo, &sourceInfo, &destInfo };
+
+		std::array<VkWriteDescriptorSet, 3> descriptorWrites{};
+		for (uint32_t binding = 0; binding < descriptorWrites.size(); binding++)
+		{
+			descriptorWrites[binding].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrites[binding].dstSet = m_hizBuildDescriptorSets[level];
+			descriptorWrites[binding].dstBinding = binding;
+			descriptorWrites[binding].descriptorType = binding == 0 ? VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER : VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+			descriptorWrites[binding].descriptorCount = 1;
+			descriptorWrites[binding].pImageInfo = imageInfos[binding];
+		}
+
+		vkUpdateDescriptorSets(m_device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+	}
 
-	void* data;
-	vkMapMemory(m_device, stagingBufferMemory, 0, bufferSize, 0, &data);
-	memcpy(data, m_vertices.data(), (size_t)bufferSize);
-	vkUnmapMemory(m_device, stagingBufferMemory);
+	VkWriteDescriptorSet sampleWrite{};
+	sampleWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	sampleWrite.dstSet = m_hizSampleDescriptorSet;
+	sampleWrite.dstBinding = 0;
+	sampleWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	sampleWrite.descriptorCount = 1;
+	sampleWrite.pImageInfo = &pyramidInfo;
+	vkUpdateDescriptorSets(m_device, 1, &sampleWrite, 0, nullptr);
+}
 
-	createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-		m_vertexBuffer, m_vertexBufferMemory);
+void Application::retireHizResources()
+{
+	VkDevice device = m_device;
+	VkImage image = m_hizImage;
+	VkDeviceMemory imageMemory = m_hizImageMemory;
+	VkImageView imageView = m_hizImageView;
+	std::vector<VkImageView> levelViews = std::move(m_hizLevelViews);
+	VkDescriptorPool descriptorPool = m_hizDescriptorPool;
 
-	copyBuffer(stagingBuffer, m_vertexBuffer, bufferSize);
+	m_hizLevelViews.clear();
+	m_hizBuildDescriptorSets.clear();
 
-	vkDestroyBuffer(m_device, stagingBuffer, nullptr);
-	vkFreeMemory(m_device, stagingBufferMemory, nullptr);
+	deferDeletion([=]()
+	{
+		vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+		for (VkImageView levelView : levelViews)
+			vkDestroyImageView(device, levelView, nullptr);
+		vkDestroyImageView(device, imageView, nullptr);
+		vkDestroyImage(device, image, nullptr);
+		vkFreeMemory(device, imageMemory, nullptr);
+	});
 }
 
-VkShaderModule Application::createShaderModule(const std::vector<char>& bytecode)
+void Application::destroyGpuDrivenResources()
 {
-	VkShaderModuleCreateInfo createInfo{};
-	createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-	createInfo.codeSize = bytecode.size();
-	createInfo.pCode = reinterpret_cast<const uint32_t*>(bytecode.data());
+	for (size_t i = 0; i < m_gpuObjectBuffers.size(); i++)
+	{
+		vkDestroyBuffer(m_device, m_gpuObjectBuffers[i], nullptr);
+		vkFreeMemory(m_device, m_gpuObjectBuffersMemory[i], nullptr);
+		vkDestroyBuffer(m_device, m_drawCommandBuffers[i], nullptr);
+		vkFreeMemory(m_device, m_drawCommandBuffersMemory[i], nullptr);
+		vkDestroyBuffer(m_device, m_drawCountBuffers[i], nullptr);
+		vkFreeMemory(m_device, m_drawCountBuffersMemory[i], nullptr);
+		vkDestroyBuffer(m_device, m_drawCountReadbackBuffers[i], nullptr);
+		vkFreeMemory(m_device, m_drawCountReadbackBuffersMemory[i], nullptr);
+	}
+	vkDestroyBuffer(m_device, m_visibilityBuffer, nullptr);
+	vkFreeMemory(m_device, m_visibilityBufferMemory, nullptr);
 
-	VkShaderModule shaderModule;
-	if (vkCreateShaderModule(m_device, &createInfo, nullptr, &shaderModule) != VK_SUCCESS)
+	if (m_hizImage != VK_NULL_HANDLE)
 	{
-		throw std::runtime_error("Failed to create shader module");
+		retireHizResources();
+		flushDeletionQueue(true);
 	}
 
-	return shaderModule;
+	vkDestroyPipeline(m_device, m_cullPipeline, nullptr);
+	vkDestroyPipelineLayout(m_device, m_cullPipelineLayout, nullptr);
+	vkDestroyDescriptorPool(m_device, m_cullDescriptorPool, nullptr);
+	vkDestroyDescriptorSetLayout(m_device, m_cullDescriptorSetLayout, nullptr);
+
+	vkDestroyPipeline(m_device, m_hizPipeline, nullptr);
+	vkDestroyPipeline(m_device, m_hizMsPipeline, nullptr);
+	vkDestroyPipelineLayout(m_device, m_hizPipelineLayout, nullptr);
+	vkDestroyDescriptorSetLayout(m_device, m_hizBuildDescriptorSetLayout, nullptr);
+	vkDestroyDescriptorSetLayout(m_device, m_hizSampleDescriptorSetLayout, nullptr);
+	vkDestroySampler(m_device, m_hizSampler, nullptr);
 }
 
-VkSampleCountFlagBits Application::getMaxUsableSampleCount()
+uint32_t Application::writeGpuObjects(const FramePacket& packet)
 {
-	VkPhysicalDeviceProperties physicalDeviceProperties;
-	vkGetPhysicalDeviceProperties(m_physicalDevice, &physicalDeviceProperties);
+	// everything the simulation produced, unculled, culling happens on the GPU
+	uint32_t objectCount = std::min(static_cast<uint32_t>(packet.drawList.size()), m_instanceBufferCapacity);
+	glm::mat4* instanceTransforms = m_mappedInstanceBuffersMemory[m_currentFrame];
+	GpuObject* objects = m_mappedGpuObjectBuffersMemory[m_currentFrame];
+	glm::vec4 sphere(m_meshBounds.sphere.center, m_meshBounds.sphere.radius);
 
-	VkSampleCountFlags counts = physicalDeviceProperties.limits.framebufferColorSampleCounts &
-								physicalDeviceProperties.limits.framebufferDepthSampleCounts;
+	for (uint32_t i = 0; i < objectCount; i++)
+	{
+		const DrawItem& item = packet.drawList[i];
+		instanceTransforms[i] = packet.transforms[item.transformIndex];
+		objects[i] = { sphere, item.firstIndex, item.indexCount, item.materialIndex, 0 };
+	}
 
-	if (counts & VK_SAMPLE_COUNT_64_BIT) { return VK_SAMPLE_COUNT_64_BIT; }
-	if (counts & VK_SAMPLE_COUNT_32_BIT) { return VK_SAMPLE_COUNT_32_BIT; }
-	if (counts & VK_SAMPLE_COUNT_16_BIT) { return VK_SAMPLE_COUNT_16_BIT; }
-	if (counts & VK_SAMPLE_COUNT_8_BIT) { return VK_SAMPLE_COUNT_8_BIT; }
-	if (counts & VK_SAMPLE_COUNT_4_BIT) { return VK_SAMPLE_COUNT_4_BIT; }
-	if (counts & VK_SAMPLE_COUNT_2_BIT) { return VK_SAMPLE_COUNT_2_BIT; }
-	return VK_SAMPLE_COUNT_1_BIT;
+	m_gpuObjectCounts[m_currentFrame] = objectCount;
+	return objectCount;
 }
 
-void Application::createIndexBuffer()
+void Application::recordGpuDrivenFrame(VkCommandBuffer commandBuffer, uint32_t imageIndex, const FramePacket& packet)
 {
-	VkDeviceSize bufferSize = sizeof(m_indices[0]) * m_indices.size();
-	VkBuffer stagingBuffer;
-	VkDeviceMemory stagingBufferMemory;
-	createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-		stagingBuffer, stagingBufferMemory);
+	// objects keep their index from frame to frame, that is what ties them to their visibility history
+	uint32_t objectCount = writeGpuObjects(packet);
 
-	void* data;
-	vkMapMemory(m_device, stagingBufferMemory, 0, bufferSize, 0, &data);
-	memcpy(data, m_indices.data(), (size_t)bufferSize);
-	vkUnmapMemory(m_device, stagingBufferMemory);
+	if (!m_visibilityCleared)
+	{
+		// nothing was visible before the first frame, the late phase tests everything
+		vkCmdFillBuffer(commandBuffer, m_visibilityBuffer, 0, VK_WHOLE_SIZE, 0);
+		m_visibilityCleared = true;
+	}
+	vkCmdFillBuffer(commandBuffer, m_drawCountBuffers[m_currentFrame], 0, sizeof(GpuCullCounters), 0);
+
+	// also orders this frame's culling after the late phase of the previous one, which wrote the visibility
+	VkMemoryBarrier clearBarrier{};
+	clearBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	clearBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	clearBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		0, 1, &clearBarrier, 0, nullptr, 0, nullptr);
+
+	uint32_t drawCalls = 0;
+
+	recordGpuCulling(commandBuffer, packet, objectCount, CullPhase::Early);
+	beginScenePass(commandBuffer, m_earlyRenderPass, imageIndex);
+	if (m_framePipeline != VK_NULL_HANDLE)
+		drawCalls += recordIndirectDraws(commandBuffer, objectCount, CullPhase::Early);
+	vkCmdEndRenderPass(commandBuffer);
 
-	createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-		m_indexBuffer, m_indexBufferMemory);
+	recordHizBuild(commandBuffer);
 
-	copyBuffer(stagingBuffer, m_indexBuffer, bufferSize);
+	recordGpuCulling(commandBuffer, packet, objectCount, CullPhase::Late);
+	beginScenePass(commandBuffer, m_lateRenderPass, imageIndex);
+	if (m_framePipeline != VK_NULL_HANDLE)
+		drawCalls += recordIndirectDraws(commandBuffer, objectCount, CullPhase::Late);
+	vkCmdEndRenderPass(commandBuffer);
 
-	vkDestroyBuffer(m_device, stagingBuffer, nullptr);
-	vkFreeMemory(m_device, stagingBufferMemory, nullptr);
+	// culled counts arrive MAX_FRAMES_IN_FLIGHT frames later through readGpuCullResults
+	m_frameStats.addDrawCounts(drawCalls, objectCount, 0);
 }
 
-void Application::createDescriptorSetLayout()
+void Application::recordGpuCulling(VkCommandBuffer commandBuffer, const FramePacket& packet, uint32_t objectCount, CullPhase phase)
 {
-	//global ubo
-	VkDescriptorSetLayoutBinding uboLayoutBinding{};
-	uboLayoutBinding.binding = 0; // binding number in shader
-	uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	uboLayoutBinding.descriptorCount = 1; // number of descriptors, if there would be an array of ubos, this would be > 1
+	CullPushConstants pushConstants{};
+	Frustum frustum = Frustum::fromViewProj(projectionFor(packet, m_swapChainExtent.width / (float)m_swapChainExtent.height) * packet.view);
+	std::copy(std::begin(frustum.planes), std::end(frustum.planes), pushConstants.planes);
+	pushConstants.objectCount = objectCount;
+	pushConstants.phase = static_cast<uint32_t>(phase);
+	pushConstants.pyramidSize = glm::vec2(m_hizExtent.width, m_hizExtent.height);
+
+	std::array<VkDescriptorSet, 2> descriptorSets = { m_cullDescriptorSets[m_currentFrame], m_hizSampleDescriptorSet };
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_cullPipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_cullPipelineLayout, 0, static_cast<uint32_t>(descriptorSets.size()), descriptorSets.data(), 0, nullptr);
+	m_frameDescriptorBinds++;
+	vkCmdPushConstants(commandBuffer, m_cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pushConstants), &pushConstants);
+	vkCmdDispatch(commandBuffer, (objectCount + 63) / 64, 1, 1);
+
+	// commands and counters are consumed by the indirect draws and the late phase, the counters also get copied back for the stats
+	VkMemoryBarrier cullBarrier{};
+	cullBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	cullBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	cullBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		0, 1, &cullBarrier, 0, nullptr, 0, nullptr);
+
+	if (phase != CullPhase::Late)
+		return;
 
-	uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT; // shader stage to bind to
-	uboLayoutBinding.pImmutableSamplers = nullptr; // optional
+	VkBufferCopy copyRegion{ 0, 0, sizeof(GpuCullCounters) };
+	vkCmdCopyBuffer(commandBuffer, m_drawCountBuffers[m_currentFrame], m_drawCountReadbackBuffers[m_currentFrame], 1, &copyRegion);
 
-	//sampler
-	VkDescriptorSetLayoutBinding samplerLayoutBinding{};
-	samplerLayoutBinding.binding = 1; // binding number in shader
-	samplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	samplerLayoutBinding.descriptorCount = 1;
-	samplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-	samplerLayoutBinding.pImmutableSamplers = nullptr;
+	VkMemoryBarrier readbackBarrier{};
+	readbackBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	readbackBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	readbackBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &readbackBarrier, 0, nullptr, 0, nullptr);
+}
 
-	std::array<VkDescriptorSetLayoutBinding, 2> bindings = { uboLayoutBinding, samplerLayoutBinding };
-	VkDescriptorSetLayoutCreateInfo layoutCreateInfo{};
-	layoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-	layoutCreateInfo.bindingCount = static_cast<uint32_t>(bindings.size());
-	layoutCreateInfo.pBindings = bindings.data();
+void Application::recordHizBuild(VkCommandBuffer commandBuffer)
+{
+	VkImageAspectFlags depthAspect = VK_IMAGE_ASPECT_DEPTH_BIT | (hasStencilComponent(findDepthFormat()) ? VK_IMAGE_ASPECT_STENCIL_BIT : 0);
 
-	if (vkCreateDescriptorSetLayout(m_device, &layoutCreateInfo, nullptr, &m_descriptorSetLayout) != VK_SUCCESS)
+	// early depth becomes readable, the color has to survive until the late pass loads it,
+	// the pyramid is rewritten completely so its old contents (read by the previous late phase) can be discarded
+	std::array<VkImageMemoryBarrier, 2> imageBarriers{};
+	for (VkImageMemoryBarrier& barrier : imageBarriers)
 	{
-		throw std::runtime_error("Failed to create descriptor set layout");
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
 	}
-}
+	imageBarriers[0].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	imageBarriers[0].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	imageBarriers[0].oldLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+	imageBarriers[0].newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+	imageBarriers[0].image = m_depthImage;
+	imageBarriers[0].subresourceRange = { depthAspect, 0, 1, 0, 1 };
+
+	imageBarriers[1].srcAccessMask = 0;
+	imageBarriers[1].dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	imageBarriers[1].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	imageBarriers[1].newLayout = VK_IMAGE_LAYOUT_GENERAL;
+	imageBarriers[1].image = m_hizImage;
+	imageBarriers[1].subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, m_hizLevels, 0, 1 };
+
+	VkMemoryBarrier colorBarrier{};
+	colorBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	colorBarrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	colorBarrier.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
 
-std::vector<const char*> Application::getRequiredExtensions()
-{
-	uint32_t glfwExtensionCount = 0;
-	const char** glfwExtensions = { 0 };
-	glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+	vkCmdPipelineBarrier(commandBuffer,
+		VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		0, 1, &colorBarrier, 0, nullptr, static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
 
-	std::vector<const char*> extensions(glfwExtensions, glfwExtensions + glfwExtensionCount);
-	if (enableValidationLayers)
-		extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_qualityTier.samples == VK_SAMPLE_COUNT_1_BIT ? m_hizPipeline : m_hizMsPipeline);
 
-	return extensions;
-}
+	HizPushConstants pushConstants{};
+	// only the rendered part of the depth buffer, the pyramid always spans the whole view
+	pushConstants.sourceWidth = m_renderExtent.width;
+	pushConstants.sourceHeight = m_renderExtent.height;
+	pushConstants.fromDepth = 1;
 
+	for (uint32_t level = 0; level < m_hizLevels; level++)
+	{
+		pushConstants.destWidth = std::max(1u, m_hizExtent.width >> level);
+		pushConstants.destHeight = std::max(1u, m_hizExtent.height >> level);
+
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_hizPipelineLayout, 0, 1, &m_hizBuildDescriptorSets[level], 0, nullptr);
+		m_frameDescriptorBinds++;
+		vkCmdPushConstants(commandBuffer, m_hizPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pushConstants), &pushConstants);
+		vkCmdDispatch(commandBuffer, (pushConstants.destWidth + 7) / 8, (pushConstants.destHeight + 7) / 8, 1);
+
+		// the next level reads this one, after the last level the cull pass samples all of them
+		VkMemoryBarrier levelBarrier{};
+		levelBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		levelBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		levelBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &levelBarrier, 0, nullptr, 0, nullptr);
+
+		pushConstants.sourceWidth = pushConstants.destWidth;
+		pushConstants.sourceHeight = pushConstants.destHeight;
+		pushConstants.fromDepth = 0;
+	}
 
-bool Application::CheckWindowExtensionsMatchVulkanExtensions(
-	const std::vector<const char*> glfwExts,														 
-	const std::vector<VkExtensionProperties>& vulkanExts)
+	// back to an attachment for the late pass, reads are done so only the execution dependency matters
+	VkImageMemoryBarrier depthBarrier = imageBarriers[0];
+	depthBarrier.srcAccessMask = 0;
+	depthBarrier.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	depthBarrier.oldLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+	depthBarrier.newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+		0, 0, nullptr, 0, nullptr, 1, &depthBarrier);
+}
+
+uint32_t Application::recordIndirectDraws(VkCommandBuffer commandBuffer, uint32_t objectCount, CullPhase phase)
 {
-	if (glfwExts.size() > vulkanExts.size())
-		return false;
+	DrawPushConstants pushConstants{};
+	pushConstants.model = glm::mat4(1.0f);
+	// material index is per draw command now, nothing reads it yet
+	vkCmdPushConstants(commandBuffer, m_pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(pushConstants), &pushConstants);
 
-	/*
-	for (const char* glfwExt : glfwExts)
-		std::cout << "GLFW Extension: " << glfwExt << std::endl;
-	*/
-	
-	/*
-	for (const VkExtensionProperties& vulkanExt : vulkanExts)
-		std::cout << "Vulkan Extension: " << vulkanExt.extensionName << std::endl;
-	*/
+	// each phase has its own region of objectCount commands and its own count
+	const uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+	VkDeviceSize commandOffset = static_cast<VkDeviceSize>(phase) * objectCount * stride;
+	VkDeviceSize countOffset = offsetof(GpuCullCounters, drawCount) + static_cast<VkDeviceSize>(phase) * sizeof(uint32_t);
 
-	for (const char* glfwExt : glfwExts)
+	if (m_supportsDrawIndirectCount)
 	{
-		bool extensionFound = false;
+		m_vkCmdDrawIndexedIndirectCount(commandBuffer, m_drawCommandBuffers[m_currentFrame], commandOffset, m_drawCountBuffers[m_currentFrame], countOffset, objectCount, stride);
+		return 1;
+	}
+	else if (m_supportsMultiDrawIndirect)
+	{
+		vkCmdDrawIndexedIndirect(commandBuffer, m_drawCommandBuffers[m_currentFrame], commandOffset, objectCount, stride);
+		return 1;
+	}
 
-		for (const VkExtensionProperties& vulkanExt : vulkanExts)
-		{
+	for (uint32_t i = 0; i < objectCount; i++)
+	{
+		vkCmdDrawIndexedIndirect(commandBuffer, m_drawCommandBuffers[m_currentFrame], commandOffset + i * stride, 1, stride);
+	}
+	return objectCount;
+}
 
-			if (std::strcmp(glfwExt, vulkanExt.extensionName))
-			{
-				extensionFound = true;
-				break;
-			}
-		}
+void Application::readGpuCullResults(uint32_t frame)
+{
+	if (!m_config.gpuDriven || m_gpuObjectCounts[frame] == 0)
+		return;
 
-		if (!extensionFound)
-			return false;
-	}
+	const GpuCullCounters& counters = *m_mappedDrawCountReadbackMemory[frame];
+	m_frameStats.addDrawCounts(0, 0, counters.frustumCulledObjects + counters.occlusionCulledObjects);
+	m_frameStats.addOcclusionCulling(counters.occlusionCulledObjects, counters.frustumCulledTriangles, counters.occlusionCulledTriangles);
+}
 
-	return true;
+glm::mat4 Application::projectionFor(const FramePacket& packet, float aspect)
+{
+	glm::mat4 proj = glm::perspective(packet.fovY, aspect, packet.nearPlane, packet.farPlane);
+	proj[1][1] *= -1; // flip y coordinate
+	return proj;
 }
 
-void Application::createDescriptorPool()
+void Application::createUniformBuffers()
 {
-	std::array<VkDescriptorPoolSize, 2> poolSizes{};
-	//Global UBO
-	poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	poolSizes[0].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
-	//Sampler
-	poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	poolSizes[1].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+	VkDeviceSize bufferSize = sizeof(GlobalUBO);
 
-	VkDescriptorPoolCreateInfo descriptorPoolCreateInfo{};
-	descriptorPoolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-	descriptorPoolCreateInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
-	descriptorPoolCreateInfo.pPoolSizes = poolSizes.data();
-	descriptorPoolCreateInfo.maxSets = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+	m_uniformBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+	m_uniformBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+	m_mappedUniformBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
 
-	if (vkCreateDescriptorPool(m_device, &descriptorPoolCreateInfo, nullptr, &m_descriptorPool) != VK_SUCCESS)
+	for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
 	{
-		throw std::runtime_error("Failed to create descriptor pool");
+		createBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		m_uniformBuffers[i], m_uniformBuffersMemory[i]);
+
+		vkMapMemory(m_device, m_uniformBuffersMemory[i], 0, bufferSize, 0, &m_mappedUniformBuffersMemory[i]);
 	}
 }
 
-void Application::createDescriptorSets()
+void Application::createInstanceBuffers()
 {
-	std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT, m_descriptorSetLayout);
-	
-	VkDescriptorSetAllocateInfo descriptorSetAllocInfo{};
-	descriptorSetAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-	descriptorSetAllocInfo.descriptorPool = m_descriptorPool;
-	descriptorSetAllocInfo.descriptorSetCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
-	descriptorSetAllocInfo.pSetLayouts = layouts.data();
+	// the benchmark scenes know their final size up front, everything else fits into the minimum. With shadows every
+	// cascade gets a range of the same size after the scene's, see recordShadowPasses
+	m_instanceBufferCapacity = std::max({ INSTANCE_BUFFER_MIN_CAPACITY, m_config.instanceCount, m_config.citySize * m_config.citySize });
+	uint32_t ranges = m_config.shadows ? 1 + ShadowCascades::CASCADE_COUNT : 1;
+	VkDeviceSize bufferSize = sizeof(glm::mat4) * m_instanceBufferCapacity * ranges;
 
-	m_descriptorSets.resize(MAX_FRAMES_IN_FLIGHT);
-	if (vkAllocateDescriptorSets(m_device, &descriptorSetAllocInfo, m_descriptorSets.data()) != VK_SUCCESS)
-	{
-		throw std::runtime_error("Failed to allocate descriptor sets");
-	}
+	m_instanceBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+	m_instanceBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+	m_mappedInstanceBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
 
 	for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
 	{
-		VkDescriptorBufferInfo bufferInfo{};
-		bufferInfo.buffer = m_uniformBuffers[i];
-		bufferInfo.offset = 0;
-		bufferInfo.range = sizeof(GlobalUBO);
-
-		VkDescriptorImageInfo imageInfo{};
-		imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-		imageInfo.imageView = m_textureImageView;
-		imageInfo.sampler = m_textureSampler;
+		createBuffer(bufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		m_instanceBuffers[i], m_instanceBuffersMemory[i]);
 
-		std::array<VkWriteDescriptorSet, 2> descriptorWrites{};
-		descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		descriptorWrites[0].dstSet = m_descriptorSets[i];
-		descriptorWrites[0].dstBinding = 0; // binding number in shader
-		descriptorWrites[0].dstArrayElement = 0; // index in array of descriptors
-		descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-		descriptorWrites[0].descriptorCount = 1; // number of descriptors
-		descriptorWrites[0].pBufferInfo = &bufferInfo; // buffer info
-		//descriptorWrite.pImageInfo = nullptr; // optional
-		//descriptorWrite.pTexelBufferView = nullptr; // optional
+		void* mapped;
+		vkMapMemory(m_device, m_instanceBuffersMemory[i], 0, bufferSize, 0, &mapped);
+		m_mappedInstanceBuffersMemory[i] = static_cast<glm::mat4*>(mapped);
+	}
+}
 
-		descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		descriptorWrites[1].dstSet = m_descriptorSets[i];
-		descriptorWrites[1].dstBinding = 1;
-		descriptorWrites[1].dstArrayElement = 0;
-		descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-		descriptorWrites[1].descriptorCount = 1;
-		descriptorWrites[1].pImageInfo = &imageInfo;
+void Application::createLightBuffers()
+{
+	// the cluster lists can't outgrow MAX_LIGHTS_PER_CLUSTER per cluster. Without lights the shader never reads either
+	// buffer, they only exist so the descriptors are valid
+	uint32_t lightCapacity = std::max(m_config.lightCount, 1u);
+	uint32_t indexCapacity = m_config.lightCount > 0 ? LightClusters::CLUSTER_COUNT * LightClusters::MAX_LIGHTS_PER_CLUSTER : 1;
+	VkDeviceSize lightBufferSize = sizeof(PointLight) * lightCapacity;
+	VkDeviceSize clusterBufferSize = sizeof(glm::uvec2) * LightClusters::CLUSTER_COUNT + sizeof(uint32_t) * indexCapacity;
+
+	m_lightBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+	m_lightBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+	m_mappedLightBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+	m_clusterBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+	m_clusterBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+	m_mappedClusterBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
 
-		vkUpdateDescriptorSets(m_device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+	for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+	{
+		createBuffer(lightBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			m_lightBuffers[i], m_lightBuffersMemory[i]);
+		void* mapped;
+		vkMapMemory(m_device, m_lightBuffersMemory[i], 0, lightBufferSize, 0, &mapped);
+		m_mappedLightBuffersMemory[i] = static_cast<PointLight*>(mapped);
+
+		createBuffer(clusterBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			m_clusterBuffers[i], m_clusterBuffersMemory[i]);
+		vkMapMemory(m_device, m_clusterBuffersMemory[i], 0, clusterBufferSize, 0, &m_mappedClusterBuffersMemory[i]);
 	}
 }
 
-void Application::framebufferResizeCallback(GLFWwindow* window, int width, int height)
+void Application::writeLightBuffers(uint32_t frame, const FramePacket& packet)
 {
-	auto app = reinterpret_cast<Application*>(glfwGetWindowUserPointer(window));
-	app->m_framebufferResized = true;
+	if (packet.lights.empty())
+		return;
+
+	// layout of ClusterBuffer in lighting.glsl, the ranges of every cluster, then the indices they point at
+	const ClusterLightLists& clusters = packet.lightClusters;
+	char* clusterMemory = static_cast<char*>(m_mappedClusterBuffersMemory[frame]);
+	memcpy(m_mappedLightBuffersMemory[frame], packet.lights.data(), sizeof(PointLight) * packet.lights.size());
+	memcpy(clusterMemory, clusters.ranges.data(), sizeof(glm::uvec2) * LightClusters::CLUSTER_COUNT);
+	memcpy(clusterMemory + sizeof(glm::uvec2) * LightClusters::CLUSTER_COUNT, clusters.lightIndices.data(), sizeof(uint32_t) * clusters.lightIndices.size());
 }
 
-VKAPI_ATTR VkBool32 VKAPI_CALL Application::debugCallback(
-	VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
-	VkDebugUtilsMessageTypeFlagsEXT messageType,
-	const VkDebugUtilsMessengerCallbackDataEXT* pCallbackData,
-	void* userData)
+void Application::createTimestampQueries()
 {
-	std::cerr << "Validation Layer: " << pCallbackData->pMessage << std::endl;
+	m_timestampsWritten.assign(MAX_FRAMES_IN_FLIGHT, false);
+	m_timestampSweepTiers.assign(MAX_FRAMES_IN_FLIGHT, -1);
 
-	return VK_FALSE;
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(m_physicalDevice, &properties);
+
+	if (!properties.limits.timestampComputeAndGraphics)
+	{
+		std::cout << "GPU timestamps not supported, GPU frame times won't be reported" << std::endl;
+		return;
+	}
+	m_timestampPeriod = properties.limits.timestampPeriod;
+
+	VkQueryPoolCreateInfo queryPoolCreateInfo{};
+	queryPoolCreateInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	queryPoolCreateInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	queryPoolCreateInfo.queryCount = TIMESTAMPS_PER_FRAME * MAX_FRAMES_IN_FLIGHT;
+
+	if (vkCreateQueryPool(m_device, &queryPoolCreateInfo, nullptr, &m_timestampQueryPool) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create timestamp query pool");
+	}
 }
 
-void Application::updateUniformBuffer(uint32_t currentImage)
+void Application::createPipelineStatisticsQueries()
 {
-	static auto startTime = std::chrono::high_resolution_clock::now();
+	m_statisticsWritten.assign(MAX_FRAMES_IN_FLIGHT, false);
+
+	if (!m_supportsPipelineStatistics)
+	{
+		std::cout << "Pipeline statistics queries not supported, fragment shader invocations won't be reported" << std::endl;
+		return;
+	}
 
-	auto currentTime = std::chrono::high_resolution_clock::now();
-	float time = std::chrono::duration<float, std::chrono::seconds::period>(currentTime - startTime).count();
+	VkQueryPoolCreateInfo queryPoolCreateInfo{};
+	queryPoolCreateInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	queryPoolCreateInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+	queryPoolCreateInfo.queryCount = MAX_FRAMES_IN_FLIGHT;
+	queryPoolCreateInfo.pipelineStatistics = VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
 
-	GlobalUBO ubo{};
-	float scale_factor = 1.0f; // Adjust the scaling factor as needed
-	glm::mat4 rotation_matrix = glm::rotate(glm::mat4(1.0f), time * glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	glm::mat4 scaling_matrix = glm::scale(glm::mat4(1.0f), glm::vec3(scale_factor, scale_factor, scale_factor));
-	ubo.model = scaling_matrix * rotation_matrix;	//ubo.model = glm::mat4(1.0f);
-	ubo.view = glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	ubo.proj = glm::perspective(glm::radians(45.0f), m_swapChainExtent.width / (float)m_swapChainExtent.height, 0.1f, 10.0f);
-
-	ubo.proj[1][1] *= -1; // flip y coordinate
-	memcpy(m_mappedUniformBuffersMemory[currentImage], &ubo, sizeof(ubo));
+	if (vkCreateQueryPool(m_device, &queryPoolCreateInfo, nullptr, &m_statisticsQueryPool) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create pipeline statistics query pool");
+	}
 }
 
-void Application::createUniformBuffers()
+void Application::readPipelineStatistics(uint32_t frame)
 {
-	VkDeviceSize bufferSize = sizeof(GlobalUBO);
-
-	m_uniformBuffers.resize(MAX_FRAMES_IN_FLIGHT);
-	m_uniformBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
-	m_mappedUniformBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+	// like the timestamps, the frame's fence was waited on
+	if (m_statisticsQueryPool == VK_NULL_HANDLE || !m_statisticsWritten[frame])
+		return;
 
-	for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+	uint64_t fragmentInvocations;
+	if (vkGetQueryPoolResults(m_device, m_statisticsQueryPool, frame, 1, sizeof(fragmentInvocations), &fragmentInvocations, sizeof(uint64_t),
+		VK_QUERY_RESULT_64_BIT) == VK_SUCCESS)
 	{
-		createBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-		m_uniformBuffers[i], m_uniformBuffersMemory[i]);
+		m_frameStats.addFragmentInvocations(fragmentInvocations);
+	}
+}
 
-		vkMapMemory(m_device, m_uniformBuffersMemory[i], 0, bufferSize, 0, &m_mappedUniformBuffersMemory[i]);
+void Application::readGpuFrameTime(uint32_t frame)
+{
+	// called after the frame's fence was waited on, so the results are available if they were written at all
+	if (m_timestampQueryPool == VK_NULL_HANDLE || !m_timestampsWritten[frame])
+		return;
+
+	uint64_t timestamps[TIMESTAMPS_PER_FRAME];
+	if (vkGetQueryPoolResults(m_device, m_timestampQueryPool, TIMESTAMPS_PER_FRAME * frame, TIMESTAMPS_PER_FRAME, sizeof(timestamps), timestamps, sizeof(uint64_t),
+		VK_QUERY_RESULT_64_BIT) == VK_SUCCESS)
+	{
+		double gpuTimeMs = (timestamps[2] - timestamps[0]) * m_timestampPeriod / 1e6;
+		m_frameStats.addGpuTime(gpuTimeMs);
+		if (m_config.shadows)
+			m_frameStats.addShadowGpuTime((timestamps[1] - timestamps[0]) * m_timestampPeriod / 1e6);
+		if (m_config.dynamicResolution)
+			m_resolutionController.addGpuTime(gpuTimeMs);
+
+		int sweepTier = m_timestampSweepTiers[frame];
+		if (sweepTier >= 0 && !m_qualitySweep.finished)
+		{
+			GpuTimes& times = m_qualitySweep.gpuTimes[sweepTier];
+			times.count++;
+			times.totalMs += gpuTimeMs;
+			times.worstMs = std::max(times.worstMs, gpuTimeMs);
+		}
 	}
 }
 
@@ -1578,16 +5756,22 @@ void Application::createTextureSampler()
 	}
 }
 
-void Application::createTextureImage()
+void Application::decodeTextureImage()
 {
-	int texWidth, texHeight, texChannels;
-	stbi_uc* pixels = stbi_load("textures/viking_room.png", &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-	VkDeviceSize imageSize = texWidth * texHeight * 4;
+	int texChannels;
+	m_decodedTexture.pixels = stbi_load("textures/viking_room.png", &m_decodedTexture.width, &m_decodedTexture.height, &texChannels, STBI_rgb_alpha);
 
-	if (!pixels)
+	if (!m_decodedTexture.pixels)
 	{
 		throw std::runtime_error("Failed to load texture image");
 	}
+}
+
+void Application::createTextureImage()
+{
+	int texWidth = m_decodedTexture.width, texHeight = m_decodedTexture.height;
+	stbi_uc* pixels = m_decodedTexture.pixels;
+	VkDeviceSize imageSize = texWidth * texHeight * 4;
 
 	m_mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(texWidth, texHeight)))) + 1;
 
@@ -1602,14 +5786,14 @@ void Application::createTextureImage()
 	vkUnmapMemory(m_device, stagingBufferMemory);
 
 	stbi_image_free(pixels);
+	m_decodedTexture.pixels = nullptr;
 
 	createImage(texWidth, texHeight, m_mipLevels, VK_SAMPLE_COUNT_1_BIT, VK_FORMAT_R8G8B8A8_SRGB , VK_IMAGE_TILING_OPTIMAL,
 		VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
 		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_textureImage, m_textureImageMemory);
 
-	transitionImageLayout(m_textureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, m_mipLevels);
+	transitionImageLayout(m_textureImage, { VK_IMAGE_ASPECT_COLOR_BIT, 0, m_mipLevels, 0, 1 }, ResourceUsage::None, ResourceUsage::TransferDst);
 	copyBufferToImage(stagingBuffer, m_textureImage, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight));
-	//transitionImageLayout(m_textureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, m_mipLevels);
 
 	vkDestroyBuffer(m_device, stagingBuffer, nullptr);
 	vkFreeMemory(m_device, stagingBufferMemory, nullptr);
@@ -1623,7 +5807,7 @@ void Application::createTextureImageView()
 }
 
 void Application::createImage(uint32_t width, uint32_t height, uint32_t mipLevels, VkSampleCountFlagBits numSamples, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usageFlags,
-	VkMemoryPropertyFlags memoryPropertyFlags, VkImage& image, VkDeviceMemory& imageMemory)
+	VkMemoryPropertyFlags memoryPropertyFlags, VkImage& image, VkDeviceMemory& imageMemory, uint32_t arrayLayers)
 {
 	VkImageCreateInfo imageCreateInfo{};
 	imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -1632,7 +5816,7 @@ void Application::createImage(uint32_t width, uint32_t height, uint32_t mipLevel
 	imageCreateInfo.extent.height = height;
 	imageCreateInfo.extent.depth = 1;
 	imageCreateInfo.mipLevels = mipLevels;
-	imageCreateInfo.arrayLayers = 1;
+	imageCreateInfo.arrayLayers = arrayLayers;
 	imageCreateInfo.format = format;
 	imageCreateInfo.tiling = tiling;
 	imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
@@ -1770,48 +5954,12 @@ void Application::endSingleTimeCommands(VkCommandBuffer commandBuffer)
 	vkFreeCommandBuffers(m_device, m_commandPool, 1, &commandBuffer);
 }
 
-void Application::transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels)
+void Application::transitionImageLayout(VkImage image, const VkImageSubresourceRange& range, ResourceUsage from, ResourceUsage to)
 {
 	VkCommandBuffer commandBuffer = beginSingleTimeCommands();
 
-	VkImageMemoryBarrier imageMemoryBarrier{};
-	imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-	imageMemoryBarrier.oldLayout = oldLayout;
-	imageMemoryBarrier.newLayout = newLayout;
-	imageMemoryBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	imageMemoryBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	imageMemoryBarrier.image = image;
-	imageMemoryBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	imageMemoryBarrier.subresourceRange.baseMipLevel = 0;
-	imageMemoryBarrier.subresourceRange.levelCount = mipLevels;
-	imageMemoryBarrier.subresourceRange.baseArrayLayer = 0;
-	imageMemoryBarrier.subresourceRange.layerCount = 1;
-
-	VkPipelineStageFlags sourceStage;
-	VkPipelineStageFlags destinationStage;
-	
-	if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)
-	{
-		imageMemoryBarrier.srcAccessMask = 0; // no flags required
-		imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT; // transfer write required
-
-		sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT; // earliest possible pipeline stage
-		destinationStage = VK_PIPELINE_STAGE_TRANSFER_BIT; // transfer stage
-	}
-	else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
-	{
-		imageMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT; // transfer write required
-		imageMemoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT; // shader read required
-
-		sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT; // transfer stage
-		destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT; // fragment shader stage
-	}
-	else
-	{
-		throw std::invalid_argument("Unsupported layout transition");
-	}
-
-	vkCmdPipelineBarrier(commandBuffer, sourceStage, destinationStage, 0, 0, nullptr, 0, nullptr, 1, &imageMemoryBarrier);
+	VkImageMemoryBarrier imageMemoryBarrier = RenderGraph::imageBarrier(image, range, from, to);
+	vkCmdPipelineBarrier(commandBuffer, RenderGraph::usageInfo(from).stages, RenderGraph::usageInfo(to).stages, 0, 0, nullptr, 0, nullptr, 1, &imageMemoryBarrier);
 
 	endSingleTimeCommands(commandBuffer);
 }
@@ -1861,8 +6009,11 @@ VkImageView Application::createImageView(VkImage image, VkFormat format, VkImage
 void Application::createDepthResources()
 {
 	VkFormat depthFormat = findDepthFormat();
-	createImage(m_swapChainExtent.width, m_swapChainExtent.height, 1, m_msaaSamples, depthFormat, VK_IMAGE_TILING_OPTIMAL,
-		VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_depthImage, m_depthImageMemory);
+	// sampled by hiz.comp in the gpu driven path and by the TAA pass offscreen
+	bool sampled = m_config.gpuDriven || rendersOffscreen();
+	VkImageUsageFlags usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | (sampled ? VK_IMAGE_USAGE_SAMPLED_BIT : 0);
+	createImage(m_sceneExtent.width, m_sceneExtent.height, 1, m_qualityTier.samples, depthFormat, VK_IMAGE_TILING_OPTIMAL,
+		usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_depthImage, m_depthImageMemory);
 	m_depthImageView = createImageView(m_depthImage, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT, 1);
 
 	//depth transition handling here :TODO
@@ -1873,7 +6024,7 @@ VkFormat Application::findDepthFormat()
 	return findSupportedFormat(
 		{ VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D24_UNORM_S8_UINT },
 		  VK_IMAGE_TILING_OPTIMAL,
-		  VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT);
+		  VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT | (m_config.gpuDriven || rendersOffscreen() ? VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT : 0));
 }
 
 bool Application::hasStencilComponent(VkFormat format)
@@ -1924,9 +6075,9 @@ VkVertexInputBindingDescription Vertex::getBindingDescription()
 	return bindingDescription;
 }
 
-std::array<VkVertexInputAttributeDescription, 3> Vertex::getAttributeDescriptions()
+std::array<VkVertexInputAttributeDescription, 4> Vertex::getAttributeDescriptions()
 {
-	std::array<VkVertexInputAttributeDescription, 3> attributeDescriptions{};
+	std::array<VkVertexInputAttributeDescription, 4> attributeDescriptions{};
 
 	// position attribute
 	attributeDescriptions[0].binding = 0; // index of the binding in the array of bindings
@@ -1946,5 +6097,11 @@ std::array<VkVertexInputAttributeDescription, 3> Vertex::getAttributeDescription
 	attributeDescriptions[2].format = VK_FORMAT_R32G32_SFLOAT;
 	attributeDescriptions[2].offset = offsetof(Vertex, texCoord);
 
+	// normal
+	attributeDescriptions[3].binding = 0;
+	attributeDescriptions[3].location = 3;
+	attributeDescriptions[3].format = VK_FORMAT_R32G32B32_SFLOAT;
+	attributeDescriptions[3].offset = offsetof(Vertex, normal);
+
 	return attributeDescriptions;
 }
@@ -21,13 +21,235 @@
 #include <array>
 #include <chrono>
 #include <unordered_map>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <string>
+#include <mutex>
+
+#include "FrameStats.h"
+#include "TripleBuffer.h"
+#include "JobSystem.h"
+#include "InstanceBatcher.h"
+#include "Culling.h"
+#include "LightClusters.h"
+#include "ShadowCascades.h"
+#include "RenderQueue.h"
+#include "OcclusionBuffer.h"
+#include "RenderableStore.h"
+#include "SceneGraph.h"
+#include "ResolutionController.h"
+#include "RenderGraph.h"
+#include "DescriptorSlots.h"
+
+enum class PipelineStressMode
+{
+	None,
+	Async, // compiled on the job system, draws use the fallback pipeline meanwhile
+	Sync // compiled on the render thread within one frame, for comparison
+};
+
+enum class UpscaleFilter : uint32_t
+{
+	Bilinear,
+	EdgeAdaptive, // bilinear, then sharpened where the neighbourhood has little contrast already (contrast adaptive sharpening)
+	Count
+};
+
+enum class PostAntiAliasing : uint32_t
+{
+	None,
+	Fxaa, // edge search on the luma of the scene color, done by the output pass
+	Taa, // jittered projection, each frame blended into the history reprojected from the previous ones, single sampled only
+	Count
+};
+
+struct ApplicationConfig
+{
+	bool headless = false; // no window/surface, renders into an offscreen image ring and accepts CPU Vulkan implementations
+	uint32_t width = 1200, height = 800; // of the window, or of the offscreen images in headless mode
+	uint32_t frameCount = 0; // frames to render before exiting, 0 runs until the window is closed
+	std::string dumpDirectory; // headless only, rendered frames are read back and written there as .ppm if set
+	uint32_t dumpInterval = 60; // dump every Nth frame
+	PipelineStressMode pipelineStress = PipelineStressMode::None; // introduce PIPELINE_STRESS_COUNT new permutations mid-run
+	uint32_t instanceCount = 0; // benchmark scene, scatters copies of the model, doubling every INSTANCE_RAMP_FRAMES up to this count
+	bool gpuDriven = false; // cull in a compute pass and draw through indirect commands instead of CPU culling + batching
+	bool sortDraws = true; // CPU path, orders the culled draw list by draw key so batches and state changes follow pipeline, material and mesh
+	bool visibilityBuffer = false; // CPU path, single sampled, draws only triangle IDs and shades every pixel once in a fullscreen resolve
+	bool depthPrepass = false; // CPU path, lays down depth from a position only stream first, the main pass shades with depth test EQUAL
+	uint32_t citySize = 0; // occlusion test scene, a citySize x citySize grid of buildings seen from street level
+	uint32_t lightCount = 0; // point lights moving over the scene, clustered forward shading, 0 renders unlit
+	bool shadows = false; // sun light with cascaded shadow maps, a cascade is only redrawn when its casters or its projection changed
+	uint32_t shadowFarInterval = 1; // far cascades redraw at most every Nth frame, taking turns, 1 redraws them whenever they change
+	bool staticInstances = false; // the instance scene doesn't spin, for comparing cached shadows against animated casters
+	uint32_t msaaSamples = 4; // 1, 2, 4 or 8, clamped to what the device supports
+	float sampleShading = 0.0f; // minSampleShading, 0 turns sample shading off
+	bool qualitySweep = false; // measures the GPU time of every quality tier in turn, prints a table and exits
+	bool dynamicResolution = false; // render the scene offscreen at a scale picked from GPU frame times, upscale into the swap chain
+	ResolutionSettings resolution; // bounds and budget of the dynamic resolution controller
+	UpscaleFilter upscaleFilter = UpscaleFilter::Bilinear;
+	PostAntiAliasing antiAliasing = PostAntiAliasing::None; // post process AA on the offscreen scene color, instead of or on top of MSAA
+	bool bindless = false; // textures in an update-after-bind array the shaders index by material, needs Vulkan 1.2 descriptor indexing
+};
+
+// MSAA sample count, the fraction of samples the fragment shader runs for and the post process AA, switchable at runtime
+struct QualityTier
+{
+	VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT; // 1 renders straight into the target image, without a resolve
+	float sampleShading = 0.0f; // 0 shades once per pixel, 1 once per sample
+	PostAntiAliasing antiAliasing = PostAntiAliasing::None; // offscreen rendering only
+
+	bool operator==(const QualityTier& other) const = default;
+};
 
 //Graphics specific
+// per frame, everything per object goes through DrawPushConstants
 struct GlobalUBO
 {
-	alignas(16) glm::mat4 model;
+	alignas(16) glm::mat4 viewProj; // premultiplied once on the CPU instead of per vertex
 	alignas(16) glm::mat4 view;
 	alignas(16) glm::mat4 proj;
+	alignas(16) glm::uvec4 clusterGrid; // xyz LightClusters grid size, w light count, 0 renders unlit
+	alignas(16) glm::vec4 clusterParams; // slice scale and bias (see LightClusters::sliceScaleBias), 1 / render extent
+	alignas(16) glm::mat4 shadowViewProj[ShadowCascades::CASCADE_COUNT]; // per cascade, what its shadow map layer was rendered with
+	alignas(16) glm::vec4 shadowSplits; // view depth where each cascade ends
+	alignas(16) glm::vec4 sunDirection; // xyz towards the sun, w its intensity, 0 without shadows
+	alignas(16) glm::uvec4 bindless; // x slot of the material table in the bindless buffer array
+};
+
+// per draw, must stay within the 128 bytes every implementation guarantees for push constants
+struct DrawPushConstants
+{
+	glm::mat4 model; // applied on top of the instance transforms, identity for batched draws
+	uint32_t materialIndex;
+	uint32_t firstTriangle; // visibility buffer, first triangle of the mesh in the shared index buffer
+};
+static_assert(sizeof(DrawPushConstants) <= 128, "push constants exceed the guaranteed minimum size");
+
+// shadow pass, one cascade at a time, layout matches shadow.vert
+struct ShadowPushConstants
+{
+	glm::mat4 viewProj;
+};
+
+// GPU driven path, one per object, layout matches GpuObject in cull.comp
+struct GpuObject
+{
+	glm::vec4 sphere; // object space center, radius
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	uint32_t materialIndex;
+	uint32_t pad;
+};
+
+// counters written by cull.comp, copied back for the stats, layout matches CullCounters in cull.comp
+struct GpuCullCounters
+{
+	uint32_t drawCount[2]; // per CullPhase, read by vkCmdDrawIndexedIndirectCount
+	uint32_t frustumCulledObjects;
+	uint32_t frustumCulledTriangles;
+	uint32_t occlusionCulledObjects;
+	uint32_t occlusionCulledTriangles;
+};
+
+// Two phase occlusion culling. Early draws whatever passed the Hi-Z test last frame, the pyramid is rebuilt from that depth,
+// then late tests everything against it and draws what was wrongly hidden (disoccluded) last frame.
+enum class CullPhase : uint32_t
+{
+	Early,
+	Late
+};
+
+struct CullPushConstants
+{
+	glm::vec4 planes[6];
+	uint32_t objectCount;
+	uint32_t phase; // CullPhase
+	glm::vec2 pyramidSize; // Hi-Z level 0 in texels
+};
+static_assert(sizeof(CullPushConstants) <= 128, "push constants exceed the guaranteed minimum size");
+
+struct HizPushConstants
+{
+	uint32_t sourceWidth, sourceHeight;
+	uint32_t destWidth, destHeight;
+	uint32_t fromDepth; // level 0 reduces the depth buffer, every other level the one above it
+};
+
+// fullscreen pass from the offscreen scene color into the swap chain image, layout matches upscale.frag
+struct UpscalePushConstants
+{
+	glm::vec2 uvScale; // render extent over scene target extent, the part of the target that was rendered to
+	glm::vec2 uvClamp; // last texel center inside that part, bilinear taps past it would read stale texels
+	glm::vec2 texelSize; // of the scene target, in uv
+	float sharpness; // edge adaptive filter only, 0 mild to 1 strong
+};
+
+// temporal AA pass from the scene color and the previous history into the next history, layout matches taa.frag
+struct TaaPushConstants
+{
+	glm::mat4 reprojection; // clip space of this frame, jittered, to the one of the previous frame, unjittered
+	glm::vec2 uvScale; // as in UpscalePushConstants, for this frame's render extent
+	glm::vec2 historyUvScale; // the same for the render extent the history was written at
+	glm::vec2 historyUvClamp;
+	glm::vec2 texelSize; // of the scene targets and the history, in uv
+	float currentWeight; // of this frame in the blend, 1 discards the history
+};
+static_assert(sizeof(TaaPushConstants) <= 128, "push constants exceed the guaranteed minimum size");
+
+// the GPU driven path splits the frame around the Hi-Z build, all variants are compatible with m_renderPass
+enum class ScenePass
+{
+	Full, // clear, draw, resolve
+	Early, // clear, draw, keep color and depth for the late pass
+	Late // load, draw, resolve
+};
+
+// a cascade as handed to the render thread, the casters as draw items of the packet's transforms
+struct ShadowCascadePacket
+{
+	glm::mat4 viewProj{ 1.0f };
+	float splitDepth = 0.0f;
+	uint64_t generation = 0; // see ShadowCascade, grows monotonically, so skipped packets can't hide a change
+	std::vector<DrawItem> casters;
+};
+
+// Everything the render thread needs from the simulation for one frame. Written by the simulation thread,
+// published through a triple buffer and never modified once the render thread picked it up.
+struct FramePacket
+{
+	uint64_t simulationFrame = 0;
+	double simulationTimeMs = 0.0; // CPU time spent building this packet
+
+	glm::mat4 view{ 1.0f };
+	float fovY = glm::radians(45.0f);
+	float nearPlane = 0.1f, farPlane = 10.0f;
+
+	std::vector<glm::mat4> transforms;
+	std::vector<DrawItem> drawList; // culled already
+	std::vector<Occluder> occluders; // drawn into the CPU occlusion buffer before the draw list is tested against it
+
+	uint32_t culledObjects = 0; // frustum and occlusion
+	uint32_t occludedObjects = 0;
+	uint64_t frustumCulledTriangles = 0, occludedTriangles = 0;
+	double cullTimeMs = 0.0;
+	double sortTimeMs = 0.0;
+
+	std::vector<PointLight> lights;
+	ClusterLightLists lightClusters; // built for view and the projection of this packet
+	double lightTimeMs = 0.0;
+
+	std::array<ShadowCascadePacket, ShadowCascades::CASCADE_COUNT> shadowCascades; // shadows only
+	uint32_t shadowMovedObjects = 0;
+	double shadowTimeMs = 0.0;
+};
+
+// CPU side image as decoded by stb_image, freed after upload
+struct DecodedImage
+{
+	int width = 0, height = 0;
+	unsigned char* pixels = nullptr; // RGBA8
 };
 
 struct Vertex
@@ -35,24 +257,96 @@ struct Vertex
 	glm::vec3 position;
 	glm::vec3 color;
 	glm::vec2 texCoord;
+	glm::vec3 normal;
 
 	static VkVertexInputBindingDescription getBindingDescription();
-	static std::array<VkVertexInputAttributeDescription, 3> getAttributeDescriptions();
+	static std::array<VkVertexInputAttributeDescription, 4> getAttributeDescriptions();
 
 	bool operator==(const Vertex& other) const
 	{
-		return position == other.position && color == other.color && texCoord == other.texCoord;
+		return position == other.position && color == other.color && texCoord == other.texCoord && normal == other.normal;
 	}
 };
+static_assert(sizeof(Vertex) == 11 * sizeof(float), "visibility_resolve.frag reads vertices as 11 packed floats");
 
 namespace std {
 	template<> struct hash<Vertex> {
 		size_t operator()(Vertex const& vertex) const {
-			return ((hash<glm::vec3>()(vertex.position) ^ (hash<glm::vec3>()(vertex.color) << 1)) >> 1) ^ (hash<glm::vec2>()(vertex.texCoord) << 1);
+			return ((((hash<glm::vec3>()(vertex.position) ^ (hash<glm::vec3>()(vertex.color) << 1)) >> 1) ^ (hash<glm::vec2>()(vertex.texCoord) << 1)) >> 1)
+				^ (hash<glm::vec3>()(vertex.normal) << 1);
+		}
+	};
+}
+
+// Everything that makes two graphics pipelines different. Render state first, then the values of the
+// specialization constants, which are read straight out of this struct (see Application::buildPipeline).
+struct PipelineKey
+{
+	VkCullModeFlags cullMode = VK_CULL_MODE_BACK_BIT;
+	VkPolygonMode polygonMode = VK_POLYGON_MODE_FILL;
+	VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+	VkBool32 sampleShadingEnable = VK_FALSE;
+	float minSampleShading = 1.0f;
+	VkBool32 blendEnable = VK_FALSE;
+	VkBool32 depthTestEnable = VK_TRUE;
+	VkBool32 depthWriteEnable = VK_TRUE;
+	VkCompareOp depthCompareOp = VK_COMPARE_OP_LESS;
+	VkBool32 depthPrepass = VK_FALSE; // position only stream and no fragment shader, color writes off
+
+	//specialization constants
+	VkBool32 useTexture = VK_TRUE; // constant_id = 0
+	VkBool32 useVertexColor = VK_TRUE; // constant_id = 1
+
+	bool operator==(const PipelineKey& other) const = default;
+};
+
+namespace std {
+	template<> struct hash<PipelineKey> {
+		size_t operator()(PipelineKey const& key) const {
+			size_t seed = 0;
+			auto combine = [&seed](size_t value) { seed ^= value + 0x9e3779b9 + (seed << 6) + (seed >> 2); };
+			combine(hash<uint32_t>()(key.cullMode));
+			combine(hash<uint32_t>()(key.polygonMode));
+			combine(hash<uint32_t>()(key.samples));
+			combine(hash<uint32_t>()(key.sampleShadingEnable));
+			combine(hash<float>()(key.minSampleShading));
+			combine(hash<uint32_t>()(key.blendEnable));
+			combine(hash<uint32_t>()(key.depthTestEnable));
+			combine(hash<uint32_t>()(key.depthWriteEnable));
+			combine(hash<uint32_t>()(key.depthCompareOp));
+			combine(hash<uint32_t>()(key.depthPrepass));
+			combine(hash<uint32_t>()(key.useTexture));
+			combine(hash<uint32_t>()(key.useVertexColor));
+			return seed;
 		}
 	};
 }
 
+enum class PipelineState
+{
+	Pending,
+	Ready,
+	Failed
+};
+
+struct PipelineEntry
+{
+	VkPipeline pipeline = VK_NULL_HANDLE;
+	PipelineState state = PipelineState::Pending;
+	double buildTimeMs = 0.0;
+	uint32_t uses = 0;
+};
+
+struct PipelineStats
+{
+	uint64_t lookups = 0;
+	uint64_t hits = 0;
+	uint64_t fallbacks = 0; // lookups answered with the fallback pipeline (or a skipped draw) while compiling
+	uint32_t asyncBuilds = 0;
+	double totalBuildTimeMs = 0.0;
+	double worstBuildTimeMs = 0.0;
+};
+
 //Vulkan specific
 struct QueueFamilyIndices
 {
@@ -63,6 +357,26 @@ struct QueueFamilyIndices
 	bool isComplete() const { return transferFamily.has_value() && graphicsFamily.has_value() && presentFamily.has_value(); }
 };
 
+// Resource destruction postponed until every frame that could reference it has completed
+struct DeferredDeletion
+{
+	uint64_t frameNumber;
+	std::function<void()> deleter;
+};
+
+// Prefix of pipeline_cache.bin. The Vulkan blob has its own header, but it lacks the driver version,
+// and a cache written by an older driver is at best useless and at worst crashes vkCreatePipelineCache
+struct PipelineCacheFileHeader
+{
+	uint32_t magic;
+	uint32_t fileVersion;
+	uint32_t vendorID;
+	uint32_t deviceID;
+	uint32_t driverVersion;
+	uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+	uint64_t dataSize;
+};
+
 struct SwapChainSupportDetails
 {
 	VkSurfaceCapabilitiesKHR capabilities;
@@ -73,6 +387,8 @@ struct SwapChainSupportDetails
 class Application
 {
 public:
+	explicit Application(const ApplicationConfig& config = {});
+
 	void run();
 
 private:
@@ -80,6 +396,7 @@ private:
 	void initVulkan();
 	void mainLoop();
 	void cleanup();
+	bool shouldClose();
 
 	//vulkan part
 
@@ -99,6 +416,8 @@ private:
 	void createSwapChain();
 	void recreateSwapChain();
 	void cleanupSwapChain();
+	void retireSwapChainResources();
+	bool isWindowMinimized();
 	SwapChainSupportDetails querySwapChainSupport(VkPhysicalDevice device);
 	VkSurfaceFormatKHR chooseSwapChainFormat(const std::vector<VkSurfaceFormatKHR>& availableFormats);
 	VkPresentModeKHR chooseSwapPresentMode(const std::vector<VkPresentModeKHR>& availablePresentModes);
@@ -106,17 +425,32 @@ private:
 
 	void createImageViews();
 	void createRenderPass();
+	VkRenderPass buildRenderPass(ScenePass pass);
 
 	void createDescriptorSetLayout();
 	void createDescriptorPool();
 	void createDescriptorSets();
 
+	void createPipelineCache();
+	void savePipelineCache();
+	void mergePipelineCache(VkPipelineCache sourceCache);
+	bool validatePipelineCacheData(const std::vector<char>& fileData, const VkPhysicalDeviceProperties& properties);
+
 	void createGraphicsPipeline();
+	VkPipeline getPipeline(const PipelineKey& key); // builds the permutation on first use, blocking
+	VkPipeline requestPipeline(const PipelineKey& key, VkPipeline fallback); // never blocks, fallback may be VK_NULL_HANDLE to skip the draw
+	void compilePipelineAsync(const PipelineKey& key);
+	void updatePipelineStress(double lastFrameTimeMs);
+	VkPipeline buildPipeline(const PipelineKey& key, VkPipelineCache cache);
+	void destroyPipelines();
+	void printPipelineStats();
+	static std::string describePipelineKey(const PipelineKey& key);
 	void createFramebuffers();
 	
+	void decodeTextureImage();
 	void createTextureImage();
 	void createImage(uint32_t width, uint32_t height, uint32_t mipLevels, VkSampleCountFlagBits numSamples, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usageFlags,
-		VkMemoryPropertyFlags memoryPropertyFlags, VkImage& image, VkDeviceMemory& imageMemory);
+		VkMemoryPropertyFlags memoryPropertyFlags, VkImage& image, VkDeviceMemory& imageMemory, uint32_t arrayLayers = 1);
 	void createTextureImageView();
 	void createTextureSampler();
 
@@ -125,22 +459,102 @@ private:
 
 	void loadModel();
 	void createVertexBuffer();
+	void createPositionBuffer();
 	void createIndexBuffer();
 	void createUniformBuffers();
-	void updateUniformBuffer(uint32_t currentImage);
-	void recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex);
+	void updateUniformBuffer(uint32_t currentImage, const FramePacket& packet);
+	void createInstanceBuffers();
+	void createLightBuffers();
+	void writeLightBuffers(uint32_t frame, const FramePacket& packet);
+	static glm::mat4 projectionFor(const FramePacket& packet, float aspect);
+
+	//gpu driven rendering
+	void createGpuDrivenResources();
+	void createCullPipeline();
+	void destroyGpuDrivenResources();
+	uint32_t writeGpuObjects(const FramePacket& packet);
+	void createHizResources();
+	void retireHizResources();
+	void recordGpuDrivenFrame(VkCommandBuffer commandBuffer, uint32_t imageIndex, const FramePacket& packet);
+	void recordGpuCulling(VkCommandBuffer commandBuffer, const FramePacket& packet, uint32_t objectCount, CullPhase phase);
+	void recordHizBuild(VkCommandBuffer commandBuffer);
+	uint32_t recordIndirectDraws(VkCommandBuffer commandBuffer, uint32_t objectCount, CullPhase phase);
+	void beginScenePass(VkCommandBuffer commandBuffer, VkRenderPass renderPass, uint32_t imageIndex);
+	void recordBatchedDraws(VkCommandBuffer commandBuffer, const FramePacket& packet);
+	void recordDepthPrepass(VkCommandBuffer commandBuffer);
+	void readGpuCullResults(uint32_t frame);
+	void createTimestampQueries();
+	void readGpuFrameTime(uint32_t frame);
+	void createPipelineStatisticsQueries();
+	void readPipelineStatistics(uint32_t frame);
+	void recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex, const FramePacket& packet);
+	void declareFrameGraph(uint32_t imageIndex, const FramePacket& packet);
+
+	//simulation thread
+	void startSimulation();
+	void stopSimulation();
+	void simulationLoop();
+	void simulateFrame(FramePacket& packet, float time);
+	void simulateInstanceScene(FramePacket& packet, float time);
+	void simulateCityScene(FramePacket& packet, float time);
+	void updateCullBounds(FramePacket& packet);
+	void cullDrawList(FramePacket& packet);
+	void sortDrawList(FramePacket& packet);
+	void simulateLights(FramePacket& packet, float time, const Aabb& area);
+	void assignLights(FramePacket& packet);
+	void updateShadowCascades(FramePacket& packet);
 
 	void drawFrame();
+	const FramePacket& acquireFramePacket();
+
+	//headless
+	void createOffscreenTargets();
+	void drawOffscreenFrame();
+	void createReadbackBuffers();
+	void recordFrameReadback(VkCommandBuffer commandBuffer, uint32_t imageIndex);
+	void writePendingFrameDump(uint32_t frameSlot);
 	//synchronization
 	void createSyncObjects();
+	void deferDeletion(std::function<void()>&& deleter);
+	void flushDeletionQueue(bool force);
 
 	void generateMipmaps(VkImage image, VkFormat format, uint32_t texWidth, uint32_t texHeight, uint32_t mipLevels);
 
 	void createColorResources();
 
+	//dynamic resolution and post process AA
+	// the scene goes to m_sceneColorImage, the post pass writes the swap chain. The quality sweep compares post process AA
+	// against MSAA, so every tier it measures pays for the same post pass
+	bool rendersOffscreen() const { return m_config.dynamicResolution || m_config.antiAliasing != PostAntiAliasing::None || m_config.qualitySweep; }
+	void createPostProcessing();
+	void destroyPostProcessing();
+	void createPostDescriptorSet();
+	void updateRenderExtent();
+	void recordTaaPass(VkCommandBuffer commandBuffer);
+	void recordPostPass(VkCommandBuffer commandBuffer, uint32_t imageIndex);
+
+	//visibility buffer
+	void createVisibilityBuffer();
+	void destroyVisibilityBuffer();
+	void createVisibilityDescriptorSet();
+	void recordVisibilityFrame(VkCommandBuffer commandBuffer, uint32_t imageIndex, const FramePacket& packet);
+
+	//cascaded shadow maps
+	void createShadowResources();
+	void destroyShadowResources();
+	uint32_t selectShadowCascades(const FramePacket& packet); // marks what this frame redraws in m_shadowCache, returns the cascades as bits
+	void recordShadowPasses(VkCommandBuffer commandBuffer, const FramePacket& packet);
+
+	//bindless descriptors
+	void createBindlessSetLayout(); // before the pipeline layout, the set itself once the texture exists
+	void createBindlessResources();
+	void destroyBindlessResources();
+	uint32_t registerBindlessTexture(VkImageView imageView, VkSampler sampler);
+	uint32_t registerBindlessBuffer(VkBuffer buffer);
+
 	VkShaderModule createShaderModule(const std::vector<char>& bytecode);
 
-	VkSampleCountFlagBits getMaxUsableSampleCount();
+	VkSampleCountFlags getUsableSampleCounts();
 
 	// this function is simply adding debug utils extension if debug mode is enabled
 	std::vector<const char*> getRequiredExtensions();
@@ -148,6 +562,13 @@ private:
 	bool CheckWindowExtensionsMatchVulkanExtensions(const std::vector<const char*> glfwExts, const std::vector<VkExtensionProperties>& vulkanExts);
 	
 	static void framebufferResizeCallback(GLFWwindow* window, int width, int height);
+	static void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods);
+
+	QualityTier clampQualityTier(QualityTier tier) const;
+	void applyQualityTier(); // to m_requestedTier, rebuilds attachments, render passes and framebuffers if the sample count changed
+	void retireRenderPasses();
+	void updateQualitySweep();
+	void printQualitySweep();
 
 	static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
 		VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
@@ -175,7 +596,7 @@ private:
 	VkCommandBuffer beginSingleTimeCommands();
 	void endSingleTimeCommands(VkCommandBuffer commandBuffer);
 
-	void transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels);
+	void transitionImageLayout(VkImage image, const VkImageSubresourceRange& range, ResourceUsage from, ResourceUsage to); // one time, waits for the queue
 	void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height);
 
 	VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels);
@@ -185,9 +606,12 @@ private:
 	bool hasStencilComponent(VkFormat format);
 	VkFormat findSupportedFormat(const std::vector<VkFormat>& candidates, VkImageTiling tiling, VkFormatFeatureFlags features);
 private:
+	ApplicationConfig m_config;
+	JobSystem m_jobSystem;
+
 	//window
 	GLFWwindow* m_window = nullptr;
-	uint32_t m_width = 1200, m_height = 800;
+	uint32_t m_width, m_height;
 
 	//vulkan
 	const std::vector<const char*> validationLayers =
@@ -195,7 +619,7 @@ private:
 		"VK_LAYER_KHRONOS_validation"
 	};
 
-	const std::vector<const char*> deviceExtensions
+	std::vector<const char*> deviceExtensions // swap chain extension is dropped in headless mode
 	{
 		VK_KHR_SWAPCHAIN_EXTENSION_NAME
 	};
@@ -207,7 +631,7 @@ private:
 #endif
 	VkDebugUtilsMessengerEXT m_debugMessenger;
 	VkInstance m_vulkanInstance;
-	VkSurfaceKHR m_surface;
+	VkSurfaceKHR m_surface = VK_NULL_HANDLE;
 	
 	VkPhysicalDevice m_physicalDevice = VK_NULL_HANDLE;
 	VkDevice m_device;
@@ -219,13 +643,45 @@ private:
 	VkDescriptorPool m_descriptorPool;
 	std::vector<VkDescriptorSet> m_descriptorSets;
 	
+	VkPipelineCache m_pipelineCache = VK_NULL_HANDLE;
+	std::mutex m_pipelineCacheMutex; // held around vkMergePipelineCaches (destination is externally synchronized) and vkGetPipelineCacheData
+	bool m_pipelineCacheWarm = false; // loaded from disk
+	const std::string m_pipelineCachePath = "pipeline_cache.bin";
+	static constexpr uint32_t PIPELINE_CACHE_MAGIC = 0x43504b56; // "VKPC"
+	static constexpr uint32_t PIPELINE_CACHE_FILE_VERSION = 1;
+
 	VkPipelineLayout m_pipelineLayout;
 	VkRenderPass m_renderPass;
-	VkPipeline m_graphicsPipeline;
+	VkRenderPass m_earlyRenderPass = VK_NULL_HANDLE, m_lateRenderPass = VK_NULL_HANDLE; // gpu driven only
+	VkPipeline m_graphicsPipeline; // permutation for m_defaultPipelineKey
+	PipelineKey m_defaultPipelineKey;
+	std::unordered_map<PipelineKey, PipelineEntry> m_pipelines;
+	PipelineStats m_pipelineStats;
+	std::mutex m_pipelinesMutex; // guards m_pipelines and m_pipelineStats, background compiles insert into them
+	JobCounter m_pipelineCompiles;
+	VkPipeline m_framePipeline = VK_NULL_HANDLE; // what recordCommandBuffer binds this frame, VK_NULL_HANDLE skips the draws
+	VkPipeline m_depthPrepassPipeline = VK_NULL_HANDLE; // depth pre-pass only, permutation of m_defaultPipelineKey
+
+	struct PipelineStressRun
+	{
+		std::vector<PipelineKey> keys;
+		uint64_t startFrame = 0;
+		CpuTimer timer;
+		double worstFrameBeforeMs = 0.0;
+		double worstFrameDuringMs = 0.0;
+		uint32_t fallbackFrames = 0;
+		bool finished = false;
+	} m_pipelineStress;
+	static constexpr uint32_t PIPELINE_STRESS_COUNT = 100;
+	static constexpr uint64_t PIPELINE_STRESS_START_FRAME = 120;
+	VkShaderModule m_vertShaderModule, m_fragShaderModule;
+	VkShaderModule m_depthPrepassVertShaderModule = VK_NULL_HANDLE;
 	std::vector<VkFramebuffer> m_swapChainFramebuffers;
+	std::vector<VkFramebuffer> m_postFramebuffers; // per swap chain image, offscreen rendering only
 
 	VkCommandPool m_commandPool, m_transferCommandPool; // TODO: add this one , m_temporaryOperationsCommandPool;
 	std::vector<VkCommandBuffer> m_commandBuffers;
+	RenderGraph m_frameGraph; // declared by every recordCommandBuffer, only recompiled when the frame's shape changes
 
 	//synchronization
 	std::vector<VkSemaphore> m_imageAvailableSemaphores;
@@ -233,28 +689,160 @@ private:
 	std::vector<VkFence> m_inFlightFences;
 
 	bool m_framebufferResized = false;
+	std::chrono::steady_clock::time_point m_lastResizeEvent;
+	const std::chrono::milliseconds RESIZE_DEBOUNCE{ 50 }; // resize events closer than this are coalesced
+	const std::chrono::milliseconds RESIZE_STATS_WINDOW{ 500 }; // frames this close to a resize count as "resizing" in stats
 
-	VkSwapchainKHR m_swapChain;
+	std::deque<DeferredDeletion> m_deletionQueue;
+	uint64_t m_frameNumber = 0;
+	FrameStats m_frameStats;
+
+	//simulation
+	std::thread m_simulationThread;
+	std::atomic<bool> m_simulationRunning = false;
+	std::atomic<uint64_t> m_consumedPacket = 0; // last simulation frame picked up by the render thread
+	TripleBuffer<FramePacket> m_framePackets;
+
+	VkSwapchainKHR m_swapChain = VK_NULL_HANDLE;
 	VkFormat m_swapChainImageFormat;
 	VkExtent2D m_swapChainExtent;
-	std::vector<VkImage> m_swapChainImages;
+	std::vector<VkImage> m_swapChainImages; // offscreen image ring in headless mode
 	std::vector<VkImageView> m_swapChainImageViews;
+	std::vector<VkDeviceMemory> m_offscreenImagesMemory; // headless only, swap chain images own their memory
+
+	//headless frame readback
+	std::vector<VkBuffer> m_readbackBuffers;
+	std::vector<VkDeviceMemory> m_readbackBuffersMemory;
+	std::vector<void*> m_mappedReadbackBuffersMemory;
+	std::vector<std::optional<uint64_t>> m_pendingFrameDumps; // per frame slot, frame number waiting to be written
 	const int MAX_FRAMES_IN_FLIGHT = 2;
 	uint32_t m_currentFrame = 0;
 
 	//rendering
-	VkSampleCountFlagBits m_msaaSamples;
+	QualityTier m_qualityTier; // what the attachments and m_defaultPipelineKey are built for
+	QualityTier m_requestedTier; // applied before the next frame, M, N and A keys or the quality sweep
+	VkSampleCountFlags m_usableSampleCounts = VK_SAMPLE_COUNT_1_BIT;
+	bool m_supportsSampleShading = false;
+	bool m_supportsPipelineStatistics = false;
+
+	struct GpuTimes
+	{
+		uint32_t count = 0;
+		double totalMs = 0.0;
+		double worstMs = 0.0;
+	};
+
+	struct QualitySweep
+	{
+		std::vector<QualityTier> tiers;
+		std::vector<GpuTimes> gpuTimes; // per tier
+		size_t current = 0;
+		uint64_t tierStartFrame = 0;
+		bool finished = false;
+	} m_qualitySweep;
+	std::vector<int> m_timestampSweepTiers; // per frame in flight, tier its timestamps count for, -1 while warming up
+	static constexpr uint64_t QUALITY_SWEEP_FRAMES = 150; // per tier
+	static constexpr uint64_t QUALITY_SWEEP_WARMUP_FRAMES = 30; // pipeline builds and frames still in flight with the previous tier
 
 	VkBuffer m_vertexBuffer;
 	VkDeviceMemory m_vertexBufferMemory;
 	VkBuffer m_indexBuffer;
 	VkDeviceMemory m_indexBufferMemory;
+	VkBuffer m_positionBuffer = VK_NULL_HANDLE; // depth pre-pass only, m_positions
+	VkDeviceMemory m_positionBufferMemory = VK_NULL_HANDLE;
 
 	std::vector<VkBuffer> m_uniformBuffers;
 	std::vector<VkDeviceMemory> m_uniformBuffersMemory;
 	std::vector<void*> m_mappedUniformBuffersMemory;
 
+	// per frame in flight, transforms of all instances drawn that frame, in batch order
+	std::vector<VkBuffer> m_instanceBuffers;
+	std::vector<VkDeviceMemory> m_instanceBuffersMemory;
+	std::vector<glm::mat4*> m_mappedInstanceBuffersMemory;
+	uint32_t m_instanceBufferCapacity = 0;
+	InstanceBatcher m_instanceBatcher;
+	static constexpr uint32_t INSTANCE_BUFFER_MIN_CAPACITY = 1024;
+	static constexpr uint64_t INSTANCE_RAMP_FRAMES = 240;
+	uint32_t m_instanceSceneCount = 0; // simulation thread only
+	SceneGraph m_sceneGraph; // instance scene, simulation thread only
+	std::vector<uint32_t> m_instanceNodes;
+	RenderableStore m_renderables; // city scene, simulation thread only
+	std::vector<Entity> m_buildingEntities;
+
+	// per frame in flight, the packet's lights and their cluster lists, read by the fragment shader
+	std::vector<VkBuffer> m_lightBuffers;
+	std::vector<VkDeviceMemory> m_lightBuffersMemory;
+	std::vector<PointLight*> m_mappedLightBuffersMemory;
+	std::vector<VkBuffer> m_clusterBuffers; // CLUSTER_COUNT ranges, then the light indices
+	std::vector<VkDeviceMemory> m_clusterBuffersMemory;
+	std::vector<void*> m_mappedClusterBuffersMemory;
+	LightClusters m_lightClusters; // simulation thread only
+
+	// culling, runs on the simulation thread
+	MeshBounds m_meshBounds; // of the loaded model, object space
+	BoundsSoA m_cullBounds; // world space, one entry per draw item
+	RenderQueue m_renderQueue; // simulation thread, draw keys of the culled draw list
+	std::vector<DrawItem> m_sortedDrawList; // swapped with the packet's draw list after sorting
+	std::vector<uint8_t> m_cullVisibility;
+	static constexpr uint32_t CULL_GRAIN_SIZE = 16384; // items per job, bounds and frustum tests
+	OccluderMesh m_buildingOccluder; // city scene, a box inside the model's bounds
+	OcclusionBuffer m_occlusionBuffer; // simulation thread only
+	std::atomic<float> m_viewAspect = 1.0f; // written by the render thread whenever the extent changes
+
+	// gpu driven rendering, per frame in flight unless noted
+	std::vector<VkBuffer> m_gpuObjectBuffers;
+	std::vector<VkDeviceMemory> m_gpuObjectBuffersMemory;
+	std::vector<GpuObject*> m_mappedGpuObjectBuffersMemory;
+	std::vector<VkBuffer> m_drawCommandBuffers; // written by cull.comp, consumed as indirect draws, early phase then late phase
+	std::vector<VkDeviceMemory> m_drawCommandBuffersMemory;
+	std::vector<VkBuffer> m_drawCountBuffers; // GpuCullCounters
+	std::vector<VkDeviceMemory> m_drawCountBuffersMemory;
+	std::vector<VkBuffer> m_drawCountReadbackBuffers; // counters copied back for the stats
+	std::vector<VkDeviceMemory> m_drawCountReadbackBuffersMemory;
+	std::vector<GpuCullCounters*> m_mappedDrawCountReadbackMemory;
+	std::vector<uint32_t> m_gpuObjectCounts; // objects submitted to the cull pass, 0 while the slot has no results to read back
+	VkBuffer m_visibilityBuffer = VK_NULL_HANDLE; // shared by all frames, per object 1 if it passed the late test last frame
+	VkDeviceMemory m_visibilityBufferMemory = VK_NULL_HANDLE;
+	bool m_visibilityCleared = false;
+	VkDescriptorSetLayout m_cullDescriptorSetLayout = VK_NULL_HANDLE;
+	VkDescriptorPool m_cullDescriptorPool = VK_NULL_HANDLE;
+	std::vector<VkDescriptorSet> m_cullDescriptorSets;
+	VkPipelineLayout m_cullPipelineLayout = VK_NULL_HANDLE;
+	VkPipeline m_cullPipeline = VK_NULL_HANDLE;
+
+	// Hi-Z pyramid, farthest depth per texel, level 0 is the largest power of two that fits the swap chain extent.
+	// Image, views and sets depend on the extent and are recreated with the swap chain.
+	VkImage m_hizImage = VK_NULL_HANDLE;
+	VkDeviceMemory m_hizImageMemory = VK_NULL_HANDLE;
+	VkImageView m_hizImageView = VK_NULL_HANDLE; // all levels, sampled by cull.comp
+	std::vector<VkImageView> m_hizLevelViews; // one per level, written by hiz.comp
+	VkExtent2D m_hizExtent{};
+	uint32_t m_hizLevels = 0;
+	VkDescriptorPool m_hizDescriptorPool = VK_NULL_HANDLE;
+	std::vector<VkDescriptorSet> m_hizBuildDescriptorSets; // one per level
+	VkDescriptorSet m_hizSampleDescriptorSet = VK_NULL_HANDLE; // set 1 of the cull pipeline
+	VkDescriptorSetLayout m_hizBuildDescriptorSetLayout = VK_NULL_HANDLE;
+	VkDescriptorSetLayout m_hizSampleDescriptorSetLayout = VK_NULL_HANDLE;
+	VkPipelineLayout m_hizPipelineLayout = VK_NULL_HANDLE;
+	VkPipeline m_hizPipeline = VK_NULL_HANDLE, m_hizMsPipeline = VK_NULL_HANDLE; // single sampled and multisampled depth source
+	VkSampler m_hizSampler = VK_NULL_HANDLE; // nearest, the test reads exact texels at the level it picks
+	static constexpr uint32_t HIZ_MAX_LEVELS = 16;
+	bool m_supportsMultiDrawIndirect = false;
+	bool m_supportsDrawIndirectCount = false; // VK_KHR_draw_indirect_count, lets cull.comp compact the commands
+	PFN_vkCmdDrawIndexedIndirectCountKHR m_vkCmdDrawIndexedIndirectCount = nullptr;
+
+	// per frame in flight: frame start, shadow passes done, frame end
+	VkQueryPool m_timestampQueryPool = VK_NULL_HANDLE;
+	static constexpr uint32_t TIMESTAMPS_PER_FRAME = 3;
+	float m_timestampPeriod = 0.0f; // nanoseconds per tick
+	std::vector<bool> m_timestampsWritten;
+
+	// per frame in flight, fragment shader invocations of the scene passes
+	VkQueryPool m_statisticsQueryPool = VK_NULL_HANDLE;
+	std::vector<bool> m_statisticsWritten;
+
 	uint32_t m_mipLevels;
+	DecodedImage m_decodedTexture;
 	VkImage m_textureImage;
 	VkDeviceMemory m_textureImageMemory;
 	VkImageView m_textureImageView;
@@ -268,6 +856,106 @@ private:
 	VkDeviceMemory m_colorImageMemory;
 	VkImageView m_colorImageView;
 
+	// Dynamic resolution. The scene targets (color, depth, scene color) are allocated once at the largest scale,
+	// a smaller render extent only shrinks the viewport and render area, so a scale change costs nothing
+	VkExtent2D m_sceneExtent{}; // of the scene targets, the swap chain extent unless rendering offscreen
+	VkExtent2D m_renderExtent{}; // part of them rendered to this frame
+	VkImage m_sceneColorImage = VK_NULL_HANDLE; // single sampled scene color, MSAA resolves into it, the post pass samples it
+	VkDeviceMemory m_sceneColorImageMemory = VK_NULL_HANDLE;
+	VkImageView m_sceneColorImageView = VK_NULL_HANDLE;
+	ResolutionController m_resolutionController;
+	VkRenderPass m_postRenderPass = VK_NULL_HANDLE;
+	VkDescriptorSetLayout m_postDescriptorSetLayout = VK_NULL_HANDLE;
+	VkDescriptorPool m_postDescriptorPool = VK_NULL_HANDLE; // follows the scene color image, retired with it
+	VkDescriptorSet m_postDescriptorSet = VK_NULL_HANDLE; // reads the scene color
+	VkPipelineLayout m_postPipelineLayout = VK_NULL_HANDLE;
+	std::array<std::array<VkPipeline, static_cast<size_t>(UpscaleFilter::Count)>, 2> m_upscalePipelines{}; // [fxaa][filter]
+	VkSampler m_postSampler = VK_NULL_HANDLE; // bilinear, clamped
+	UpscaleFilter m_upscaleFilter = UpscaleFilter::Bilinear; // U switches
+
+	// Temporal AA. Two history images at the scene target size, every frame reads one and writes the other,
+	// the output pass then reads the one just written instead of the scene color
+	std::array<VkImage, 2> m_historyImages{};
+	std::array<VkDeviceMemory, 2> m_historyImagesMemory{};
+	std::array<VkImageView, 2> m_historyImageViews{};
+	std::array<VkFramebuffer, 2> m_historyFramebuffers{};
+	std::array<VkDescriptorSet, 2> m_historyDescriptorSets{}; // output pass reading history i
+	std::array<VkDescriptorSet, 2> m_taaDescriptorSets{}; // TAA pass writing history i, only allocated for single sampled tiers
+	uint32_t m_historyIndex = 0; // written last
+	VkExtent2D m_historyExtent{}; // render extent it was written at
+	bool m_historyValid = false; // false discards it, after it was recreated or TAA was just switched on
+	VkRenderPass m_taaRenderPass = VK_NULL_HANDLE;
+	VkDescriptorSetLayout m_taaDescriptorSetLayout = VK_NULL_HANDLE;
+	VkPipelineLayout m_taaPipelineLayout = VK_NULL_HANDLE;
+	VkPipeline m_taaPipeline = VK_NULL_HANDLE;
+	glm::mat4 m_previousViewProj{ 1.0f }; // unjittered
+	glm::mat4 m_taaReprojection{ 1.0f }; // see TaaPushConstants, updated with the uniform buffer
+	static constexpr VkFormat HISTORY_FORMAT = VK_FORMAT_R16G16B16A16_SFLOAT; // small blend weights would quantize away in 8 bits
+	static constexpr uint32_t TAA_JITTER_PHASES = 8; // Halton(2, 3) positions cycled through
+	static constexpr float TAA_CURRENT_WEIGHT = 0.1f;
+
+	// Visibility buffer. One render pass, two subpasses: the first rasterizes triangle IDs and depth only, the second reads
+	// the IDs back as an input attachment, fetches the triangle's vertices from the vertex and index buffers and shades
+	// every covered pixel exactly once, however many triangles were drawn over it
+	VkImage m_triangleIdImage = VK_NULL_HANDLE; // instance + 1 and triangle per pixel, 0 where nothing was drawn
+	VkDeviceMemory m_triangleIdImageMemory = VK_NULL_HANDLE;
+	VkImageView m_triangleIdImageView = VK_NULL_HANDLE;
+	std::vector<VkFramebuffer> m_visibilityFramebuffers; // per swap chain image, IDs, depth and the scene target
+	VkRenderPass m_visibilityRenderPass = VK_NULL_HANDLE;
+	VkDescriptorSetLayout m_visibilityDescriptorSetLayout = VK_NULL_HANDLE; // set 1 of the resolve, the ID input attachment
+	VkDescriptorPool m_visibilityDescriptorPool = VK_NULL_HANDLE; // follows the ID image, retired with it
+	VkDescriptorSet m_visibilityDescriptorSet = VK_NULL_HANDLE;
+	VkPipelineLayout m_resolvePipelineLayout = VK_NULL_HANDLE;
+	VkPipeline m_triangleIdPipeline = VK_NULL_HANDLE, m_resolvePipeline = VK_NULL_HANDLE;
+	static constexpr VkFormat TRIANGLE_ID_FORMAT = VK_FORMAT_R32G32_UINT;
+
+	// Cascaded shadow maps. One depth array image shared by all frames in flight, a layer per cascade. A layer is only
+	// redrawn when the packet's cascade differs from what it holds, frames in flight are ordered by the render pass
+	// dependencies. Without shadows the image is 1x1 and only exists so the descriptor is valid
+	struct CachedShadowCascade
+	{
+		glm::mat4 viewProj{ 1.0f };
+		uint64_t generation = 0;
+		bool valid = false;
+	};
+	std::array<CachedShadowCascade, ShadowCascades::CASCADE_COUNT> m_shadowCache; // render thread only
+	uint32_t m_shadowRedraw = 0; // cascades the frame being recorded redraws, as bits
+	VkImage m_shadowImage = VK_NULL_HANDLE;
+	VkDeviceMemory m_shadowImageMemory = VK_NULL_HANDLE;
+	VkImageView m_shadowImageView = VK_NULL_HANDLE; // all layers, sampled with depth comparison
+	std::array<VkImageView, ShadowCascades::CASCADE_COUNT> m_shadowLayerViews{};
+	std::array<VkFramebuffer, ShadowCascades::CASCADE_COUNT> m_shadowFramebuffers{};
+	VkFormat m_shadowFormat = VK_FORMAT_UNDEFINED;
+	VkSampler m_shadowSampler = VK_NULL_HANDLE;
+	VkRenderPass m_shadowRenderPass = VK_NULL_HANDLE;
+	VkPipelineLayout m_shadowPipelineLayout = VK_NULL_HANDLE;
+	VkPipeline m_shadowPipeline = VK_NULL_HANDLE;
+	InstanceBatcher m_shadowBatcher; // reused for every cascade
+	ShadowCascades m_shadowCascades; // simulation thread only
+	std::vector<glm::mat4> m_shadowTransforms; // simulation thread, per draw item, what the cascades compare against the last frame
+	const glm::vec3 SUN_DIRECTION{ 0.5f, 0.3f, -1.0f }; // from the sun into the scene, low enough for long shadows
+	static constexpr float SUN_INTENSITY = 0.85f;
+	static constexpr uint32_t SHADOW_FIRST_ROUND_ROBIN_CASCADE = 2; // this one and the ones after it wait for their turn
+	static constexpr float SHADOW_DEPTH_BIAS = 1.25f, SHADOW_SLOPE_BIAS = 1.75f; // rasterizer depth bias of the shadow passes
+
+	// Bindless descriptors. One update-after-bind set with an array of textures and one of storage buffers, bound once per
+	// frame next to the per frame set, however many materials are drawn. The frame shader looks the texture of the draw's
+	// material up in the material table, a buffer in the array. Slots are only reused once no frame in flight can read them.
+	// Without descriptor indexing the frame shader samples the one texture of the per frame set
+	bool m_supportsBindless = false;
+	uint32_t m_instanceApiVersion = VK_API_VERSION_1_0;
+	uint32_t m_bindlessTextureCapacity = 0, m_bindlessBufferCapacity = 0; // the constants below, clamped to the device limits
+	VkDescriptorSetLayout m_bindlessSetLayout = VK_NULL_HANDLE;
+	VkDescriptorPool m_bindlessDescriptorPool = VK_NULL_HANDLE;
+	VkDescriptorSet m_bindlessDescriptorSet = VK_NULL_HANDLE;
+	DescriptorSlots m_bindlessTextureSlots, m_bindlessBufferSlots;
+	VkBuffer m_materialTableBuffer = VK_NULL_HANDLE;
+	VkDeviceMemory m_materialTableMemory = VK_NULL_HANDLE;
+	uint32_t m_materialTableSlot = DescriptorSlots::INVALID_SLOT;
+	uint32_t m_frameDescriptorBinds = 0; // vkCmdBindDescriptorSets calls of the frame being recorded
+	static constexpr uint32_t BINDLESS_TEXTURE_CAPACITY = 4096, BINDLESS_BUFFER_CAPACITY = 256;
+	static constexpr uint32_t MATERIAL_TABLE_SIZE = 1024; // materials past the end use the last entry
+
 	/*
 	const std::vector<Vertex> m_vertices =
 	{
@@ -290,6 +978,7 @@ private:
 	*/ // Saved for future reference
 
 	std::vector<Vertex> m_vertices;
+	std::vector<glm::vec3> m_positions; // depth pre-pass only, the positions of m_vertices on their own
 	std::vector<uint32_t> m_indices;
 	
 	const std::string m_modelPath = "textures/obj/viking_room.obj";
@@ -0,0 +1,1188 @@
+#include "Benchmarks.h"
+
+#include "Culling.h"
+#include "DescriptorSlots.h"
+#include "FrameStats.h"
+#include "InstanceBatcher.h"
+#include "JobSystem.h"
+#include "LightClusters.h"
+#include "OcclusionBuffer.h"
+#include "RenderGraph.h"
+#include "RenderQueue.h"
+#include "RenderableStore.h"
+#include "ResolutionController.h"
+#include "SceneGraph.h"
+#include "ShadowCascades.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <glm/gtc/matrix_transform.hpp>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+	// best of several runs, the first one warms caches and wakes the workers up
+	double measureMs(const std::function<void()>& function, int runs = 5)
+	{
+		double best = 1e30;
+		for (int i = 0; i < runs; i++)
+		{
+			CpuTimer timer;
+			function();
+			best = std::min(best, timer.elapsedMs());
+		}
+		return best;
+	}
+
+	void benchmarkJobSystem()
+	{
+		const uint32_t maxCores = std::max(1u, std::thread::hardware_concurrency());
+
+		// scaling: embarrassingly parallel math over 4M elements
+		const uint32_t elementCount = 1 << 22;
+		std::vector<float> values(elementCount);
+
+		std::cout << "Job system scaling, parallelFor over " << elementCount << " elements:" << std::endl;
+		double singleCoreMs = 0.0;
+		for (uint32_t cores = 1; cores <= maxCores; cores++)
+		{
+			JobSystem jobSystem(cores - 1);
+			double ms = measureMs([&]()
+			{
+				jobSystem.parallelFor(elementCount, 16384, [&](uint32_t begin, uint32_t end)
+				{
+					for (uint32_t i = begin; i < end; i++)
+						values[i] = std::sqrt(std::abs(std::sin(i * 0.001f) * std::cos(i * 0.002f)));
+				});
+			});
+
+			if (cores == 1)
+				singleCoreMs = ms;
+			std::cout << "  " << cores << " cores: " << ms << " ms, speedup " << singleCoreMs / ms << "x" << std::endl;
+		}
+
+		// fork-join: recursive splitting, the shape loaders and culling produce, exercises stealing
+		std::cout << "Job system fork-join (recursive split down to 1024 element leaves):" << std::endl;
+		for (uint32_t cores = 1; cores <= maxCores; cores *= 2)
+		{
+			JobSystem jobSystem(cores - 1);
+			std::atomic<uint64_t> sum = 0;
+
+			std::function<void(uint32_t, uint32_t)> split = [&](uint32_t begin, uint32_t end)
+			{
+				if (end - begin <= 1024)
+				{
+					uint64_t local = 0;
+					for (uint32_t i = begin; i < end; i++)
+						local += static_cast<uint64_t>(values[i] * 1000.0f);
+					sum.fetch_add(local, std::memory_order_relaxed);
+					return;
+				}
+
+				uint32_t middle = begin + (end - begin) / 2;
+				JobCounter counter;
+				jobSystem.run([&split, begin, middle]() { split(begin, middle); }, &counter);
+				split(middle, end);
+				jobSystem.wait(counter);
+			};
+
+			double ms = measureMs([&]() { sum = 0; split(0, elementCount); });
+			std::cout << "  " << cores << " cores: " << ms << " ms" << std::endl;
+		}
+
+		// contention: several external threads hammer one job system with tiny jobs and dependency chains
+		const uint32_t producerCount = std::max(2u, maxCores);
+		const uint32_t jobsPerProducer = 100000;
+		JobSystem jobSystem;
+		std::atomic<uint64_t> executed = 0;
+		std::atomic<uint64_t> continuationsExecuted = 0;
+
+		CpuTimer timer;
+		std::vector<std::thread> producers;
+		for (uint32_t p = 0; p < producerCount; p++)
+		{
+			producers.emplace_back([&]()
+			{
+				JobCounter counter;
+				JobCounter after;
+				for (uint32_t i = 0; i < jobsPerProducer; i++)
+				{
+					jobSystem.run([&]() { executed.fetch_add(1, std::memory_order_relaxed); }, &counter);
+
+					if (i % 1000 == 999)
+						jobSystem.runAfter(counter, [&]() { continuationsExecuted.fetch_add(1, std::memory_order_relaxed); }, &after);
+				}
+				jobSystem.wait(counter);
+				jobSystem.wait(after);
+			});
+		}
+
+		for (std::thread& producer : producers)
+		{
+			producer.join();
+		}
+		double ms = timer.elapsedMs();
+
+		uint64_t expectedJobs = static_cast<uint64_t>(producerCount) * jobsPerProducer;
+		uint64_t expectedContinuations = static_cast<uint64_t>(producerCount) * (jobsPerProducer / 1000);
+		std::cout << "Job system contention: " << producerCount << " producers, " << expectedJobs << " jobs in " << ms << " ms ("
+			<< expectedJobs / ms * 1000.0 << " jobs/s)" << std::endl;
+
+		if (executed != expectedJobs || continuationsExecuted != expectedContinuations)
+			throw std::runtime_error("Job system stress test lost jobs");
+
+		// a job without a counter has nobody waiting for it, its exception has to come out of pumpMainThread
+		if (jobSystem.workerCount() > 0)
+		{
+			bool reported = false;
+			jobSystem.run([]() { throw std::logic_error("detached job failed"); });
+			for (uint32_t attempt = 0; attempt < 1000 && !reported; attempt++)
+			{
+				try
+				{
+					jobSystem.pumpMainThread();
+					std::this_thread::sleep_for(std::chrono::milliseconds(1));
+				}
+				catch (const std::logic_error&)
+				{
+					reported = true;
+				}
+			}
+
+			if (!reported)
+				throw std::runtime_error("Exception of a job without a counter was lost");
+		}
+	}
+
+	void benchmarkInstanceBatching()
+	{
+		// 16 meshes x 4 materials in random order, the worst case for the last-batch shortcut
+		const uint32_t meshCount = 16;
+		const uint32_t materialCount = 4;
+		std::mt19937 random(42);
+
+		std::cout << "Instance batching (" << meshCount * materialCount << " distinct mesh/material pairs, shuffled):" << std::endl;
+		for (uint32_t itemCount = 1000; itemCount <= 1000000; itemCount *= 10)
+		{
+			std::vector<DrawItem> drawList(itemCount);
+			std::vector<glm::mat4> transforms(itemCount, glm::mat4(1.0f));
+			std::vector<glm::mat4> instanceTransforms(itemCount);
+
+			for (uint32_t i = 0; i < itemCount; i++)
+			{
+				uint32_t mesh = random() % meshCount;
+				drawList[i] = { i, mesh * 3000, 3000, static_cast<uint32_t>(random() % materialCount) };
+			}
+
+			InstanceBatcher batcher;
+			uint32_t written = 0;
+			double ms = measureMs([&]() { written = batcher.build(drawList, transforms, instanceTransforms.data(), itemCount); });
+
+			uint32_t batchedInstances = 0;
+			for (const InstanceBatch& batch : batcher.batches())
+				batchedInstances += batch.instanceCount;
+
+			if (written != itemCount || batchedInstances != itemCount)
+				throw std::runtime_error("Instance batcher lost draws");
+
+			std::cout << "  " << itemCount << " draws -> " << batcher.batches().size() << " instanced draws in " << ms << " ms" << std::endl;
+		}
+	}
+
+	void benchmarkFrustumCulling()
+	{
+		// 1M helmet sized objects scattered through a 2km cube, camera in the middle, roughly a tenth survives
+		const uint32_t objectCount = 1000000;
+		std::mt19937 random(7);
+		std::uniform_real_distribution<float> position(-1000.0f, 1000.0f);
+		std::uniform_real_distribution<float> angle(0.0f, 6.2831853f);
+
+		const std::vector<glm::vec3> cube = { { -0.5f, -0.5f, -0.5f }, { 0.5f, 0.5f, 0.5f }, { 0.5f, -0.5f, 0.2f } };
+		MeshBounds meshBounds = computeMeshBounds(cube.data(), cube.size(), sizeof(glm::vec3));
+
+		BoundsSoA bounds;
+		bounds.resize(objectCount);
+		for (uint32_t i = 0; i < objectCount; i++)
+		{
+			glm::mat4 transform = glm::translate(glm::mat4(1.0f), glm::vec3(position(random), position(random), position(random)));
+			transform = glm::rotate(transform, angle(random), glm::vec3(0.0f, 0.0f, 1.0f));
+			bounds.set(i, meshBounds, transform);
+		}
+
+		glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(1.0f, 0.3f, 0.1f), glm::vec3(0.0f, 0.0f, 1.0f));
+		glm::mat4 proj = glm::perspectiveRH_ZO(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 1500.0f);
+		Frustum frustum = Frustum::fromViewProj(proj * view);
+
+		std::vector<uint8_t> reference(objectCount);
+		uint32_t referenceCount = cullObjects(frustum, bounds, 0, objectCount, reference.data(), CullingPath::Scalar);
+
+		std::cout << "Frustum culling " << objectCount << " objects, " << referenceCount << " visible, "
+			<< objectCount - referenceCount << " draws skipped:" << std::endl;
+
+		std::vector<uint8_t> visible(objectCount);
+		for (CullingPath path : { CullingPath::Scalar, CullingPath::Sse, CullingPath::Avx2 })
+		{
+			if (!isCullingPathAvailable(path))
+			{
+				std::cout << "  " << cullingPathName(path) << ": not supported by this CPU or build" << std::endl;
+				continue;
+			}
+
+			uint32_t count = 0;
+			double ms = measureMs([&]() { count = cullObjects(frustum, bounds, 0, objectCount, visible.data(), path); });
+			if (count != referenceCount || visible != reference)
+				throw std::runtime_error(std::string("Frustum culling mismatch in ") + cullingPathName(path) + " path");
+
+			std::cout << "  " << cullingPathName(path) << ": " << ms << " ms, " << ms * 1e6 / objectCount << " ns/object" << std::endl;
+		}
+
+		JobSystem jobSystem;
+		uint32_t count = 0;
+		double ms = measureMs([&]() { count = cullObjectsParallel(jobSystem, frustum, bounds, visible.data()); });
+		if (count != referenceCount || visible != reference)
+			throw std::runtime_error("Frustum culling mismatch in parallel path");
+
+		std::cout << "  best path on " << jobSystem.workerCount() + 1 << " threads: " << ms << " ms, " << ms * 1e6 / objectCount << " ns/object" << std::endl;
+	}
+
+	// per pixel reference for OcclusionBuffer::isOccluded, same projection, no tiles
+	bool isOccludedBruteForce(const OcclusionBuffer& buffer, const glm::mat4& viewProj, const glm::vec3& center, const glm::vec3& extent)
+	{
+		float minX = 1e30f, minY = 1e30f, maxX = -1e30f, maxY = -1e30f, nearest = 1.0f;
+		for (int i = 0; i < 8; i++)
+		{
+			glm::vec4 clip = viewProj * glm::vec4(center + extent * glm::vec3(i & 1 ? 1.0f : -1.0f, i & 2 ? 1.0f : -1.0f, i & 4 ? 1.0f : -1.0f), 1.0f);
+			if (clip.w <= 0.0f || clip.z < 0.0f)
+				return false;
+			float x = (clip.x / clip.w * 0.5f + 0.5f) * buffer.width(), y = (clip.y / clip.w * 0.5f + 0.5f) * buffer.height();
+			minX = std::min(minX, x);
+			maxX = std::max(maxX, x);
+			minY = std::min(minY, y);
+			maxY = std::max(maxY, y);
+			nearest = std::min(nearest, clip.z / clip.w);
+		}
+
+		int x0 = std::max(0, static_cast<int>(std::floor(std::max(minX, -1.0f))));
+		int x1 = std::min(static_cast<int>(buffer.width()) - 1, static_cast<int>(std::floor(std::min(maxX, static_cast<float>(buffer.width())))));
+		int y0 = std::max(0, static_cast<int>(std::floor(std::max(minY, -1.0f))));
+		int y1 = std::min(static_cast<int>(buffer.height()) - 1, static_cast<int>(std::floor(std::min(maxY, static_cast<float>(buffer.height())))));
+		if (x0 > x1 || y0 > y1)
+			return false;
+
+		for (int y = y0; y <= y1; y++)
+		{
+			for (int x = x0; x <= x1; x++)
+			{
+				if (buffer.depth()[y * buffer.width() + x] >= nearest)
+					return false;
+			}
+		}
+		return true;
+	}
+
+	void benchmarkOcclusionCulling()
+	{
+		const glm::vec3 up(0.0f, 0.0f, 1.0f);
+		glm::mat4 proj = glm::perspectiveRH_ZO(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 1000.0f);
+		proj[1][1] *= -1; // same y flip as the renderer
+
+		// sanity: a wall filling the view, only its front face survives back face culling and covers the center pixel
+		{
+			JobSystem jobSystem(0);
+			OccluderMesh wall = makeBoxOccluder({ { 10.0f, -50.0f, -50.0f }, { 11.0f, 50.0f, 50.0f } });
+			glm::mat4 viewProj = proj * glm::lookAt(glm::vec3(0.0f), glm::vec3(1.0f, 0.0f, 0.0f), up);
+
+			OcclusionBuffer buffer;
+			buffer.rasterize(jobSystem, viewProj, { { &wall, glm::mat4(1.0f) } });
+
+			glm::vec4 front = viewProj * glm::vec4(10.0f, 0.0f, 0.0f, 1.0f);
+			float centerDepth = buffer.depth()[(buffer.height() / 2) * buffer.width() + buffer.width() / 2];
+			if (buffer.rasterizedFaces() != 1 || std::abs(centerDepth - front.z / front.w) > 1e-5f)
+				throw std::runtime_error("Occlusion buffer: wrong front face or depth for a wall");
+			if (buffer.isOccluded({ 5.0f, 0.0f, 0.0f }, glm::vec3(0.5f)) || !buffer.isOccluded({ 20.0f, 0.0f, 0.0f }, glm::vec3(0.5f)))
+				throw std::runtime_error("Occlusion buffer: wrong result in front of / behind a wall");
+		}
+
+		// a 64x64 block city seen from a street, 100k small objects scattered over it
+		const uint32_t side = 64, objectCount = 100000;
+		const float blockSpacing = 6.0f;
+		OccluderMesh block = makeBoxOccluder({ { -2.0f, -2.0f, 0.0f }, { 2.0f, 2.0f, 1.0f } });
+
+		std::vector<Occluder> occluders;
+		for (uint32_t y = 0; y < side; y++)
+		{
+			for (uint32_t x = 0; x < side; x++)
+			{
+				float height = 3.0f + static_cast<float>((x * 73856093u ^ y * 19349663u) % 1000) * 0.015f;
+				glm::mat4 transform = glm::translate(glm::mat4(1.0f), glm::vec3(x * blockSpacing, y * blockSpacing, 0.0f));
+				occluders.push_back({ &block, glm::scale(transform, glm::vec3(1.0f, 1.0f, height)) });
+			}
+		}
+		uint32_t faceCount = static_cast<uint32_t>(occluders.size() * block.indices.size() / block.faceSize);
+
+		std::mt19937 random(11);
+		std::uniform_real_distribution<float> ground(0.0f, side * blockSpacing), altitude(0.5f, 20.0f);
+		BoundsSoA bounds;
+		bounds.resize(objectCount);
+		for (uint32_t i = 0; i < objectCount; i++)
+		{
+			bounds.centerX[i] = ground(random);
+			bounds.centerY[i] = ground(random);
+			bounds.centerZ[i] = altitude(random);
+			bounds.extentX[i] = bounds.extentY[i] = bounds.extentZ[i] = 0.5f;
+			bounds.radius[i] = 0.87f;
+		}
+
+		glm::vec3 eye(-5.0f, (side / 2 - 0.5f) * blockSpacing, 1.7f);
+		glm::mat4 viewProj = proj * glm::lookAt(eye, eye + glm::vec3(1.0f, 0.25f, 0.0f), up);
+
+		JobSystem singleThread(0);
+		OcclusionBuffer scalar, simd;
+		double scalarMs = measureMs([&]() { scalar.rasterize(singleThread, viewProj, occluders, CullingPath::Scalar); });
+		double simdMs = measureMs([&]() { simd.rasterize(singleThread, viewProj, occluders, CullingPath::Sse); });
+		if (scalar.depth() != simd.depth())
+			throw std::runtime_error("Occlusion buffer: SIMD rasterizer differs from the scalar one");
+
+		JobSystem jobSystem;
+		OcclusionBuffer parallel;
+		double parallelMs = measureMs([&]() { parallel.rasterize(jobSystem, viewProj, occluders); });
+		if (parallel.depth() != scalar.depth())
+			throw std::runtime_error("Occlusion buffer: parallel rasterizer differs from the scalar one");
+
+		std::cout << "Occlusion rasterizer, " << occluders.size() << " box occluders (" << faceCount << " faces, "
+			<< scalar.rasterizedFaces() << " after clipping and back face culling) into " << scalar.width() << "x" << scalar.height() << ":" << std::endl;
+		std::cout << "  scalar: " << scalarMs << " ms, " << scalarMs * 1e6 / faceCount << " ns/face" << std::endl;
+		std::cout << "  SSE: " << simdMs << " ms, " << simdMs * 1e6 / faceCount << " ns/face" << std::endl;
+		std::cout << "  SSE on " << jobSystem.workerCount() + 1 << " threads: " << parallelMs << " ms, " << parallelMs * 1e6 / faceCount << " ns/face" << std::endl;
+
+		// the tile hierarchy has to give exactly the per pixel answer
+		uint32_t referenceCount = 0;
+		for (uint32_t i = 0; i < objectCount; i++)
+		{
+			glm::vec3 center(bounds.centerX[i], bounds.centerY[i], bounds.centerZ[i]);
+			glm::vec3 extent(bounds.extentX[i], bounds.extentY[i], bounds.extentZ[i]);
+			bool reference = isOccludedBruteForce(scalar, viewProj, center, extent);
+			if (scalar.isOccluded(center, extent, CullingPath::Scalar) != reference || scalar.isOccluded(center, extent, CullingPath::Sse) != reference)
+				throw std::runtime_error("Occlusion test differs from the per pixel reference");
+			referenceCount += reference;
+		}
+
+		std::vector<uint8_t> visible(objectCount);
+		std::cout << "Occlusion test, " << objectCount << " objects, " << referenceCount << " occluded:" << std::endl;
+		for (CullingPath path : { CullingPath::Scalar, CullingPath::Sse })
+		{
+			uint32_t occluded = 0;
+			double ms = measureMs([&]()
+			{
+				std::fill(visible.begin(), visible.end(), 1);
+				occluded = scalar.cullObjects(singleThread, bounds, visible.data(), objectCount, path);
+			});
+			if (occluded != referenceCount)
+				throw std::runtime_error("Occlusion test count differs from the per pixel reference");
+			std::cout << "  " << cullingPathName(path) << ": " << ms << " ms, " << ms * 1e6 / objectCount << " ns/object" << std::endl;
+		}
+
+		// against a 4x finer buffer: the rasterizer is inner conservative, so everything hidden at the low
+		// resolution has to stay hidden at the high one, it only finds more
+		OcclusionBuffer fine(scalar.width() * 4, scalar.height() * 4);
+		fine.rasterize(jobSystem, viewProj, occluders);
+		uint32_t fineCount = 0, falselyOccluded = 0;
+		for (uint32_t i = 0; i < objectCount; i++)
+		{
+			glm::vec3 center(bounds.centerX[i], bounds.centerY[i], bounds.centerZ[i]);
+			glm::vec3 extent(bounds.extentX[i], bounds.extentY[i], bounds.extentZ[i]);
+			bool coarse = scalar.isOccluded(center, extent), detailed = fine.isOccluded(center, extent);
+			fineCount += detailed;
+			falselyOccluded += coarse && !detailed;
+		}
+		std::cout << "  at " << fine.width() << "x" << fine.height() << ": " << fineCount << " occluded" << std::endl;
+		if (falselyOccluded != 0)
+			throw std::runtime_error("Occlusion buffer hides " + std::to_string(falselyOccluded) + " objects that a finer buffer sees");
+	}
+
+	void benchmarkSceneGraph()
+	{
+		// 100k nodes, 100 roots, every other node hangs below a random earlier one, so depths come in mixed order
+		const uint32_t nodeCount = 100000, rootCount = 100;
+		std::mt19937 random(5);
+		std::uniform_real_distribution<float> offset(-2.0f, 2.0f), angle(0.0f, 6.2831853f);
+
+		std::vector<uint32_t> parents(nodeCount, SceneGraph::NO_PARENT);
+		std::vector<glm::mat4> locals(nodeCount);
+		for (uint32_t i = 0; i < nodeCount; i++)
+		{
+			if (i >= rootCount)
+				parents[i] = random() % i;
+			locals[i] = glm::translate(glm::mat4(1.0f), glm::vec3(offset(random), offset(random), offset(random)));
+			locals[i] = glm::rotate(locals[i], angle(random), glm::normalize(glm::vec3(offset(random), offset(random), 1.0f)));
+		}
+
+		SceneGraph graph;
+		for (uint32_t i = 0; i < nodeCount; i++)
+			graph.createNode(parents[i], locals[i]);
+
+		JobSystem singleThread(0);
+		CpuTimer timer;
+		graph.update(singleThread, 4096, CullingPath::Scalar);
+		std::cout << "Scene graph, " << nodeCount << " nodes in " << graph.levelCount() << " levels, first update with the depth sort: "
+			<< timer.elapsedMs() << " ms" << std::endl;
+
+		// parents come first, world matrices in creation order are the reference. The SSE path and the compiler's
+		// contraction of glm's math round differently, so compare with a tolerance relative to the matrix' magnitude
+		std::vector<glm::mat4> reference(nodeCount);
+		auto checkWorld = [&](const char* what)
+		{
+			for (uint32_t i = 0; i < nodeCount; i++)
+			{
+				reference[i] = parents[i] == SceneGraph::NO_PARENT ? locals[i] : reference[parents[i]] * locals[i];
+
+				const glm::mat4& world = graph.worldTransform(i);
+				float magnitude = 1.0f;
+				for (int c = 0; c < 4; c++)
+					for (int r = 0; r < 4; r++)
+						magnitude = std::max(magnitude, std::abs(reference[i][c][r]));
+				for (int c = 0; c < 4; c++)
+					for (int r = 0; r < 4; r++)
+						if (std::abs(world[c][r] - reference[i][c][r]) > 1e-4f * magnitude)
+							throw std::runtime_error(std::string("Scene graph world transforms wrong after ") + what);
+			}
+		};
+		checkWorld("the first update");
+
+		JobSystem jobSystem;
+		for (uint32_t percent : { 100u, 1u })
+		{
+			std::cout << "  " << percent << "% of the nodes dirty:" << std::endl;
+			uint32_t dirtyCount = nodeCount * percent / 100;
+
+			auto run = [&](JobSystem& jobs, CullingPath path, const char* name)
+			{
+				double best = 1e30;
+				uint32_t updated = 0;
+				for (int r = 0; r < 5; r++)
+				{
+					// same seed for every run and path, so they all update the same dirty set
+					std::mt19937 dirtyRandom(percent);
+					for (uint32_t d = 0; d < dirtyCount; d++)
+					{
+						uint32_t node = dirtyCount == nodeCount ? d : dirtyRandom() % nodeCount;
+						locals[node] = glm::rotate(locals[node], 0.01f, glm::vec3(0.0f, 0.0f, 1.0f));
+						graph.setLocalTransform(node, locals[node]);
+					}
+
+					CpuTimer updateTimer;
+					uint32_t runUpdated = graph.update(jobs, 4096, path);
+					double ms = updateTimer.elapsedMs();
+					if (ms < best)
+					{
+						best = ms;
+						updated = runUpdated;
+					}
+				}
+				checkWorld(name);
+				std::cout << "    " << name << ": " << best << " ms, " << updated << " world matrices recomputed, "
+					<< best * 1e6 / std::max(1u, updated) << " ns/node" << std::endl;
+			};
+
+			run(singleThread, CullingPath::Scalar, "scalar");
+			run(singleThread, CullingPath::Sse, "SSE");
+			run(jobSystem, CullingPath::Best, (std::string("SSE on ") + std::to_string(jobSystem.workerCount() + 1) + " threads").c_str());
+		}
+	}
+
+	void benchmarkRenderableStore()
+	{
+		// 1M renderables in two archetypes, a quarter of them flagged as occluders
+		const uint32_t entityCount = 1000000;
+		const ComponentMask drawable = componentBit(RenderableComponent::Transform) | componentBit(RenderableComponent::Mesh)
+			| componentBit(RenderableComponent::Material) | componentBit(RenderableComponent::Bounds);
+		const ComponentMask flagged = drawable | componentBit(RenderableComponent::Flags);
+
+		RenderableStore store;
+		std::vector<Entity> entities(entityCount);
+		std::cout << "Renderable store, " << entityCount << " entities:" << std::endl;
+
+		CpuTimer timer;
+		for (uint32_t i = 0; i < entityCount; i++)
+		{
+			RenderableDesc desc;
+			desc.components = i % 4 == 0 ? flagged : drawable;
+			desc.transform = glm::translate(glm::mat4(1.0f), glm::vec3(static_cast<float>(i), 0.0f, 0.0f));
+			desc.mesh = { 0, 3000 };
+			desc.material = i % 4;
+			desc.bounds = { glm::vec3(i - 0.5f, -0.5f, -0.5f), glm::vec3(i + 0.5f, 0.5f, 0.5f) };
+			desc.flags = RENDERABLE_OCCLUDER;
+			entities[i] = store.create(desc);
+		}
+		double queueMs = timer.restartMs();
+		store.flush();
+		double flushMs = timer.elapsedMs();
+		if (store.size() != entityCount || store.count(flagged) != entityCount / 4)
+			throw std::runtime_error("Renderable store lost entities on create");
+		std::cout << "  create: " << queueMs << " ms queued + " << flushMs << " ms flushed, " << (queueMs + flushMs) * 1e6 / entityCount << " ns/entity" << std::endl;
+
+		// the kind of pass culling and instance upload make, transform and bounds of everything
+		double sum = 0.0;
+		auto iterate = [&](const RenderableChunk& chunk, double& local)
+		{
+			for (uint32_t i = 0; i < chunk.count; i++)
+				local += chunk.transforms[i][3].x + chunk.bounds[i].max.x - chunk.bounds[i].min.x + chunk.meshes[i].indexCount;
+		};
+		double ms = measureMs([&]()
+		{
+			sum = 0.0;
+			store.forEachChunk(drawable, [&](const RenderableChunk& chunk) { iterate(chunk, sum); });
+		});
+		double expected = 0.0;
+		for (uint32_t i = 0; i < entityCount; i++)
+			expected += i + 1.0 + 3000.0;
+		if (std::abs(sum - expected) > expected * 1e-9)
+			throw std::runtime_error("Renderable store query visited the wrong entities");
+		std::cout << "  query transform + bounds + mesh: " << ms << " ms, " << ms * 1e6 / entityCount << " ns/entity" << std::endl;
+
+		JobSystem jobSystem;
+		std::mutex sumMutex;
+		ms = measureMs([&]()
+		{
+			sum = 0.0;
+			store.parallelForEachChunk(jobSystem, drawable, [&](const RenderableChunk& chunk)
+			{
+				double local = 0.0;
+				iterate(chunk, local);
+				std::lock_guard<std::mutex> lock(sumMutex);
+				sum += local;
+			});
+		});
+		if (std::abs(sum - expected) > expected * 1e-9)
+			throw std::runtime_error("Renderable store parallel query visited the wrong entities");
+		std::cout << "  same on " << jobSystem.workerCount() + 1 << " threads: " << ms << " ms, " << ms * 1e6 / entityCount << " ns/entity" << std::endl;
+
+		// structural changes: destroy every other entity (all the flagged ones), then give a tenth of the survivors flags again
+		timer.restartMs();
+		for (uint32_t i = 0; i < entityCount; i += 2)
+			store.destroy(entities[i]);
+		store.flush();
+		ms = timer.restartMs();
+		if (store.size() != entityCount / 2 || store.isAlive(entities[0]) || !store.isAlive(entities[1]))
+			throw std::runtime_error("Renderable store destroyed the wrong entities");
+		std::cout << "  destroy " << entityCount / 2 << ": " << ms << " ms, " << ms * 1e6 / (entityCount / 2) << " ns/entity" << std::endl;
+
+		uint32_t moved = 0;
+		for (uint32_t i = 1; i < entityCount; i += 20)
+		{
+			RenderableDesc values;
+			values.components = componentBit(RenderableComponent::Flags);
+			values.flags = RENDERABLE_OCCLUDER;
+			store.addComponents(entities[i], values);
+			moved++;
+		}
+		store.flush();
+		ms = timer.elapsedMs();
+		std::cout << "  add a component to " << moved << ": " << ms << " ms, " << ms * 1e6 / moved << " ns/entity" << std::endl;
+
+		// every survivor still finds its own data after all the swapping around
+		for (uint32_t i = 1; i < entityCount; i += 2)
+		{
+			const glm::mat4* transform = store.transform(entities[i]);
+			if (!transform || (*transform)[3].x != static_cast<float>(i) || store.mesh(entities[i])->indexCount != 3000)
+				throw std::runtime_error("Renderable store moved the wrong data");
+		}
+		if (store.count(flagged) != moved)
+			throw std::runtime_error("Renderable store archetype counts are off");
+	}
+
+	void benchmarkResolutionController()
+	{
+		// synthetic GPU: a fixed part plus a part that grows with the pixel count, scaled by a scene load that changes
+		// every phase, a few percent noise and the odd spike. Results arrive two frames late like timestamp queries do
+		struct Phase
+		{
+			const char* name;
+			double load;
+		};
+		const Phase phases[] = { { "light", 0.7 }, { "heavy", 1.6 }, { "medium", 1.0 }, { "very heavy", 2.5 } };
+		const uint32_t phaseFrames = 600, latency = 2;
+		const double fixedMs = 1.0, pixelMs = 14.0;
+
+		ResolutionSettings settings;
+		settings.budgetMs = 16.0;
+		settings.latencyFrames = latency;
+		std::cout << "Dynamic resolution controller, " << settings.budgetMs << " ms budget, scale " << settings.minScale << " - " << settings.maxScale
+			<< ", " << phaseFrames << " frames per phase:" << std::endl;
+
+		struct PhaseResult
+		{
+			double totalScale = 0.0, totalMs = 0.0;
+			uint32_t overBudget = 0;
+		};
+
+		auto run = [&](bool adaptive, std::vector<PhaseResult>& results)
+		{
+			ResolutionController controller(settings);
+			std::mt19937 random(11);
+			std::normal_distribution<double> noise(1.0, 0.04);
+			std::vector<double> inFlight;
+			results.assign(std::size(phases), {});
+
+			for (uint32_t frame = 0; frame < phaseFrames * std::size(phases); frame++)
+			{
+				const Phase& phase = phases[frame / phaseFrames];
+				float scale = adaptive ? controller.scale() : 1.0f;
+				double ms = (fixedMs + pixelMs * phase.load * scale * scale) * noise(random);
+				if (random() % 100 == 0)
+					ms *= 1.5;
+
+				// the first frames after a phase change show how quickly it recovers, they count as well
+				PhaseResult& result = results[frame / phaseFrames];
+				result.totalScale += scale;
+				result.totalMs += ms;
+				result.overBudget += ms > settings.budgetMs;
+
+				inFlight.push_back(ms);
+				if (inFlight.size() > latency)
+				{
+					controller.addGpuTime(inFlight.front());
+					inFlight.erase(inFlight.begin());
+				}
+			}
+			return controller.summary();
+		};
+
+		std::vector<PhaseResult> fixed, adaptive;
+		run(false, fixed);
+		ResolutionController::Summary summary = run(true, adaptive);
+
+		for (size_t i = 0; i < std::size(phases); i++)
+		{
+			std::cout << "  " << phases[i].name << " (load " << phases[i].load << "): fixed " << fixed[i].totalMs / phaseFrames << " ms, "
+				<< 100.0 * fixed[i].overBudget / phaseFrames << "% over budget; dynamic scale " << adaptive[i].totalScale / phaseFrames << ", "
+				<< adaptive[i].totalMs / phaseFrames << " ms, " << 100.0 * adaptive[i].overBudget / phaseFrames << "% over budget" << std::endl;
+		}
+		std::cout << "  dynamic overall: " << summary.scaleChanges << " scale changes, GPU time deviation " << summary.deviationMs << " ms" << std::endl;
+
+		// light scenes keep the full resolution, heavy ones get back under budget
+		if (adaptive[0].totalScale / phaseFrames < 0.99 || adaptive[1].overBudget > fixed[1].overBudget / 5)
+			throw std::runtime_error("Resolution controller doesn't track the budget");
+	}
+
+	void benchmarkRenderQueue()
+	{
+		// 4 pipelines x 64 materials x 256 meshes at random depths, the kind of spread a busy scene would have
+		std::mt19937 random(42);
+		std::uniform_real_distribution<float> depths(0.0f, 1.0f);
+		JobSystem jobSystem;
+
+		std::cout << "Render queue, radix sort vs std::stable_sort (4 pipelines, 64 materials, 256 meshes):" << std::endl;
+		for (uint32_t drawCount = 1000; drawCount <= 1000000; drawCount *= 10)
+		{
+			std::vector<uint64_t> keys(drawCount);
+			for (uint64_t& key : keys)
+			{
+				DrawKeyFields fields;
+				fields.pipeline = random() % 4;
+				fields.material = random() % 64;
+				fields.mesh = (random() % 256) * 1000;
+				fields.depth = depths(random);
+				key = packDrawKey(fields);
+			}
+
+			// sorting is destructive, refill outside of the timed part
+			RenderQueue queue;
+			auto sortMs = [&](JobSystem* sortJobs)
+			{
+				double best = 1e30;
+				for (int run = 0; run < 5; run++)
+				{
+					queue.clear();
+					for (uint32_t i = 0; i < drawCount; i++)
+						queue.push(keys[i], i);
+
+					CpuTimer timer;
+					queue.sort(sortJobs);
+					best = std::min(best, timer.elapsedMs());
+				}
+				return best;
+			};
+
+			queue.clear();
+			for (uint32_t i = 0; i < drawCount; i++)
+				queue.push(keys[i], i);
+			StateChangeCounts unsorted = queue.countStateChanges();
+
+			double serialMs = sortMs(nullptr);
+			double parallelMs = sortMs(&jobSystem);
+
+			std::vector<RenderQueue::Entry> expected;
+			double stdMs = measureMs([&]()
+			{
+				expected.clear();
+				for (uint32_t i = 0; i < drawCount; i++)
+					expected.push_back({ keys[i], i });
+				std::stable_sort(expected.begin(), expected.end(), [](const RenderQueue::Entry& a, const RenderQueue::Entry& b) { return a.key < b.key; });
+			});
+
+			// equal keys have to keep their order, or draws with identical state would flicker between frames
+			const std::vector<RenderQueue::Entry>& entries = queue.entries();
+			for (uint32_t i = 0; i < drawCount; i++)
+			{
+				if (entries[i].key != expected[i].key || entries[i].payload != expected[i].payload)
+					throw std::runtime_error("Render queue sort is wrong or unstable");
+			}
+			StateChangeCounts sorted = queue.countStateChanges();
+
+			std::cout << "  " << drawCount << " draws: radix " << serialMs << " ms (" << queue.sortPasses() << " passes), on "
+				<< jobSystem.workerCount() + 1 << " threads " << parallelMs << " ms, std::stable_sort " << stdMs << " ms, "
+				<< serialMs * 1e6 / drawCount << " ns/draw" << std::endl;
+			std::cout << "    binds unsorted -> sorted: pipeline " << unsorted.pipelineBinds << " -> " << sorted.pipelineBinds
+				<< ", material " << unsorted.materialBinds << " -> " << sorted.materialBinds
+				<< ", mesh " << unsorted.meshBinds << " -> " << sorted.meshBinds << std::endl;
+		}
+	}
+
+	void benchmarkLightClusters()
+	{
+		// a street level view over a 200 x 200 area, lights spread like the application's scenes do: the radius grows
+		// with the spacing, so the lights per cluster stay about the same while the count goes up
+		const float nearPlane = 0.1f, farPlane = 300.0f;
+		glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 0.0f, 1.7f), glm::vec3(1.0f, 0.0f, 1.7f), glm::vec3(0.0f, 0.0f, 1.0f));
+		glm::mat4 proj = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, nearPlane, farPlane);
+		proj[1][1] *= -1;
+
+		std::mt19937 random(42);
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+		JobSystem serialJobs(0);
+		JobSystem jobSystem;
+		LightClusters clusters;
+		ClusterLightLists lists;
+
+		std::cout << "Light clusters (" << LightClusters::GRID_X << "x" << LightClusters::GRID_Y << "x" << LightClusters::GRID_Z << " froxels):" << std::endl;
+		for (uint32_t lightCount = 16; lightCount <= 4096; lightCount *= 4)
+		{
+			float spacing = std::sqrt(200.0f * 200.0f / lightCount);
+			std::vector<PointLight> lights(lightCount);
+			for (PointLight& light : lights)
+			{
+				light.position = glm::vec3(200.0f * unit(random) - 20.0f, 200.0f * unit(random) - 100.0f, 0.5f + 11.5f * unit(random));
+				light.radius = 2.0f * spacing;
+				light.color = glm::vec3(1.0f);
+				light.intensity = 1.0f;
+			}
+
+			double serialMs = measureMs([&]() { clusters.build(serialJobs, lights, view, proj, nearPlane, farPlane, lists); });
+			double parallelMs = measureMs([&]() { clusters.build(jobSystem, lights, view, proj, nearPlane, farPlane, lists); });
+
+			uint32_t maxCount = 0, occupied = 0;
+			for (uint32_t cluster = 0; cluster < LightClusters::CLUSTER_COUNT; cluster++)
+			{
+				glm::uvec2 range = lists.ranges[cluster];
+				Aabb bounds = LightClusters::clusterBounds(cluster, proj, nearPlane, farPlane);
+				for (uint32_t i = range.x; i < range.x + range.y; i++)
+				{
+					const PointLight& light = lights[lists.lightIndices[i]];
+					if (!LightClusters::sphereIntersectsAabb(glm::vec3(view * glm::vec4(light.position, 1.0f)), light.radius, bounds))
+						throw std::runtime_error("Light cluster lists a light that doesn't reach it");
+				}
+
+				maxCount = std::max(maxCount, range.y);
+				occupied += range.y > 0 ? 1 : 0;
+			}
+
+			// points picked the way the fragment shader picks its cluster have to find every light in reach
+			glm::vec2 slice = LightClusters::sliceScaleBias(nearPlane, farPlane);
+			for (int sample = 0; sample < 20000; sample++)
+			{
+				glm::vec2 ndc(2.0f * unit(random) - 1.0f, 2.0f * unit(random) - 1.0f);
+				float depth = nearPlane * std::pow(farPlane / nearPlane, unit(random));
+				glm::vec3 point(ndc.x * depth / proj[0][0], ndc.y * depth / proj[1][1], -depth);
+
+				uint32_t x = std::min(static_cast<uint32_t>((ndc.x + 1.0f) * 0.5f * LightClusters::GRID_X), LightClusters::GRID_X - 1);
+				uint32_t y = std::min(static_cast<uint32_t>((ndc.y + 1.0f) * 0.5f * LightClusters::GRID_Y), LightClusters::GRID_Y - 1);
+				uint32_t z = std::min(static_cast<uint32_t>(std::max(std::log(depth) * slice.x + slice.y, 0.0f)), LightClusters::GRID_Z - 1);
+				glm::uvec2 range = lists.ranges[(z * LightClusters::GRID_Y + y) * LightClusters::GRID_X + x];
+				if (range.y == LightClusters::MAX_LIGHTS_PER_CLUSTER)
+					continue;
+
+				const uint32_t* first = &lists.lightIndices[range.x];
+				for (uint32_t i = 0; i < lightCount; i++)
+				{
+					glm::vec3 offset = glm::vec3(view * glm::vec4(lights[i].position, 1.0f)) - point;
+					if (glm::dot(offset, offset) < lights[i].radius * lights[i].radius && std::find(first, first + range.y, i) == first + range.y)
+						throw std::runtime_error("Light cluster misses a light");
+				}
+			}
+
+			// a naive forward renderer evaluates every light for every fragment
+			std::cout << "  " << lightCount << " lights: " << serialMs << " ms, on " << jobSystem.workerCount() + 1 << " threads " << parallelMs << " ms, "
+				<< lists.lightIndices.size() << " light/cluster pairs, per cluster avg "
+				<< static_cast<double>(lists.lightIndices.size()) / std::max(occupied, 1u) << " max " << maxCount
+				<< " (naive: " << lightCount << "), " << occupied << " clusters lit" << std::endl;
+		}
+	}
+
+	void benchmarkShadowCascades()
+	{
+		// a grid of objects seen from above at an angle, the sun coming in low from the side. Every frame either leaves the
+		// objects alone or spins all of them, what a cached cascade has to redraw is the sum of the casters of the dirty ones
+		const uint32_t side = 256;
+		const float spacing = 2.5f, nearPlane = 0.1f, farPlane = 400.0f, aspect = 16.0f / 9.0f, fovY = glm::radians(60.0f);
+		const glm::vec3 lightDirection(0.5f, 0.3f, -1.0f);
+		MeshBounds meshBounds{ { glm::vec3(-0.5f), glm::vec3(0.5f) }, { glm::vec3(0.0f), std::sqrt(0.75f) } };
+
+		uint32_t count = side * side;
+		std::vector<glm::mat4> transforms(count);
+		BoundsSoA bounds;
+		bounds.resize(count);
+		auto place = [&](float angle)
+		{
+			for (uint32_t i = 0; i < count; i++)
+			{
+				glm::vec3 position((i % side) * spacing, (i / side) * spacing, 0.0f);
+				transforms[i] = glm::rotate(glm::translate(glm::mat4(1.0f), position), angle + i * 0.37f, glm::vec3(0.0f, 0.0f, 1.0f));
+				bounds.set(i, meshBounds, transforms[i]);
+			}
+		};
+		auto viewFrom = [](const glm::vec3& eye) { return glm::lookAt(eye, eye + glm::vec3(1.0f, 1.0f, -0.5f), glm::vec3(0.0f, 0.0f, 1.0f)); };
+
+		JobSystem jobSystem;
+		ShadowCascades cascades;
+		glm::mat4 view = viewFrom(glm::vec3(20.0f, 20.0f, 15.0f));
+		place(0.0f);
+		cascades.update(jobSystem, view, fovY, aspect, nearPlane, farPlane, lightDirection, bounds, transforms.data());
+
+		std::cout << "Shadow cascades (" << ShadowCascades::CASCADE_COUNT << " x " << ShadowCascades::MAP_SIZE << "^2, " << count << " objects):" << std::endl;
+		std::cout << "  casters per cascade:";
+		uint32_t totalCasters = 0;
+		for (const ShadowCascade& cascade : cascades.cascades())
+		{
+			std::cout << " " << cascade.casters.size() << " (to " << cascade.splitDepth << ")";
+			totalCasters += static_cast<uint32_t>(cascade.casters.size());
+		}
+		std::cout << std::endl;
+
+		// every object in reach of a cascade's box, seen from the light, has to be drawn into it
+		for (const ShadowCascade& cascade : cascades.cascades())
+		{
+			for (uint32_t i = 0; i < count; i += 7)
+			{
+				glm::vec4 clip = cascade.viewProj * glm::vec4(bounds.centerX[i], bounds.centerY[i], bounds.centerZ[i], 1.0f);
+				bool inBox = std::abs(clip.x) < 1.0f && std::abs(clip.y) < 1.0f && clip.z < 1.0f;
+				if (inBox && std::find(cascade.casters.begin(), cascade.casters.end(), i) == cascade.casters.end())
+					throw std::runtime_error("Shadow cascade misses a caster");
+			}
+		}
+
+		// points of each slice of the view frustum have to land inside the cascade they are assigned to
+		std::mt19937 random(42);
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+		glm::mat4 cameraToWorld = glm::inverse(view);
+		float tanHalfFovY = std::tan(0.5f * fovY);
+		for (int sample = 0; sample < 20000; sample++)
+		{
+			float depth = nearPlane + (farPlane - nearPlane) * unit(random);
+			glm::vec3 point((2.0f * unit(random) - 1.0f) * depth * tanHalfFovY * aspect, (2.0f * unit(random) - 1.0f) * depth * tanHalfFovY, -depth);
+			uint32_t c = 0;
+			while (c < ShadowCascades::CASCADE_COUNT - 1 && depth > cascades.cascades()[c].splitDepth)
+				c++;
+
+			glm::vec4 clip = cascades.cascades()[c].viewProj * cameraToWorld * glm::vec4(point, 1.0f);
+			if (std::abs(clip.x) > 1.0f || std::abs(clip.y) > 1.0f || clip.z < 0.0f || clip.z > 1.0f)
+				throw std::runtime_error("Shadow cascade doesn't cover its slice");
+		}
+
+		// nothing moved: same matrices, same generations, every cascade can be kept
+		std::array<ShadowCascade, ShadowCascades::CASCADE_COUNT> before = cascades.cascades();
+		double staticMs = measureMs([&]() { cascades.update(jobSystem, view, fovY, aspect, nearPlane, farPlane, lightDirection, bounds, transforms.data()); });
+		for (uint32_t c = 0; c < ShadowCascades::CASCADE_COUNT; c++)
+		{
+			if (cascades.cascades()[c].viewProj != before[c].viewProj || cascades.cascades()[c].generation != before[c].generation)
+				throw std::runtime_error("Shadow cascade changed without anything moving");
+		}
+
+		// the camera moving a little shifts the projections by whole texels only
+		cascades.update(jobSystem, viewFrom(glm::vec3(20.37f, 20.11f, 15.0f)), fovY, aspect, nearPlane, farPlane, lightDirection, bounds, transforms.data());
+		uint32_t shiftedCascades = 0;
+		for (uint32_t c = 0; c < ShadowCascades::CASCADE_COUNT; c++)
+		{
+			glm::vec2 shift = glm::vec2(cascades.cascades()[c].viewProj[3] - before[c].viewProj[3]) * (0.5f * ShadowCascades::MAP_SIZE);
+			if (glm::length(shift - glm::round(shift)) > 0.01f)
+				throw std::runtime_error("Shadow cascade moved by a fraction of a texel");
+			shiftedCascades += glm::length(shift) > 0.5f ? 1 : 0;
+		}
+		cascades.update(jobSystem, view, fovY, aspect, nearPlane, farPlane, lightDirection, bounds, transforms.data());
+
+		// everything spinning: every cascade with casters is dirty every frame
+		float angle = 0.0f;
+		uint64_t redrawnCasters = 0;
+		int animatedFrames = 0;
+		double animatedMs = measureMs([&]()
+		{
+			place(angle += 0.01f);
+			std::array<uint64_t, ShadowCascades::CASCADE_COUNT> generations;
+			for (uint32_t c = 0; c < ShadowCascades::CASCADE_COUNT; c++)
+				generations[c] = cascades.cascades()[c].generation;
+
+			cascades.update(jobSystem, view, fovY, aspect, nearPlane, farPlane, lightDirection, bounds, transforms.data());
+			for (uint32_t c = 0; c < ShadowCascades::CASCADE_COUNT; c++)
+			{
+				const ShadowCascade& cascade = cascades.cascades()[c];
+				if (!cascade.casters.empty() && cascade.generation == generations[c])
+					throw std::runtime_error("Shadow cascade kept although its casters moved");
+				if (cascade.generation != generations[c])
+					redrawnCasters += cascade.casters.size();
+			}
+			animatedFrames++;
+		});
+
+		// placing the objects is part of the animated timing, the static scene skips it
+		std::cout << "  static: " << staticMs << " ms, 0 casters redrawn (uncached: " << totalCasters << "), camera step moved "
+			<< shiftedCascades << " cascades by whole texels" << std::endl;
+		std::cout << "  animated: " << animatedMs << " ms (with placing), " << cascades.movedObjects() << " objects moved, "
+			<< redrawnCasters / animatedFrames << " casters redrawn per frame" << std::endl;
+	}
+
+	void benchmarkRenderGraph()
+	{
+		// a deferred frame declared like the renderer declares its own: the images are imported, the handles only have
+		// to be told apart since nothing is recorded
+		auto fakeImage = [](uint64_t id) { return reinterpret_cast<VkImage>(id); };
+		VkImageSubresourceRange color{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+		VkImageSubresourceRange depth{ VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 1 };
+		const uint32_t bloomLevels = 4;
+
+		RenderGraph graph;
+		auto declare = [&](bool debugView)
+		{
+			graph.reset();
+			RenderGraph::Resource shadowMap = graph.importImage("shadow map", fakeImage(1), depth, ResourceUsage::FragmentSampled);
+			RenderGraph::Resource albedo = graph.importImage("albedo", fakeImage(2), color, ResourceUsage::None);
+			RenderGraph::Resource normals = graph.importImage("normals", fakeImage(3), color, ResourceUsage::None);
+			RenderGraph::Resource sceneDepth = graph.importImage("depth", fakeImage(4), depth, ResourceUsage::None);
+			RenderGraph::Resource hdr = graph.importImage("hdr", fakeImage(5), color, ResourceUsage::None);
+			RenderGraph::Resource debug = graph.importImage("debug", fakeImage(6), color, ResourceUsage::None);
+			RenderGraph::Resource target = graph.importImage("swap chain", fakeImage(7), color, ResourceUsage::Present, ResourceUsage::Present);
+			std::array<RenderGraph::Resource, bloomLevels> bloom;
+			for (uint32_t i = 0; i < bloomLevels; i++)
+				bloom[i] = graph.importImage("bloom", fakeImage(8 + i), color, ResourceUsage::None);
+
+			graph.addPass("shadows", nullptr).write(shadowMap, ResourceUsage::DepthAttachment);
+			graph.addPass("gbuffer", nullptr).write(albedo, ResourceUsage::ColorAttachment).write(normals, ResourceUsage::ColorAttachment)
+				.write(sceneDepth, ResourceUsage::DepthAttachment);
+			graph.addPass("lighting", nullptr).read(albedo, ResourceUsage::FragmentSampled).read(normals, ResourceUsage::FragmentSampled)
+				.read(sceneDepth, ResourceUsage::DepthSampled).read(shadowMap, ResourceUsage::FragmentSampled).write(hdr, ResourceUsage::ColorAttachment);
+			// nothing reads it, culled
+			if (debugView)
+				graph.addPass("debug view", nullptr).read(normals, ResourceUsage::FragmentSampled).write(debug, ResourceUsage::ColorAttachment);
+			for (uint32_t i = 0; i < bloomLevels; i++)
+				graph.addPass("bloom", nullptr).read(i == 0 ? hdr : bloom[i - 1], ResourceUsage::FragmentSampled).write(bloom[i], ResourceUsage::ColorAttachment);
+			graph.addPass("tonemap", nullptr).read(hdr, ResourceUsage::FragmentSampled).read(bloom[bloomLevels - 1], ResourceUsage::FragmentSampled)
+				.write(target, ResourceUsage::ColorAttachment);
+		};
+
+		declare(true);
+		if (!graph.compile())
+			throw std::runtime_error("Render graph didn't compile its first declaration");
+		if (graph.culledPassCount() != 1)
+			throw std::runtime_error("Render graph didn't cull the unused pass");
+
+		// the same shape again is a hash and nothing else
+		uint32_t passes = graph.passCount(), barriers = graph.barrierCount(), imageBarriers = graph.imageBarrierCount();
+		declare(true);
+		if (graph.compile())
+			throw std::runtime_error("Render graph recompiled an unchanged shape");
+
+		double cachedMs = measureMs([&]()
+		{
+			for (int i = 0; i < 1000; i++)
+			{
+				declare(true);
+				graph.compile();
+			}
+		});
+
+		uint64_t compilesBefore = graph.compileCount();
+		double changingMs = measureMs([&]()
+		{
+			for (int i = 0; i < 1000; i++)
+			{
+				declare(i % 2 == 0);
+				graph.compile();
+			}
+		});
+		if (graph.compileCount() - compilesBefore < 1000)
+			throw std::runtime_error("Render graph didn't recompile a changed shape");
+
+		std::cout << "  " << passes << " passes declared, 1 culled, " << barriers << " barrier batches, "
+			<< imageBarriers << " image barriers" << std::endl;
+		std::cout << "  declare + compile: " << cachedMs * 1000.0 / 1000 << " us per frame with the shape unchanged, "
+			<< changingMs * 1000.0 / 1000 << " us when it changes every frame" << std::endl;
+
+		// transient aliasing: 1080p targets at 4 bytes per texel, the bloom chain halving. Lifetimes are in passes of the
+		// frame above with an antialiasing pass behind the tonemap: gbuffer 0, lighting 1, bloom 2..5, tonemap 6, fxaa 7
+		const VkDeviceSize fullSize = 1920ull * 1080 * 4, alignment = 65536;
+		std::vector<TransientPlacement> placements =
+		{
+			{ 2 * fullSize, alignment, 0, 1 }, // albedo
+			{ 2 * fullSize, alignment, 0, 1 }, // normals
+			{ fullSize, alignment, 0, 1 }, // depth
+			{ 2 * fullSize, alignment, 1, 6 }, // hdr, 16 bit float
+		};
+		for (uint32_t i = 0; i < bloomLevels; i++)
+			placements.push_back({ 2 * fullSize >> (2 * (i + 1)), alignment, 2 + i, i + 1 < bloomLevels ? 3 + i : 6 });
+		placements.push_back({ fullSize, alignment, 6, 7 }); // tonemapped
+
+		VkDeviceSize separateSize = 0;
+		for (const TransientPlacement& placement : placements)
+			separateSize += placement.size;
+		VkDeviceSize aliasedSize = RenderGraph::placeTransients(placements);
+
+		// nothing alive at the same time may share memory
+		for (size_t a = 0; a < placements.size(); a++)
+		{
+			for (size_t b = a + 1; b < placements.size(); b++)
+			{
+				const TransientPlacement& pa = placements[a];
+				const TransientPlacement& pb = placements[b];
+				bool aliveTogether = pa.firstPass <= pb.lastPass && pb.firstPass <= pa.lastPass;
+				bool sharedMemory = pa.offset < pb.offset + pb.size && pb.offset < pa.offset + pa.size;
+				if (aliveTogether && sharedMemory)
+					throw std::runtime_error("Render graph placed transients alive at the same time in the same memory");
+				if (pa.offset % pa.alignment != 0)
+					throw std::runtime_error("Render graph placed a transient off its alignment");
+			}
+		}
+
+		std::cout << "  transients: " << separateSize / (1024 * 1024) << " MiB separately, " << aliasedSize / (1024 * 1024) << " MiB aliased" << std::endl;
+	}
+
+	void benchmarkBindless()
+	{
+		// a frame of draws over 16 meshes, ordered by material then mesh the way the draw keys order them. With a set per
+		// material every material switch is a vkCmdBindDescriptorSets on top of the per frame set, and every material needs
+		// a set per frame in flight. Bindless binds both sets once and switches materials through the push constant
+		const uint32_t drawCount = 100000, meshCount = 16, framesInFlight = 2;
+		std::mt19937 random(42);
+
+		std::cout << "Descriptor binds per frame, a set per material vs bindless (" << drawCount << " draws, " << meshCount << " meshes):" << std::endl;
+		for (uint32_t materialCount = 4; materialCount <= 4096; materialCount *= 8)
+		{
+			std::vector<DrawItem> drawList(drawCount);
+			for (uint32_t i = 0; i < drawCount; i++)
+				drawList[i] = { i, static_cast<uint32_t>(random() % meshCount) * 3000, 3000, static_cast<uint32_t>(random() % materialCount) };
+			std::sort(drawList.begin(), drawList.end(), [](const DrawItem& a, const DrawItem& b)
+			{
+				return a.materialIndex != b.materialIndex ? a.materialIndex < b.materialIndex : a.firstIndex < b.firstIndex;
+			});
+
+			std::vector<glm::mat4> transforms(drawCount, glm::mat4(1.0f)), instanceTransforms(drawCount);
+			InstanceBatcher batcher;
+			batcher.build(drawList, transforms, instanceTransforms.data(), drawCount);
+
+			// the same elision recordBatchedDraws does
+			uint32_t materialSwitches = 0, boundMaterial = UINT32_MAX;
+			for (const InstanceBatch& batch : batcher.batches())
+			{
+				if (batch.materialIndex != boundMaterial)
+					materialSwitches++;
+				boundMaterial = batch.materialIndex;
+			}
+
+			std::cout << "  " << materialCount << " materials, " << batcher.batches().size() << " instanced draws: per material "
+				<< 1 + materialSwitches << " binds, " << materialCount * framesInFlight << " sets; bindless 1 bind, "
+				<< materialCount << " texture slots" << std::endl;
+		}
+
+		// streaming churn: a resident set of textures, some replaced every frame. A slot may only come back once the
+		// frames that could still sample it are done
+		const uint32_t capacity = 4096, resident = 3000, replacedPerFrame = 64, frameCount = 20000;
+		std::vector<uint64_t> releasedAt(capacity, UINT64_MAX);
+		std::vector<uint32_t> live;
+		uint64_t reuses = 0;
+		DescriptorSlots slots;
+
+		auto churn = [&](bool check)
+		{
+			slots = DescriptorSlots(capacity, framesInFlight);
+			live.clear();
+			for (uint32_t i = 0; i < resident; i++)
+				live.push_back(slots.allocate());
+
+			for (uint64_t frame = 1; frame <= frameCount; frame++)
+			{
+				slots.collect(frame);
+				for (uint32_t i = 0; i < replacedPerFrame; i++)
+				{
+					uint32_t& entry = live[random() % live.size()];
+					slots.release(entry, frame);
+					if (check)
+						releasedAt[entry] = frame;
+
+					entry = slots.allocate();
+					if (entry == DescriptorSlots::INVALID_SLOT)
+						throw std::runtime_error("Descriptor slots ran out with most of them waiting for reuse");
+					if (check && releasedAt[entry] != UINT64_MAX)
+					{
+						if (releasedAt[entry] + framesInFlight > frame)
+							throw std::runtime_error("Descriptor slot reused while a frame in flight could still read it");
+						reuses++;
+					}
+				}
+			}
+		};
+
+		churn(true);
+		double ms = measureMs([&]() { churn(false); });
+		if (slots.usedCount() != resident || slots.highWater() > resident + replacedPerFrame * (framesInFlight + 1))
+			throw std::runtime_error("Descriptor slots leak or don't reuse released slots");
+
+		uint64_t operations = static_cast<uint64_t>(frameCount) * replacedPerFrame * 2;
+		std::cout << "  slot churn: " << resident << " resident, " << replacedPerFrame << " replaced per frame over " << frameCount << " frames, "
+			<< reuses << " reuses, high water " << slots.highWater() << " of " << capacity << ", " << ms * 1e6 / operations << " ns per allocate/release" << std::endl;
+	}
+
+	struct Benchmark
+	{
+		const char* name;
+		void (*function)();
+	};
+
+	const Benchmark benchmarks[] =
+	{
+		{ "jobs", benchmarkJobSystem },
+		{ "batching", benchmarkInstanceBatching },
+		{ "culling", benchmarkFrustumCulling },
+		{ "occlusion", benchmarkOcclusionCulling },
+		{ "scenegraph", benchmarkSceneGraph },
+		{ "entities", benchmarkRenderableStore },
+		{ "resolution", benchmarkResolutionController },
+		{ "sorting", benchmarkRenderQueue },
+		{ "lights", benchmarkLightClusters },
+		{ "shadows", benchmarkShadowCascades },
+		{ "rendergraph", benchmarkRenderGraph },
+		{ "bindless", benchmarkBindless },
+	};
+}
+
+bool runBenchmark(const std::string& name)
+{
+	bool found = false;
+
+	for (const Benchmark& benchmark : benchmarks)
+	{
+		if (name == "all" || name == benchmark.name)
+		{
+			std::cout << "== " << benchmark.name << " ==" << std::endl;
+			benchmark.function();
+			found = true;
+		}
+	}
+
+	return found;
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <string>
+
+// CPU side micro benchmarks, run with --bench <name> (or --bench all) instead of starting the renderer.
+// Results go to stdout, a failed consistency check throws.
+// Returns false if there is no benchmark with that name.
+bool runBenchmark(const std::string& name);
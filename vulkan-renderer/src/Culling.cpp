@@ -0,0 +1,266 @@
+#include "Culling.h"
+
+#include "CullingAvx2.h"
+#include "JobSystem.h"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CULLING_SSE 1
+#include <immintrin.h>
+#endif
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#endif
+
+MeshBounds computeMeshBounds(const glm::vec3* positions, size_t count, size_t stride)
+{
+	MeshBounds bounds{};
+	if (count == 0)
+		return bounds;
+
+	auto position = [&](size_t i) -> const glm::vec3& { return *reinterpret_cast<const glm::vec3*>(reinterpret_cast<const char*>(positions) + i * stride); };
+
+	bounds.aabb = { position(0), position(0) };
+	for (size_t i = 1; i < count; i++)
+	{
+		bounds.aabb.min = glm::min(bounds.aabb.min, position(i));
+		bounds.aabb.max = glm::max(bounds.aabb.max, position(i));
+	}
+
+	// centered on the box so both volumes can share one center in BoundsSoA, slightly looser than a minimal sphere
+	bounds.sphere.center = 0.5f * (bounds.aabb.min + bounds.aabb.max);
+	float radiusSquared = 0.0f;
+	for (size_t i = 0; i < count; i++)
+	{
+		glm::vec3 offset = position(i) - bounds.sphere.center;
+		radiusSquared = std::max(radiusSquared, glm::dot(offset, offset));
+	}
+	bounds.sphere.radius = std::sqrt(radiusSquared);
+
+	return bounds;
+}
+
+void BoundsSoA::resize(uint32_t count)
+{
+	m_count = count;
+	for (std::vector<float>* component : { &centerX, &centerY, &centerZ, &extentX, &extentY, &extentZ, &radius })
+	{
+		component->resize(count);
+	}
+}
+
+void BoundsSoA::set(uint32_t index, const MeshBounds& bounds, const glm::mat4& transform)
+{
+	glm::vec3 localCenter = 0.5f * (bounds.aabb.min + bounds.aabb.max);
+	glm::vec3 localExtent = 0.5f * (bounds.aabb.max - bounds.aabb.min);
+	glm::vec3 center = glm::vec3(transform * glm::vec4(localCenter, 1.0f));
+
+	// extents of the rotated box along the world axes
+	glm::mat3 absolute(glm::abs(glm::vec3(transform[0])), glm::abs(glm::vec3(transform[1])), glm::abs(glm::vec3(transform[2])));
+	glm::vec3 extent = absolute * localExtent;
+
+	float maxScale = std::max({ glm::length(glm::vec3(transform[0])), glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2])) });
+
+	centerX[index] = center.x;
+	centerY[index] = center.y;
+	centerZ[index] = center.z;
+	extentX[index] = extent.x;
+	extentY[index] = extent.y;
+	extentZ[index] = extent.z;
+	radius[index] = bounds.sphere.radius * maxScale;
+}
+
+Frustum Frustum::fromViewProj(const glm::mat4& viewProj)
+{
+	// Gribb/Hartmann, glm is column major so row i is (m[0][i], m[1][i], m[2][i], m[3][i])
+	auto row = [&](int i) { return glm::vec4(viewProj[0][i], viewProj[1][i], viewProj[2][i], viewProj[3][i]); };
+
+	Frustum frustum;
+	frustum.planes[0] = row(3) + row(0); // left
+	frustum.planes[1] = row(3) - row(0); // right
+	frustum.planes[2] = row(3) + row(1); // bottom
+	frustum.planes[3] = row(3) - row(1); // top
+	frustum.planes[4] = row(2); // near, depth 0..1
+	frustum.planes[5] = row(3) - row(2); // far
+
+	for (glm::vec4& plane : frustum.planes)
+	{
+		plane /= glm::length(glm::vec3(plane));
+	}
+
+	return frustum;
+}
+
+static bool cpuSupportsAvx2()
+{
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return false;
+
+	// AVX2 needs the OS to save the ymm registers too, OSXSAVE and XCR0 bits 1 and 2
+	__cpuid(info, 1);
+	bool osSavesAvx = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+	__cpuidex(info, 7, 0);
+	return osSavesAvx && (info[1] & (1 << 5));
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+	return __builtin_cpu_supports("avx2");
+#else
+	return false;
+#endif
+}
+
+bool isCullingPathAvailable(CullingPath path)
+{
+	switch (path)
+	{
+	case CullingPath::Sse:
+#if CULLING_SSE
+		return true;
+#else
+		return false;
+#endif
+	case CullingPath::Avx2:
+	{
+		// decided once, the CPU doesn't change
+		static const bool available = cullAvx2Compiled() && cpuSupportsAvx2();
+		return available;
+	}
+	default:
+		return true;
+	}
+}
+
+const char* cullingPathName(CullingPath path)
+{
+	switch (path)
+	{
+	case CullingPath::Scalar: return "scalar";
+	case CullingPath::Sse: return "SSE";
+	case CullingPath::Avx2: return "AVX2";
+	default: return "best";
+	}
+}
+
+namespace
+{
+	uint32_t cullScalar(const Frustum& frustum, const BoundsSoA& bounds, uint32_t begin, uint32_t end, uint8_t* visible)
+	{
+		uint32_t visibleCount = 0;
+
+		for (uint32_t i = begin; i < end; i++)
+		{
+			bool inside = true;
+			for (const glm::vec4& plane : frustum.planes)
+			{
+				float distance = plane.x * bounds.centerX[i] + plane.y * bounds.centerY[i] + plane.z * bounds.centerZ[i] + plane.w;
+				float boxRadius = std::abs(plane.x) * bounds.extentX[i] + std::abs(plane.y) * bounds.extentY[i] + std::abs(plane.z) * bounds.extentZ[i];
+
+				// whichever volume is tighter against this plane
+				if (distance < -std::min(bounds.radius[i], boxRadius))
+				{
+					inside = false;
+					break;
+				}
+			}
+
+			visible[i] = inside ? 1 : 0;
+			visibleCount += inside ? 1 : 0;
+		}
+
+		return visibleCount;
+	}
+
+#if CULLING_SSE
+	uint32_t cullSse(const Frustum& frustum, const BoundsSoA& bounds, uint32_t begin, uint32_t end, uint8_t* visible)
+	{
+		__m128 nx[6], ny[6], nz[6], nw[6], ax[6], ay[6], az[6];
+		for (int p = 0; p < 6; p++)
+		{
+			const glm::vec4& plane = frustum.planes[p];
+			nx[p] = _mm_set1_ps(plane.x);
+			ny[p] = _mm_set1_ps(plane.y);
+			nz[p] = _mm_set1_ps(plane.z);
+			nw[p] = _mm_set1_ps(plane.w);
+			ax[p] = _mm_set1_ps(std::abs(plane.x));
+			ay[p] = _mm_set1_ps(std::abs(plane.y));
+			az[p] = _mm_set1_ps(std::abs(plane.z));
+		}
+		const __m128 signBit = _mm_set1_ps(-0.0f);
+
+		uint32_t visibleCount = 0;
+		uint32_t i = begin;
+		for (; i + 4 <= end; i += 4)
+		{
+			__m128 cx = _mm_loadu_ps(&bounds.centerX[i]);
+			__m128 cy = _mm_loadu_ps(&bounds.centerY[i]);
+			__m128 cz = _mm_loadu_ps(&bounds.centerZ[i]);
+			__m128 ex = _mm_loadu_ps(&bounds.extentX[i]);
+			__m128 ey = _mm_loadu_ps(&bounds.extentY[i]);
+			__m128 ez = _mm_loadu_ps(&bounds.extentZ[i]);
+			__m128 r = _mm_loadu_ps(&bounds.radius[i]);
+
+			__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+			for (int p = 0; p < 6; p++)
+			{
+				__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx[p], cx), _mm_mul_ps(ny[p], cy)), _mm_add_ps(_mm_mul_ps(nz[p], cz), nw[p]));
+				__m128 boxRadius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax[p], ex), _mm_mul_ps(ay[p], ey)), _mm_mul_ps(az[p], ez));
+				__m128 negativeRadius = _mm_xor_ps(_mm_min_ps(r, boxRadius), signBit);
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negativeRadius));
+			}
+
+			uint32_t mask = static_cast<uint32_t>(_mm_movemask_ps(inside));
+			for (int k = 0; k < 4; k++)
+			{
+				visible[i + k] = (mask >> k) & 1;
+			}
+			visibleCount += static_cast<uint32_t>(std::popcount(mask));
+		}
+
+		return visibleCount + cullScalar(frustum, bounds, i, end, visible);
+	}
+#endif
+
+}
+
+uint32_t cullObjects(const Frustum& frustum, const BoundsSoA& bounds, uint32_t begin, uint32_t end, uint8_t* visible, CullingPath path)
+{
+	if (path == CullingPath::Best)
+		path = isCullingPathAvailable(CullingPath::Avx2) ? CullingPath::Avx2 : isCullingPathAvailable(CullingPath::Sse) ? CullingPath::Sse : CullingPath::Scalar;
+
+	switch (path)
+	{
+	case CullingPath::Avx2:
+	{
+		CullAvx2Input input{ &frustum.planes[0].x, bounds.centerX.data(), bounds.centerY.data(), bounds.centerZ.data(),
+			bounds.extentX.data(), bounds.extentY.data(), bounds.extentZ.data(), bounds.radius.data() };
+		uint32_t tail = end - (end - begin) % 8;
+		return cullAvx2(input, begin, tail, visible) + cullScalar(frustum, bounds, tail, end, visible);
+	}
+#if CULLING_SSE
+	case CullingPath::Sse:
+		return cullSse(frustum, bounds, begin, end, visible);
+#endif
+	default:
+		return cullScalar(frustum, bounds, begin, end, visible);
+	}
+}
+
+uint32_t cullObjectsParallel(JobSystem& jobSystem, const Frustum& frustum, const BoundsSoA& bounds, uint8_t* visible, uint32_t grainSize, CullingPath path)
+{
+	std::atomic<uint32_t> visibleCount = 0;
+
+	// chunks write disjoint ranges of visible, no synchronisation needed beyond the count
+	jobSystem.parallelFor(bounds.size(), grainSize, [&](uint32_t begin, uint32_t end)
+	{
+		visibleCount.fetch_add(cullObjects(frustum, bounds, begin, end, visible, path), std::memory_order_relaxed);
+	});
+
+	return visibleCount.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+class JobSystem;
+
+struct Aabb
+{
+	glm::vec3 min;
+	glm::vec3 max;
+};
+
+struct BoundingSphere
+{
+	glm::vec3 center;
+	float radius;
+};
+
+// Object space bounds of a mesh, computed once at load
+struct MeshBounds
+{
+	Aabb aabb;
+	BoundingSphere sphere;
+};
+
+MeshBounds computeMeshBounds(const glm::vec3* positions, size_t count, size_t stride);
+
+// World space bounds of many objects as structure of arrays, so the SIMD tests load 4/8 objects per register.
+// Every object has a sphere and an AABB (center + half extents) sharing the same center.
+class BoundsSoA
+{
+public:
+	void resize(uint32_t count);
+	uint32_t size() const { return m_count; }
+
+	// object space bounds moved into world space, transform may rotate and scale
+	void set(uint32_t index, const MeshBounds& bounds, const glm::mat4& transform);
+
+	std::vector<float> centerX, centerY, centerZ;
+	std::vector<float> extentX, extentY, extentZ;
+	std::vector<float> radius;
+
+private:
+	uint32_t m_count = 0;
+};
+
+// Six planes facing inwards, xyz normal and w distance, a point p is inside a plane if dot(n, p) + w >= 0
+struct Frustum
+{
+	glm::vec4 planes[6];
+
+	// expects a 0..1 depth range projection (GLM_FORCE_DEPTH_ZERO_TO_ONE)
+	static Frustum fromViewProj(const glm::mat4& viewProj);
+};
+
+enum class CullingPath
+{
+	Scalar,
+	Sse, // 4 objects per iteration
+	Avx2, // 8 objects per iteration, if the CPU supports it, CullingAvx2.cpp is the only file built with AVX2
+	Best
+};
+
+bool isCullingPathAvailable(CullingPath path);
+const char* cullingPathName(CullingPath path);
+
+// Tests objects [begin, end) against the frustum and writes 1 (visible) or 0 to visible[i].
+// An object is culled if its sphere or its AABB lies entirely outside one of the planes. Returns the visible count.
+uint32_t cullObjects(const Frustum& frustum, const BoundsSoA& bounds, uint32_t begin, uint32_t end, uint8_t* visible, CullingPath path = CullingPath::Best);
+
+// same, split over the job system in chunks of grainSize objects
+uint32_t cullObjectsParallel(JobSystem& jobSystem, const Frustum& frustum, const BoundsSoA& bounds, uint8_t* visible, uint32_t grainSize = 16384,
+	CullingPath path = CullingPath::Best);
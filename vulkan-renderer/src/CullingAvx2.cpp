@@ -0,0 +1,74 @@
+#include "CullingAvx2.h"
+
+// The only file built with AVX2 code generation (/arch:AVX2 in the project, -mavx2 elsewhere), Culling.cpp only calls
+// into it once cpuid reported AVX2. Inline functions of shared headers instantiated here could end up compiled with AVX2
+// and picked by the linker for every caller, so this file sticks to raw pointers and intrinsics
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+
+bool cullAvx2Compiled()
+{
+	return true;
+}
+
+uint32_t cullAvx2(const CullAvx2Input& input, uint32_t begin, uint32_t end, uint8_t* visible)
+{
+	const __m256 signBit = _mm256_set1_ps(-0.0f);
+
+	__m256 nx[6], ny[6], nz[6], nw[6], ax[6], ay[6], az[6];
+	for (int p = 0; p < 6; p++)
+	{
+		const float* plane = input.planes + 4 * p;
+		nx[p] = _mm256_set1_ps(plane[0]);
+		ny[p] = _mm256_set1_ps(plane[1]);
+		nz[p] = _mm256_set1_ps(plane[2]);
+		nw[p] = _mm256_set1_ps(plane[3]);
+		ax[p] = _mm256_andnot_ps(signBit, nx[p]);
+		ay[p] = _mm256_andnot_ps(signBit, ny[p]);
+		az[p] = _mm256_andnot_ps(signBit, nz[p]);
+	}
+
+	uint32_t visibleCount = 0;
+	uint32_t i = begin;
+	for (; i + 8 <= end; i += 8)
+	{
+		__m256 cx = _mm256_loadu_ps(input.centerX + i);
+		__m256 cy = _mm256_loadu_ps(input.centerY + i);
+		__m256 cz = _mm256_loadu_ps(input.centerZ + i);
+		__m256 ex = _mm256_loadu_ps(input.extentX + i);
+		__m256 ey = _mm256_loadu_ps(input.extentY + i);
+		__m256 ez = _mm256_loadu_ps(input.extentZ + i);
+		__m256 r = _mm256_loadu_ps(input.radius + i);
+
+		__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+		for (int p = 0; p < 6; p++)
+		{
+			__m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx[p], cx), _mm256_mul_ps(ny[p], cy)), _mm256_add_ps(_mm256_mul_ps(nz[p], cz), nw[p]));
+			__m256 boxRadius = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ax[p], ex), _mm256_mul_ps(ay[p], ey)), _mm256_mul_ps(az[p], ez));
+			__m256 negativeRadius = _mm256_xor_ps(_mm256_min_ps(r, boxRadius), signBit);
+			inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, negativeRadius, _CMP_GE_OQ));
+		}
+
+		uint32_t mask = static_cast<uint32_t>(_mm256_movemask_ps(inside));
+		for (int k = 0; k < 8; k++)
+		{
+			visible[i + k] = (mask >> k) & 1;
+			visibleCount += (mask >> k) & 1;
+		}
+	}
+
+	// the tail is left to the caller
+	return visibleCount;
+}
+#else
+bool cullAvx2Compiled()
+{
+	return false;
+}
+
+uint32_t cullAvx2(const CullAvx2Input&, uint32_t, uint32_t, uint8_t*)
+{
+	return 0;
+}
+#endif
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstdint>
+
+// Frustum culling 8 objects at a time, split out of Culling.cpp so only this code is compiled for AVX2.
+// Plain pointers into Frustum and BoundsSoA, the AVX2 file doesn't include their headers
+struct CullAvx2Input
+{
+	const float* planes; // 6 x (normal, distance)
+	const float* centerX;
+	const float* centerY;
+	const float* centerZ;
+	const float* extentX;
+	const float* extentY;
+	const float* extentZ;
+	const float* radius;
+};
+
+bool cullAvx2Compiled(); // false if the file was built without AVX2 enabled
+
+// whole groups of 8 from begin on, the objects past the last full group are left untouched. Returns the visible count
+uint32_t cullAvx2(const CullAvx2Input& input, uint32_t begin, uint32_t end, uint8_t* visible);
@@ -0,0 +1,45 @@
+#include "DescriptorSlots.h"
+
+#include <stdexcept>
+
+DescriptorSlots::DescriptorSlots(uint32_t capacity, uint32_t reuseDelay)
+	: m_capacity(capacity), m_reuseDelay(reuseDelay), m_allocated(capacity, 0)
+{
+}
+
+uint32_t DescriptorSlots::allocate()
+{
+	uint32_t slot;
+	if (!m_free.empty())
+	{
+		slot = m_free.back();
+		m_free.pop_back();
+	}
+	else if (m_nextUnused < m_capacity)
+		slot = m_nextUnused++;
+	else
+		return INVALID_SLOT;
+
+	m_allocated[slot] = 1;
+	m_usedCount++;
+	return slot;
+}
+
+void DescriptorSlots::release(uint32_t slot, uint64_t frameNumber)
+{
+	if (slot >= m_capacity || !m_allocated[slot])
+		throw std::runtime_error("Released a descriptor slot that isn't allocated");
+
+	m_allocated[slot] = 0;
+	m_usedCount--;
+	m_pending.push_back({ slot, frameNumber });
+}
+
+void DescriptorSlots::collect(uint64_t frameNumber)
+{
+	while (!m_pending.empty() && m_pending.front().frameNumber + m_reuseDelay <= frameNumber)
+	{
+		m_free.push_back(m_pending.front().slot);
+		m_pending.pop_front();
+	}
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+// Indices into a descriptor array that is bound once and indexed by the shaders. A released slot may still be read by
+// the frames in flight, it only goes back to the free list once the frame it was released in is reuseDelay frames old,
+// the same rule the application's deletion queue follows
+class DescriptorSlots
+{
+public:
+	static constexpr uint32_t INVALID_SLOT = UINT32_MAX;
+
+	DescriptorSlots() = default;
+	DescriptorSlots(uint32_t capacity, uint32_t reuseDelay);
+
+	uint32_t allocate(); // INVALID_SLOT when every slot is taken or still waiting
+	void release(uint32_t slot, uint64_t frameNumber);
+	void collect(uint64_t frameNumber); // call once per frame, after its fence was waited on
+
+	uint32_t capacity() const { return m_capacity; }
+	uint32_t usedCount() const { return m_usedCount; } // allocated and not released
+	uint32_t pendingCount() const { return static_cast<uint32_t>(m_pending.size()); }
+	uint32_t highWater() const { return m_nextUnused; } // slots handed out at least once, the part of the array ever written
+
+private:
+	struct PendingSlot
+	{
+		uint32_t slot;
+		uint64_t frameNumber;
+	};
+
+	uint32_t m_capacity = 0;
+	uint32_t m_reuseDelay = 0;
+	uint32_t m_nextUnused = 0;
+	uint32_t m_usedCount = 0;
+	std::vector<uint32_t> m_free; // last in first out, the most recently written descriptors are the likeliest in cache
+	std::deque<PendingSlot> m_pending; // in release order, so oldest frame first
+	std::vector<uint8_t> m_allocated; // per slot, catches double releases
+};
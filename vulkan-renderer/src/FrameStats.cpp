@@ -0,0 +1,243 @@
+#include "FrameStats.h"
+
+#include <iostream>
+#include <algorithm>
+#include <iterator>
+
+FrameStats::FrameStats(double reportIntervalSeconds)
+	: m_reportInterval(reportIntervalSeconds), m_lastReport(Clock::now())
+{
+}
+
+void FrameStats::addFrame(double frameTimeMs, bool resizing)
+{
+	m_frameCount++;
+	m_totalTimeMs += frameTimeMs;
+	m_worstTimeMs = std::max(m_worstTimeMs, frameTimeMs);
+
+	if (resizing)
+	{
+		m_resizeFrameCount++;
+		m_worstResizeTimeMs = std::max(m_worstResizeTimeMs, frameTimeMs);
+	}
+}
+
+void FrameStats::addStageTime(FrameStage stage, double timeMs)
+{
+	StageTimes& times = m_stages[static_cast<size_t>(stage)];
+	times.count++;
+	times.totalMs += timeMs;
+	times.worstMs = std::max(times.worstMs, timeMs);
+}
+
+void FrameStats::addGpuTime(double timeMs)
+{
+	m_gpu.count++;
+	m_gpu.totalMs += timeMs;
+	m_gpu.worstMs = std::max(m_gpu.worstMs, timeMs);
+}
+
+void FrameStats::addFragmentInvocations(uint64_t invocations)
+{
+	m_statisticsSamples++;
+	m_fragmentInvocations += invocations;
+}
+
+void FrameStats::addDrawCounts(uint32_t drawCalls, uint32_t instances, uint32_t culledObjects)
+{
+	m_drawCalls += drawCalls;
+	m_instances += instances;
+	m_culledObjects += culledObjects;
+}
+
+void FrameStats::addOcclusionCulling(uint32_t occludedObjects, uint64_t frustumCulledTriangles, uint64_t occludedTriangles)
+{
+	m_occlusionSamples++;
+	m_occludedObjects += occludedObjects;
+	m_frustumCulledTriangles += frustumCulledTriangles;
+	m_occludedTriangles += occludedTriangles;
+}
+
+void FrameStats::addStateChanges(uint32_t draws, uint32_t pipelineBinds, uint32_t materialBinds, uint32_t meshSwitches)
+{
+	m_stateChangeFrames++;
+	m_stateChangeDraws += draws;
+	m_pipelineBinds += pipelineBinds;
+	m_materialBinds += materialBinds;
+	m_meshSwitches += meshSwitches;
+}
+
+void FrameStats::addDescriptorBinds(uint32_t bindCalls, uint32_t bindlessSlots)
+{
+	m_descriptorFrames++;
+	m_descriptorBinds += bindCalls;
+	m_bindlessSlots += bindlessSlots;
+}
+
+void FrameStats::addLightClusters(uint32_t lights, uint32_t clusterLights, uint32_t droppedLights)
+{
+	m_lightClusterFrames++;
+	m_lights += lights;
+	m_clusterLights += clusterLights;
+	m_droppedClusterLights += droppedLights;
+}
+
+void FrameStats::addRenderExtent(uint32_t width, uint32_t height)
+{
+	m_minRenderWidth = m_renderExtentCount == 0 ? width : std::min(m_minRenderWidth, width);
+	m_maxRenderWidth = std::max(m_maxRenderWidth, width);
+	m_renderExtentCount++;
+	m_renderWidth += width;
+	m_renderHeight += height;
+}
+
+void FrameStats::addShadows(uint32_t redrawnCascades, uint32_t keptCascades, uint32_t drawCalls, uint32_t instances, uint32_t movedObjects)
+{
+	m_shadowFrames++;
+	m_redrawnCascades += redrawnCascades;
+	m_keptCascades += keptCascades;
+	m_shadowDrawCalls += drawCalls;
+	m_shadowInstances += instances;
+	m_shadowMovedObjects += movedObjects;
+}
+
+void FrameStats::addShadowGpuTime(double timeMs)
+{
+	m_shadowGpu.count++;
+	m_shadowGpu.totalMs += timeMs;
+	m_shadowGpu.worstMs = std::max(m_shadowGpu.worstMs, timeMs);
+}
+
+void FrameStats::report()
+{
+	auto now = Clock::now();
+	double elapsed = std::chrono::duration<double, std::chrono::seconds::period>(now - m_lastReport).count();
+	if (elapsed < m_reportInterval)
+		return;
+
+	if (m_frameCount > 0)
+	{
+		std::cout << "Frame time: avg " << m_totalTimeMs / m_frameCount << " ms, worst " << m_worstTimeMs << " ms"
+			<< " (" << m_frameCount << " frames)";
+
+		if (m_resizeFrameCount > 0)
+			std::cout << ", worst during resize " << m_worstResizeTimeMs << " ms (" << m_resizeFrameCount << " frames)";
+
+		std::cout << std::endl;
+
+		static const char* stageNames[] = { "events", "simulation", "culling", "sorting", "lighting", "shadows", "wait", "record", "submit" };
+		static_assert(std::size(stageNames) == static_cast<size_t>(FrameStage::Count), "stage names out of sync");
+
+		std::cout << "  CPU stages (avg/worst ms):";
+		for (size_t i = 0; i < m_stages.size(); i++)
+		{
+			if (m_stages[i].count == 0)
+				continue;
+			std::cout << " " << stageNames[i] << " " << m_stages[i].totalMs / m_stages[i].count << "/" << m_stages[i].worstMs;
+		}
+		std::cout << std::endl;
+
+		if (m_gpu.count > 0)
+			std::cout << "  GPU (avg/worst ms): " << m_gpu.totalMs / m_gpu.count << "/" << m_gpu.worstMs << std::endl;
+
+		// overdraw shows up here, with MSAA sample shading every shaded sample counts
+		if (m_statisticsSamples > 0)
+			std::cout << "  Fragment shader invocations per frame: " << m_fragmentInvocations / m_statisticsSamples << std::endl;
+
+		if (m_drawCalls > 0 || m_culledObjects > 0)
+			std::cout << "  Per frame: " << m_drawCalls / m_frameCount << " draw calls, " << m_instances / m_frameCount << " instances, "
+				<< m_culledObjects / m_frameCount << " culled" << std::endl;
+
+		// read back with a delay, averaged over the results that arrived rather than the frames
+		if (m_occlusionSamples > 0)
+			std::cout << "  Rejected per frame: " << m_occludedObjects / m_occlusionSamples << " objects by occlusion, "
+				<< m_frustumCulledTriangles / m_occlusionSamples << " triangles by frustum, " << m_occludedTriangles / m_occlusionSamples << " by occlusion" << std::endl;
+
+		// without the elision every draw would set all of its state
+		if (m_stateChangeFrames > 0)
+		{
+			uint64_t draws = m_stateChangeDraws / m_stateChangeFrames;
+			uint64_t pipelineBinds = m_pipelineBinds / m_stateChangeFrames, materialBinds = m_materialBinds / m_stateChangeFrames;
+			uint64_t meshSwitches = m_meshSwitches / m_stateChangeFrames;
+			std::cout << "  State changes per frame: " << pipelineBinds << " pipeline binds (" << draws - pipelineBinds << " elided), "
+				<< materialBinds << " material binds (" << draws - materialBinds << " elided), "
+				<< meshSwitches << " mesh switches (" << draws - meshSwitches << " elided) over " << draws << " draws" << std::endl;
+		}
+
+		// vkCmdBindDescriptorSets calls of the frame, with the bindless set they don't grow with the materials drawn
+		if (m_descriptorFrames > 0)
+		{
+			std::cout << "  Descriptor set binds per frame: " << static_cast<double>(m_descriptorBinds) / m_descriptorFrames;
+			if (m_bindlessSlots > 0)
+				std::cout << ", " << m_bindlessSlots / m_descriptorFrames << " bindless slots in use";
+			std::cout << std::endl;
+		}
+
+		// pairs over the per cluster limit are lights the far, large clusters leave out
+		if (m_lightClusterFrames > 0)
+			std::cout << "  Light clusters: " << m_lights / m_lightClusterFrames << " lights, " << m_clusterLights / m_lightClusterFrames
+				<< " light/cluster pairs, " << m_droppedClusterLights / m_lightClusterFrames << " dropped" << std::endl;
+
+		if (m_renderExtentCount > 0)
+			std::cout << "  Render resolution: avg " << m_renderWidth / m_renderExtentCount << "x" << m_renderHeight / m_renderExtentCount
+				<< ", width " << m_minRenderWidth << " - " << m_maxRenderWidth << std::endl;
+
+		// kept cascades cost nothing on the GPU, a static scene under a still camera redraws none of them
+		if (m_shadowFrames > 0)
+		{
+			std::cout << "  Shadows per frame: " << static_cast<double>(m_redrawnCascades) / m_shadowFrames << " cascades redrawn, "
+				<< static_cast<double>(m_keptCascades) / m_shadowFrames << " kept, " << m_shadowDrawCalls / m_shadowFrames << " draw calls, "
+				<< m_shadowInstances / m_shadowFrames << " instances, " << m_shadowMovedObjects / m_shadowFrames << " objects moved";
+			if (m_shadowGpu.count > 0)
+				std::cout << ", GPU (avg/worst ms) " << m_shadowGpu.totalMs / m_shadowGpu.count << "/" << m_shadowGpu.worstMs;
+			std::cout << std::endl;
+		}
+	}
+
+	reset();
+	m_lastReport = now;
+}
+
+void FrameStats::reset()
+{
+	m_frameCount = 0;
+	m_totalTimeMs = 0.0;
+	m_worstTimeMs = 0.0;
+	m_resizeFrameCount = 0;
+	m_worstResizeTimeMs = 0.0;
+	m_stages = {};
+	m_gpu = {};
+	m_statisticsSamples = 0;
+	m_fragmentInvocations = 0;
+	m_drawCalls = 0;
+	m_instances = 0;
+	m_culledObjects = 0;
+	m_occlusionSamples = 0;
+	m_occludedObjects = 0;
+	m_frustumCulledTriangles = 0;
+	m_occludedTriangles = 0;
+	m_stateChangeFrames = 0;
+	m_stateChangeDraws = 0;
+	m_pipelineBinds = 0;
+	m_materialBinds = 0;
+	m_meshSwitches = 0;
+	m_descriptorFrames = 0;
+	m_descriptorBinds = 0;
+	m_bindlessSlots = 0;
+	m_lightClusterFrames = 0;
+	m_lights = 0;
+	m_clusterLights = 0;
+	m_droppedClusterLights = 0;
+	m_renderExtentCount = 0;
+	m_renderWidth = 0;
+	m_renderHeight = 0;
+	m_minRenderWidth = 0;
+	m_maxRenderWidth = 0;
+	m_shadowFrames = 0;
+	m_redrawnCascades = 0;
+	m_keptCascades = 0;
+	m_shadowDrawCalls = 0;
+	m_shadowInstances = 0;
+	m_shadowMovedObjects = 0;
+	m_shadowGpu = {};
+}
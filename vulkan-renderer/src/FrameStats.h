@@ -0,0 +1,115 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <array>
+
+// CPU work of a frame, split by the thread/stage it runs on
+enum class FrameStage : uint32_t
+{
+	Events,     // main thread, glfwPollEvents
+	Simulation, // simulation thread, building the frame packet
+	Culling,    // simulation thread, frustum culling the draw list (part of Simulation)
+	Sorting,    // simulation thread, sorting the draw list by draw key (part of Simulation)
+	Lighting,   // simulation thread, assigning lights to clusters (part of Simulation)
+	Shadows,    // simulation thread, fitting the shadow cascades and collecting their casters (part of Simulation)
+	Wait,       // main thread, fence wait + image acquire
+	Record,     // main thread, uniform upload + command recording
+	Submit,     // main thread, queue submit + present
+	Count
+};
+
+struct CpuTimer
+{
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+	double elapsedMs() const
+	{
+		return std::chrono::duration<double, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+
+	double restartMs()
+	{
+		auto now = std::chrono::high_resolution_clock::now();
+		double elapsed = std::chrono::duration<double, std::chrono::milliseconds::period>(now - start).count();
+		start = now;
+		return elapsed;
+	}
+};
+
+// Accumulates CPU frame times and prints a short summary once per report interval.
+// Frames flagged as "resizing" are tracked separately so swap chain recreation hitches are visible.
+class FrameStats
+{
+public:
+	using Clock = std::chrono::high_resolution_clock;
+
+	explicit FrameStats(double reportIntervalSeconds = 1.0);
+
+	void addFrame(double frameTimeMs, bool resizing);
+	void addStageTime(FrameStage stage, double timeMs);
+	void addGpuTime(double timeMs); // from timestamp queries, arrives MAX_FRAMES_IN_FLIGHT frames late
+	void addFragmentInvocations(uint64_t invocations); // from pipeline statistics queries, arrives with the GPU time
+	void addDrawCounts(uint32_t drawCalls, uint32_t instances, uint32_t culledObjects);
+	void addOcclusionCulling(uint32_t occludedObjects, uint64_t frustumCulledTriangles, uint64_t occludedTriangles); // scenes with occluders only
+	void addStateChanges(uint32_t draws, uint32_t pipelineBinds, uint32_t materialBinds, uint32_t meshSwitches); // CPU path only
+	void addDescriptorBinds(uint32_t bindCalls, uint32_t bindlessSlots); // every frame, bindlessSlots in use, 0 without the bindless set
+	void addLightClusters(uint32_t lights, uint32_t clusterLights, uint32_t droppedLights); // per simulated frame, clustered lighting only
+	void addRenderExtent(uint32_t width, uint32_t height); // dynamic resolution only
+	void addShadows(uint32_t redrawnCascades, uint32_t keptCascades, uint32_t drawCalls, uint32_t instances, uint32_t movedObjects); // shadows only
+	void addShadowGpuTime(double timeMs); // of the shadow passes, arrives with the frame's GPU time
+	void report(); // prints and resets if the report interval elapsed
+
+private:
+	struct StageTimes
+	{
+		uint32_t count = 0;
+		double totalMs = 0.0;
+		double worstMs = 0.0;
+	};
+
+	void reset();
+
+	double m_reportInterval;
+	Clock::time_point m_lastReport;
+
+	uint32_t m_frameCount = 0;
+	double m_totalTimeMs = 0.0;
+	double m_worstTimeMs = 0.0;
+
+	uint32_t m_resizeFrameCount = 0;
+	double m_worstResizeTimeMs = 0.0;
+
+	std::array<StageTimes, static_cast<size_t>(FrameStage::Count)> m_stages{};
+	StageTimes m_gpu{};
+	uint32_t m_statisticsSamples = 0;
+	uint64_t m_fragmentInvocations = 0;
+
+	uint64_t m_drawCalls = 0;
+	uint64_t m_instances = 0;
+	uint64_t m_culledObjects = 0;
+
+	uint32_t m_occlusionSamples = 0;
+	uint64_t m_occludedObjects = 0;
+	uint64_t m_frustumCulledTriangles = 0;
+	uint64_t m_occludedTriangles = 0;
+
+	uint32_t m_stateChangeFrames = 0;
+	uint64_t m_stateChangeDraws = 0;
+	uint64_t m_pipelineBinds = 0, m_materialBinds = 0, m_meshSwitches = 0;
+
+	uint32_t m_descriptorFrames = 0;
+	uint64_t m_descriptorBinds = 0, m_bindlessSlots = 0;
+
+	uint32_t m_lightClusterFrames = 0;
+	uint64_t m_lights = 0, m_clusterLights = 0, m_droppedClusterLights = 0;
+
+	uint32_t m_renderExtentCount = 0;
+	uint64_t m_renderWidth = 0, m_renderHeight = 0;
+	uint32_t m_minRenderWidth = 0, m_maxRenderWidth = 0;
+
+	uint32_t m_shadowFrames = 0;
+	uint64_t m_redrawnCascades = 0, m_keptCascades = 0;
+	uint64_t m_shadowDrawCalls = 0, m_shadowInstances = 0, m_shadowMovedObjects = 0;
+	StageTimes m_shadowGpu{};
+};
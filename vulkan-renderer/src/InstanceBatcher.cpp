@@ -0,0 +1,60 @@
+#include "InstanceBatcher.h"
+
+#include <algorithm>
+
+uint32_t InstanceBatcher::build(const std::vector<DrawItem>& drawList, const std::vector<glm::mat4>& transforms, glm::mat4* instanceTransforms, uint32_t maxInstances)
+{
+	m_batchLookup.clear();
+	m_batches.clear();
+	m_itemBatches.resize(drawList.size());
+
+	// count the instances of every batch, neighbouring items are usually copies of the same thing so try the last batch first
+	BatchKey lastKey{};
+	uint32_t lastBatch = UINT32_MAX;
+
+	for (size_t i = 0; i < drawList.size(); i++)
+	{
+		const DrawItem& item = drawList[i];
+		BatchKey key{ item.firstIndex, item.indexCount, item.materialIndex };
+
+		if (lastBatch == UINT32_MAX || !(key == lastKey))
+		{
+			auto [it, inserted] = m_batchLookup.try_emplace(key, static_cast<uint32_t>(m_batches.size()));
+			if (inserted)
+				m_batches.push_back({ item.firstIndex, item.indexCount, item.materialIndex, 0, 0 });
+
+			lastKey = key;
+			lastBatch = it->second;
+		}
+
+		m_batches[lastBatch].instanceCount++;
+		m_itemBatches[i] = lastBatch;
+	}
+
+	// lay the batches out back to back, clamped to the buffer size
+	uint32_t instanceCount = 0;
+	for (InstanceBatch& batch : m_batches)
+	{
+		batch.firstInstance = instanceCount;
+		batch.instanceCount = std::min(batch.instanceCount, maxInstances - instanceCount);
+		instanceCount += batch.instanceCount;
+	}
+
+	m_batchCursors.assign(m_batches.size(), 0);
+	for (size_t i = 0; i < drawList.size(); i++)
+	{
+		uint32_t batchIndex = m_itemBatches[i];
+		const InstanceBatch& batch = m_batches[batchIndex];
+
+		uint32_t& cursor = m_batchCursors[batchIndex];
+		if (cursor == batch.instanceCount)
+			continue;
+
+		instanceTransforms[batch.firstInstance + cursor++] = transforms[drawList[i].transformIndex];
+	}
+
+	// a batch clamped down to nothing would be an empty draw
+	m_batches.erase(std::remove_if(m_batches.begin(), m_batches.end(), [](const InstanceBatch& batch) { return batch.instanceCount == 0; }), m_batches.end());
+
+	return instanceCount;
+}
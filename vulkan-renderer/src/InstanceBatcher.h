@@ -0,0 +1,62 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// One object the simulation wants drawn this frame
+struct DrawItem
+{
+	uint32_t transformIndex; // index into FramePacket::transforms
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	uint32_t materialIndex = 0;
+};
+
+// instanceCount copies of one mesh + material, their transforms sit at [firstInstance, firstInstance + instanceCount)
+// in the instance buffer, the vertex shader finds them through gl_InstanceIndex
+struct InstanceBatch
+{
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	uint32_t materialIndex;
+	uint32_t firstInstance;
+	uint32_t instanceCount;
+};
+
+// Groups draw items sharing mesh and material into instanced draws, in order of first appearance.
+// Meant to be kept around and rebuilt every frame so its allocations are reused.
+class InstanceBatcher
+{
+public:
+	// writes the transforms of the batched items to instanceTransforms (usually mapped GPU memory) and returns how many were written,
+	// items that don't fit into maxInstances are dropped
+	uint32_t build(const std::vector<DrawItem>& drawList, const std::vector<glm::mat4>& transforms, glm::mat4* instanceTransforms, uint32_t maxInstances);
+
+	const std::vector<InstanceBatch>& batches() const { return m_batches; }
+
+private:
+	struct BatchKey
+	{
+		uint32_t firstIndex;
+		uint32_t indexCount;
+		uint32_t materialIndex;
+
+		bool operator==(const BatchKey& other) const = default;
+	};
+
+	struct BatchKeyHash
+	{
+		size_t operator()(const BatchKey& key) const
+		{
+			return (static_cast<size_t>(key.firstIndex) * 0x9e3779b97f4a7c15ull) ^ (static_cast<size_t>(key.indexCount) << 20) ^ key.materialIndex;
+		}
+	};
+
+	std::unordered_map<BatchKey, uint32_t, BatchKeyHash> m_batchLookup;
+	std::vector<uint32_t> m_itemBatches; // batch index of every draw item
+	std::vector<uint32_t> m_batchCursors; // next free instance slot of every batch while scattering
+	std::vector<InstanceBatch> m_batches;
+};
@@ -0,0 +1,300 @@
+#include "JobSystem.h"
+
+#include <algorithm>
+#include <iterator>
+
+namespace
+{
+	// lets a thread find its own deque, and tells worker threads of different job systems apart
+	thread_local const JobSystem* t_owner = nullptr;
+	thread_local uint32_t t_workerIndex = 0;
+}
+
+JobSystem::JobSystem(uint32_t workerCount)
+	: m_mainThreadId(std::this_thread::get_id())
+{
+	uint32_t queueCount = std::max(1u, workerCount);
+	for (uint32_t i = 0; i < queueCount; i++)
+	{
+		m_workers.push_back(std::make_unique<Worker>());
+	}
+
+	for (uint32_t i = 0; i < workerCount; i++)
+	{
+		m_threads.emplace_back(&JobSystem::workerLoop, this, i);
+	}
+}
+
+JobSystem::~JobSystem()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_sleepMutex);
+		m_stopping = true;
+	}
+	m_wakeCondition.notify_all();
+
+	for (std::thread& thread : m_threads)
+	{
+		thread.join();
+	}
+}
+
+uint32_t JobSystem::defaultWorkerCount()
+{
+	uint32_t cores = std::thread::hardware_concurrency();
+	return cores > 1 ? cores - 1 : 0;
+}
+
+void JobSystem::run(Job job, JobCounter* counter)
+{
+	if (counter)
+		counter->m_pending.fetch_add(1, std::memory_order_relaxed);
+
+	enqueue({ std::move(job), counter });
+}
+
+void JobSystem::runAfter(JobCounter& dependency, Job job, JobCounter* counter)
+{
+	if (counter)
+		counter->m_pending.fetch_add(1, std::memory_order_relaxed);
+
+	{
+		// finish() takes the same lock before handing out continuations, so a job is either queued here
+		// before the dependency completes or sees it completed, never lost in between
+		std::lock_guard<std::mutex> lock(dependency.m_mutex);
+		if (!dependency.isDone())
+		{
+			dependency.m_continuations.emplace_back(std::move(job), counter);
+			return;
+		}
+	}
+
+	enqueue({ std::move(job), counter });
+}
+
+void JobSystem::runOnMainThread(Job job, JobCounter* counter)
+{
+	if (counter)
+		counter->m_pending.fetch_add(1, std::memory_order_relaxed);
+
+	std::lock_guard<std::mutex> lock(m_mainThreadMutex);
+	m_mainThreadJobs.push_back({ std::move(job), counter });
+}
+
+void JobSystem::wait(JobCounter& counter)
+{
+	bool onMainThread = std::this_thread::get_id() == m_mainThreadId;
+
+	while (!counter.isDone())
+	{
+		// main thread jobs can't run anywhere else, so waiting on the main thread has to drain them too
+		if (onMainThread)
+			pumpMainThread();
+
+		if (!tryRunOne())
+			std::this_thread::yield();
+	}
+
+	std::exception_ptr error;
+	{
+		std::lock_guard<std::mutex> lock(counter.m_mutex);
+		std::swap(error, counter.m_error);
+	}
+
+	if (error)
+		std::rethrow_exception(error);
+}
+
+void JobSystem::parallelFor(uint32_t count, uint32_t grainSize, const std::function<void(uint32_t begin, uint32_t end)>& body)
+{
+	if (count == 0)
+		return;
+
+	grainSize = std::max(1u, grainSize);
+
+	// a single chunk isn't worth a trip through the queues
+	if (count <= grainSize)
+	{
+		body(0, count);
+		return;
+	}
+
+	JobCounter counter;
+	for (uint32_t begin = 0; begin < count; begin += grainSize)
+	{
+		uint32_t end = std::min(count, begin + grainSize);
+		run([&body, begin, end]() { body(begin, end); }, &counter);
+	}
+
+	wait(counter);
+}
+
+void JobSystem::pumpMainThread()
+{
+	std::deque<QueuedJob> jobs;
+	{
+		std::lock_guard<std::mutex> lock(m_mainThreadMutex);
+		jobs.swap(m_mainThreadJobs);
+	}
+
+	for (size_t i = 0; i < jobs.size(); i++)
+	{
+		try
+		{
+			execute(jobs[i]);
+		}
+		catch (...)
+		{
+			// the jobs after the failed one still have to run, ahead of anything queued in the meantime
+			std::lock_guard<std::mutex> lock(m_mainThreadMutex);
+			m_mainThreadJobs.insert(m_mainThreadJobs.begin(), std::make_move_iterator(jobs.begin() + i + 1), std::make_move_iterator(jobs.end()));
+			throw;
+		}
+	}
+}
+
+void JobSystem::workerLoop(uint32_t workerIndex)
+{
+	t_owner = this;
+	t_workerIndex = workerIndex;
+
+	while (true)
+	{
+		if (tryRunOne())
+			continue;
+
+		std::unique_lock<std::mutex> lock(m_sleepMutex);
+		m_wakeCondition.wait(lock, [this]() { return m_stopping || m_queuedJobs.load(std::memory_order_acquire) > 0; });
+
+		if (m_stopping)
+			return;
+	}
+}
+
+void JobSystem::enqueue(QueuedJob&& job)
+{
+	// workers push onto their own deque, everyone else spreads jobs round robin
+	uint32_t queueIndex = t_owner == this ? t_workerIndex : m_nextQueue.fetch_add(1, std::memory_order_relaxed) % m_workers.size();
+
+	{
+		// counted before it is visible so the counter never underflows, and under the sleep mutex so a worker
+		// can't check the predicate, miss the job and go to sleep right after we notified
+		std::lock_guard<std::mutex> lock(m_sleepMutex);
+		m_queuedJobs.fetch_add(1, std::memory_order_release);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_workers[queueIndex]->mutex);
+		m_workers[queueIndex]->jobs.push_back(std::move(job));
+	}
+
+	m_wakeCondition.notify_one();
+}
+
+bool JobSystem::tryPop(uint32_t workerIndex, QueuedJob& job)
+{
+	Worker& worker = *m_workers[workerIndex];
+	std::lock_guard<std::mutex> lock(worker.mutex);
+
+	if (worker.jobs.empty())
+		return false;
+
+	job = std::move(worker.jobs.back());
+	worker.jobs.pop_back();
+	return true;
+}
+
+bool JobSystem::trySteal(uint32_t thiefIndex, QueuedJob& job)
+{
+	uint32_t queueCount = static_cast<uint32_t>(m_workers.size());
+
+	for (uint32_t i = 1; i <= queueCount; i++)
+	{
+		Worker& victim = *m_workers[(thiefIndex + i) % queueCount];
+		std::unique_lock<std::mutex> lock(victim.mutex, std::try_to_lock);
+
+		// a contended deque is busy anyway, try the next one instead of queueing up behind its owner
+		if (!lock.owns_lock() || victim.jobs.empty())
+			continue;
+
+		job = std::move(victim.jobs.front());
+		victim.jobs.pop_front();
+		return true;
+	}
+
+	return false;
+}
+
+bool JobSystem::tryRunOne()
+{
+	if (m_queuedJobs.load(std::memory_order_acquire) == 0)
+		return false;
+
+	uint32_t ownIndex = t_owner == this ? t_workerIndex : 0;
+
+	QueuedJob job;
+	if ((t_owner == this && tryPop(ownIndex, job)) || trySteal(ownIndex, job))
+	{
+		m_queuedJobs.fetch_sub(1, std::memory_order_relaxed);
+		execute(job);
+		return true;
+	}
+
+	return false;
+}
+
+void JobSystem::execute(QueuedJob& job)
+{
+	try
+	{
+		job.function();
+	}
+	catch (...)
+	{
+		// nobody waits for a job without a counter, so its error surfaces on the main thread instead,
+		// rethrown from pumpMainThread() or wait() there rather than terminating a worker
+		if (!job.counter)
+		{
+			if (std::this_thread::get_id() == m_mainThreadId)
+				throw;
+
+			std::exception_ptr error = std::current_exception();
+			runOnMainThread([error]() { std::rethrow_exception(error); });
+			return;
+		}
+
+		std::lock_guard<std::mutex> lock(job.counter->m_mutex);
+		if (!job.counter->m_error)
+			job.counter->m_error = std::current_exception();
+	}
+
+	finish(job.counter);
+}
+
+void JobSystem::finish(JobCounter* counter)
+{
+	if (!counter)
+		return;
+
+	// as long as we aren't the last job a plain decrement is enough
+	uint32_t pending = counter->m_pending.load(std::memory_order_relaxed);
+	while (pending > 1)
+	{
+		if (counter->m_pending.compare_exchange_weak(pending, pending - 1, std::memory_order_acq_rel))
+			return;
+	}
+
+	// the last decrement happens under the lock, wait() takes the same lock before returning,
+	// so the counter (often on the waiter's stack) can't disappear while we still touch it
+	std::vector<std::pair<Job, JobCounter*>> continuations;
+	{
+		std::lock_guard<std::mutex> lock(counter->m_mutex);
+		if (counter->m_pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			continuations.swap(counter->m_continuations);
+	}
+
+	for (auto& [function, continuationCounter] : continuations)
+	{
+		enqueue({ std::move(function), continuationCounter });
+	}
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fork-join counter. Every job started with a counter increments it and decrements it when done,
+// JobSystem::wait() blocks (while helping out) until it drops back to zero.
+// Jobs started with runAfter() are held back until the counter they depend on reaches zero.
+class JobCounter
+{
+public:
+	bool isDone() const { return m_pending.load(std::memory_order_acquire) == 0; }
+
+private:
+	friend class JobSystem;
+
+	std::atomic<uint32_t> m_pending = 0;
+
+	std::mutex m_mutex; // guards continuations and error
+	std::vector<std::pair<std::function<void()>, JobCounter*>> m_continuations;
+	std::exception_ptr m_error; // first exception thrown by one of the jobs, rethrown by wait()
+};
+
+// Work-stealing job scheduler. Each worker owns a deque: it pushes and pops its own jobs at the back (LIFO, cache warm),
+// idle workers steal from the front of the others (FIFO, oldest and usually biggest work first).
+// Jobs that have to run on the main thread (GLFW, present) go into a separate queue drained by pumpMainThread().
+class JobSystem
+{
+public:
+	using Job = std::function<void()>;
+
+	// the calling thread helps out in wait(), so hardware_concurrency - 1 workers keep every core busy,
+	// with 0 workers everything runs on the waiting thread
+	explicit JobSystem(uint32_t workerCount = defaultWorkerCount());
+	~JobSystem();
+
+	static uint32_t defaultWorkerCount();
+
+	JobSystem(const JobSystem&) = delete;
+	JobSystem& operator=(const JobSystem&) = delete;
+
+	uint32_t workerCount() const { return static_cast<uint32_t>(m_threads.size()); }
+
+	void run(Job job, JobCounter* counter = nullptr);
+	void runAfter(JobCounter& dependency, Job job, JobCounter* counter = nullptr);
+	void runOnMainThread(Job job, JobCounter* counter = nullptr);
+
+	// executes jobs while waiting, rethrows the first exception of a job that ran with this counter
+	// (on the main thread also those of jobs without a counter, see pumpMainThread)
+	void wait(JobCounter& counter);
+
+	// splits [0, count) into chunks of grainSize and runs body(begin, end) on them, returns once all are done
+	void parallelFor(uint32_t count, uint32_t grainSize, const std::function<void(uint32_t begin, uint32_t end)>& body);
+
+	// runs all queued main thread jobs, called once per frame from the main loop.
+	// Exceptions thrown by jobs that ran without a counter are forwarded here and rethrown.
+	void pumpMainThread();
+
+	// runs at most one queued job on the calling thread, lets background work progress without workers
+	bool runPendingJob() { return tryRunOne(); }
+
+private:
+	struct QueuedJob
+	{
+		Job function;
+		JobCounter* counter;
+	};
+
+	struct Worker
+	{
+		std::mutex mutex;
+		std::deque<QueuedJob> jobs;
+	};
+
+	void workerLoop(uint32_t workerIndex);
+	void enqueue(QueuedJob&& job);
+	bool tryPop(uint32_t workerIndex, QueuedJob& job);
+	bool trySteal(uint32_t thiefIndex, QueuedJob& job);
+	bool tryRunOne();
+	void execute(QueuedJob& job);
+	void finish(JobCounter* counter);
+
+	std::vector<std::unique_ptr<Worker>> m_workers; // one deque per worker thread, at least one
+	std::vector<std::thread> m_threads;
+
+	std::atomic<uint32_t> m_queuedJobs = 0;
+	std::atomic<uint32_t> m_nextQueue = 0; // round robin target for jobs pushed by non-worker threads
+	std::atomic<bool> m_stopping = false;
+	std::mutex m_sleepMutex;
+	std::condition_variable m_wakeCondition;
+
+	std::thread::id m_mainThreadId;
+	std::mutex m_mainThreadMutex;
+	std::deque<QueuedJob> m_mainThreadJobs;
+};
@@ -0,0 +1,180 @@
+#include "LightClusters.h"
+
+#include "JobSystem.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+namespace
+{
+	float sliceDepth(uint32_t slice, float nearPlane, float farPlane)
+	{
+		return nearPlane * std::pow(farPlane / nearPlane, static_cast<float>(slice) / LightClusters::GRID_Z);
+	}
+
+	uint32_t sliceOf(float depth, float nearPlane, float farPlane)
+	{
+		float slice = std::floor(std::log(depth / nearPlane) / std::log(farPlane / nearPlane) * LightClusters::GRID_Z);
+		return static_cast<uint32_t>(std::clamp(slice, 0.0f, static_cast<float>(LightClusters::GRID_Z - 1)));
+	}
+
+	// NDC range [ndcMin, ndcMax] to the tiles it covers, false if it is off screen
+	bool tileRange(float ndcMin, float ndcMax, uint32_t tiles, uint32_t& first, uint32_t& last)
+	{
+		if (ndcMax < -1.0f || ndcMin > 1.0f)
+			return false;
+
+		float scale = 0.5f * tiles;
+		first = static_cast<uint32_t>(std::clamp(std::floor((ndcMin + 1.0f) * scale), 0.0f, tiles - 1.0f));
+		last = static_cast<uint32_t>(std::clamp(std::floor((ndcMax + 1.0f) * scale), 0.0f, tiles - 1.0f));
+		return true;
+	}
+}
+
+void LightClusters::build(JobSystem& jobSystem, const std::vector<PointLight>& lights, const glm::mat4& view, const glm::mat4& proj,
+	float nearPlane, float farPlane, ClusterLightLists& lists)
+{
+	uint32_t lightCount = static_cast<uint32_t>(lights.size());
+	m_lightRanges.resize(lightCount);
+	lists.ranges.resize(CLUSTER_COUNT);
+
+	// x / depth is monotonic in depth, so the NDC extremes of the sphere's box lie at its nearest or farthest depth
+	for (uint32_t i = 0; i < lightCount; i++)
+	{
+		LightRange& range = m_lightRanges[i];
+		range.center = glm::vec3(view * glm::vec4(lights[i].position, 1.0f));
+		range.radius = lights[i].radius;
+		range.minZ = 1;
+		range.maxZ = 0;
+
+		float depth = -range.center.z;
+		if (depth + range.radius <= nearPlane || depth - range.radius >= farPlane)
+			continue;
+
+		float nearDepth = std::max(depth - range.radius, nearPlane);
+		float farDepth = std::min(depth + range.radius, farPlane);
+
+		float ndcX[4], ndcY[4];
+		for (int k = 0; k < 4; k++)
+		{
+			float edgeDepth = k & 1 ? farDepth : nearDepth;
+			float side = k & 2 ? range.radius : -range.radius;
+			ndcX[k] = proj[0][0] * (range.center.x + side) / edgeDepth;
+			ndcY[k] = proj[1][1] * (range.center.y + side) / edgeDepth;
+		}
+
+		auto [minX, maxX] = std::minmax_element(ndcX, ndcX + 4);
+		auto [minY, maxY] = std::minmax_element(ndcY, ndcY + 4);
+		if (!tileRange(*minX, *maxX, GRID_X, range.minX, range.maxX) || !tileRange(*minY, *maxY, GRID_Y, range.minY, range.maxY))
+			continue;
+
+		range.minZ = sliceOf(nearDepth, nearPlane, farPlane);
+		range.maxZ = sliceOf(farDepth, nearPlane, farPlane);
+	}
+
+	// one job per slice, hits are collected light by light and then bucketed by tile, which keeps the lights in order
+	jobSystem.parallelFor(GRID_Z, 1, [&](uint32_t begin, uint32_t end)
+	{
+		for (uint32_t slice = begin; slice < end; slice++)
+		{
+			SliceLists& sliceLists = m_slices[slice];
+			sliceLists.hits.clear();
+			sliceLists.droppedLights = 0;
+
+			std::array<Aabb, TILE_COUNT> bounds;
+			for (uint32_t tile = 0; tile < TILE_COUNT; tile++)
+				bounds[tile] = clusterBounds(slice * TILE_COUNT + tile, proj, nearPlane, farPlane);
+
+			for (uint32_t i = 0; i < lightCount; i++)
+			{
+				const LightRange& range = m_lightRanges[i];
+				if (slice < range.minZ || slice > range.maxZ)
+					continue;
+
+				for (uint32_t y = range.minY; y <= range.maxY; y++)
+				{
+					for (uint32_t x = range.minX; x <= range.maxX; x++)
+					{
+						uint32_t tile = y * GRID_X + x;
+						if (sphereIntersectsAabb(range.center, range.radius, bounds[tile]))
+							sliceLists.hits.push_back({ tile, i });
+					}
+				}
+			}
+
+			std::array<uint32_t, TILE_COUNT> offsets{};
+			for (const ClusterHit& hit : sliceLists.hits)
+				offsets[hit.tile]++;
+
+			glm::uvec2* ranges = &lists.ranges[slice * TILE_COUNT];
+			uint32_t offset = 0;
+			for (uint32_t tile = 0; tile < TILE_COUNT; tile++)
+			{
+				uint32_t count = std::min(offsets[tile], MAX_LIGHTS_PER_CLUSTER);
+				sliceLists.droppedLights += offsets[tile] - count;
+				ranges[tile] = { offset, count };
+				offsets[tile] = offset;
+				offset += count;
+			}
+
+			sliceLists.lightIndices.resize(offset);
+			for (const ClusterHit& hit : sliceLists.hits)
+			{
+				if (offsets[hit.tile] < ranges[hit.tile].x + ranges[hit.tile].y)
+					sliceLists.lightIndices[offsets[hit.tile]++] = hit.light;
+			}
+		}
+	});
+
+	// slices back to back, their ranges were relative to the start of the slice
+	lists.lightIndices.clear();
+	lists.droppedLights = 0;
+	for (uint32_t slice = 0; slice < GRID_Z; slice++)
+	{
+		const SliceLists& sliceLists = m_slices[slice];
+		uint32_t sliceOffset = static_cast<uint32_t>(lists.lightIndices.size());
+		for (uint32_t tile = 0; tile < TILE_COUNT; tile++)
+			lists.ranges[slice * TILE_COUNT + tile].x += sliceOffset;
+
+		lists.lightIndices.insert(lists.lightIndices.end(), sliceLists.lightIndices.begin(), sliceLists.lightIndices.end());
+		lists.droppedLights += sliceLists.droppedLights;
+	}
+}
+
+Aabb LightClusters::clusterBounds(uint32_t cluster, const glm::mat4& proj, float nearPlane, float farPlane)
+{
+	uint32_t x = cluster % GRID_X;
+	uint32_t y = cluster / GRID_X % GRID_Y;
+	uint32_t z = cluster / TILE_COUNT;
+
+	float ndcX[2] = { 2.0f * x / GRID_X - 1.0f, 2.0f * (x + 1) / GRID_X - 1.0f };
+	float ndcY[2] = { 2.0f * y / GRID_Y - 1.0f, 2.0f * (y + 1) / GRID_Y - 1.0f };
+	float depths[2] = { sliceDepth(z, nearPlane, farPlane), sliceDepth(z + 1, nearPlane, farPlane) };
+
+	// the frustum widens with depth, the box has to hold the tile's corners on both depth planes, two opposite ones span it
+	Aabb aabb{ glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX) };
+	for (float depth : depths)
+	{
+		for (int k = 0; k < 2; k++)
+		{
+			glm::vec3 corner(ndcX[k] * depth / proj[0][0], ndcY[k] * depth / proj[1][1], -depth);
+			aabb.min = glm::min(aabb.min, corner);
+			aabb.max = glm::max(aabb.max, corner);
+		}
+	}
+	return aabb;
+}
+
+bool LightClusters::sphereIntersectsAabb(const glm::vec3& center, float radius, const Aabb& aabb)
+{
+	glm::vec3 closest = glm::clamp(center, aabb.min, aabb.max);
+	glm::vec3 offset = center - closest;
+	return glm::dot(offset, offset) <= radius * radius;
+}
+
+glm::vec2 LightClusters::sliceScaleBias(float nearPlane, float farPlane)
+{
+	float scale = GRID_Z / std::log(farPlane / nearPlane);
+	return glm::vec2(scale, -std::log(nearPlane) * scale);
+}
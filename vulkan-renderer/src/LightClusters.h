@@ -0,0 +1,77 @@
+#pragma once
+
+#include "Culling.h"
+
+#include <glm/glm.hpp>
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+class JobSystem;
+
+// World space, layout matches PointLight in lighting.glsl (std430)
+struct PointLight
+{
+	glm::vec3 position;
+	float radius; // the falloff reaches 0 here, clusters further away don't list the light
+	glm::vec3 color;
+	float intensity;
+};
+
+// Output of LightClusters::build, what the fragment shader reads: per cluster a range of lightIndices,
+// every index points into the light list the clusters were built from
+struct ClusterLightLists
+{
+	std::vector<glm::uvec2> ranges; // offset, count
+	std::vector<uint32_t> lightIndices;
+	uint32_t droppedLights = 0; // light/cluster pairs over MAX_LIGHTS_PER_CLUSTER
+};
+
+// Froxel grid over the view frustum: GRID_X x GRID_Y screen tiles, GRID_Z slices spaced exponentially between the near
+// and far plane so clusters stay roughly cube shaped. Every light is tested against the view space bounds of the clusters
+// its sphere can touch, each slice is filled on its own job. Meant to be kept around and rebuilt every frame.
+class LightClusters
+{
+public:
+	static constexpr uint32_t GRID_X = 16, GRID_Y = 9, GRID_Z = 24; // must match lighting.glsl
+	static constexpr uint32_t TILE_COUNT = GRID_X * GRID_Y;
+	static constexpr uint32_t CLUSTER_COUNT = TILE_COUNT * GRID_Z;
+	static constexpr uint32_t MAX_LIGHTS_PER_CLUSTER = 128; // bounds the index list, the fragment loop and the GPU buffer
+
+	// proj as used for rendering (y flipped, 0..1 depth), without jitter
+	void build(JobSystem& jobSystem, const std::vector<PointLight>& lights, const glm::mat4& view, const glm::mat4& proj,
+		float nearPlane, float farPlane, ClusterLightLists& lists);
+
+	// view space bounds of cluster (z * GRID_Y + y) * GRID_X + x
+	static Aabb clusterBounds(uint32_t cluster, const glm::mat4& proj, float nearPlane, float farPlane);
+	static bool sphereIntersectsAabb(const glm::vec3& center, float radius, const Aabb& aabb);
+
+	// the fragment shader finds its slice as log(viewDepth) * scale + bias
+	static glm::vec2 sliceScaleBias(float nearPlane, float farPlane);
+
+private:
+	// view space sphere of a light and the clusters it can reach, an empty z range if it can't reach any
+	struct LightRange
+	{
+		glm::vec3 center;
+		float radius;
+		uint32_t minX, maxX, minY, maxY, minZ, maxZ;
+	};
+
+	struct ClusterHit
+	{
+		uint32_t tile;
+		uint32_t light;
+	};
+
+	struct SliceLists
+	{
+		std::vector<ClusterHit> hits;
+		std::vector<uint32_t> lightIndices;
+		uint32_t droppedLights = 0;
+	};
+
+	std::vector<LightRange> m_lightRanges;
+	std::array<SliceLists, GRID_Z> m_slices;
+};
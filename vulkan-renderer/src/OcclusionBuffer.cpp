@@ -0,0 +1,384 @@
+#include "OcclusionBuffer.h"
+
+#include "JobSystem.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define OCCLUSION_SSE 1
+#include <immintrin.h>
+#endif
+
+OccluderMesh makeBoxOccluder(const Aabb& box)
+{
+	OccluderMesh mesh;
+
+	// bit 0 picks x, bit 1 y, bit 2 z
+	for (int i = 0; i < 8; i++)
+	{
+		mesh.positions.push_back({ i & 1 ? box.max.x : box.min.x, i & 2 ? box.max.y : box.min.y, i & 4 ? box.max.z : box.min.z });
+	}
+
+	// counter clockwise quads, seen from outside
+	mesh.faceSize = 4;
+	mesh.indices =
+	{
+		0, 2, 3, 1, // -z
+		4, 5, 7, 6, // +z
+		0, 1, 5, 4, // -y
+		2, 6, 7, 3, // +y
+		0, 4, 6, 2, // -x
+		1, 3, 7, 5, // +x
+	};
+
+	return mesh;
+}
+
+OcclusionBuffer::OcclusionBuffer(uint32_t width, uint32_t height)
+{
+	m_tilesX = std::max(1u, (width + TILE_SIZE - 1) / TILE_SIZE);
+	m_tilesY = std::max(1u, (height + TILE_SIZE - 1) / TILE_SIZE);
+	m_width = m_tilesX * TILE_SIZE;
+	m_height = m_tilesY * TILE_SIZE;
+
+	m_depth.assign(m_width * m_height, 1.0f);
+	m_tileDepth.assign(m_tilesX * m_tilesY, 1.0f);
+}
+
+void OcclusionBuffer::rasterize(JobSystem& jobSystem, const glm::mat4& viewProj, const std::vector<Occluder>& occluders, CullingPath path)
+{
+	m_viewProj = viewProj;
+
+	// fixed slots per occluder so setup runs in parallel without compaction, unused slots stay empty
+	m_faceOffsets.resize(occluders.size() + 1);
+	m_faceOffsets[0] = 0;
+	for (size_t i = 0; i < occluders.size(); i++)
+	{
+		m_faceOffsets[i + 1] = m_faceOffsets[i] + static_cast<uint32_t>(occluders[i].mesh->indices.size() / occluders[i].mesh->faceSize);
+	}
+	m_faces.resize(m_faceOffsets.back());
+
+	jobSystem.parallelFor(static_cast<uint32_t>(occluders.size()), 64, [&](uint32_t begin, uint32_t end)
+	{
+		for (uint32_t i = begin; i < end; i++)
+			setupFaces(occluders[i], &m_faces[m_faceOffsets[i]]);
+	});
+
+	// most slots end up empty (back faces, off screen), the bands only walk the rest
+	m_activeFaces.clear();
+	for (uint32_t i = 0; i < m_faces.size(); i++)
+	{
+		if (m_faces[i].minX <= m_faces[i].maxX)
+			m_activeFaces.push_back(i);
+	}
+	m_rasterizedFaces = static_cast<uint32_t>(m_activeFaces.size());
+
+#if OCCLUSION_SSE
+	bool simd = path != CullingPath::Scalar;
+#else
+	bool simd = false;
+#endif
+
+	// bands of whole tile rows, every band owns its pixels and tiles, faces are binned by their bounds on the fly
+	const uint32_t bandRows = 2 * TILE_SIZE;
+	uint32_t bandCount = (m_height + bandRows - 1) / bandRows;
+	jobSystem.parallelFor(bandCount, 1, [&](uint32_t begin, uint32_t end)
+	{
+		for (uint32_t band = begin; band < end; band++)
+			rasterizeBand(band * bandRows, std::min(m_height, (band + 1) * bandRows), simd);
+	});
+}
+
+void OcclusionBuffer::setupFaces(const Occluder& occluder, ScreenFace* out) const
+{
+	const OccluderMesh& mesh = *occluder.mesh;
+	glm::mat4 transform = m_viewProj * occluder.transform;
+	float width = static_cast<float>(m_width), height = static_cast<float>(m_height);
+	uint32_t faceSize = std::clamp(mesh.faceSize, 3u, MAX_FACE_SIZE);
+
+	for (size_t f = 0; f + faceSize <= mesh.indices.size(); f += faceSize)
+	{
+		ScreenFace& face = out[f / faceSize];
+		face.minX = 0;
+		face.maxX = -1;
+
+		glm::vec4 clip[MAX_FACE_SIZE];
+		for (uint32_t k = 0; k < faceSize; k++)
+		{
+			clip[k] = transform * glm::vec4(mesh.positions[mesh.indices[f + k]], 1.0f);
+		}
+
+		// near plane (z >= 0 with a 0..1 depth range), clipping a convex polygon adds one vertex at most
+		glm::vec4 polygon[MAX_FACE_SIZE + 1];
+		int count = 0;
+		for (uint32_t k = 0; k < faceSize; k++)
+		{
+			const glm::vec4& a = clip[k];
+			const glm::vec4& b = clip[(k + 1) % faceSize];
+			if (a.z >= 0.0f)
+				polygon[count++] = a;
+			if ((a.z >= 0.0f) != (b.z >= 0.0f))
+				polygon[count++] = a + (b - a) * (a.z / (a.z - b.z));
+		}
+		if (count < 3)
+			continue;
+
+		glm::vec3 screen[MAX_FACE_SIZE + 1];
+		for (int k = 0; k < count; k++)
+		{
+			glm::vec3 ndc = glm::vec3(polygon[k]) / polygon[k].w;
+			screen[k] = { (ndc.x * 0.5f + 0.5f) * width, (ndc.y * 0.5f + 0.5f) * height, ndc.z };
+		}
+
+		// Vulkan's convention, positive area is counter clockwise in framebuffer coordinates (y down), the rest is culled
+		float area = 0.0f;
+		for (int k = 0; k < count; k++)
+		{
+			const glm::vec3& a = screen[k];
+			const glm::vec3& b = screen[(k + 1) % count];
+			area -= 0.5f * (a.x * b.y - b.x * a.y);
+		}
+		if (!(area > 0.0f))
+			continue;
+
+		// edge functions, positive on the inner side of each edge. Evaluated at a pixel center, an edge function is
+		// (|A| + |B|) / 2 above its minimum over the pixel, biasing by that keeps only pixels the face fully covers
+		face.edgeCount = count;
+		for (int e = 0; e < count; e++)
+		{
+			const glm::vec3& a = screen[e];
+			const glm::vec3& b = screen[(e + 1) % count];
+			face.edgeA[e] = b.y - a.y;
+			face.edgeB[e] = a.x - b.x;
+			face.edgeC[e] = b.x * a.y - b.y * a.x - 0.5f * (std::abs(face.edgeA[e]) + std::abs(face.edgeB[e]));
+		}
+
+		// depth is linear in screen space after the perspective divide. The plane comes from the largest triangle of
+		// the fan, clipping can leave two vertices almost on top of each other. The same bias turns the value at the
+		// pixel center into the farthest the face gets within the pixel.
+		glm::vec3 d1(0.0f), d2(0.0f);
+		float determinant = 0.0f;
+		for (int k = 1; k + 1 < count; k++)
+		{
+			glm::vec3 e1 = screen[k] - screen[0], e2 = screen[k + 1] - screen[0];
+			float candidate = e1.x * e2.y - e2.x * e1.y;
+			if (std::abs(candidate) > std::abs(determinant))
+			{
+				d1 = e1;
+				d2 = e2;
+				determinant = candidate;
+			}
+		}
+		face.depthA = (d1.z * d2.y - d2.z * d1.y) / determinant;
+		face.depthB = (d2.z * d1.x - d1.z * d2.x) / determinant;
+		face.depthC = screen[0].z - face.depthA * screen[0].x - face.depthB * screen[0].y + 0.5f * (std::abs(face.depthA) + std::abs(face.depthB));
+
+		// pixels that can lie completely inside, clamped in float first so far off screen vertices can't overflow the ints
+		float minX = screen[0].x, maxX = screen[0].x, minY = screen[0].y, maxY = screen[0].y;
+		for (int k = 1; k < count; k++)
+		{
+			minX = std::min(minX, screen[k].x);
+			maxX = std::max(maxX, screen[k].x);
+			minY = std::min(minY, screen[k].y);
+			maxY = std::max(maxY, screen[k].y);
+		}
+		face.minX = std::max(0, static_cast<int>(std::ceil(std::clamp(minX, -1.0f, width))));
+		face.maxX = std::min(static_cast<int>(m_width) - 1, static_cast<int>(std::floor(std::clamp(maxX, -1.0f, width))) - 1);
+		face.minY = std::max(0, static_cast<int>(std::ceil(std::clamp(minY, -1.0f, height))));
+		face.maxY = std::min(static_cast<int>(m_height) - 1, static_cast<int>(std::floor(std::clamp(maxY, -1.0f, height))) - 1);
+		if (face.minY > face.maxY)
+			face.maxX = face.minX - 1;
+	}
+}
+
+void OcclusionBuffer::rasterizeBand(uint32_t firstRow, uint32_t endRow, bool simd)
+{
+	std::fill(m_depth.begin() + firstRow * m_width, m_depth.begin() + endRow * m_width, 1.0f);
+
+	// both paths evaluate the same expressions in the same order, their results match bit for bit
+	for (uint32_t index : m_activeFaces)
+	{
+		const ScreenFace& face = m_faces[index];
+		int y0 = std::max(face.minY, static_cast<int>(firstRow));
+		int y1 = std::min(face.maxY, static_cast<int>(endRow) - 1);
+		if (y0 > y1)
+			continue;
+
+		for (int y = y0; y <= y1; y++)
+		{
+			float py = y + 0.5f;
+			float rows[MAX_FACE_SIZE + 1];
+			for (int e = 0; e < face.edgeCount; e++)
+			{
+				rows[e] = face.edgeB[e] * py + face.edgeC[e];
+			}
+			float rowDepth = face.depthB * py + face.depthC;
+			float* depthRow = &m_depth[y * m_width];
+
+#if OCCLUSION_SSE
+			if (simd)
+			{
+				__m128 a[MAX_FACE_SIZE + 1], r[MAX_FACE_SIZE + 1];
+				for (int e = 0; e < face.edgeCount; e++)
+				{
+					a[e] = _mm_set1_ps(face.edgeA[e]);
+					r[e] = _mm_set1_ps(rows[e]);
+				}
+				const __m128 depthA = _mm_set1_ps(face.depthA), rowDepths = _mm_set1_ps(rowDepth);
+				const __m128 zero = _mm_setzero_ps();
+				const __m128 laneOffsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+				// lanes left of minX or right of maxX are outside the bounds the scalar path loops over
+				const __m128 minX = _mm_set1_ps(face.minX + 0.5f), maxX = _mm_set1_ps(face.maxX + 0.5f);
+
+				for (int x = face.minX & ~3; x <= face.maxX; x += 4)
+				{
+					__m128 px = _mm_add_ps(_mm_set1_ps(static_cast<float>(x)), laneOffsets);
+					__m128 inside = _mm_and_ps(_mm_cmpge_ps(px, minX), _mm_cmple_ps(px, maxX));
+					for (int e = 0; e < face.edgeCount; e++)
+					{
+						inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a[e], px), r[e]), zero));
+					}
+
+					__m128 depth = _mm_add_ps(_mm_mul_ps(depthA, px), rowDepths);
+					__m128 previous = _mm_loadu_ps(depthRow + x);
+					inside = _mm_and_ps(inside, _mm_cmplt_ps(depth, previous));
+					_mm_storeu_ps(depthRow + x, _mm_or_ps(_mm_and_ps(inside, depth), _mm_andnot_ps(inside, previous)));
+				}
+				continue;
+			}
+#endif
+			for (int x = face.minX; x <= face.maxX; x++)
+			{
+				float px = x + 0.5f;
+				bool inside = true;
+				for (int e = 0; e < face.edgeCount && inside; e++)
+				{
+					inside = face.edgeA[e] * px + rows[e] >= 0.0f;
+				}
+
+				float depth = face.depthA * px + rowDepth;
+				if (inside && depth < depthRow[x])
+					depthRow[x] = depth;
+			}
+		}
+	}
+
+	for (uint32_t tileY = firstRow / TILE_SIZE; tileY < endRow / TILE_SIZE; tileY++)
+	{
+		for (uint32_t tileX = 0; tileX < m_tilesX; tileX++)
+		{
+			float farthest = 0.0f;
+			for (uint32_t y = tileY * TILE_SIZE; y < (tileY + 1) * TILE_SIZE; y++)
+			{
+				const float* depthRow = &m_depth[y * m_width + tileX * TILE_SIZE];
+				farthest = std::max(farthest, *std::max_element(depthRow, depthRow + TILE_SIZE));
+			}
+			m_tileDepth[tileY * m_tilesX + tileX] = farthest;
+		}
+	}
+}
+
+bool OcclusionBuffer::isOccluded(const glm::vec3& center, const glm::vec3& extent, CullingPath path) const
+{
+	float minX = 1e30f, minY = 1e30f, maxX = -1e30f, maxY = -1e30f;
+	float nearest = 1.0f;
+
+	for (int i = 0; i < 8; i++)
+	{
+		glm::vec3 corner = center + extent * glm::vec3(i & 1 ? 1.0f : -1.0f, i & 2 ? 1.0f : -1.0f, i & 4 ? 1.0f : -1.0f);
+		glm::vec4 clip = m_viewProj * glm::vec4(corner, 1.0f);
+
+		// reaches in front of the near plane, can't be projected, keep it
+		if (clip.w <= 0.0f || clip.z < 0.0f)
+			return false;
+
+		float x = (clip.x / clip.w * 0.5f + 0.5f) * m_width;
+		float y = (clip.y / clip.w * 0.5f + 0.5f) * m_height;
+		minX = std::min(minX, x);
+		maxX = std::max(maxX, x);
+		minY = std::min(minY, y);
+		maxY = std::max(maxY, y);
+		nearest = std::min(nearest, clip.z / clip.w);
+	}
+
+	// every pixel the rectangle touches, not only those whose centers it covers
+	int x0 = std::max(0, static_cast<int>(std::floor(std::max(minX, -1.0f))));
+	int x1 = std::min(static_cast<int>(m_width) - 1, static_cast<int>(std::floor(std::min(maxX, static_cast<float>(m_width)))));
+	int y0 = std::max(0, static_cast<int>(std::floor(std::max(minY, -1.0f))));
+	int y1 = std::min(static_cast<int>(m_height) - 1, static_cast<int>(std::floor(std::min(maxY, static_cast<float>(m_height)))));
+	if (x0 > x1 || y0 > y1)
+		return false; // off screen, that is for frustum culling to decide
+
+	const int tileSize = static_cast<int>(TILE_SIZE);
+	for (int tileY = y0 / tileSize; tileY <= y1 / tileSize; tileY++)
+	{
+		for (int tileX = x0 / tileSize; tileX <= x1 / tileSize; tileX++)
+		{
+			// even the farthest pixel of the tile is in front of the object
+			if (m_tileDepth[tileY * m_tilesX + tileX] < nearest)
+				continue;
+
+			int px0 = std::max(x0, tileX * tileSize), px1 = std::min(x1, tileX * tileSize + tileSize - 1);
+			int py0 = std::max(y0, tileY * tileSize), py1 = std::min(y1, tileY * tileSize + tileSize - 1);
+
+			for (int y = py0; y <= py1; y++)
+			{
+				const float* depthRow = &m_depth[y * m_width];
+#if OCCLUSION_SSE
+				if (path != CullingPath::Scalar)
+				{
+					// the two aligned groups of 4 in this tile row, lanes outside [px0, px1] masked off
+					const __m128 nearestDepth = _mm_set1_ps(nearest);
+					const __m128i laneIndices = _mm_setr_epi32(0, 1, 2, 3);
+					int mask = 0;
+					for (int x = tileX * tileSize; x < tileX * tileSize + tileSize; x += 4)
+					{
+						__m128i lanes = _mm_add_epi32(_mm_set1_epi32(x), laneIndices);
+						__m128i inRange = _mm_and_si128(_mm_cmpgt_epi32(lanes, _mm_set1_epi32(px0 - 1)), _mm_cmplt_epi32(lanes, _mm_set1_epi32(px1 + 1)));
+						__m128 behind = _mm_cmpge_ps(_mm_loadu_ps(depthRow + x), nearestDepth);
+						mask |= _mm_movemask_ps(_mm_and_ps(behind, _mm_castsi128_ps(inRange)));
+					}
+					if (mask != 0)
+						return false;
+					continue;
+				}
+#endif
+				for (int x = px0; x <= px1; x++)
+				{
+					if (depthRow[x] >= nearest)
+						return false;
+				}
+			}
+		}
+	}
+
+	return true;
+}
+
+uint32_t OcclusionBuffer::cullObjects(JobSystem& jobSystem, const BoundsSoA& bounds, uint8_t* visible, uint32_t grainSize, CullingPath path) const
+{
+	std::atomic<uint32_t> occludedCount = 0;
+
+	jobSystem.parallelFor(bounds.size(), grainSize, [&](uint32_t begin, uint32_t end)
+	{
+		uint32_t occluded = 0;
+		for (uint32_t i = begin; i < end; i++)
+		{
+			if (!visible[i])
+				continue;
+
+			glm::vec3 center(bounds.centerX[i], bounds.centerY[i], bounds.centerZ[i]);
+			glm::vec3 extent(bounds.extentX[i], bounds.extentY[i], bounds.extentZ[i]);
+			if (isOccluded(center, extent, path))
+			{
+				visible[i] = 0;
+				occluded++;
+			}
+		}
+		occludedCount.fetch_add(occluded, std::memory_order_relaxed);
+	});
+
+	return occludedCount.load(std::memory_order_relaxed);
+}
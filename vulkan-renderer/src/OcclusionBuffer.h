@@ -0,0 +1,85 @@
+#pragma once
+
+#include "Culling.h"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+class JobSystem;
+
+// Low poly stand-in for a big mesh, drawn into the occlusion buffer instead of the real thing.
+// Must lie inside the mesh it stands for, otherwise it hides objects that are actually visible.
+// Counter clockwise front faces, same as the graphics pipeline. Faces are convex and planar with faceSize
+// vertices each, a quad covers the pixels along its diagonal where two triangles would each only cover half of them.
+struct OccluderMesh
+{
+	std::vector<glm::vec3> positions;
+	std::vector<uint32_t> indices;
+	uint32_t faceSize = 3;
+};
+
+OccluderMesh makeBoxOccluder(const Aabb& box);
+
+struct Occluder
+{
+	const OccluderMesh* mesh;
+	glm::mat4 transform;
+};
+
+// CPU software occlusion culling. Occluders are rasterized into a small depth buffer (nearest depth per pixel),
+// which is then reduced into 8x8 tiles holding their farthest depth. Objects are tested tile first and per pixel
+// only where a tile can't decide, so the result is exactly that of a full per pixel test.
+// Rasterization is inner conservative: a face only writes pixels it covers completely, with the farthest depth it
+// has within them, so the buffer never hides anything the occluders don't. Pixels on an edge between two faces stay open.
+class OcclusionBuffer
+{
+public:
+	static constexpr uint32_t TILE_SIZE = 8;
+	static constexpr uint32_t MAX_FACE_SIZE = 4;
+
+	// width and height are rounded up to whole tiles
+	explicit OcclusionBuffer(uint32_t width = 320, uint32_t height = 192);
+
+	// clears and draws the occluders, split into horizontal bands over the job system.
+	// viewProj expects a 0..1 depth range and the y flip of the renderer.
+	// Scalar runs the reference rasterizer, every other path rows of 4 pixels with SSE
+	void rasterize(JobSystem& jobSystem, const glm::mat4& viewProj, const std::vector<Occluder>& occluders, CullingPath path = CullingPath::Best);
+
+	// world space box, center and half extents, against what was rasterized last
+	bool isOccluded(const glm::vec3& center, const glm::vec3& extent, CullingPath path = CullingPath::Best) const;
+
+	// clears visible[i] of every visible object the buffer hides, returns how many it cleared
+	uint32_t cullObjects(JobSystem& jobSystem, const BoundsSoA& bounds, uint8_t* visible, uint32_t grainSize = 4096, CullingPath path = CullingPath::Best) const;
+
+	uint32_t width() const { return m_width; }
+	uint32_t height() const { return m_height; }
+	const std::vector<float>& depth() const { return m_depth; }
+	uint32_t rasterizedFaces() const { return m_rasterizedFaces; } // after clipping and back face culling
+
+private:
+	// screen space face, near plane clipping adds a vertex at most. Edge functions and depth plane are evaluated at
+	// pixel centers and biased by half a pixel, see setupFaces
+	struct ScreenFace
+	{
+		float edgeA[MAX_FACE_SIZE + 1], edgeB[MAX_FACE_SIZE + 1], edgeC[MAX_FACE_SIZE + 1];
+		int edgeCount;
+		float depthA, depthB, depthC;
+		int minX, minY, maxX, maxY; // inclusive pixel bounds, empty if minX > maxX
+	};
+
+	void setupFaces(const Occluder& occluder, ScreenFace* out) const;
+	void rasterizeBand(uint32_t firstRow, uint32_t endRow, bool simd);
+
+	uint32_t m_width, m_height;
+	uint32_t m_tilesX, m_tilesY;
+	std::vector<float> m_depth; // nearest depth, cleared to 1
+	std::vector<float> m_tileDepth; // farthest depth of each tile
+
+	glm::mat4 m_viewProj{ 1.0f };
+	std::vector<ScreenFace> m_faces; // one slot per occluder face
+	std::vector<uint32_t> m_faceOffsets;
+	std::vector<uint32_t> m_activeFaces; // slots that survived setup, in order
+	uint32_t m_rasterizedFaces = 0;
+};
@@ -0,0 +1,687 @@
+#include "RenderGraph.h"
+
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+namespace
+{
+	constexpr VkAccessFlags WRITE_ACCESS = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT
+		| VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_HOST_WRITE_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+
+	void combine(uint64_t& seed, uint64_t value)
+	{
+		seed ^= value + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2);
+	}
+
+	// non-dispatchable handles are pointers on 64 bit and integers on 32 bit builds
+	template<typename Handle>
+	uint64_t handleKey(Handle handle)
+	{
+		return (uint64_t)handle;
+	}
+
+	bool livesOverlap(const TransientPlacement& a, const TransientPlacement& b)
+	{
+		return a.firstPass <= b.lastPass && b.firstPass <= a.lastPass;
+	}
+
+	bool memoryOverlaps(const TransientPlacement& a, VkDeviceSize offset, VkDeviceSize size)
+	{
+		return a.offset < offset + size && offset < a.offset + a.size;
+	}
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::read(Resource resource, ResourceUsage usage)
+{
+	m_graph.m_passes[m_pass].accesses.push_back({ resource, usage, false, true });
+	return *this;
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::write(Resource resource, ResourceUsage usage)
+{
+	m_graph.m_passes[m_pass].accesses.push_back({ resource, usage, true, false });
+	return *this;
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::modify(Resource resource, ResourceUsage usage)
+{
+	m_graph.m_passes[m_pass].accesses.push_back({ resource, usage, true, true });
+	return *this;
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::sideEffect()
+{
+	m_graph.m_passes[m_pass].sideEffect = true;
+	return *this;
+}
+
+void RenderGraph::init(VkDevice device, FindMemoryType findMemoryType, Retire retire)
+{
+	m_device = device;
+	m_findMemoryType = std::move(findMemoryType);
+	m_retire = std::move(retire);
+}
+
+void RenderGraph::destroy()
+{
+	// the device is idle by now, nothing to wait for
+	for (const Transient& transient : m_transients)
+	{
+		vkDestroyImageView(m_device, transient.view, nullptr);
+		vkDestroyImage(m_device, transient.image, nullptr);
+	}
+	if (m_transientMemory != VK_NULL_HANDLE)
+		vkFreeMemory(m_device, m_transientMemory, nullptr);
+
+	m_transients.clear();
+	m_transientMemory = VK_NULL_HANDLE;
+	m_compiled = false;
+}
+
+void RenderGraph::reset()
+{
+	m_resources.clear();
+	m_passes.clear();
+	m_compiledDeclaration = false;
+}
+
+RenderGraph::Resource RenderGraph::importImage(const char* name, VkImage image, const VkImageSubresourceRange& range, ResourceUsage initial, ResourceUsage final)
+{
+	ResourceDecl resource{ name, ResourceKind::ImportedImage };
+	resource.image = image;
+	resource.range = range;
+	resource.initial = initial;
+	resource.final = final;
+	m_resources.push_back(resource);
+	return static_cast<Resource>(m_resources.size() - 1);
+}
+
+RenderGraph::Resource RenderGraph::importBuffer(const char* name, VkBuffer buffer, ResourceUsage initial, ResourceUsage final)
+{
+	ResourceDecl resource{ name, ResourceKind::ImportedBuffer };
+	resource.buffer = buffer;
+	resource.initial = initial;
+	resource.final = final;
+	m_resources.push_back(resource);
+	return static_cast<Resource>(m_resources.size() - 1);
+}
+
+RenderGraph::Resource RenderGraph::createImage(const char* name, const TransientImageDesc& desc)
+{
+	ResourceDecl resource{ name, ResourceKind::TransientImage };
+	resource.range = { desc.aspect, 0, 1, 0, 1 };
+	resource.desc = desc;
+	m_resources.push_back(resource);
+	return static_cast<Resource>(m_resources.size() - 1);
+}
+
+RenderGraph::PassBuilder RenderGraph::addPass(const char* name, RecordFunction record)
+{
+	m_passes.push_back({ name, std::move(record) });
+	return PassBuilder(*this, static_cast<uint32_t>(m_passes.size() - 1));
+}
+
+bool RenderGraph::compile()
+{
+	m_compiledDeclaration = true;
+
+	uint64_t hash = shapeHash();
+	if (m_compiled && hash == m_compiledHash)
+		return false;
+
+	uint32_t resourceCount = static_cast<uint32_t>(m_resources.size());
+	uint32_t passCount = static_cast<uint32_t>(m_passes.size());
+
+	std::vector<std::vector<PassResource>> passResources(passCount);
+	for (uint32_t p = 0; p < passCount; p++)
+		passResources[p] = mergeAccesses(m_passes[p]);
+
+	// back to front: a pass is needed if it has side effects or writes something a needed pass after it reads or that
+	// is read after the graph. Before a pass that drops the previous contents, nobody needs them any more
+	std::vector<bool> live(resourceCount), needed(passCount);
+	for (uint32_t r = 0; r < resourceCount; r++)
+		live[r] = m_resources[r].final != ResourceUsage::None;
+
+	for (uint32_t p = passCount; p-- > 0;)
+	{
+		bool isNeeded = m_passes[p].sideEffect;
+		for (const PassResource& access : passResources[p])
+			isNeeded = isNeeded || (access.writes && live[access.resource]);
+		if (!isNeeded)
+			continue;
+
+		needed[p] = true;
+		for (const PassResource& access : passResources[p])
+			live[access.resource] = access.keepContents;
+	}
+
+	// transients live from the first to the last needed pass touching them. Everything they were used for is what the
+	// next one in their memory has to wait for, in this frame or the next
+	std::vector<Transient> transients;
+	std::vector<VkPipelineStageFlags> usedStages(resourceCount);
+	std::vector<VkAccessFlags> writtenAccess(resourceCount);
+	m_transientIndex.assign(resourceCount, UINT32_MAX);
+	uint32_t scheduled = 0;
+	for (uint32_t p = 0; p < passCount; p++)
+	{
+		if (!needed[p])
+			continue;
+
+		for (const PassResource& access : passResources[p])
+		{
+			usedStages[access.resource] |= access.stages;
+			writtenAccess[access.resource] |= access.access & WRITE_ACCESS;
+			if (m_resources[access.resource].kind != ResourceKind::TransientImage)
+				continue;
+
+			uint32_t& index = m_transientIndex[access.resource];
+			if (index == UINT32_MAX)
+			{
+				if (access.keepContents)
+					throw std::runtime_error(std::string("Render graph pass ") + m_passes[p].name + " reads transient " + m_resources[access.resource].name + " before anything wrote it");
+
+				index = static_cast<uint32_t>(transients.size());
+				transients.push_back({ access.resource, m_resources[access.resource].desc });
+				transients.back().placement.firstPass = scheduled;
+			}
+			transients[index].placement.lastPass = scheduled;
+		}
+		scheduled++;
+	}
+	realizeTransients(transients);
+
+	std::vector<ResourceState> states(resourceCount);
+	for (uint32_t r = 0; r < resourceCount; r++)
+	{
+		if (m_resources[r].kind != ResourceKind::TransientImage)
+			states[r] = initialState(m_resources[r]);
+	}
+	for (const Transient& transient : m_transients)
+	{
+		ResourceState& state = states[transient.resource];
+		for (const Transient& other : m_transients)
+		{
+			if (memoryOverlaps(other.placement, transient.placement.offset, transient.placement.size))
+			{
+				state.writeStages |= usedStages[other.resource];
+				state.writeAccess |= writtenAccess[other.resource];
+			}
+		}
+	}
+
+	// one batch of barriers in front of every pass, with everything it needs from the ones before
+	m_schedule.clear();
+	for (uint32_t p = 0; p < passCount; p++)
+	{
+		if (!needed[p])
+			continue;
+
+		CompiledPass compiled{ p };
+		for (const PassResource& access : passResources[p])
+			transition(states[access.resource], m_resources[access.resource].kind != ResourceKind::ImportedBuffer, access, compiled.barriers);
+		m_schedule.push_back(std::move(compiled));
+	}
+
+	m_finalBarriers = {};
+	m_finalStates.clear();
+	for (uint32_t r = 0; r < resourceCount; r++)
+	{
+		const ResourceDecl& resource = m_resources[r];
+		if (resource.kind == ResourceKind::TransientImage)
+			continue;
+
+		bool isImage = resource.kind == ResourceKind::ImportedImage;
+		if (resource.final != ResourceUsage::None)
+		{
+			UsageInfo info = usageInfo(resource.final);
+			VkImageLayout layout = isImage ? info.layout : VK_IMAGE_LAYOUT_UNDEFINED;
+			transition(states[r], isImage, { r, layout, layout, info.stages, info.access, false, true }, m_finalBarriers);
+		}
+		m_finalStates.emplace_back(r, states[r]);
+	}
+
+	m_barrierCount = m_finalBarriers.srcStages != 0 ? 1 : 0;
+	m_imageBarrierCount = static_cast<uint32_t>(m_finalBarriers.images.size());
+	for (const CompiledPass& compiled : m_schedule)
+	{
+		m_barrierCount += compiled.barriers.srcStages != 0 ? 1 : 0;
+		m_imageBarrierCount += static_cast<uint32_t>(compiled.barriers.images.size());
+	}
+	m_culledPasses = passCount - scheduled;
+
+	m_compiledHash = hash;
+	m_compiled = true;
+	m_compileCount++;
+	return true;
+}
+
+void RenderGraph::execute(VkCommandBuffer commandBuffer)
+{
+	if (!m_compiledDeclaration)
+		throw std::runtime_error("Render graph executed without compiling what was declared");
+
+	for (const CompiledPass& compiled : m_schedule)
+	{
+		recordBarriers(commandBuffer, compiled.barriers);
+		if (m_passes[compiled.pass].record)
+			m_passes[compiled.pass].record(commandBuffer);
+	}
+	recordBarriers(commandBuffer, m_finalBarriers);
+
+	for (const auto& [resource, state] : m_finalStates)
+	{
+		const ResourceDecl& decl = m_resources[resource];
+		m_states[decl.kind == ResourceKind::ImportedImage ? handleKey(decl.image) : handleKey(decl.buffer)] = state;
+	}
+}
+
+void RenderGraph::forgetStates()
+{
+	m_states.clear();
+}
+
+VkImage RenderGraph::image(Resource resource) const
+{
+	const ResourceDecl& decl = m_resources[resource];
+	if (decl.kind != ResourceKind::TransientImage)
+		return decl.image;
+
+	// VK_NULL_HANDLE if every pass using it was culled
+	uint32_t index = resource < m_transientIndex.size() ? m_transientIndex[resource] : UINT32_MAX;
+	return index != UINT32_MAX ? m_transients[index].image : VK_NULL_HANDLE;
+}
+
+VkImageView RenderGraph::imageView(Resource resource) const
+{
+	uint32_t index = resource < m_transientIndex.size() ? m_transientIndex[resource] : UINT32_MAX;
+	return index != UINT32_MAX ? m_transients[index].view : VK_NULL_HANDLE;
+}
+
+UsageInfo RenderGraph::usageInfo(ResourceUsage usage)
+{
+	switch (usage)
+	{
+	case ResourceUsage::ColorAttachment:
+		return { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+	case ResourceUsage::DepthAttachment:
+		return { VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+			VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL };
+	case ResourceUsage::DepthSampled:
+		return { VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL };
+	case ResourceUsage::InputAttachment:
+		return { VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_INPUT_ATTACHMENT_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+	case ResourceUsage::FragmentSampled:
+		return { VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+	case ResourceUsage::TransferSrc:
+		return { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL };
+	case ResourceUsage::TransferDst:
+		return { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL };
+	case ResourceUsage::HostRead:
+		return { VK_PIPELINE_STAGE_HOST_BIT, VK_ACCESS_HOST_READ_BIT, VK_IMAGE_LAYOUT_GENERAL };
+	case ResourceUsage::Present:
+		// presenting waits on a semaphore, nothing in the command buffer has to
+		return { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR };
+	default:
+		return { VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0, VK_IMAGE_LAYOUT_UNDEFINED };
+	}
+}
+
+VkImageMemoryBarrier RenderGraph::imageBarrier(VkImage image, const VkImageSubresourceRange& range, ResourceUsage from, ResourceUsage to)
+{
+	UsageInfo source = usageInfo(from);
+	UsageInfo destination = usageInfo(to);
+
+	VkImageMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.srcAccessMask = source.access & WRITE_ACCESS; // reads have nothing to make available
+	barrier.dstAccessMask = destination.access;
+	barrier.oldLayout = source.layout;
+	barrier.newLayout = destination.layout;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = image;
+	barrier.subresourceRange = range;
+	return barrier;
+}
+
+VkDeviceSize RenderGraph::placeTransients(std::vector<TransientPlacement>& placements)
+{
+	std::vector<uint32_t> order(placements.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return placements[a].size > placements[b].size; });
+
+	std::vector<uint32_t> placed;
+	VkDeviceSize totalSize = 0;
+	for (uint32_t i : order)
+	{
+		TransientPlacement& placement = placements[i];
+
+		// the lowest free offset is either the start or right behind one of the placed transients alive at the same time
+		VkDeviceSize best = ~VkDeviceSize(0);
+		auto tryOffset = [&](VkDeviceSize offset)
+		{
+			offset = (offset + placement.alignment - 1) / placement.alignment * placement.alignment;
+			if (offset >= best)
+				return;
+			for (uint32_t other : placed)
+			{
+				if (livesOverlap(placements[other], placement) && memoryOverlaps(placements[other], offset, placement.size))
+					return;
+			}
+			best = offset;
+		};
+
+		tryOffset(0);
+		for (uint32_t other : placed)
+		{
+			if (livesOverlap(placements[other], placement))
+				tryOffset(placements[other].offset + placements[other].size);
+		}
+
+		placement.offset = best;
+		placed.push_back(i);
+		totalSize = std::max(totalSize, best + placement.size);
+	}
+
+	return totalSize;
+}
+
+uint64_t RenderGraph::shapeHash() const
+{
+	uint64_t seed = 0;
+	for (const ResourceDecl& resource : m_resources)
+	{
+		combine(seed, std::hash<std::string_view>()(resource.name));
+		combine(seed, static_cast<uint64_t>(resource.kind));
+		combine(seed, static_cast<uint64_t>(resource.final));
+		combine(seed, resource.range.aspectMask);
+		combine(seed, resource.range.levelCount);
+		combine(seed, resource.range.layerCount);
+
+		if (resource.kind == ResourceKind::TransientImage)
+		{
+			combine(seed, resource.desc.format);
+			combine(seed, resource.desc.extent.width);
+			combine(seed, resource.desc.extent.height);
+			combine(seed, resource.desc.usage);
+			combine(seed, resource.desc.samples);
+		}
+		else
+		{
+			// the barriers into the first pass depend on where the resource stands
+			ResourceState state = initialState(resource);
+			combine(seed, state.layout);
+			combine(seed, state.writeStages);
+			combine(seed, state.writeAccess);
+			combine(seed, state.readStages);
+			combine(seed, state.visibleStages);
+			combine(seed, state.visibleAccess);
+		}
+	}
+
+	for (const PassDecl& pass : m_passes)
+	{
+		combine(seed, std::hash<std::string_view>()(pass.name));
+		combine(seed, pass.sideEffect);
+		for (const Access& access : pass.accesses)
+		{
+			combine(seed, access.resource);
+			combine(seed, static_cast<uint64_t>(access.usage));
+			combine(seed, access.writes);
+			combine(seed, access.keepContents);
+		}
+	}
+
+	return seed;
+}
+
+RenderGraph::ResourceState RenderGraph::initialState(const ResourceDecl& resource) const
+{
+	bool isImage = resource.kind == ResourceKind::ImportedImage;
+	auto it = m_states.find(isImage ? handleKey(resource.image) : handleKey(resource.buffer));
+	if (it != m_states.end())
+		return it->second;
+
+	UsageInfo info = usageInfo(resource.initial);
+	ResourceState state;
+	state.layout = isImage ? info.layout : VK_IMAGE_LAYOUT_UNDEFINED;
+	if (info.access & WRITE_ACCESS)
+	{
+		state.writeStages = info.stages;
+		state.writeAccess = info.access & WRITE_ACCESS;
+	}
+	else
+		state.readStages = info.stages;
+	state.visibleStages = info.stages;
+	state.visibleAccess = info.access;
+	return state;
+}
+
+std::vector<RenderGraph::PassResource> RenderGraph::mergeAccesses(const PassDecl& pass) const
+{
+	std::vector<PassResource> merged;
+	for (const Access& access : pass.accesses)
+	{
+		if (access.resource >= m_resources.size())
+			throw std::runtime_error(std::string("Render graph pass ") + pass.name + " uses an undeclared resource");
+
+		UsageInfo info = usageInfo(access.usage);
+		VkImageLayout layout = m_resources[access.resource].kind != ResourceKind::ImportedBuffer ? info.layout : VK_IMAGE_LAYOUT_UNDEFINED;
+		VkAccessFlags accessMask = access.writes ? info.access : info.access & ~WRITE_ACCESS;
+
+		auto it = std::find_if(merged.begin(), merged.end(), [&](const PassResource& other) { return other.resource == access.resource; });
+		if (it == merged.end())
+		{
+			merged.push_back({ access.resource, layout, layout, info.stages, accessMask, access.writes, access.keepContents });
+			continue;
+		}
+
+		it->exitLayout = layout;
+		it->stages |= info.stages;
+		it->access |= accessMask;
+		it->writes = it->writes || access.writes;
+	}
+	return merged;
+}
+
+void RenderGraph::transition(ResourceState& state, bool isImage, const PassResource& access, BarrierBatch& batch)
+{
+	bool layoutChange = isImage && state.layout != access.entryLayout;
+
+	if (access.writes || layoutChange)
+	{
+		// writes and layout transitions wait for every access since the last write, only a write has to be made available
+		VkPipelineStageFlags srcStages = state.writeStages | state.readStages;
+		if (srcStages != 0 || layoutChange)
+		{
+			batch.srcStages |= srcStages != 0 ? srcStages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+			batch.dstStages |= access.stages;
+			if (isImage && (layoutChange || state.writeAccess != 0))
+			{
+				VkImageLayout oldLayout = layoutChange && !access.keepContents ? VK_IMAGE_LAYOUT_UNDEFINED : state.layout;
+				batch.images.push_back({ access.resource, state.writeAccess, access.access, oldLayout, access.entryLayout });
+			}
+			else if (!isImage && state.writeAccess != 0)
+			{
+				batch.memorySrcAccess |= state.writeAccess;
+				batch.memoryDstAccess |= access.access;
+			}
+		}
+
+		state.writeStages = access.stages;
+		state.writeAccess = access.access & WRITE_ACCESS;
+		state.readStages = 0;
+		state.visibleStages = access.stages;
+		state.visibleAccess = access.access;
+	}
+	else
+	{
+		// reads in the same layout only wait for the last write, and only once per stage and access
+		bool visible = (access.stages & ~state.visibleStages) == 0 && (access.access & ~state.visibleAccess) == 0;
+		if (!visible && state.writeStages != 0)
+		{
+			batch.srcStages |= state.writeStages;
+			batch.dstStages |= access.stages;
+			if (isImage && state.writeAccess != 0)
+				batch.images.push_back({ access.resource, state.writeAccess, access.access, state.layout, state.layout });
+			else if (state.writeAccess != 0)
+			{
+				batch.memorySrcAccess |= state.writeAccess;
+				batch.memoryDstAccess |= access.access;
+			}
+		}
+
+		state.readStages |= access.stages;
+		state.visibleStages |= access.stages;
+		state.visibleAccess |= access.access;
+	}
+
+	state.layout = access.exitLayout;
+}
+
+void RenderGraph::realizeTransients(std::vector<Transient>& transients)
+{
+	// same images alive for the same passes end up in the same places, the ones created last time stay
+	bool unchanged = transients.size() == m_transients.size();
+	for (size_t i = 0; unchanged && i < transients.size(); i++)
+	{
+		unchanged = transients[i].desc == m_transients[i].desc && transients[i].placement.firstPass == m_transients[i].placement.firstPass
+			&& transients[i].placement.lastPass == m_transients[i].placement.lastPass;
+	}
+	if (unchanged)
+	{
+		for (size_t i = 0; i < transients.size(); i++)
+			m_transients[i].resource = transients[i].resource;
+		return;
+	}
+
+	destroyTransients();
+	if (transients.empty())
+		return;
+	if (m_device == VK_NULL_HANDLE)
+		throw std::runtime_error("Render graph can't create transient images without a device");
+
+	uint32_t memoryTypeBits = ~0u;
+	std::vector<TransientPlacement> placements;
+	for (Transient& transient : transients)
+	{
+		VkImageCreateInfo imageCreateInfo{};
+		imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+		imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+		imageCreateInfo.extent = { transient.desc.extent.width, transient.desc.extent.height, 1 };
+		imageCreateInfo.mipLevels = 1;
+		imageCreateInfo.arrayLayers = 1;
+		imageCreateInfo.format = transient.desc.format;
+		imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+		imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		imageCreateInfo.usage = transient.desc.usage;
+		imageCreateInfo.samples = transient.desc.samples;
+		imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+		if (vkCreateImage(m_device, &imageCreateInfo, nullptr, &transient.image) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create transient image");
+		}
+
+		VkMemoryRequirements memoryRequirements;
+		vkGetImageMemoryRequirements(m_device, transient.image, &memoryRequirements);
+		transient.placement.size = memoryRequirements.size;
+		transient.placement.alignment = memoryRequirements.alignment;
+		memoryTypeBits &= memoryRequirements.memoryTypeBits;
+		placements.push_back(transient.placement);
+		m_transientImageSize += memoryRequirements.size;
+	}
+
+	// one allocation for all of them, the images sharing memory are never alive at the same time
+	m_transientMemorySize = placeTransients(placements);
+	if (memoryTypeBits == 0)
+		throw std::runtime_error("Transient images have no memory type in common");
+
+	VkMemoryAllocateInfo memoryAllocateInfo{};
+	memoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	memoryAllocateInfo.allocationSize = m_transientMemorySize;
+	memoryAllocateInfo.memoryTypeIndex = m_findMemoryType(memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	if (vkAllocateMemory(m_device, &memoryAllocateInfo, nullptr, &m_transientMemory) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to allocate transient image memory");
+	}
+
+	for (size_t i = 0; i < transients.size(); i++)
+	{
+		Transient& transient = transients[i];
+		transient.placement = placements[i];
+		vkBindImageMemory(m_device, transient.image, m_transientMemory, transient.placement.offset);
+
+		VkImageViewCreateInfo viewCreateInfo{};
+		viewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		viewCreateInfo.image = transient.image;
+		viewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		viewCreateInfo.format = transient.desc.format;
+		viewCreateInfo.subresourceRange = { transient.desc.aspect, 0, 1, 0, 1 };
+
+		if (vkCreateImageView(m_device, &viewCreateInfo, nullptr, &transient.view) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create transient image view");
+		}
+	}
+
+	m_transients = std::move(transients);
+}
+
+void RenderGraph::destroyTransients()
+{
+	if (m_transientMemory != VK_NULL_HANDLE)
+	{
+		VkDevice device = m_device;
+		std::vector<Transient> transients = std::move(m_transients);
+		VkDeviceMemory memory = m_transientMemory;
+		m_retire([=]()
+		{
+			for (const Transient& transient : transients)
+			{
+				vkDestroyImageView(device, transient.view, nullptr);
+				vkDestroyImage(device, transient.image, nullptr);
+			}
+			vkFreeMemory(device, memory, nullptr);
+		});
+	}
+
+	m_transients.clear();
+	m_transientMemory = VK_NULL_HANDLE;
+	m_transientMemorySize = 0;
+	m_transientImageSize = 0;
+}
+
+void RenderGraph::recordBarriers(VkCommandBuffer commandBuffer, const BarrierBatch& batch)
+{
+	if (batch.srcStages == 0)
+		return;
+
+	m_imageBarriers.clear();
+	for (const ImageTransition& transition : batch.images)
+	{
+		VkImageMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.srcAccessMask = transition.srcAccess;
+		barrier.dstAccessMask = transition.dstAccess;
+		barrier.oldLayout = transition.oldLayout;
+		barrier.newLayout = transition.newLayout;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = image(transition.resource);
+		barrier.subresourceRange = m_resources[transition.resource].range;
+		m_imageBarriers.push_back(barrier);
+	}
+
+	VkMemoryBarrier memoryBarrier{};
+	memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	memoryBarrier.srcAccessMask = batch.memorySrcAccess;
+	memoryBarrier.dstAccessMask = batch.memoryDstAccess;
+
+	vkCmdPipelineBarrier(commandBuffer, batch.srcStages, batch.dstStages, 0, batch.memorySrcAccess != 0 ? 1 : 0, &memoryBarrier,
+		0, nullptr, static_cast<uint32_t>(m_imageBarriers.size()), m_imageBarriers.data());
+}
@@ -0,0 +1,249 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+// How a pass touches a resource, RenderGraph::usageInfo has the stages, access and layout behind each
+enum class ResourceUsage : uint8_t
+{
+	None, // untouched, contents undefined
+	ColorAttachment,
+	DepthAttachment,
+	DepthSampled, // read only depth, sampled by the fragment shader
+	InputAttachment,
+	FragmentSampled,
+	TransferSrc,
+	TransferDst,
+	HostRead,
+	Present // as the state of an acquired image, its stage is the one the acquire semaphore is waited on
+};
+
+struct UsageInfo
+{
+	VkPipelineStageFlags stages;
+	VkAccessFlags access;
+	VkImageLayout layout;
+};
+
+// An image that only lives within the graph, created by it when it is compiled
+struct TransientImageDesc
+{
+	VkFormat format = VK_FORMAT_UNDEFINED;
+	VkExtent2D extent{};
+	VkImageUsageFlags usage = 0;
+	VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+	VkImageAspectFlags aspect = VK_IMAGE_ASPECT_COLOR_BIT;
+
+	bool operator==(const TransientImageDesc& other) const
+	{
+		return format == other.format && extent.width == other.extent.width && extent.height == other.extent.height && usage == other.usage
+			&& samples == other.samples && aspect == other.aspect;
+	}
+};
+
+// Memory a transient needs and the passes it is alive for, offset is filled in by RenderGraph::placeTransients
+struct TransientPlacement
+{
+	VkDeviceSize size = 0;
+	VkDeviceSize alignment = 1;
+	uint32_t firstPass = 0;
+	uint32_t lastPass = 0;
+	VkDeviceSize offset = 0;
+};
+
+// The passes of a frame and the resources they touch. Passes are declared every frame, in the order they run, with the
+// images and buffers they read and write; compile() turns that into the pipeline barriers between them, drops passes
+// nothing downstream uses and places transient images that are never alive at the same time in the same memory. It only
+// does so when the shape of the graph changed: what the passes record and which VkImage an imported resource is this
+// frame don't count. A pass leaves every resource in the layout of the last usage it declared for it, render passes
+// begin and end in the layouts of their attachments and leave the transitions and the ordering to the graph.
+// Imported resources keep the state the graph left them in from one execution to the next.
+class RenderGraph
+{
+public:
+	using Resource = uint32_t;
+	using RecordFunction = std::function<void(VkCommandBuffer)>;
+	using FindMemoryType = std::function<uint32_t(uint32_t typeFilter, VkMemoryPropertyFlags properties)>;
+	using Retire = std::function<void(std::function<void()>&&)>; // destroys once the frames in flight are done
+
+	class PassBuilder
+	{
+	public:
+		PassBuilder& read(Resource resource, ResourceUsage usage);
+		PassBuilder& write(Resource resource, ResourceUsage usage); // the previous contents are dropped
+		PassBuilder& modify(Resource resource, ResourceUsage usage); // reads the previous contents and writes
+		PassBuilder& sideEffect(); // never culled, for work outside the graph's resources
+
+	private:
+		friend class RenderGraph;
+		PassBuilder(RenderGraph& graph, uint32_t pass) : m_graph(graph), m_pass(pass) {}
+
+		RenderGraph& m_graph;
+		uint32_t m_pass;
+	};
+
+	// without init the graph can compile, but not create transients
+	void init(VkDevice device, FindMemoryType findMemoryType, Retire retire);
+	void destroy();
+
+	// starts declaring a frame, resources and passes of the previous one are gone. Names are kept as pointers, literals
+	void reset();
+
+	// initial is assumed the first time the image is seen, later it is wherever the last execution left it. A final usage
+	// marks the image as read after the graph, the passes writing it are kept and it is moved there at the end
+	Resource importImage(const char* name, VkImage image, const VkImageSubresourceRange& range, ResourceUsage initial, ResourceUsage final = ResourceUsage::None);
+	Resource importBuffer(const char* name, VkBuffer buffer, ResourceUsage initial, ResourceUsage final = ResourceUsage::None);
+	Resource createImage(const char* name, const TransientImageDesc& desc);
+
+	PassBuilder addPass(const char* name, RecordFunction record);
+
+	// returns false if the shape matched the compiled one and nothing had to be done
+	bool compile();
+	void execute(VkCommandBuffer commandBuffer);
+
+	// the imported images were destroyed, handles may be reused by new ones
+	void forgetStates();
+
+	VkImage image(Resource resource) const; // transients exist once compiled
+	VkImageView imageView(Resource resource) const;
+
+	uint32_t passCount() const { return static_cast<uint32_t>(m_passes.size()); }
+	uint32_t culledPassCount() const { return m_culledPasses; }
+	uint32_t barrierCount() const { return m_barrierCount; } // vkCmdPipelineBarrier calls per execution
+	uint32_t imageBarrierCount() const { return m_imageBarrierCount; }
+	VkDeviceSize transientMemory() const { return m_transientMemorySize; } // allocated, after aliasing
+	VkDeviceSize transientImageMemory() const { return m_transientImageSize; } // the transients' sizes added up
+	uint64_t compileCount() const { return m_compileCount; }
+
+	static UsageInfo usageInfo(ResourceUsage usage);
+	// one transition outside of any graph, for uploads and one time setup. from None discards the contents
+	static VkImageMemoryBarrier imageBarrier(VkImage image, const VkImageSubresourceRange& range, ResourceUsage from, ResourceUsage to);
+	// greedy, largest first: every transient goes to the lowest offset that doesn't overlap one alive at the same time.
+	// Returns the memory all of them need
+	static VkDeviceSize placeTransients(std::vector<TransientPlacement>& placements);
+
+private:
+	enum class ResourceKind : uint8_t
+	{
+		ImportedImage,
+		ImportedBuffer,
+		TransientImage
+	};
+
+	struct ResourceDecl
+	{
+		const char* name;
+		ResourceKind kind;
+		VkImage image = VK_NULL_HANDLE;
+		VkBuffer buffer = VK_NULL_HANDLE;
+		VkImageSubresourceRange range{};
+		ResourceUsage initial = ResourceUsage::None;
+		ResourceUsage final = ResourceUsage::None;
+		TransientImageDesc desc{};
+	};
+
+	struct Access
+	{
+		Resource resource;
+		ResourceUsage usage;
+		bool writes;
+		bool keepContents;
+	};
+
+	struct PassDecl
+	{
+		const char* name;
+		RecordFunction record;
+		std::vector<Access> accesses;
+		bool sideEffect = false;
+	};
+
+	// where a resource stands between passes. Reads after the last write only wait for it once per stage and access
+	struct ResourceState
+	{
+		VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+		VkPipelineStageFlags writeStages = 0; // of the last write or layout transition
+		VkAccessFlags writeAccess = 0;
+		VkPipelineStageFlags readStages = 0; // since then
+		VkPipelineStageFlags visibleStages = 0; // the write is visible to
+		VkAccessFlags visibleAccess = 0;
+	};
+
+	// the accesses of one pass to one resource merged: it enters in the layout of the first, leaves in the one of the last
+	struct PassResource
+	{
+		Resource resource;
+		VkImageLayout entryLayout, exitLayout;
+		VkPipelineStageFlags stages;
+		VkAccessFlags access;
+		bool writes;
+		bool keepContents; // of the first access
+	};
+
+	struct ImageTransition
+	{
+		Resource resource;
+		VkAccessFlags srcAccess, dstAccess;
+		VkImageLayout oldLayout, newLayout;
+	};
+
+	// one vkCmdPipelineBarrier, before a pass or after the last one
+	struct BarrierBatch
+	{
+		VkPipelineStageFlags srcStages = 0, dstStages = 0;
+		VkAccessFlags memorySrcAccess = 0, memoryDstAccess = 0; // buffers, as a global memory barrier
+		std::vector<ImageTransition> images;
+	};
+
+	struct CompiledPass
+	{
+		uint32_t pass;
+		BarrierBatch barriers;
+	};
+
+	struct Transient
+	{
+		Resource resource;
+		TransientImageDesc desc;
+		TransientPlacement placement;
+		VkImage image = VK_NULL_HANDLE;
+		VkImageView view = VK_NULL_HANDLE;
+	};
+
+	uint64_t shapeHash() const;
+	ResourceState initialState(const ResourceDecl& resource) const;
+	std::vector<PassResource> mergeAccesses(const PassDecl& pass) const;
+	static void transition(ResourceState& state, bool isImage, const PassResource& access, BarrierBatch& batch);
+	void realizeTransients(std::vector<Transient>& transients);
+	void destroyTransients();
+	void recordBarriers(VkCommandBuffer commandBuffer, const BarrierBatch& batch);
+
+	VkDevice m_device = VK_NULL_HANDLE;
+	FindMemoryType m_findMemoryType;
+	Retire m_retire;
+
+	std::vector<ResourceDecl> m_resources;
+	std::vector<PassDecl> m_passes;
+	bool m_compiledDeclaration = false; // compile() ran since reset()
+
+	// compiled
+	uint64_t m_compiledHash = 0;
+	bool m_compiled = false;
+	std::vector<CompiledPass> m_schedule;
+	BarrierBatch m_finalBarriers;
+	std::vector<std::pair<Resource, ResourceState>> m_finalStates; // of the imported resources
+	std::vector<Transient> m_transients;
+	std::vector<uint32_t> m_transientIndex; // per resource, into m_transients
+	VkDeviceMemory m_transientMemory = VK_NULL_HANDLE;
+	VkDeviceSize m_transientMemorySize = 0, m_transientImageSize = 0;
+	uint32_t m_culledPasses = 0;
+	uint32_t m_barrierCount = 0, m_imageBarrierCount = 0;
+	uint64_t m_compileCount = 0;
+
+	std::unordered_map<uint64_t, ResourceState> m_states; // of imported images and buffers by handle, as the last execution left them
+	std::vector<VkImageMemoryBarrier> m_imageBarriers; // scratch for recording
+};
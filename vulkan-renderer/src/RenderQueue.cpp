@@ -0,0 +1,145 @@
+#include "RenderQueue.h"
+
+#include "JobSystem.h"
+
+#include <algorithm>
+#include <functional>
+
+namespace
+{
+	struct FieldLayout
+	{
+		uint32_t shift;
+		uint32_t bits;
+	};
+
+	// indexed by DrawKeyField
+	constexpr FieldLayout FIELD_LAYOUTS[] = { { 60, 4 }, { 52, 8 }, { 40, 12 }, { 16, 24 }, { 0, 16 } };
+	static_assert(std::size(FIELD_LAYOUTS) == static_cast<size_t>(DrawKeyField::Count), "draw key layout out of sync");
+
+	uint64_t packField(uint32_t value, DrawKeyField field)
+	{
+		const FieldLayout& layout = FIELD_LAYOUTS[static_cast<uint32_t>(field)];
+		return (static_cast<uint64_t>(value) & ((1ull << layout.bits) - 1)) << layout.shift;
+	}
+}
+
+uint64_t packDrawKey(const DrawKeyFields& fields)
+{
+	const uint32_t depthMax = (1u << FIELD_LAYOUTS[static_cast<uint32_t>(DrawKeyField::Depth)].bits) - 1;
+	uint32_t depth = static_cast<uint32_t>(std::clamp(fields.depth, 0.0f, 1.0f) * depthMax + 0.5f);
+
+	return packField(fields.pass, DrawKeyField::Pass) | packField(fields.pipeline, DrawKeyField::Pipeline) | packField(fields.material, DrawKeyField::Material)
+		| packField(fields.mesh, DrawKeyField::Mesh) | packField(depth, DrawKeyField::Depth);
+}
+
+uint32_t drawKeyField(uint64_t key, DrawKeyField field)
+{
+	const FieldLayout& layout = FIELD_LAYOUTS[static_cast<uint32_t>(field)];
+	return static_cast<uint32_t>((key >> layout.shift) & ((1ull << layout.bits) - 1));
+}
+
+void RenderQueue::sort(JobSystem* jobSystem)
+{
+	m_sortPasses = 0;
+	uint32_t count = static_cast<uint32_t>(m_entries.size());
+	if (count < 2)
+		return;
+
+	m_scratch.resize(count);
+
+	// one chunk per thread. Each chunk scatters into its own slice of every bucket, in order, which keeps the sort stable
+	uint32_t chunkCount = 1;
+	if (jobSystem != nullptr && count >= PARALLEL_THRESHOLD)
+		chunkCount = jobSystem->workerCount() + 1;
+	uint32_t chunkSize = (count + chunkCount - 1) / chunkCount;
+	chunkCount = (count + chunkSize - 1) / chunkSize;
+
+	auto forEachChunk = [&](const std::function<void(uint32_t chunk, uint32_t begin, uint32_t end)>& body)
+	{
+		if (chunkCount == 1)
+			body(0, 0, count);
+		else
+			jobSystem->parallelFor(count, chunkSize, [&](uint32_t begin, uint32_t end) { body(begin / chunkSize, begin, end); });
+	};
+
+	auto digitOf = [](uint64_t key, uint32_t digit) { return static_cast<uint32_t>(key >> (digit * DIGIT_BITS)) & (BUCKETS - 1); };
+
+	// every digit's histogram in one read, the totals don't depend on the order and tell which digits can be skipped
+	m_counts.assign(static_cast<size_t>(chunkCount) * DIGITS, {});
+	forEachChunk([&](uint32_t chunk, uint32_t begin, uint32_t end)
+	{
+		std::array<uint32_t, BUCKETS>* counts = &m_counts[static_cast<size_t>(chunk) * DIGITS];
+		for (uint32_t i = begin; i < end; i++)
+		{
+			uint64_t key = m_entries[i].key;
+			for (uint32_t digit = 0; digit < DIGITS; digit++)
+				counts[digit][digitOf(key, digit)]++;
+		}
+	});
+
+	m_offsets.resize(chunkCount);
+	for (uint32_t digit = 0; digit < DIGITS; digit++)
+	{
+		std::array<uint32_t, BUCKETS> totals{};
+		for (uint32_t chunk = 0; chunk < chunkCount; chunk++)
+		{
+			const std::array<uint32_t, BUCKETS>& counts = m_counts[static_cast<size_t>(chunk) * DIGITS + digit];
+			for (uint32_t bucket = 0; bucket < BUCKETS; bucket++)
+				totals[bucket] += counts[bucket];
+		}
+
+		if (std::find(totals.begin(), totals.end(), count) != totals.end())
+			continue;
+
+		// the chunk histograms of the first pass came from the original order, later passes moved entries between chunks
+		if (chunkCount > 1 && m_sortPasses > 0)
+		{
+			forEachChunk([&](uint32_t chunk, uint32_t begin, uint32_t end)
+			{
+				std::array<uint32_t, BUCKETS>& counts = m_counts[static_cast<size_t>(chunk) * DIGITS + digit];
+				counts = {};
+				for (uint32_t i = begin; i < end; i++)
+					counts[digitOf(m_entries[i].key, digit)]++;
+			});
+		}
+
+		// bucket major, chunk minor: chunk c's slice of a bucket starts after the slices of the chunks before it
+		uint32_t offset = 0;
+		for (uint32_t bucket = 0; bucket < BUCKETS; bucket++)
+		{
+			for (uint32_t chunk = 0; chunk < chunkCount; chunk++)
+			{
+				m_offsets[chunk][bucket] = offset;
+				offset += m_counts[static_cast<size_t>(chunk) * DIGITS + digit][bucket];
+			}
+		}
+
+		forEachChunk([&](uint32_t chunk, uint32_t begin, uint32_t end)
+		{
+			std::array<uint32_t, BUCKETS>& offsets = m_offsets[chunk];
+			for (uint32_t i = begin; i < end; i++)
+				m_scratch[offsets[digitOf(m_entries[i].key, digit)]++] = m_entries[i];
+		});
+
+		m_entries.swap(m_scratch);
+		m_sortPasses++;
+	}
+}
+
+StateChangeCounts RenderQueue::countStateChanges() const
+{
+	StateChangeCounts counts;
+	for (size_t i = 0; i < m_entries.size(); i++)
+	{
+		uint64_t key = m_entries[i].key;
+		auto changed = [&](DrawKeyField field) { return i == 0 || drawKeyField(key, field) != drawKeyField(m_entries[i - 1].key, field); };
+
+		// a new pipeline or material doesn't make the mesh bound before it any less valid
+		counts.draws++;
+		counts.pipelineBinds += changed(DrawKeyField::Pipeline) ? 1 : 0;
+		counts.materialBinds += changed(DrawKeyField::Material) ? 1 : 0;
+		counts.meshBinds += changed(DrawKeyField::Mesh) ? 1 : 0;
+	}
+	return counts;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class JobSystem;
+
+// The state one draw needs. packDrawKey turns it into a 64 bit sort key, most significant field first:
+//   pass 4 | pipeline 8 | material 12 | mesh 24 | depth 16
+// Sorted draws change the most expensive state least often, and draws with identical state go front to back.
+struct DrawKeyFields
+{
+	uint32_t pass = 0; // opaque first, anything that has to be drawn over it later
+	uint32_t pipeline = 0;
+	uint32_t material = 0;
+	uint32_t mesh = 0; // first triangle in the shared index buffer
+	float depth = 0.0f; // 0 at the near plane, 1 at the far plane
+};
+
+enum class DrawKeyField : uint32_t
+{
+	Pass,
+	Pipeline,
+	Material,
+	Mesh,
+	Depth,
+	Count
+};
+
+uint64_t packDrawKey(const DrawKeyFields& fields); // fields wider than their bits wrap around, depth is clamped
+uint32_t drawKeyField(uint64_t key, DrawKeyField field);
+
+// What a recorder walking the draws in order has to set: one bind per field that differs from the draw before
+struct StateChangeCounts
+{
+	uint32_t draws = 0;
+	uint32_t pipelineBinds = 0;
+	uint32_t materialBinds = 0;
+	uint32_t meshBinds = 0;
+};
+
+// Draw keys with a payload, usually the index of the draw they stand for, sorted with an LSD radix sort of 8 bits per pass.
+// Passes over a digit every key has in common are skipped, with a handful of passes, pipelines and materials that is most
+// of the upper half. Meant to be kept around and refilled every frame so its allocations are reused.
+class RenderQueue
+{
+public:
+	struct Entry
+	{
+		uint64_t key;
+		uint32_t payload;
+	};
+
+	void clear() { m_entries.clear(); }
+	void reserve(size_t count) { m_entries.reserve(count); }
+	void push(uint64_t key, uint32_t payload) { m_entries.push_back({ key, payload }); }
+
+	// stable, queues of PARALLEL_THRESHOLD entries and more are split over the job system if there is one
+	void sort(JobSystem* jobSystem = nullptr);
+
+	const std::vector<Entry>& entries() const { return m_entries; }
+	uint32_t sortPasses() const { return m_sortPasses; } // of the last sort, digits that weren't skipped
+
+	StateChangeCounts countStateChanges() const; // of the entries in their current order
+
+	static constexpr uint32_t PARALLEL_THRESHOLD = 1 << 16; // below that the jobs cost more than they save
+
+private:
+	static constexpr uint32_t DIGIT_BITS = 8;
+	static constexpr uint32_t BUCKETS = 1 << DIGIT_BITS;
+	static constexpr uint32_t DIGITS = 64 / DIGIT_BITS;
+
+	std::vector<Entry> m_entries;
+	std::vector<Entry> m_scratch;
+	std::vector<std::array<uint32_t, BUCKETS>> m_counts; // per chunk and digit, chunk major
+	std::vector<std::array<uint32_t, BUCKETS>> m_offsets; // per chunk, of the digit being scattered
+	uint32_t m_sortPasses = 0;
+};
@@ -0,0 +1,318 @@
+#include "RenderableStore.h"
+
+#include "JobSystem.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace
+{
+	constexpr uint32_t COMPONENT_COUNT = static_cast<uint32_t>(RenderableComponent::Count);
+
+	constexpr size_t componentSizes[COMPONENT_COUNT] =
+	{
+		sizeof(glm::mat4), // Transform
+		sizeof(MeshRef),   // Mesh
+		sizeof(uint32_t),  // Material
+		sizeof(Aabb),      // Bounds
+		sizeof(uint32_t),  // Flags
+	};
+
+	constexpr size_t alignArray(size_t offset)
+	{
+		return (offset + 15) & ~size_t(15);
+	}
+}
+
+Entity RenderableStore::create(const RenderableDesc& desc)
+{
+	std::lock_guard<std::mutex> lock(m_commandMutex);
+
+	Entity entity;
+	if (!m_freeIndices.empty())
+	{
+		entity.index = m_freeIndices.back();
+		m_freeIndices.pop_back();
+	}
+	else
+	{
+		entity.index = static_cast<uint32_t>(m_records.size());
+		m_records.emplace_back();
+	}
+
+	EntityRecord& record = m_records[entity.index];
+	record.alive = true;
+	record.archetype = NO_ARCHETYPE;
+	entity.generation = record.generation;
+
+	m_commands.push_back({ CommandType::Create, entity, desc });
+	return entity;
+}
+
+void RenderableStore::destroy(Entity entity)
+{
+	std::lock_guard<std::mutex> lock(m_commandMutex);
+
+	if (!isAlive(entity))
+		return;
+
+	m_records[entity.index].alive = false;
+	m_commands.push_back({ CommandType::Destroy, entity, {} });
+}
+
+void RenderableStore::addComponents(Entity entity, const RenderableDesc& values)
+{
+	std::lock_guard<std::mutex> lock(m_commandMutex);
+	if (isAlive(entity))
+		m_commands.push_back({ CommandType::AddComponents, entity, values });
+}
+
+void RenderableStore::removeComponents(Entity entity, ComponentMask components)
+{
+	RenderableDesc desc;
+	desc.components = components;
+
+	std::lock_guard<std::mutex> lock(m_commandMutex);
+	if (isAlive(entity))
+		m_commands.push_back({ CommandType::RemoveComponents, entity, desc });
+}
+
+void RenderableStore::flush()
+{
+	for (const Command& command : m_commands)
+	{
+		EntityRecord& record = m_records[command.entity.index];
+
+		// commands recorded after a destroy of the same entity find a newer generation
+		if (record.generation != command.entity.generation)
+			continue;
+
+		switch (command.type)
+		{
+		case CommandType::Create:
+		{
+			uint32_t archetype = findArchetype(command.desc.components);
+			record.archetype = archetype;
+			record.row = pushRow(archetype, command.entity);
+			writeComponents(archetype, record.row, command.desc);
+			m_entityCount++;
+			break;
+		}
+		case CommandType::Destroy:
+			removeRow(record.archetype, record.row);
+			record.archetype = NO_ARCHETYPE;
+			record.generation++;
+			m_freeIndices.push_back(command.entity.index);
+			m_entityCount--;
+			break;
+		case CommandType::AddComponents:
+			moveEntity(command.entity, m_archetypes[record.archetype].components | command.desc.components, command.desc);
+			break;
+		case CommandType::RemoveComponents:
+			moveEntity(command.entity, m_archetypes[record.archetype].components & ~command.desc.components, {});
+			break;
+		}
+	}
+
+	m_commands.clear();
+}
+
+void RenderableStore::clear()
+{
+	m_archetypes.clear();
+	m_archetypeIndices.clear();
+	m_records.clear();
+	m_freeIndices.clear();
+	m_entityCount = 0;
+	m_commands.clear();
+}
+
+bool RenderableStore::isAlive(Entity entity) const
+{
+	return entity.index < m_records.size() && m_records[entity.index].alive && m_records[entity.index].generation == entity.generation;
+}
+
+void RenderableStore::forEachChunk(ComponentMask required, const std::function<void(const RenderableChunk& chunk)>& function)
+{
+	for (Archetype& archetype : m_archetypes)
+	{
+		if ((archetype.components & required) != required)
+			continue;
+
+		for (uint32_t chunk = 0; chunk * archetype.capacity < archetype.count; chunk++)
+			function(chunkView(archetype, chunk));
+	}
+}
+
+void RenderableStore::parallelForEachChunk(JobSystem& jobSystem, ComponentMask required, const std::function<void(const RenderableChunk& chunk)>& function)
+{
+	// flatten first, chunks are the unit of work
+	std::vector<RenderableChunk> chunks;
+	forEachChunk(required, [&](const RenderableChunk& chunk) { chunks.push_back(chunk); });
+
+	jobSystem.parallelFor(static_cast<uint32_t>(chunks.size()), 1, [&](uint32_t begin, uint32_t end)
+	{
+		for (uint32_t i = begin; i < end; i++)
+			function(chunks[i]);
+	});
+}
+
+uint32_t RenderableStore::count(ComponentMask required) const
+{
+	uint32_t total = 0;
+	for (const Archetype& archetype : m_archetypes)
+	{
+		if ((archetype.components & required) == required)
+			total += archetype.count;
+	}
+	return total;
+}
+
+uint32_t RenderableStore::findArchetype(ComponentMask components)
+{
+	auto found = m_archetypeIndices.find(components);
+	if (found != m_archetypeIndices.end())
+		return found->second;
+
+	Archetype archetype{};
+	archetype.components = components;
+
+	// as many rows as fit once every array starts 16 byte aligned
+	size_t rowSize = sizeof(Entity);
+	for (uint32_t c = 0; c < COMPONENT_COUNT; c++)
+	{
+		if (components & (1u << c))
+			rowSize += componentSizes[c];
+	}
+	archetype.capacity = static_cast<uint32_t>((CHUNK_SIZE - 16 * COMPONENT_COUNT) / rowSize);
+
+	size_t offset = alignArray(sizeof(Entity) * archetype.capacity);
+	for (uint32_t c = 0; c < COMPONENT_COUNT; c++)
+	{
+		if (!(components & (1u << c)))
+			continue;
+		archetype.offsets[c] = offset;
+		offset = alignArray(offset + componentSizes[c] * archetype.capacity);
+	}
+	if (offset > CHUNK_SIZE)
+		throw std::runtime_error("Renderable archetype doesn't fit into a chunk");
+
+	m_archetypes.push_back(std::move(archetype));
+	uint32_t index = static_cast<uint32_t>(m_archetypes.size()) - 1;
+	m_archetypeIndices[components] = index;
+	return index;
+}
+
+uint32_t RenderableStore::pushRow(uint32_t archetypeIndex, Entity entity)
+{
+	Archetype& archetype = m_archetypes[archetypeIndex];
+
+	if (archetype.count == archetype.chunks.size() * archetype.capacity)
+		archetype.chunks.push_back(std::make_unique<std::byte[]>(CHUNK_SIZE));
+
+	uint32_t row = archetype.count++;
+	std::byte* chunk = archetype.chunks[row / archetype.capacity].get();
+	reinterpret_cast<Entity*>(chunk)[row % archetype.capacity] = entity;
+	return row;
+}
+
+void RenderableStore::removeRow(uint32_t archetypeIndex, uint32_t row)
+{
+	Archetype& archetype = m_archetypes[archetypeIndex];
+	uint32_t last = --archetype.count;
+	if (row == last)
+		return;
+
+	// the last row fills the hole, so every chunk but the last stays full
+	Entity* rowEntity = reinterpret_cast<Entity*>(archetype.chunks[row / archetype.capacity].get()) + row % archetype.capacity;
+	Entity* lastEntity = reinterpret_cast<Entity*>(archetype.chunks[last / archetype.capacity].get()) + last % archetype.capacity;
+	*rowEntity = *lastEntity;
+	m_records[rowEntity->index].row = row;
+
+	for (uint32_t c = 0; c < COMPONENT_COUNT; c++)
+	{
+		if (archetype.components & (1u << c))
+		{
+			RenderableComponent component = static_cast<RenderableComponent>(c);
+			std::memcpy(componentAt(archetype, row, component), componentAt(archetype, last, component), componentSizes[c]);
+		}
+	}
+}
+
+void RenderableStore::writeComponents(uint32_t archetypeIndex, uint32_t row, const RenderableDesc& values)
+{
+	Archetype& archetype = m_archetypes[archetypeIndex];
+	ComponentMask components = archetype.components & values.components;
+
+	const void* sources[COMPONENT_COUNT] = { &values.transform, &values.mesh, &values.material, &values.bounds, &values.flags };
+	for (uint32_t c = 0; c < COMPONENT_COUNT; c++)
+	{
+		if (components & (1u << c))
+			std::memcpy(componentAt(archetype, row, static_cast<RenderableComponent>(c)), sources[c], componentSizes[c]);
+	}
+}
+
+void RenderableStore::moveEntity(Entity entity, ComponentMask components, const RenderableDesc& values)
+{
+	EntityRecord& record = m_records[entity.index];
+	uint32_t from = record.archetype, fromRow = record.row;
+	uint32_t to = findArchetype(components);
+
+	if (to != from)
+	{
+		uint32_t toRow = pushRow(to, entity);
+		ComponentMask shared = m_archetypes[from].components & components;
+		for (uint32_t c = 0; c < COMPONENT_COUNT; c++)
+		{
+			if (shared & (1u << c))
+			{
+				RenderableComponent component = static_cast<RenderableComponent>(c);
+				std::memcpy(componentAt(m_archetypes[to], toRow, component), componentAt(m_archetypes[from], fromRow, component), componentSizes[c]);
+			}
+		}
+
+		removeRow(from, fromRow);
+		record.archetype = to;
+		record.row = toRow;
+	}
+
+	writeComponents(to, record.row, values);
+}
+
+void* RenderableStore::component(Entity entity, RenderableComponent component)
+{
+	if (!isAlive(entity))
+		return nullptr;
+
+	const EntityRecord& record = m_records[entity.index];
+	if (record.archetype == NO_ARCHETYPE || !(m_archetypes[record.archetype].components & componentBit(component)))
+		return nullptr;
+
+	return componentAt(m_archetypes[record.archetype], record.row, component);
+}
+
+std::byte* RenderableStore::componentAt(Archetype& archetype, uint32_t row, RenderableComponent component)
+{
+	uint32_t c = static_cast<uint32_t>(component);
+	return archetype.chunks[row / archetype.capacity].get() + archetype.offsets[c] + (row % archetype.capacity) * componentSizes[c];
+}
+
+RenderableChunk RenderableStore::chunkView(Archetype& archetype, uint32_t chunk)
+{
+	std::byte* data = archetype.chunks[chunk].get();
+	auto array = [&](RenderableComponent component) -> std::byte*
+	{
+		return archetype.components & componentBit(component) ? data + archetype.offsets[static_cast<uint32_t>(component)] : nullptr;
+	};
+
+	RenderableChunk view;
+	view.count = std::min(archetype.capacity, archetype.count - chunk * archetype.capacity);
+	view.entities = reinterpret_cast<const Entity*>(data);
+	view.transforms = reinterpret_cast<glm::mat4*>(array(RenderableComponent::Transform));
+	view.meshes = reinterpret_cast<MeshRef*>(array(RenderableComponent::Mesh));
+	view.materials = reinterpret_cast<uint32_t*>(array(RenderableComponent::Material));
+	view.bounds = reinterpret_cast<Aabb*>(array(RenderableComponent::Bounds));
+	view.flags = reinterpret_cast<uint32_t*>(array(RenderableComponent::Flags));
+	return view;
+}
@@ -0,0 +1,170 @@
+#pragma once
+
+#include "Culling.h"
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+class JobSystem;
+
+enum class RenderableComponent : uint32_t
+{
+	Transform, // glm::mat4, object to world
+	Mesh,      // MeshRef
+	Material,  // uint32_t material index
+	Bounds,    // Aabb, world space
+	Flags,     // uint32_t, RenderableFlags
+	Count
+};
+
+using ComponentMask = uint32_t;
+
+constexpr ComponentMask componentBit(RenderableComponent component)
+{
+	return 1u << static_cast<uint32_t>(component);
+}
+
+// range of the shared index buffer, the same pair a DrawItem carries
+struct MeshRef
+{
+	uint32_t firstIndex;
+	uint32_t indexCount;
+};
+
+enum RenderableFlags : uint32_t
+{
+	RENDERABLE_OCCLUDER = 1 << 0, // candidate for the CPU occlusion buffer
+};
+
+// index + generation, a destroyed entity's index is reused with the next generation
+struct Entity
+{
+	uint32_t index = ~0u;
+	uint32_t generation = 0;
+
+	bool operator==(const Entity& other) const { return index == other.index && generation == other.generation; }
+};
+
+// initial values, only the components in the mask are stored
+struct RenderableDesc
+{
+	ComponentMask components = 0;
+	glm::mat4 transform{ 1.0f };
+	MeshRef mesh{};
+	uint32_t material = 0;
+	Aabb bounds{};
+	uint32_t flags = 0;
+};
+
+// one chunk as seen by a query, arrays of count entries, nullptr for components the archetype doesn't have
+struct RenderableChunk
+{
+	uint32_t count;
+	const Entity* entities;
+	glm::mat4* transforms;
+	MeshRef* meshes;
+	uint32_t* materials;
+	Aabb* bounds;
+	uint32_t* flags;
+};
+
+// Archetype store for renderables. Entities with the same set of components share an archetype, which keeps them
+// in 16 KiB chunks with one tightly packed array per component, so queries stream through memory linearly.
+// Structural changes (create, destroy, adding or removing components) are queued and applied by flush(),
+// once per frame, so chunks never move under a running query. Component values can be written any time.
+class RenderableStore
+{
+public:
+	static constexpr size_t CHUNK_SIZE = 16 * 1024;
+
+	RenderableStore() = default;
+	RenderableStore(const RenderableStore&) = delete;
+	RenderableStore& operator=(const RenderableStore&) = delete;
+
+	// deferred, the handle is valid right away but the entity shows up in queries after the next flush.
+	// Recording is thread safe, flush and queries aren't
+	Entity create(const RenderableDesc& desc);
+	void destroy(Entity entity);
+	void addComponents(Entity entity, const RenderableDesc& values); // values.components are added, their values set
+	void removeComponents(Entity entity, ComponentMask components);
+
+	void flush(); // applies the queued changes in the order they were recorded
+	void clear(); // everything, queued changes included
+
+	bool isAlive(Entity entity) const; // created and not destroyed, maybe not flushed yet
+	uint32_t size() const { return m_entityCount; } // flushed entities
+
+	// direct access to a flushed entity's components, nullptr if it doesn't have one
+	glm::mat4* transform(Entity entity) { return static_cast<glm::mat4*>(component(entity, RenderableComponent::Transform)); }
+	MeshRef* mesh(Entity entity) { return static_cast<MeshRef*>(component(entity, RenderableComponent::Mesh)); }
+	uint32_t* material(Entity entity) { return static_cast<uint32_t*>(component(entity, RenderableComponent::Material)); }
+	Aabb* bounds(Entity entity) { return static_cast<Aabb*>(component(entity, RenderableComponent::Bounds)); }
+	uint32_t* flags(Entity entity) { return static_cast<uint32_t*>(component(entity, RenderableComponent::Flags)); }
+
+	// every chunk of every archetype that has at least the required components
+	void forEachChunk(ComponentMask required, const std::function<void(const RenderableChunk& chunk)>& function);
+	void parallelForEachChunk(JobSystem& jobSystem, ComponentMask required, const std::function<void(const RenderableChunk& chunk)>& function);
+	uint32_t count(ComponentMask required) const;
+
+private:
+	static constexpr uint32_t NO_ARCHETYPE = ~0u;
+
+	struct Archetype
+	{
+		ComponentMask components;
+		uint32_t capacity; // entities per chunk
+		size_t offsets[static_cast<size_t>(RenderableComponent::Count)]; // of each array in a chunk, entities start at 0
+		uint32_t count = 0;
+		std::vector<std::unique_ptr<std::byte[]>> chunks; // kept when emptied, for reuse
+	};
+
+	// where an entity lives, indexed by Entity::index
+	struct EntityRecord
+	{
+		uint32_t generation = 0;
+		uint32_t archetype = NO_ARCHETYPE;
+		uint32_t row = 0;
+		bool alive = false;
+	};
+
+	enum class CommandType
+	{
+		Create,
+		Destroy,
+		AddComponents,
+		RemoveComponents
+	};
+
+	struct Command
+	{
+		CommandType type;
+		Entity entity;
+		RenderableDesc desc; // mask only for RemoveComponents
+	};
+
+	uint32_t findArchetype(ComponentMask components);
+	uint32_t pushRow(uint32_t archetype, Entity entity);
+	void removeRow(uint32_t archetype, uint32_t row);
+	void writeComponents(uint32_t archetype, uint32_t row, const RenderableDesc& values);
+	void moveEntity(Entity entity, ComponentMask components, const RenderableDesc& values);
+	void* component(Entity entity, RenderableComponent component);
+	std::byte* componentAt(Archetype& archetype, uint32_t row, RenderableComponent component);
+	RenderableChunk chunkView(Archetype& archetype, uint32_t chunk);
+
+	std::vector<Archetype> m_archetypes;
+	std::unordered_map<ComponentMask, uint32_t> m_archetypeIndices;
+
+	std::vector<EntityRecord> m_records;
+	std::vector<uint32_t> m_freeIndices;
+	uint32_t m_entityCount = 0;
+
+	std::mutex m_commandMutex; // guards the queue and the entity records while recording
+	std::vector<Command> m_commands;
+};
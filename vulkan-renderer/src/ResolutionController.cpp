@@ -0,0 +1,89 @@
+#include "ResolutionController.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+ResolutionController::ResolutionController(const ResolutionSettings& settings)
+	: m_settings(settings)
+{
+	m_settings.minScale = std::clamp(m_settings.minScale, 0.1f, 1.0f);
+	m_settings.maxScale = std::clamp(m_settings.maxScale, m_settings.minScale, 2.0f);
+	m_scale = m_settings.maxScale;
+	m_minScale = m_maxScale = m_scale;
+}
+
+void ResolutionController::addGpuTime(double timeMs)
+{
+	m_frames++;
+	if (timeMs > m_settings.budgetMs)
+		m_overBudgetFrames++;
+	m_totalScale += m_scale;
+	m_minScale = std::min(m_minScale, m_scale);
+	m_maxScale = std::max(m_maxScale, m_scale);
+	m_totalMs += timeMs;
+	m_totalSquaredMs += timeMs * timeMs;
+	m_worstMs = std::max(m_worstMs, timeMs);
+
+	m_filteredMs = m_filteredMs == 0.0 ? timeMs : m_filteredMs + SMOOTHING * (timeMs - m_filteredMs);
+
+	// frames that were already in flight when the scale changed say nothing about the new one
+	if (++m_framesSinceChange <= m_settings.latencyFrames)
+		return;
+
+	double target = m_settings.budgetMs * m_settings.headroom;
+	double ideal = m_scale * std::sqrt(target / std::max(m_filteredMs, 1e-3));
+	float next = static_cast<float>(std::clamp(ideal, m_scale * MAX_STEP_DOWN, m_scale * MAX_STEP_UP));
+	next = std::clamp(next, m_settings.minScale, m_settings.maxScale);
+
+	// small corrections cost a resolution change and buy nothing, the bounds are always reachable though
+	bool atBound = next == m_settings.minScale || next == m_settings.maxScale;
+	if (next == m_scale || (std::abs(next - m_scale) < DEADBAND * m_scale && !atBound))
+		return;
+
+	// the filtered time follows the model, so the next decision doesn't wait for the filter to catch up
+	m_filteredMs *= (next * next) / (m_scale * m_scale);
+	m_scale = next;
+	m_framesSinceChange = 0;
+	m_scaleChanges++;
+}
+
+ResolutionController::Summary ResolutionController::summary() const
+{
+	Summary summary;
+	summary.frames = m_frames;
+	summary.overBudgetFrames = m_overBudgetFrames;
+	summary.scaleChanges = m_scaleChanges;
+	summary.minScale = m_minScale;
+	summary.maxScale = m_maxScale;
+	summary.worstMs = m_worstMs;
+
+	if (m_frames > 0)
+	{
+		summary.averageScale = m_totalScale / m_frames;
+		summary.averageMs = m_totalMs / m_frames;
+		summary.deviationMs = std::sqrt(std::max(0.0, m_totalSquaredMs / m_frames - summary.averageMs * summary.averageMs));
+	}
+	return summary;
+}
+
+void ResolutionController::printSummary(uint32_t outputWidth, uint32_t outputHeight) const
+{
+	Summary s = summary();
+	if (s.frames == 0)
+	{
+		std::cout << "Dynamic resolution: no GPU timings, the render scale stayed at " << m_scale << std::endl;
+		return;
+	}
+
+	auto resolution = [&](double scale)
+	{
+		return std::to_string(static_cast<uint32_t>(outputWidth * scale + 0.5)) + "x" + std::to_string(static_cast<uint32_t>(outputHeight * scale + 0.5));
+	};
+
+	std::cout << "Dynamic resolution over " << s.frames << " frames, budget " << m_settings.budgetMs << " ms:" << std::endl;
+	std::cout << "  render scale avg " << s.averageScale << " (" << resolution(s.averageScale) << "), range " << s.minScale << " - " << s.maxScale
+		<< " (" << resolution(s.minScale) << " - " << resolution(s.maxScale) << "), " << s.scaleChanges << " changes" << std::endl;
+	std::cout << "  GPU time avg " << s.averageMs << " ms, deviation " << s.deviationMs << " ms, worst " << s.worstMs << " ms, over budget in "
+		<< 100.0 * s.overBudgetFrames / s.frames << "% of the frames" << std::endl;
+}
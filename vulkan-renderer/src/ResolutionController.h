@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+
+struct ResolutionSettings
+{
+	float minScale = 0.5f; // of the output resolution, per axis
+	float maxScale = 1.0f;
+	double budgetMs = 16.0; // GPU time per frame to stay under
+	double headroom = 0.9; // aims for this fraction of the budget, so noise doesn't push every other frame over it
+	uint32_t latencyFrames = 2; // frames between a scale change and the first GPU time measured at that scale
+};
+
+// Picks the render scale from measured GPU frame times. GPU time is taken to grow with the pixel count, i.e. the
+// square of the scale, which gives the scale that would have hit the target; the controller moves towards it
+// quickly when over budget and slowly when under, and ignores differences too small to be worth a change.
+class ResolutionController
+{
+public:
+	explicit ResolutionController(const ResolutionSettings& settings = {});
+
+	void addGpuTime(double timeMs); // one per frame, in the order the frames were submitted
+	float scale() const { return m_scale; }
+	const ResolutionSettings& settings() const { return m_settings; }
+
+	// everything since construction, outputWidth/outputHeight is the resolution at scale 1
+	void printSummary(uint32_t outputWidth, uint32_t outputHeight) const;
+
+	struct Summary
+	{
+		uint32_t frames = 0;
+		uint32_t overBudgetFrames = 0;
+		uint32_t scaleChanges = 0;
+		double averageScale = 0.0;
+		float minScale = 0.0f, maxScale = 0.0f;
+		double averageMs = 0.0;
+		double deviationMs = 0.0; // standard deviation of the GPU time
+		double worstMs = 0.0;
+	};
+	Summary summary() const;
+
+private:
+	static constexpr double SMOOTHING = 0.25; // weight of the newest frame in the filtered time
+	static constexpr double MAX_STEP_DOWN = 0.85; // per change, as a factor of the scale
+	static constexpr double MAX_STEP_UP = 1.05;
+	static constexpr double DEADBAND = 0.03; // relative difference that doesn't warrant a change
+
+	ResolutionSettings m_settings;
+	float m_scale;
+	double m_filteredMs = 0.0; // 0 until the first measurement
+	uint32_t m_framesSinceChange = 0;
+
+	uint32_t m_frames = 0;
+	uint32_t m_overBudgetFrames = 0;
+	uint32_t m_scaleChanges = 0;
+	double m_totalScale = 0.0;
+	float m_minScale, m_maxScale;
+	double m_totalMs = 0.0, m_totalSquaredMs = 0.0, m_worstMs = 0.0;
+};
@@ -0,0 +1,188 @@
+#include "SceneGraph.h"
+
+#include "JobSystem.h"
+
+#include <algorithm>
+#include <atomic>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SCENE_GRAPH_SSE 1
+#include <immintrin.h>
+#endif
+
+namespace
+{
+#if SCENE_GRAPH_SSE
+	// parent * local, column by column. glm may contract to fused multiply adds, so the results can differ in the last bits
+	void multiplySse(const glm::mat4& parent, const glm::mat4& local, glm::mat4& out)
+	{
+		const __m128 p0 = _mm_loadu_ps(&parent[0][0]);
+		const __m128 p1 = _mm_loadu_ps(&parent[1][0]);
+		const __m128 p2 = _mm_loadu_ps(&parent[2][0]);
+		const __m128 p3 = _mm_loadu_ps(&parent[3][0]);
+
+		for (int c = 0; c < 4; c++)
+		{
+			const float* column = &local[c][0];
+			__m128 result = _mm_mul_ps(p0, _mm_set1_ps(column[0]));
+			result = _mm_add_ps(result, _mm_mul_ps(p1, _mm_set1_ps(column[1])));
+			result = _mm_add_ps(result, _mm_mul_ps(p2, _mm_set1_ps(column[2])));
+			result = _mm_add_ps(result, _mm_mul_ps(p3, _mm_set1_ps(column[3])));
+			_mm_storeu_ps(&out[c][0], result);
+		}
+	}
+#endif
+}
+
+uint32_t SceneGraph::createNode(uint32_t parent, const glm::mat4& localTransform)
+{
+	uint32_t node = static_cast<uint32_t>(m_slots.size());
+	uint32_t slot = static_cast<uint32_t>(m_local.size());
+	uint32_t parentSlot = parent == NO_PARENT ? NO_PARENT : m_slots.at(parent);
+	uint32_t depth = parent == NO_PARENT ? 0 : m_depth[parentSlot] + 1;
+
+	m_local.push_back(localTransform);
+	m_world.push_back(localTransform);
+	m_parent.push_back(parentSlot);
+	m_depth.push_back(depth);
+	m_dirty.push_back(1);
+	m_nodes.push_back(node);
+	m_slots.push_back(slot);
+
+	// appending keeps the depth order as long as the node is at least as deep as the last one
+	if (!m_sorted || depth + 1 < levelCount())
+		m_sorted = false;
+	else if (depth == levelCount())
+		m_levelStarts.push_back(slot + 1);
+	else
+		m_levelStarts.back() = slot + 1;
+
+	return node;
+}
+
+void SceneGraph::clear()
+{
+	m_local.clear();
+	m_world.clear();
+	m_parent.clear();
+	m_depth.clear();
+	m_dirty.clear();
+	m_nodes.clear();
+	m_slots.clear();
+	m_levelStarts.assign(1, 0);
+	m_sorted = true;
+}
+
+void SceneGraph::setLocalTransform(uint32_t node, const glm::mat4& localTransform)
+{
+	// callers may set every node each frame, the unchanged ones must not cost a world update
+	uint32_t slot = m_slots[node];
+	if (m_local[slot] == localTransform)
+		return;
+
+	m_local[slot] = localTransform;
+	m_dirty[slot] = 1;
+}
+
+uint32_t SceneGraph::parent(uint32_t node) const
+{
+	uint32_t parentSlot = m_parent[m_slots[node]];
+	return parentSlot == NO_PARENT ? NO_PARENT : m_nodes[parentSlot];
+}
+
+void SceneGraph::sortByDepth()
+{
+	uint32_t count = static_cast<uint32_t>(m_local.size());
+	uint32_t depthCount = *std::max_element(m_depth.begin(), m_depth.end()) + 1;
+
+	// stable counting sort, parents stay in front of their children
+	m_levelStarts.assign(depthCount + 1, 0);
+	for (uint32_t depth : m_depth)
+		m_levelStarts[depth + 1]++;
+	for (uint32_t d = 0; d < depthCount; d++)
+		m_levelStarts[d + 1] += m_levelStarts[d];
+
+	std::vector<uint32_t> newSlots(count);
+	std::vector<uint32_t> next(m_levelStarts.begin(), m_levelStarts.end() - 1);
+	for (uint32_t slot = 0; slot < count; slot++)
+		newSlots[slot] = next[m_depth[slot]]++;
+
+	auto reorder = [&](auto& values)
+	{
+		std::remove_reference_t<decltype(values)> sorted(count);
+		for (uint32_t slot = 0; slot < count; slot++)
+			sorted[newSlots[slot]] = values[slot];
+		values.swap(sorted);
+	};
+	reorder(m_local);
+	reorder(m_world);
+	reorder(m_parent);
+	reorder(m_depth);
+	reorder(m_dirty);
+	reorder(m_nodes);
+
+	for (uint32_t& parent : m_parent)
+	{
+		if (parent != NO_PARENT)
+			parent = newSlots[parent];
+	}
+	for (uint32_t slot = 0; slot < count; slot++)
+		m_slots[m_nodes[slot]] = slot;
+
+	m_sorted = true;
+}
+
+uint32_t SceneGraph::update(JobSystem& jobSystem, uint32_t grainSize, CullingPath path)
+{
+	if (m_local.empty())
+		return 0;
+	if (!m_sorted)
+		sortByDepth();
+
+#if SCENE_GRAPH_SSE
+	bool simd = path != CullingPath::Scalar;
+#else
+	bool simd = false;
+#endif
+
+	// a level only reads the one above, which is complete once parallelFor returns
+	std::atomic<uint32_t> updated = 0;
+	for (uint32_t level = 0; level < levelCount(); level++)
+	{
+		uint32_t first = m_levelStarts[level];
+		jobSystem.parallelFor(m_levelStarts[level + 1] - first, grainSize, [&](uint32_t begin, uint32_t end)
+		{
+			updated.fetch_add(updateLevel(first + begin, first + end, simd), std::memory_order_relaxed);
+		});
+	}
+
+	std::fill(m_dirty.begin(), m_dirty.end(), 0);
+	return updated.load(std::memory_order_relaxed);
+}
+
+uint32_t SceneGraph::updateLevel(uint32_t begin, uint32_t end, bool simd)
+{
+	uint32_t updated = 0;
+
+	for (uint32_t slot = begin; slot < end; slot++)
+	{
+		uint32_t parent = m_parent[slot];
+		if (!m_dirty[slot] && (parent == NO_PARENT || !m_dirty[parent]))
+			continue;
+
+		// the flag now means "world changed", the level below reads it
+		m_dirty[slot] = 1;
+		updated++;
+
+		if (parent == NO_PARENT)
+			m_world[slot] = m_local[slot];
+#if SCENE_GRAPH_SSE
+		else if (simd)
+			multiplySse(m_world[parent], m_local[slot], m_world[slot]);
+#endif
+		else
+			m_world[slot] = m_world[parent] * m_local[slot];
+	}
+
+	return updated;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "Culling.h"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+class JobSystem;
+
+// Transform hierarchy. Every node attribute lives in its own array (local, world, parent, dirty flag), kept sorted
+// by depth so a level is one contiguous range whose parents are all finished once the level above is.
+// Levels are updated one after another, the nodes of a level in parallel, and only where something above changed.
+// Nodes are addressed by the id createNode returns, ids stay valid when the arrays get re-sorted.
+class SceneGraph
+{
+public:
+	static constexpr uint32_t NO_PARENT = ~0u;
+
+	// parent has to exist already, the world transform is valid after the next update
+	uint32_t createNode(uint32_t parent = NO_PARENT, const glm::mat4& localTransform = glm::mat4(1.0f));
+	void clear();
+
+	void setLocalTransform(uint32_t node, const glm::mat4& localTransform); // marks the node and its subtree dirty, unless unchanged
+	const glm::mat4& localTransform(uint32_t node) const { return m_local[m_slots[node]]; }
+	const glm::mat4& worldTransform(uint32_t node) const { return m_world[m_slots[node]]; }
+	uint32_t parent(uint32_t node) const;
+
+	// recomputes the world transform of every dirty node and its descendants, returns how many were recomputed.
+	// Scalar multiplies with glm, every other path with SSE
+	uint32_t update(JobSystem& jobSystem, uint32_t grainSize = 4096, CullingPath path = CullingPath::Best);
+
+	uint32_t nodeCount() const { return static_cast<uint32_t>(m_slots.size()); }
+	uint32_t levelCount() const { return static_cast<uint32_t>(m_levelStarts.size()) - 1; }
+
+private:
+	void sortByDepth();
+	uint32_t updateLevel(uint32_t begin, uint32_t end, bool simd);
+
+	// indexed by slot, the position in depth order
+	std::vector<glm::mat4> m_local;
+	std::vector<glm::mat4> m_world;
+	std::vector<uint32_t> m_parent; // slot of the parent, NO_PARENT for roots
+	std::vector<uint32_t> m_depth;
+	std::vector<uint8_t> m_dirty; // local changed, or after its level ran: world changed
+	std::vector<uint32_t> m_nodes; // id of the node in each slot
+
+	std::vector<uint32_t> m_slots; // slot of each node id
+	std::vector<uint32_t> m_levelStarts{ 0 }; // first slot of each depth, plus the end
+	bool m_sorted = true;
+};
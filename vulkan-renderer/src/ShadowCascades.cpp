@@ -0,0 +1,147 @@
+#include "ShadowCascades.h"
+
+#include "JobSystem.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
+void ShadowCascades::update(JobSystem& jobSystem, const glm::mat4& view, float fovY, float aspect, float nearPlane, float farPlane, const glm::vec3& lightDirection,
+	const BoundsSoA& bounds, const glm::mat4* transforms)
+{
+	uint32_t objectCount = bounds.size();
+
+	// a fixed rotation with the eye at the origin, the texel grid the centers snap to stays put in the world
+	glm::vec3 forward = glm::normalize(lightDirection);
+	glm::vec3 up = std::abs(forward.z) < 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+	glm::mat4 lightView = glm::lookAt(glm::vec3(0.0f), forward, up);
+	glm::mat4 viewToLight = lightView * glm::inverse(view);
+	float tanHalfFovY = std::tan(0.5f * fovY);
+
+	std::array<glm::vec3, CASCADE_COUNT> centers;
+	std::array<float, CASCADE_COUNT> radii;
+	float sliceNear = nearPlane;
+	for (uint32_t c = 0; c < CASCADE_COUNT; c++)
+	{
+		float sliceFar = splitDepth(c, nearPlane, farPlane);
+		BoundingSphere sphere = sliceSphere(sliceNear, sliceFar, tanHalfFovY, aspect);
+
+		// the radius only changes with the projection, rounded up so float noise in it can't change the texel size
+		float radius = std::ceil(sphere.radius * 16.0f) / 16.0f;
+		float texelSize = 2.0f * radius / MAP_SIZE;
+		glm::vec3 center = glm::floor(glm::vec3(viewToLight * glm::vec4(sphere.center, 1.0f)) / texelSize) * texelSize;
+
+		// sides and far end of the cascade's box. There is no near plane, anything between the light and the slice can
+		// throw a shadow into it. 0..1 depth spelled out, this file doesn't see the GLM_FORCE defines of Application.h
+		glm::mat4 box = glm::orthoRH_ZO(center.x - radius, center.x + radius, center.y - radius, center.y + radius, -center.z - radius, -center.z + radius);
+		m_casterVolumes[c] = Frustum::fromViewProj(box * lightView);
+		m_casterVolumes[c].planes[4] = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+
+		centers[c] = center;
+		radii[c] = radius;
+		m_cascades[c].splitDepth = sliceFar;
+		sliceNear = sliceFar;
+	}
+
+	// anything that moved changes the cascades its old or its new bounds reach into, a different object count all of them
+	std::atomic<uint32_t> dirtyCascades = 0;
+	std::atomic<uint32_t> movedObjects = 0;
+	if (objectCount == m_previousTransforms.size())
+	{
+		jobSystem.parallelFor(objectCount, 4096, [&](uint32_t begin, uint32_t end)
+		{
+			uint32_t dirty = 0, moved = 0;
+			for (uint32_t i = begin; i < end; i++)
+			{
+				if (transforms[i] == m_previousTransforms[i])
+					continue;
+
+				moved++;
+				glm::vec3 center(bounds.centerX[i], bounds.centerY[i], bounds.centerZ[i]);
+				glm::vec3 previousCenter(m_previousBounds.centerX[i], m_previousBounds.centerY[i], m_previousBounds.centerZ[i]);
+				for (uint32_t c = 0; c < CASCADE_COUNT; c++)
+				{
+					if (sphereInFrustum(m_casterVolumes[c], center, bounds.radius[i]) || sphereInFrustum(m_casterVolumes[c], previousCenter, m_previousBounds.radius[i]))
+						dirty |= 1u << c;
+				}
+			}
+
+			if (moved > 0)
+			{
+				movedObjects.fetch_add(moved, std::memory_order_relaxed);
+				dirtyCascades.fetch_or(dirty, std::memory_order_relaxed);
+			}
+		});
+	}
+	else
+	{
+		movedObjects = objectCount;
+		dirtyCascades = (1u << CASCADE_COUNT) - 1;
+	}
+	m_movedObjects = movedObjects.load();
+
+	m_visibility.resize(objectCount);
+	for (uint32_t c = 0; c < CASCADE_COUNT; c++)
+	{
+		ShadowCascade& cascade = m_cascades[c];
+		if (dirtyCascades.load() & (1u << c))
+			cascade.generation++;
+
+		cullObjectsParallel(jobSystem, m_casterVolumes[c], bounds, m_visibility.data());
+
+		// the near plane moves out to the caster closest to the light, in steps of the radius so casters moving a little
+		// don't change the matrix every frame
+		float nearDepth = -centers[c].z - radii[c];
+		cascade.casters.clear();
+		for (uint32_t i = 0; i < objectCount; i++)
+		{
+			if (!m_visibility[i])
+				continue;
+
+			cascade.casters.push_back(i);
+			float casterDepth = glm::dot(glm::vec3(bounds.centerX[i], bounds.centerY[i], bounds.centerZ[i]), forward) - bounds.radius[i];
+			nearDepth = std::min(nearDepth, casterDepth);
+		}
+		nearDepth = std::floor(nearDepth / radii[c]) * radii[c];
+
+		const glm::vec3& center = centers[c];
+		glm::mat4 proj = glm::orthoRH_ZO(center.x - radii[c], center.x + radii[c], center.y - radii[c], center.y + radii[c], nearDepth, -center.z + radii[c]);
+		cascade.viewProj = proj * lightView;
+	}
+
+	m_previousBounds = bounds;
+	m_previousTransforms.assign(transforms, transforms + objectCount);
+}
+
+float ShadowCascades::splitDepth(uint32_t cascade, float nearPlane, float farPlane)
+{
+	float fraction = static_cast<float>(cascade + 1) / CASCADE_COUNT;
+	float logarithmic = nearPlane * std::pow(farPlane / nearPlane, fraction);
+	float uniform = nearPlane + (farPlane - nearPlane) * fraction;
+	return SPLIT_LAMBDA * logarithmic + (1.0f - SPLIT_LAMBDA) * uniform;
+}
+
+BoundingSphere ShadowCascades::sliceSphere(float nearDepth, float farDepth, float tanHalfFovY, float aspect)
+{
+	// corners at depth d are d * k from the axis. The center on the axis that is equally far from the near and the far
+	// corners, unless that lies beyond the far plane, then the far corners alone decide
+	float k2 = tanHalfFovY * tanHalfFovY * (1.0f + aspect * aspect);
+	float centerDepth = 0.5f * (nearDepth + farDepth) * (1.0f + k2);
+	if (centerDepth >= farDepth)
+		return { glm::vec3(0.0f, 0.0f, -farDepth), farDepth * std::sqrt(k2) };
+
+	float offset = farDepth - centerDepth;
+	return { glm::vec3(0.0f, 0.0f, -centerDepth), std::sqrt(offset * offset + farDepth * farDepth * k2) };
+}
+
+bool ShadowCascades::sphereInFrustum(const Frustum& frustum, const glm::vec3& center, float radius)
+{
+	for (const glm::vec4& plane : frustum.planes)
+	{
+		if (glm::dot(glm::vec3(plane), center) + plane.w < -radius)
+			return false;
+	}
+	return true;
+}
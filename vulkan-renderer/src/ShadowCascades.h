@@ -0,0 +1,58 @@
+#pragma once
+
+#include "Culling.h"
+
+#include <glm/glm.hpp>
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+class JobSystem;
+
+// One slice of the view frustum as seen from the light
+struct ShadowCascade
+{
+	glm::mat4 viewProj{ 1.0f }; // light view projection, 0..1 depth, no y flip
+	float splitDepth = 0.0f; // view depth where the cascade ends
+	uint64_t generation = 0; // bumped whenever a caster in reach moved, appeared or disappeared
+	std::vector<uint32_t> casters; // objects that can throw a shadow into the slice, indices into the bounds it was fitted to
+};
+
+// Cascaded shadow maps for one directional light. The view frustum is split into CASCADE_COUNT slices, each covered by
+// its bounding sphere, so the projection keeps its size while the camera turns, and the sphere's center is snapped to the
+// texel grid in light space, so texels don't crawl while it moves. A cascade whose matrix and generation didn't change
+// would render exactly what its shadow map holds already, which lets the renderer keep it. Meant to be kept around and
+// updated every frame, objects are expected to keep their index from one update to the next.
+class ShadowCascades
+{
+public:
+	static constexpr uint32_t CASCADE_COUNT = 4; // must match lighting.glsl
+	static constexpr uint32_t MAP_SIZE = 2048; // texels per side of every cascade
+	static constexpr float SPLIT_LAMBDA = 0.75f; // logarithmic to uniform split blend, see splitDepth
+
+	// camera as used for rendering, lightDirection points from the light into the scene. bounds and transforms hold one
+	// entry per object, the transforms are only compared against the previous update to find the objects that moved
+	void update(JobSystem& jobSystem, const glm::mat4& view, float fovY, float aspect, float nearPlane, float farPlane, const glm::vec3& lightDirection,
+		const BoundsSoA& bounds, const glm::mat4* transforms);
+
+	const std::array<ShadowCascade, CASCADE_COUNT>& cascades() const { return m_cascades; }
+	uint32_t movedObjects() const { return m_movedObjects; } // of the last update
+
+	// far end of cascade i, practical split scheme: logarithmic near the camera, where texels are needed most, blended
+	// towards uniform further out so the far cascades don't stretch over most of the range
+	static float splitDepth(uint32_t cascade, float nearPlane, float farPlane);
+
+	// view space bounding sphere of the frustum slice between two depths, tanHalfFovY and aspect of the projection
+	static BoundingSphere sliceSphere(float nearDepth, float farDepth, float tanHalfFovY, float aspect);
+
+	static bool sphereInFrustum(const Frustum& frustum, const glm::vec3& center, float radius);
+
+private:
+	std::array<ShadowCascade, CASCADE_COUNT> m_cascades;
+	std::array<Frustum, CASCADE_COUNT> m_casterVolumes; // the cascade's box, open towards the light
+	std::vector<uint8_t> m_visibility;
+	BoundsSoA m_previousBounds;
+	std::vector<glm::mat4> m_previousTransforms;
+	uint32_t m_movedObjects = 0;
+};
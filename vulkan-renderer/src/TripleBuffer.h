@@ -0,0 +1,44 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// Lock-free single producer / single consumer triple buffer.
+// The producer always has a private buffer to write into, the consumer always reads the latest published one,
+// and neither side ever waits for the other. Unconsumed packets are simply overwritten by newer ones.
+template<typename T>
+class TripleBuffer
+{
+public:
+	// producer side
+	T& writeBuffer() { return m_buffers[m_writeIndex]; }
+
+	void publish()
+	{
+		uint8_t previous = m_shared.exchange(static_cast<uint8_t>(m_writeIndex | DIRTY_BIT), std::memory_order_acq_rel);
+		m_writeIndex = previous & INDEX_MASK;
+	}
+
+	// consumer side, returns true if a newer buffer was published since the last call
+	bool consume()
+	{
+		if (!(m_shared.load(std::memory_order_relaxed) & DIRTY_BIT))
+			return false;
+
+		uint8_t previous = m_shared.exchange(m_readIndex, std::memory_order_acq_rel);
+		m_readIndex = previous & INDEX_MASK;
+		return true;
+	}
+
+	const T& readBuffer() const { return m_buffers[m_readIndex]; }
+
+private:
+	static constexpr uint8_t INDEX_MASK = 0x3;
+	static constexpr uint8_t DIRTY_BIT = 0x4;
+
+	std::array<T, 3> m_buffers{};
+	std::atomic<uint8_t> m_shared{ 1 }; // index of the buffer in the middle, plus dirty bit
+	uint8_t m_writeIndex = 0; // owned by the producer
+	uint8_t m_readIndex = 2; // owned by the consumer
+};
@@ -1,13 +1,141 @@
 #include "Application.h"
+#include "Benchmarks.h"
 
 #include <iostream>
+#include <string>
 
-int main()
+static ApplicationConfig parseArguments(int argc, char** argv)
 {
-	Application app;
+	ApplicationConfig config{};
 
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+
+		if (arg == "--headless")
+			config.headless = true;
+		else if (arg == "--resolution" && hasValue)
+		{
+			// WxH, e.g. 1920x1080
+			std::string resolution = argv[++i];
+			size_t separator = resolution.find('x');
+			if (separator == std::string::npos)
+				throw std::invalid_argument("Resolution must be WIDTHxHEIGHT: " + resolution);
+			config.width = static_cast<uint32_t>(std::stoul(resolution.substr(0, separator)));
+			config.height = static_cast<uint32_t>(std::stoul(resolution.substr(separator + 1)));
+		}
+		else if (arg == "--frames" && hasValue)
+			config.frameCount = static_cast<uint32_t>(std::stoul(argv[++i]));
+		else if (arg == "--dump" && hasValue)
+			config.dumpDirectory = argv[++i];
+		else if (arg == "--dump-interval" && hasValue)
+			config.dumpInterval = std::max(1u, static_cast<uint32_t>(std::stoul(argv[++i])));
+		else if (arg == "--gpu-driven")
+			config.gpuDriven = true;
+		else if (arg == "--no-draw-sort")
+			config.sortDraws = false;
+		else if (arg == "--visibility-buffer")
+			config.visibilityBuffer = true;
+		else if (arg == "--depth-prepass")
+			config.depthPrepass = true;
+		else if (arg == "--bindless")
+			config.bindless = true;
+		else if (arg == "--instances" && hasValue)
+			config.instanceCount = static_cast<uint32_t>(std::stoul(argv[++i]));
+		else if (arg == "--city" && hasValue)
+			config.citySize = static_cast<uint32_t>(std::stoul(argv[++i]));
+		else if (arg == "--lights" && hasValue)
+			config.lightCount = static_cast<uint32_t>(std::stoul(argv[++i]));
+		else if (arg == "--shadows")
+			config.shadows = true;
+		else if (arg == "--shadow-interval" && hasValue)
+			config.shadowFarInterval = std::max(1u, static_cast<uint32_t>(std::stoul(argv[++i])));
+		else if (arg == "--static-instances")
+			config.staticInstances = true;
+		else if (arg == "--msaa" && hasValue)
+			config.msaaSamples = static_cast<uint32_t>(std::stoul(argv[++i]));
+		else if (arg == "--sample-shading" && hasValue)
+			config.sampleShading = std::stof(argv[++i]);
+		else if (arg == "--quality-sweep")
+			config.qualitySweep = true;
+		else if (arg == "--dynamic-resolution")
+			config.dynamicResolution = true;
+		else if (arg == "--min-render-scale" && hasValue)
+			config.resolution.minScale = std::stof(argv[++i]);
+		else if (arg == "--max-render-scale" && hasValue)
+			config.resolution.maxScale = std::stof(argv[++i]);
+		else if (arg == "--gpu-budget" && hasValue)
+			config.resolution.budgetMs = std::stod(argv[++i]);
+		else if (arg == "--upscale" && hasValue)
+		{
+			std::string filter = argv[++i];
+			if (filter == "bilinear")
+				config.upscaleFilter = UpscaleFilter::Bilinear;
+			else if (filter == "edge")
+				config.upscaleFilter = UpscaleFilter::EdgeAdaptive;
+			else
+				throw std::invalid_argument("Unknown upscale filter: " + filter);
+		}
+		else if (arg == "--aa" && hasValue)
+		{
+			std::string mode = argv[++i];
+			if (mode == "none")
+				config.antiAliasing = PostAntiAliasing::None;
+			else if (mode == "fxaa")
+				config.antiAliasing = PostAntiAliasing::Fxaa;
+			else if (mode == "taa")
+				config.antiAliasing = PostAntiAliasing::Taa;
+			else
+				throw std::invalid_argument("Unknown antialiasing mode: " + mode);
+		}
+		else if (arg == "--pipeline-stress" && hasValue)
+		{
+			std::string mode = argv[++i];
+			if (mode == "async")
+				config.pipelineStress = PipelineStressMode::Async;
+			else if (mode == "sync")
+				config.pipelineStress = PipelineStressMode::Sync;
+			else
+				throw std::invalid_argument("Unknown pipeline stress mode: " + mode);
+		}
+		else
+			throw std::invalid_argument("Unknown or incomplete argument: " + arg);
+	}
+
+	// frames are read back from the offscreen image ring, swap chain images are never copied out
+	if (!config.dumpDirectory.empty() && !config.headless)
+		throw std::invalid_argument("--dump needs --headless");
+
+	// the ID pass numbers the triangles of CPU batches, indirect draws would need their own bookkeeping
+	if (config.visibilityBuffer && config.gpuDriven)
+		throw std::invalid_argument("--visibility-buffer can't be combined with --gpu-driven");
+
+	// the ID pass already is a depth only pass, and the GPU driven path draws its occluders first in the early pass
+	if (config.depthPrepass && (config.visibilityBuffer || config.gpuDriven))
+		throw std::invalid_argument("--depth-prepass is for the CPU forward path, it can't be combined with --visibility-buffer or --gpu-driven");
+
+	// there is no window to close in headless mode
+	// the sweep ends on its own once every tier has been measured
+	if (config.headless && config.frameCount == 0 && !config.qualitySweep)
+		config.frameCount = 1000;
+
+	return config;
+}
+
+int main(int argc, char** argv)
+{
 	try
 	{
+		// CPU micro benchmarks don't need a window or a device
+		if (argc == 3 && std::string(argv[1]) == "--bench")
+		{
+			if (!runBenchmark(argv[2]))
+				throw std::invalid_argument(std::string("Unknown benchmark: ") + argv[2]);
+			return EXIT_SUCCESS;
+		}
+
+		Application app(parseArguments(argc, argv));
 		app.run();
 	}
 	catch (const std::exception& e)
@@ -17,4 +145,4 @@ int main()
 	}
 
 	return EXIT_SUCCESS;
-}
\ No newline at end of file
+}